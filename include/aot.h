@@ -0,0 +1,70 @@
+//
+// Created by davidg on 05.09.25.
+//
+
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <block_cache.h>
+
+#define AOT_ABI_VERSION 1
+#define AOT_IMAGE_SYMBOL "lr35902_aot_image"
+
+/**
+ * Translated code for the block starting at `pc` with ROM bank `bank`
+ * mapped there. Like a JIT block it leaves PC and cycles as the
+ * interpreter would and may stop before any instruction.
+ */
+typedef struct {
+    uint16_t pc;
+    uint16_t bank;
+    native_block_fn fn;
+} AotEntry;
+
+/**
+ * What a shared object written by lr35902_aot exports as AOT_IMAGE_SYMBOL.
+ * Entries are sorted by bank, then pc.
+ */
+typedef struct {
+    uint32_t abi;      // AOT_ABI_VERSION
+    uint32_t gb_size;  // sizeof(GB) it was compiled against
+    uint32_t rom_hash; // aot_rom_hash of the whole ROM image
+    uint32_t count;
+    const AotEntry* entries;
+} AotImage;
+
+/**
+ * A loaded shared object, per machine
+ */
+typedef struct Aot {
+    void* handle;
+    const AotImage* image;
+    const void* rom; // RomImage the hash was checked against
+    char* path;
+} Aot;
+
+/**
+ * FNV-1a over the ROM, ties a shared object to the ROM it was made from.
+ */
+uint32_t aot_rom_hash(const uint8_t* data, size_t size);
+
+/**
+ * Opens the shared object at `path` for the machine's cartridge and routes
+ * cpu_run through the block cache, which takes each block's native code
+ * from it. ROM code that was not translated and code in RAM stay with the
+ * interpreter. Returns false, with the reason printed, if the file cannot
+ * be opened or was made for another ROM or build.
+ */
+bool aot_load(GB* gb, const char* path);
+
+void aot_unload(GB* gb);
+
+/**
+ * Translated code for a block, NULL if there is none.
+ */
+native_block_fn aot_lookup(const GB* gb, uint16_t pc, uint16_t bank);
+
+#endif // AOT_H
@@ -0,0 +1,39 @@
+//
+// Created by davidg on 04.09.25.
+//
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gb.h>
+
+#define BATCH_LANES 8 // machines per group, one 32-bit lane of an AVX2 register each
+
+typedef struct {
+    uint64_t vector_instructions; // executed once for a whole group of lanes
+    uint64_t lane_instructions;   // instructions of single lanes those stood for
+    uint64_t scalar_instructions; // lanes stepped on their own with cpu_step
+    uint64_t splits;              // vector runs ended by lanes branching apart
+} BatchStats;
+
+/**
+ * Runs every machine for `cycles` cycles, with the same outcome as cpu_run
+ * on each, for many copies of one ROM that differ only in inputs or seeds.
+ *
+ * Machines go in groups of BATCH_LANES. The registers of a group are held
+ * structure-of-arrays, one SIMD lane per machine, and all lanes whose PC
+ * agrees execute each instruction together. Memory operands are gathered
+ * through the lanes' page tables. A lane that branches elsewhere is split
+ * off to cpu_step and regroups once its PC meets the others again: the
+ * lanes with the lowest PC always go next, so lanes that ran ahead wait at
+ * the join. Events, interrupts and the odd opcode (HALT, STOP, DI, EI,
+ * RETI) take the scalar path as well.
+ *
+ * Traced or profiled machines and those with the JIT, AOT code, idle
+ * skipping or a debugger enabled run on their own with cpu_run. `stats` may be NULL.
+ */
+void batch_run(GB* const* machines, size_t count, uint32_t cycles, BatchStats* stats);
+
+#endif // BATCH_H
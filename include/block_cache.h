@@ -0,0 +1,103 @@
+//
+// Created by davidg on 28.07.25.
+//
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cpu.h>
+
+#define BLOCK_CACHE_SLOTS 1024 // direct mapped, power of two
+#define BLOCK_MAX_OPS 16
+#define BLOCK_INDEX_PAGES 0x100 // 256 byte pages of the address space
+
+/**
+ * One instruction with its handler resolved and its immediate already fetched
+ */
+typedef struct {
+    opcode_func_t handler;
+    uint16_t operand;
+    uint16_t next_pc; // PC after this instruction
+    uint8_t opcode;
+    uint8_t cycles;   // base cycles
+} DecodedOp;
+
+/**
+ * Translated block, see jit.c. Leaves PC and cycles as the interpreter would.
+ */
+typedef void (*native_block_fn)(GB* gb);
+
+/**
+ * Straight-line run of instructions up to and including the first one that
+ * writes PC or halts the CPU.
+ */
+typedef struct {
+    bool valid;
+    uint16_t pc;     // guest address of the first instruction
+    uint16_t bank;   // ROM bank mapped at pc while decoding
+    uint32_t end;    // one past the last decoded byte
+    uint32_t cycles; // base cycles of the whole block
+    uint32_t hits;   // entries since decoding, drives the JIT
+    native_block_fn native;
+    bool idle_loop;      // branches back to pc without writing memory, see block_cache_set_idle_skip
+    uint8_t idle_misses; // probes in a row that did not find a fixed point
+    bool counter_loop;   // DEC r / JR NZ back to pc, see block_cache_set_idle_skip
+    uint8_t count;
+    DecodedOp ops[BLOCK_MAX_OPS];
+} Block;
+
+typedef struct BlockCache {
+    Block slots[BLOCK_CACHE_SLOTS];
+
+    // Index of the valid blocks for block_cache_invalidate
+    uint64_t page_slots[BLOCK_INDEX_PAGES][BLOCK_CACHE_SLOTS / 64]; // slots with a block in each page
+    uint8_t code_bytes[0x10000 / 8];                                 // bytes some block was decoded from
+} BlockCache;
+
+BlockCache* block_cache_create(void);
+void block_cache_destroy(BlockCache* cache);
+
+/**
+ * Runs whole blocks until cpu->cycles reaches the scheduler deadline, the
+ * CPU halts or an unknown opcode is reached. A block is left early when an
+ * event falls due inside it. Backs cpu_run when LR35902_DISPATCH is BLOCK
+ * or the JIT is enabled.
+ */
+cpu_status_t block_cache_run(GB* gb);
+
+/**
+ * Opt-in idle loop skipping, routes cpu_run through the block core.
+ * A block that jumps back to itself and writes no memory is probed once
+ * per entry: if an iteration leaves the CPU exactly as it found it, the
+ * remaining whole iterations up to the deadline are skipped by moving
+ * the cycle counter. Reads of LY, STAT, DIV and TIMA cap the skip at
+ * their next change (see mem_mark_io_timed). A DEC r / JR NZ block
+ * counting down to itself is skipped in one step as well. The CPU ends
+ * up where plain interpretation would.
+ *
+ * Not skipped: loops that write memory or use the stack, EI/DI/HALT,
+ * loops over more than one block and loops that change any other state,
+ * e.g. 16-bit counters (DEC rr; LD A,B; OR C) or pointer scans. Every
+ * other block pays for running interpreted; combine with the JIT to keep
+ * busy code fast.
+ */
+void block_cache_set_idle_skip(GB* gb, bool enabled);
+
+/**
+ * Drops every block that covers `address` and stops watching its page once
+ * no block is left there. Called by the mem_write slow path for RAM pages
+ * marked in Memory.code_pages, and for HRAM bytes block_cache_covers.
+ */
+void block_cache_invalidate(GB* gb, uint16_t address);
+
+/**
+ * Whether some cached block was decoded from `address`. Cheap enough for
+ * every write to HRAM, which shares its page with the I/O registers.
+ */
+static inline bool block_cache_covers(const BlockCache* cache, uint16_t address) {
+    return cache && (cache->code_bytes[address >> 3] & (1u << (address & 7)));
+}
+
+#endif // BLOCK_CACHE_H
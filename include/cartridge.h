@@ -0,0 +1,110 @@
+//
+// Created by davidg on 12.08.25.
+//
+
+#ifndef CARTRIDGE_H
+#define CARTRIDGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROM_BANK_SIZE 0x4000
+#define RAM_BANK_SIZE 0x2000
+#define CART_RAM_MAX 0x20000
+#define CART_ROM_BANKS_MAX 512 // MBC5 selects banks with 9 bits, no MBC reaches further
+#define CART_RAM_PAGES (CART_RAM_MAX / 0x100) // in 256 byte pages of the memory map
+
+typedef struct GB GB;
+
+typedef enum {
+    MBC_NONE,
+    MBC_1,
+    MBC_3,
+    MBC_5,
+} mbc_type_t;
+
+/**
+ * ROM file mapped read-only. One image per file is shared by every machine
+ * in the process and reference counted.
+ */
+typedef struct RomImage {
+    const uint8_t* data;
+    size_t size;       // multiple of ROM_BANK_SIZE, at least two banks
+    bool mapped;       // mmap'ed, otherwise a zero-padded heap copy
+    unsigned long long dev, ino;
+    int refs;
+    struct RomImage* next;
+
+    // Parsed cartridge header
+    char title[17];
+    uint8_t type;
+    uint32_t header_rom_size;
+    uint32_t header_ram_size;
+    bool header_checksum_ok;
+} RomImage;
+
+/**
+ * Per-machine cartridge state: MBC registers and external RAM
+ */
+typedef struct {
+    RomImage* rom;
+    mbc_type_t mbc;
+    uint16_t rom_banks;
+
+    uint8_t* ram;
+    uint32_t ram_size;
+    bool ram_enabled;
+    const uint8_t* shared_ram[CART_RAM_PAGES]; // frozen contents of each RAM page, NULL once private, see cart_share_ram
+    uint8_t unchanged_ram[CART_RAM_PAGES / 8];  // RAM pages not written since then, see state_hash
+
+    uint16_t bank_lo;  // MBC1 5 bits, MBC3 7 bits, MBC5 9 bits
+    uint8_t bank_hi;   // MBC1 2 bits, MBC3/MBC5 RAM bank or RTC register
+    uint8_t mode;      // MBC1 banking mode
+
+    // Current mapping, derived from the registers above
+    uint16_t rom_bank0;
+    uint16_t rom_bank;
+    uint8_t ram_bank;
+} Cartridge;
+
+/**
+ * Maps `filename` as cartridge of this machine. Returns false (with errno
+ * set) if the file cannot be opened or mapped.
+ */
+bool cart_load(GB* gb, const char* filename);
+
+/**
+ * Makes `image` this machine's cartridge with the MBC registers and RAM
+ * size of `state`. The RAM is shared with the pages `ram`, one per 256
+ * bytes, as by cart_share_ram. Used to restore savestates.
+ */
+bool cart_attach(GB* gb, RomImage* image, const Cartridge* state, const uint8_t* const* ram);
+
+/**
+ * Backs the cartridge RAM with the read-only pages `frozen` instead of its
+ * own copy: reads go straight to them, the first write to a page copies it.
+ * `frozen` must outlive the sharing, see savestate.c.
+ */
+void cart_share_ram(GB* gb, const uint8_t* const* frozen);
+
+/**
+ * Current contents of cartridge RAM page `index`, shared or not.
+ */
+const uint8_t* cart_ram_page(const GB* gb, unsigned index);
+
+/**
+ * Drops the machine's reference to the shared ROM image and frees its RAM.
+ */
+void cart_unload(GB* gb);
+
+/**
+ * Bank mapped at `address`: ROM bank for 0x0000–0x7FFF, 0x100 + RAM bank
+ * for 0xA000–0xBFFF, 0 elsewhere. Used to key cached code.
+ */
+uint16_t cart_bank_at(const GB* gb, uint16_t address);
+
+void cart_image_retain(RomImage* image);
+void cart_image_release(RomImage* image);
+
+#endif // CARTRIDGE_H
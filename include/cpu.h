@@ -22,17 +22,53 @@ typedef struct {
     uint16_t sp;
     uint16_t pc;
 
+    // Lazy flags: while flags_op != FLAGS_EAGER, f is stale and is rebuilt
+    // from the operands and result of the last ADD/ADC/SUB/SBC/CP on demand
+    uint8_t flags_op;
+    uint8_t flags_xy;       // x ^ y of that operation
+    uint16_t flags_result;  // x + y + c or x - y - c, 16 bits wide
+
     // CPU Status
     bool halted;
     bool ime;
-    uint32_t cycles;
+    uint64_t cycles; // master timeline, never wraps
 } CPU;
 
-typedef void (*opcode_func_t)(CPU* cpu);
+typedef struct GB GB;
+
+/**
+ * Opcode handler. PC already points past the instruction and `operand`
+ * holds its immediate bytes (little endian), if it has any.
+ */
+typedef void (*opcode_func_t)(GB* gb, uint16_t operand);
+
+/**
+ * Why cpu_step/cpu_run handed control back to the caller
+ */
+typedef enum {
+    CPU_OK,             // instruction executed, keep going
+    CPU_BUDGET_DONE,    // cycle budget used up
+    CPU_HALTED,         // CPU sits in HALT and no scheduled event can wake it
+    CPU_UNKNOWN_OPCODE, // PC points at an opcode without handler
+    CPU_BREAKPOINT,     // stopped for the debugger, see Debugger.stop
+} cpu_status_t;
 
 void cpu_init(CPU* cpu);
 
-void cpu_step(CPU* cpu);
+/**
+ * Executes a single instruction through the reference opcode table.
+ * Due events fire first; an interrupt dispatch or 4 cycles of HALT count
+ * as the step instead.
+ */
+cpu_status_t cpu_step(GB* gb);
+
+/**
+ * Executes instructions until at least `cycle_budget` cycles have passed,
+ * the CPU halts for good or an unknown opcode is reached. In HALT it skips
+ * straight to the next scheduled event.
+ * Uses the dispatch core picked with the LR35902_DISPATCH CMake option.
+ */
+cpu_status_t cpu_run(GB* gb, uint32_t cycle_budget);
 
 void cpu_print_state(const CPU* cpu);
 
@@ -41,11 +77,47 @@ void cpu_print_state(const CPU* cpu);
 #define FLAG_H 0x20
 #define FLAG_C 0x10
 
-#define SET_FLAG(cpu, flag)   ((cpu)->f |= (flag))
-#define CLEAR_FLAG(cpu, flag) ((cpu)->f &= ~(flag))
-#define GET_FLAG(cpu, flag)   (((cpu)->f & (flag)) != 0)
+#define FLAGS_EAGER 0
+#define FLAGS_ADD   1
+#define FLAGS_SUB   2
+
+/**
+ * Z N H C of an 8-bit add or subtract. Bit 4 and bit 8 of x ^ y ^ result
+ * are the carries (borrows) out of bit 3 and bit 7.
+ */
+static inline uint8_t flags_from_result(uint8_t op, uint8_t xy, uint16_t result) {
+    uint16_t carries = xy ^ result;
+    return ((result & 0xFF) == 0 ? FLAG_Z : 0) |
+           (op == FLAGS_SUB ? FLAG_N : 0) |
+           (carries & 0x10 ? FLAG_H : 0) |
+           (carries & 0x100 ? FLAG_C : 0);
+}
+
+/**
+ * Current value of the flag register, every read of f goes through here.
+ */
+static inline uint8_t cpu_flags(const CPU* cpu) {
+    if (cpu->flags_op == FLAGS_EAGER) return cpu->f;
+    return flags_from_result(cpu->flags_op, cpu->flags_xy, cpu->flags_result);
+}
+
+static inline void cpu_set_flags(CPU* cpu, uint8_t f) {
+    cpu->f = f;
+    cpu->flags_op = FLAGS_EAGER;
+}
+
+/**
+ * Writes pending lazy flags back into f, for code that reads f directly.
+ */
+static inline void cpu_sync_flags(CPU* cpu) {
+    cpu_set_flags(cpu, cpu_flags(cpu));
+}
+
+#define SET_FLAG(cpu, flag)   cpu_set_flags((cpu), cpu_flags(cpu) | (flag))
+#define CLEAR_FLAG(cpu, flag) cpu_set_flags((cpu), cpu_flags(cpu) & ~(flag))
+#define GET_FLAG(cpu, flag)   ((cpu_flags(cpu) & (flag)) != 0)
 
-#define REG_AF(cpu) (((cpu)->a << 8) | (cpu)->f)
+#define REG_AF(cpu) (((cpu)->a << 8) | cpu_flags(cpu))
 #define REG_BC(cpu) (((cpu)->b << 8) | (cpu)->c)
 #define REG_DE(cpu) (((cpu)->d << 8) | (cpu)->e)
 #define REG_HL(cpu) (((cpu)->h << 8) | (cpu)->l)
@@ -0,0 +1,102 @@
+//
+// Created by davidg on 06.09.25.
+//
+
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cpu.h>
+
+#define DEBUG_ADDRESSES 0x10000 // the whole address space, one bit each
+
+typedef enum {
+    DEBUG_RUNNING,
+    DEBUG_BREAKPOINT,   // PC reached a breakpoint, the instruction there has not run
+    DEBUG_READ_WATCH,   // the last instruction read a watched address
+    DEBUG_WRITE_WATCH,  // the last instruction wrote a watched address
+    DEBUG_ACCESS_WATCH, // the last instruction touched an address watched both ways
+    DEBUG_STEP,         // debug_step ran its instruction
+} debug_stop_t;
+
+/**
+ * Breakpoints and watchpoints of one machine, one bit per address each.
+ * Attaching routes cpu_run through the block cache, which checks the
+ * breakpoint bitmap once per block entry: blocks are cut so that every
+ * breakpoint starts one. Watchpoints take their page off the fast path
+ * (see mem_debug_watch) and cut blocks after every instruction, so the
+ * stop comes right after the access. Without a debugger none of this runs.
+ */
+typedef struct Debugger {
+    uint8_t breakpoints[DEBUG_ADDRESSES / 8];
+    uint8_t read_watch[DEBUG_ADDRESSES / 8];
+    uint8_t write_watch[DEBUG_ADDRESSES / 8];
+    unsigned watch_count;  // addresses with a watchpoint of any kind
+
+    debug_stop_t stop;     // why cpu_run returned CPU_BREAKPOINT, DEBUG_RUNNING once handled
+    uint16_t stop_address; // breakpoint or watched address
+    bool resuming;         // the next block entry at resume_pc does not stop
+    uint16_t resume_pc;
+    bool stepping;         // stop at the next block entry, blocks are single instructions meanwhile
+    bool quiet;            // accesses of the debugger itself do not hit watchpoints
+} Debugger;
+
+/**
+ * Creates the machine's debugger, with nothing set. Does nothing if one is
+ * attached already.
+ */
+void debug_attach(GB* gb);
+
+/**
+ * Removes the debugger, its breakpoints and watchpoints.
+ */
+void debug_detach(GB* gb);
+
+void debug_set_breakpoint(GB* gb, uint16_t address, bool enabled);
+
+/**
+ * Adds or removes the MEM_WATCH_* kinds in `kinds` at `address`.
+ */
+void debug_set_watchpoint(GB* gb, uint16_t address, uint8_t kinds, bool enabled);
+
+/**
+ * Lets the next cpu_run go past a breakpoint at the current PC.
+ */
+void debug_resume(GB* gb);
+
+/**
+ * Runs the CPU for one instruction and returns how cpu_run stopped,
+ * CPU_BREAKPOINT with DEBUG_STEP (or a watchpoint) once it has. An
+ * interrupt dispatched after the instruction is stepped into.
+ */
+cpu_status_t debug_step(GB* gb);
+
+/**
+ * True if decode_block has to end the block before `address`.
+ */
+bool debug_splits_before(const Debugger* debug, uint16_t address);
+
+/**
+ * Checked by block_cache_run before every block: true if the CPU should
+ * stop here, with the reason in Debugger.stop.
+ */
+bool debug_should_stop(GB* gb);
+
+/**
+ * Called by the memory slow path for pages under mem_debug_watch.
+ */
+void debug_access(GB* gb, uint16_t address, bool write);
+
+/**
+ * Memory access for the debugger itself, without hitting watchpoints.
+ */
+uint8_t debug_peek(GB* gb, uint16_t address);
+void debug_poke(GB* gb, uint16_t address, uint8_t value);
+
+/**
+ * Puts the watch flags back into a page table rebuilt by state_restore.
+ */
+void debug_restore_watches(GB* gb);
+
+#endif // DEBUGGER_H
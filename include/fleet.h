@@ -0,0 +1,20 @@
+//
+// Created by davidg on 21.07.25.
+//
+
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gb.h>
+
+/**
+ * Runs every machine for `cycles` cycles (see cpu_run) on a pool of `workers` threads.
+ * Machines are sharded evenly over the workers; a worker that runs out of
+ * machines steals from the back of another worker's shard.
+ * workers == 0 uses one thread per online core.
+ */
+void fleet_run(GB* const* machines, size_t count, unsigned workers, uint32_t cycles);
+
+#endif // FLEET_H
@@ -0,0 +1,70 @@
+//
+// Created by davidg on 21.07.25.
+//
+
+#ifndef GB_H
+#define GB_H
+
+#include <cpu.h>
+#include <memory.h>
+#include <block_cache.h>
+#include <cartridge.h>
+#include <scheduler.h>
+#include <timer.h>
+#include <ppu.h>
+#include <savestate.h>
+#include <rewind.h>
+#include <jit.h>
+#include <aot.h>
+#include <debugger.h>
+#include <trace.h>
+#include <profile.h>
+
+/**
+ * One complete machine: CPU, memory map and device state.
+ * Nothing is shared between instances, so every GB can run on its own thread.
+ */
+struct GB {
+    CPU cpu;
+    Memory mem;
+    Cartridge cart;
+    Scheduler sched;
+    Timer timer;
+    Ppu ppu;
+    BlockCache* blocks; // created on first use by the BLOCK core
+    Jit* jit;           // created by jit_set_enabled
+    bool jit_enabled;
+    Aot* aot;           // NULL unless aot_load
+    bool idle_skip;     // see block_cache_set_idle_skip
+    Debugger* debug;    // NULL unless debug_attach
+    SaveState* state;   // copy-on-write base of Memory.data, see savestate.c
+    Rewind* rewind;     // NULL unless recording
+    Trace* trace;       // NULL unless tracing, see trace_start
+    Profile* profile;   // NULL unless profiling, see profile_start
+};
+
+#define GB_CLOCK_HZ 4194304   // cycles per second
+#define GB_FRAME_CYCLES 70224 // one LCD frame, 59.7 Hz
+
+#define GB_COMPLETE
+#include <memory.h> // inline memory accessors
+
+void gb_init(GB* gb);
+
+GB* gb_create(void);
+
+/**
+ * gb_create without clearing Memory.data, for a machine that gets all its
+ * memory from a savestate right away (see state_fork).
+ */
+GB* gb_create_unmapped(void);
+void gb_destroy(GB* gb);
+
+/**
+ * Clone of a running machine. Both continue copy-on-write on top of one
+ * frozen state, so only the pages written since the last fork or capture
+ * are copied.
+ */
+GB* gb_fork(GB* gb);
+
+#endif // GB_H
@@ -0,0 +1,28 @@
+//
+// Created by davidg on 06.09.25.
+//
+
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include <stdbool.h>
+#include <gb.h>
+
+/**
+ * Attaches a debugger and serves one GDB remote-serial-protocol client
+ * until it detaches or kills the session. `address` is a Unix socket path
+ * (anything with a slash) or a TCP port on the loopback interface, given
+ * as "port" or "127.0.0.1:port".
+ *
+ * Registers go out as six 16-bit little-endian values: AF, BC, DE, HL, SP,
+ * PC. Breakpoints (Z0/Z1) and watchpoints (Z2 write, Z3 read, Z4 access)
+ * map onto debug_set_breakpoint and debug_set_watchpoint; continuing runs
+ * cpu_run a frame at a time and stops on Ctrl-C.
+ *
+ *   gdb -ex 'set architecture z80' -ex 'target remote localhost:2159'
+ *
+ * Returns false, with errno set, if the socket cannot be opened.
+ */
+bool gdb_serve(GB* gb, const char* address);
+
+#endif // GDB_STUB_H
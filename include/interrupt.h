@@ -0,0 +1,42 @@
+//
+// Created by davidg on 15.08.25.
+//
+
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <stdint.h>
+
+#define IF_ADDR 0xFF0F
+#define IE_ADDR 0xFFFF
+
+typedef struct GB GB;
+
+typedef enum {
+    INT_VBLANK,
+    INT_STAT,
+    INT_TIMER,
+    INT_SERIAL,
+    INT_JOYPAD,
+} interrupt_t;
+
+/**
+ * Hooks IF and IE. Any change to them, to IME or to HALT schedules
+ * EVENT_IRQ, nothing is polled per instruction.
+ */
+void interrupt_init(GB* gb);
+
+void interrupt_request(GB* gb, interrupt_t irq);
+
+/**
+ * EVENT_IRQ: wakes a halted CPU and, with IME set, jumps to the vector of
+ * the highest priority pending interrupt.
+ */
+void interrupt_dispatch(GB* gb);
+
+/**
+ * EVENT_EI: the delayed half of EI
+ */
+void interrupt_enable(GB* gb);
+
+#endif // INTERRUPT_H
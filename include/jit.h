@@ -0,0 +1,45 @@
+//
+// Created by davidg on 04.08.25.
+//
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <block_cache.h>
+
+#define JIT_THRESHOLD 32          // block entries before a block gets translated
+#define JIT_CODE_SIZE (256 * 1024) // native code buffer per machine
+
+/**
+ * Per-machine native code buffer. Blocks are bump allocated and the whole
+ * buffer is flushed once it runs full.
+ */
+typedef struct Jit {
+    uint8_t* code;
+    size_t used;
+} Jit;
+
+/**
+ * True if this build and host can run translated code (x86-64 only).
+ */
+bool jit_available(void);
+
+/**
+ * Turns translation of hot blocks on or off for one machine. While enabled,
+ * cpu_run always goes through the block cache, whatever LR35902_DISPATCH is.
+ * Returns false if the JIT is not available.
+ */
+bool jit_set_enabled(GB* gb, bool enabled);
+
+/**
+ * Translates the longest supported prefix of `block` into native code.
+ * Returns NULL if not even the first instruction is supported.
+ */
+native_block_fn jit_compile(GB* gb, const Block* block);
+
+void jit_destroy(Jit* jit);
+
+#endif // JIT_H
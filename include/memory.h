@@ -5,11 +5,165 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-void memory_init(void);
-uint8_t mem_read(uint16_t address);
-void mem_write(uint16_t address, uint8_t value);
-void load_rom(const char* filename);
+#define MEMORY_SIZE 0x10000 // 64 KB
+#define PAGE_SIZE 0x100
+#define PAGE_COUNT (MEMORY_SIZE / PAGE_SIZE)
+
+typedef struct GB GB;
+
+#define MEM_WATCH_READ 0x01
+#define MEM_WATCH_WRITE 0x02
+
+typedef uint8_t (*mem_read_func_t)(GB* gb, uint16_t address);
+typedef void (*mem_write_func_t)(GB* gb, uint16_t address, uint8_t value);
+typedef uint64_t (*mem_change_func_t)(GB* gb, uint16_t address);
+
+#define MEM_CHANGE_NEVER UINT32_MAX // cycles ahead a stopped register reports, see mem_mark_io_timed
+
+/**
+ * Address space of a single machine, mapped in 256 byte pages.
+ * A page either points straight at host memory or goes through a handler:
+ * read_pages/write_pages are the fast path, NULL sends the access to
+ * read_handlers/write_handlers instead.
+ */
+typedef struct {
+    const uint8_t* read_pages[PAGE_COUNT];
+    uint8_t* write_pages[PAGE_COUNT];
+    uint8_t* ram_pages[PAGE_COUNT];  // writable backing of a page, also while its fast path is off
+    mem_read_func_t read_handlers[PAGE_COUNT];
+    mem_write_func_t write_handlers[PAGE_COUNT];
+
+    // I/O registers 0xFF00–0xFFFF, NULL means plain byte in data
+    mem_read_func_t io_read[PAGE_SIZE];
+    mem_write_func_t io_write[PAGE_SIZE];
+    mem_change_func_t io_timed[PAGE_SIZE]; // registers whose value follows the cycle counter, see mem_mark_io_timed
+
+    uint8_t code_pages[PAGE_COUNT / 8]; // one bit per RAM page holding cached blocks
+    uint8_t debug_watch[PAGE_COUNT];    // MEM_WATCH_* flags of pages with debugger watchpoints
+    const uint8_t* watched_reads[PAGE_COUNT]; // direct read page held back while reads are watched
+    mem_write_func_t write_watch[PAGE_COUNT]; // sees writes to a RAM page before they land, see mem_watch_writes
+
+    // Copy-on-write, see mem_share_pages
+    const uint8_t* shared_pages[PAGE_COUNT]; // frozen contents of each data page, NULL once private
+    uint8_t shared_home[PAGE_COUNT];         // data page behind each address page
+    uint8_t unchanged_pages[PAGE_COUNT / 8]; // data pages not written since mem_share_pages, see state_hash
+
+    uint8_t data[MEMORY_SIZE];          // backing store of the default map
+} Memory;
+
+void memory_init(GB* gb);
+
+/**
+ * Resets the page tables and I/O hooks to the default map, leaves the
+ * contents of `data` alone.
+ */
+void memory_map_default(GB* gb);
+
+/**
+ * Maps pages first..last for reading: straight from `base` (page by page)
+ * or, if base is NULL, through `handler`.
+ */
+void mem_map_read(GB* gb, uint8_t first_page, uint8_t last_page, const uint8_t* base, mem_read_func_t handler);
+
+/**
+ * Maps pages first..last for writing: straight into `base` or, if base is
+ * NULL, through `handler`. A NULL handler drops the write.
+ */
+void mem_map_write(GB* gb, uint8_t first_page, uint8_t last_page, uint8_t* base, mem_write_func_t handler);
+
+/**
+ * Hooks a single I/O register in 0xFF00–0xFFFF.
+ */
+void mem_map_io(GB* gb, uint16_t address, mem_read_func_t read, mem_write_func_t write);
+
+/**
+ * Marks an I/O register whose value changes with time alone, without a
+ * scheduled event (DIV, TIMA, LY, STAT). `next_change` returns the first
+ * cycle from cpu.cycles on at which a read may see another value, or
+ * cpu.cycles + MEM_CHANGE_NEVER while only a write can change it. Idle
+ * loops reading the register are skipped no further than that.
+ */
+void mem_mark_io_timed(GB* gb, uint16_t address, mem_change_func_t next_change);
+
+/**
+ * Calls `watch` with every write to pages first..last before the byte is
+ * stored, the old value is still in memory. The pages stay RAM but lose
+ * their fast write path. Only for pages without an echo (VRAM, OAM).
+ * A NULL watch ends it.
+ */
+void mem_watch_writes(GB* gb, uint8_t first_page, uint8_t last_page, mem_write_func_t watch);
+
+/**
+ * Routes writes to a RAM page (and its echo) through the slow path so
+ * cached code on it gets invalidated. No-op for pages without RAM, HRAM
+ * writes look at block_cache_covers instead.
+ */
+void mem_watch_code(GB* gb, uint8_t page);
+void mem_unwatch_code(GB* gb, uint8_t page);
+
+/**
+ * Sets the MEM_WATCH_* flags of a page for debugger watchpoints. A watched
+ * page loses its fast path for that kind of access, and the slow path
+ * reports every access to it with debug_access. Pages without flags keep
+ * their direct pointers and pay nothing.
+ */
+void mem_debug_watch(GB* gb, uint8_t page, uint8_t flags);
+
+/**
+ * Backs the pages of `data` (except the I/O page) with the read-only
+ * copies in `frozen` instead: reads go straight to them, the first write
+ * to a page copies it into `data`. `frozen` must outlive the sharing, see
+ * savestate.c. Pages under mem_watch_writes are copied at once.
+ */
+void mem_share_pages(GB* gb, const uint8_t* const frozen[PAGE_COUNT]);
+
+/**
+ * Data page `page` no longer holds what mem_share_pages put there. Writes
+ * through the map report this on their own, only devices that store into
+ * Memory.data directly (OAM DMA) have to call it.
+ */
+void mem_touch_page(GB* gb, uint8_t page);
+
+uint8_t mem_read_slow(GB* gb, uint16_t address);
+void mem_write_slow(GB* gb, uint16_t address, uint8_t value);
+
+/**
+ * Loads a cartridge (see cart_load), exits on failure.
+ */
+void load_rom(GB* gb, const char* filename);
+
+#include <gb.h>
 
 #endif // MEMORY_H
+
+/*
+ * Fast path accessors: one table lookup plus a load or store. They need the
+ * complete struct GB, so gb.h includes this header again once it is defined.
+ */
+#if defined(GB_COMPLETE) && !defined(MEMORY_ACCESSORS)
+#define MEMORY_ACCESSORS
+
+static inline uint8_t mem_read(GB* gb, uint16_t address) {
+    const uint8_t* page = gb->mem.read_pages[address >> 8];
+    if (page) return page[address & 0xFF];
+    return mem_read_slow(gb, address);
+}
+
+// Registered with mem_mark_io_timed, NULL for everything that only changes through writes and events
+static inline mem_change_func_t mem_timed_change(const GB* gb, uint16_t address) {
+    return address >= 0xFF00 ? gb->mem.io_timed[address & 0xFF] : NULL;
+}
+
+static inline void mem_write(GB* gb, uint16_t address, uint8_t value) {
+    uint8_t* page = gb->mem.write_pages[address >> 8];
+    if (page) {
+        page[address & 0xFF] = value;
+    } else {
+        mem_write_slow(gb, address, value);
+    }
+}
+
+#endif
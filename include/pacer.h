@@ -0,0 +1,64 @@
+//
+// Created by davidg on 01.09.25.
+//
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <gb.h>
+
+/**
+ * Holds one machine at real time (or a multiple of it) frame by frame.
+ * Frame deadlines are taken from the 64-bit cycle timeline, not summed up
+ * from sleep durations, so waking up late never turns into drift. The wait
+ * sleeps until shortly before the deadline and spins the rest; the spin
+ * margin follows how late the host's sleeps actually come back.
+ */
+typedef struct {
+    double speed;           // multiple of GB_CLOCK_HZ, 0 runs unlimited
+    uint64_t anchor_cycles; // cpu->cycles that belong to anchor_ns
+    int64_t anchor_ns;
+    int64_t spin_ns;        // sleep ends this long before a deadline
+
+    int64_t start_ns;
+    int64_t start_cpu_ns;   // thread CPU time at pacer_init
+    uint64_t start_cycles;
+    uint64_t cycles;        // cpu->cycles after the last frame
+    uint64_t frames;
+    uint64_t late_frames;
+    uint64_t resyncs;
+    double jitter_sum;      // wake-up minus deadline, ns
+    double jitter_squares;
+    double jitter_max;
+    int64_t drift_ns;       // host minus guest time after the last frame
+} Pacer;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t late_frames;   // ran past their deadline by more than a millisecond
+    uint64_t resyncs;       // fell so far behind that the timeline restarted
+    double jitter_mean_us;
+    double jitter_stddev_us;
+    double jitter_max_us;
+    double drift_us;        // positive: the guest is behind the host clock
+    double guest_speed;     // guest seconds per host second
+    double cpu_load;        // share of one core the pacing thread used
+} PacerStats;
+
+/**
+ * Starts the timeline at the current cycle count of `gb` and now.
+ * Call from the thread that runs the frames, the CPU load is per thread.
+ */
+void pacer_init(Pacer* pacer, const GB* gb, double speed);
+
+/**
+ * Runs GB_FRAME_CYCLES and waits until the host clock catches up with
+ * the guest. Returns the status of cpu_run; only after CPU_BUDGET_DONE
+ * is there a next frame.
+ */
+cpu_status_t pacer_run_frame(GB* gb, Pacer* pacer);
+
+void pacer_stats(const Pacer* pacer, PacerStats* stats);
+
+#endif // PACER_H
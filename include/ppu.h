@@ -0,0 +1,163 @@
+//
+// Created by davidg on 02.09.25.
+//
+
+#ifndef PPU_H
+#define PPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LCDC_ADDR 0xFF40
+#define STAT_ADDR 0xFF41
+#define SCY_ADDR  0xFF42
+#define SCX_ADDR  0xFF43
+#define LY_ADDR   0xFF44
+#define LYC_ADDR  0xFF45
+#define DMA_ADDR  0xFF46
+#define BGP_ADDR  0xFF47
+#define OBP0_ADDR 0xFF48
+#define OBP1_ADDR 0xFF49
+#define WY_ADDR   0xFF4A
+#define WX_ADDR   0xFF4B
+#define PPU_REGS  12 // LCDC..WX, the registers a line is rendered from
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+typedef struct GB GB;
+typedef struct PpuPipeline PpuPipeline;
+
+/**
+ * Line renderers, all with the same output. The SIMD kernels decode and
+ * composite 16 (SSE2) or 32 (AVX2) pixels per instruction.
+ */
+typedef enum {
+    PPU_KERNEL_SCALAR,
+    PPU_KERNEL_SSE2,
+    PPU_KERNEL_AVX2,
+} ppu_kernel_t;
+
+/**
+ * Headless DMG video. LY and the STAT mode follow from the cycle counter,
+ * nothing is stepped per dot. Visible lines are rendered in one piece at
+ * the end of their mode 3, but only once something needs them: a write to
+ * VRAM, OAM or a PPU register first renders every line that is due with
+ * the old contents, VBlank renders the rest and completes the frame.
+ * Frames hold shades, 0 (white) to 3 (black).
+ *
+ * A line is only rendered again if VRAM, OAM or a register actually
+ * changed since the last time, otherwise the pixels from the previous
+ * frame stay.
+ */
+typedef struct {
+    bool reference;       // no reuse of old lines, see ppu_set_reference
+    uint8_t kernel;       // ppu_kernel_t
+    uint64_t frame_start; // cpu->cycles at which the current frame's LY 0 began
+    uint64_t next_event;  // when EVENT_PPU is scheduled
+    uint8_t line;         // next line to render, SCREEN_HEIGHT once the frame is done
+    uint8_t window_line;  // window row the next line shows, if it shows the window
+    uint8_t stat;         // STAT bits 3–6, interrupt sources
+    PpuPipeline* pipe;    // NULL unless lines are rendered on their own thread, see ppu_pipeline_start
+
+    uint64_t version;                    // bumped by every write that changes how lines look
+    uint64_t line_version[SCREEN_HEIGHT]; // version each line of `screen` was rendered from
+    uint8_t line_window[SCREEN_HEIGHT];   // and its window row
+
+    uint64_t frames; // frames completed since ppu_init
+    uint8_t screen[SCREEN_HEIGHT][SCREEN_WIDTH]; // frame being rendered
+    uint8_t frame[SCREEN_HEIGHT][SCREEN_WIDTH];  // last complete frame, see ppu_flush
+} Ppu;
+
+typedef struct {
+    uint64_t stalls;         // times the CPU thread found the queue full
+    uint64_t waits;          // times it had to wait for a frame or a reload
+    uint64_t max_lag_cycles; // furthest the renderer was behind when a frame was done
+} PpuPipelineStats;
+
+void ppu_init(GB* gb);
+
+/**
+ * Scalar kernel and every line rendered, as reference for --lockstep
+ */
+void ppu_set_reference(GB* gb, bool reference);
+
+/**
+ * Best kernel the host supports
+ */
+ppu_kernel_t ppu_best_kernel(void);
+
+/**
+ * EVENT_PPU: VBlank and the STAT interrupt sources
+ */
+void ppu_event(GB* gb);
+
+/**
+ * Renders the lines that are due by now
+ */
+void ppu_sync(GB* gb);
+
+/**
+ * Forgets which lines could be reused, for a PPU restored from a savestate
+ */
+void ppu_invalidate(GB* gb);
+
+/**
+ * Moves rendering to a thread of its own. The CPU thread keeps all timing
+ * (LY, STAT, interrupts) and only queues what the renderer needs: the
+ * writes that change how lines look, stamped with their cycle, and which
+ * line is due when. The render thread replays them in order onto its own
+ * copy of VRAM, OAM and the registers and stays up to a frame behind.
+ * Frames come out exactly as rendered in place. False if the thread
+ * cannot be started.
+ */
+bool ppu_pipeline_start(GB* gb);
+
+/**
+ * Joins the render thread, rendering continues in place
+ */
+void ppu_pipeline_stop(GB* gb);
+
+/**
+ * Waits for the render thread to catch up and brings Ppu.frame up to date.
+ * Call before looking at the frame; without a render thread it is always current.
+ */
+void ppu_flush(GB* gb);
+
+/**
+ * False without a render thread
+ */
+bool ppu_pipeline_stats(const GB* gb, PpuPipelineStats* stats);
+
+/**
+ * Last complete frame as binary PGM, false if the file cannot be written
+ */
+bool ppu_save_pgm(const GB* gb, const char* filename);
+
+/**
+ * Renders one line into `out` (shades) from a copy of VRAM (0x8000–0x9FFF),
+ * OAM and the registers LCDC..WX. Used by the PPU and by anything that
+ * renders from recorded state.
+ */
+#define PPU_REG(regs, name) ((regs)[name##_ADDR - LCDC_ADDR])
+
+#define LCDC_BG_ON      0x01
+#define LCDC_OBJ_ON     0x02
+#define LCDC_OBJ_TALL   0x04
+#define LCDC_BG_MAP     0x08
+#define LCDC_TILES_8000 0x10
+#define LCDC_WINDOW_ON  0x20
+#define LCDC_WINDOW_MAP 0x40
+#define LCDC_LCD_ON     0x80
+
+// Whether `line` shows the window, which then advances its row counter
+static inline bool ppu_window_visible(const uint8_t* regs, unsigned line) {
+    uint8_t lcdc = PPU_REG(regs, LCDC);
+    return (lcdc & LCDC_WINDOW_ON) && (lcdc & LCDC_BG_ON) &&
+           line >= PPU_REG(regs, WY) && PPU_REG(regs, WX) <= 166;
+}
+
+void ppu_render_line(ppu_kernel_t kernel, const uint8_t* vram, const uint8_t* oam, const uint8_t* regs,
+                     unsigned line, unsigned window_line, uint8_t* out);
+
+#endif // PPU_H
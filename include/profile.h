@@ -0,0 +1,45 @@
+//
+// Created by davidg on 29.08.25.
+//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct GB GB;
+typedef struct Profile Profile;
+
+/**
+ * Starts counting where guest cycles go: per opcode, per PC, per ROM bank
+ * and per call stack. The stack is shadowed from CALL/RET and interrupt
+ * dispatch. Translated JIT code is bypassed while profiling.
+ */
+bool profile_start(GB* gb);
+void profile_stop(GB* gb);
+
+/**
+ * Called by the dispatch cores before each instruction while gb->profile
+ * is set. Charges the cycles since the last call to the instruction before.
+ */
+void profile_record(GB* gb, uint8_t opcode);
+
+/**
+ * Called before an interrupt jumps to `vector`, opens a frame for the handler
+ */
+void profile_interrupt(GB* gb, uint16_t vector);
+
+/**
+ * One line per call stack, "main;00:0150;01:4A20 <cycles>", the input
+ * format of flamegraph.pl and speedscope.
+ */
+void profile_write_collapsed(GB* gb, FILE* file);
+
+/**
+ * The `top` hottest opcodes and PCs and the cycles of every ROM bank
+ */
+void profile_write_report(GB* gb, FILE* file, unsigned top);
+
+#endif // PROFILE_H
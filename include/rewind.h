@@ -0,0 +1,56 @@
+//
+// Created by davidg on 25.08.25.
+//
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <savestate.h>
+
+typedef struct GB GB;
+
+/**
+ * Ring of the last `capacity` savestates, one every `interval` cycles.
+ * Each one is a delta (state_capture): it only owns the pages written
+ * since the one before, found through the copy-on-write faults of the
+ * page table, so recording costs nothing per instruction. Every
+ * `keyframe_every`th state is a keyframe so the oldest deltas can be
+ * freed once they fall out of the ring.
+ */
+typedef struct Rewind {
+    SaveState** ring;
+    unsigned capacity;
+    unsigned count;
+    unsigned newest;
+    unsigned keyframe_every;
+    unsigned since_keyframe;
+    uint32_t interval;
+} Rewind;
+
+/**
+ * Starts recording. Replaces a recording that is already attached.
+ * `capacity`, `interval` and `keyframe_every` are at least 1.
+ */
+void rewind_attach(GB* gb, unsigned capacity, uint32_t interval, unsigned keyframe_every);
+void rewind_detach(GB* gb);
+
+/**
+ * Goes back to the newest recorded state and drops it from the ring.
+ * Returns false once the history is used up.
+ */
+bool rewind_step_back(GB* gb);
+
+/**
+ * Host memory held by the history
+ */
+size_t rewind_memory(const GB* gb);
+
+/**
+ * EVENT_REWIND: records the next state
+ */
+void rewind_event(GB* gb);
+
+#endif // REWIND_H
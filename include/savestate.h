@@ -0,0 +1,86 @@
+//
+// Created by davidg on 22.08.25.
+//
+
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SAVESTATE_VERSION 3
+
+typedef struct GB GB;
+
+/**
+ * Frozen machine state: CPU, devices and the 256 pages of Memory.data.
+ * Never changes after capture, so any number of machines (on any thread)
+ * can run copy-on-write on top of one state. Reference counted.
+ */
+typedef struct SaveState SaveState;
+
+/**
+ * Freezes the machine. Pages the machine still shares with the state it
+ * came from are shared again, only pages written since are copied; the
+ * machine itself continues copy-on-write on top of the new state, so
+ * capturing again later is just as cheap.
+ */
+SaveState* state_capture(GB* gb);
+
+/**
+ * state_capture that copies every non-zero page and shares nothing, so it
+ * does not keep older states alive. Starts a new delta chain.
+ */
+SaveState* state_capture_keyframe(GB* gb);
+
+/**
+ * New machine running copy-on-write on top of `state`. Costs a page table
+ * and the device state, no memory is copied until it is written.
+ */
+GB* state_fork(SaveState* state);
+
+/**
+ * Puts `gb` back to `state`, copy-on-write as well. Fails if the state
+ * belongs to another cartridge.
+ */
+bool state_restore(GB* gb, SaveState* state);
+
+/**
+ * 64-bit digest of the machine as it is now, for telling explored states
+ * apart: machines that would capture the same state hash the same, also
+ * when they got there at different cycle counts. Every state keeps the
+ * hashes of its 256 byte pages, so only pages written since the machine's
+ * last capture, restore or fork are hashed again; the I/O page and the
+ * cartridge RAM are hashed on every call.
+ */
+uint64_t state_hash(GB* gb);
+
+/**
+ * Bytes of host memory the state owns itself, not counting shared pages
+ */
+size_t state_size(const SaveState* state);
+
+/**
+ * state_size of the state and every older state it shares pages with
+ */
+size_t state_chain_size(const SaveState* state);
+
+void state_retain(SaveState* state);
+void state_release(SaveState* state);
+
+/**
+ * Versioned file format: fixed header with the device state, a bitmap of
+ * the non-zero pages, those pages and the cartridge RAM. The ROM itself is
+ * not included, only its header checksum to check against on restore.
+ */
+bool state_save(const SaveState* state, const char* filename);
+
+/**
+ * Maps a state file read-only. Restoring from it reads the pages straight
+ * out of the mapping. Returns NULL with errno set (EINVAL for files that
+ * are not a state of this version).
+ */
+SaveState* state_load(const char* filename);
+
+#endif // SAVESTATE_H
@@ -0,0 +1,73 @@
+//
+// Created by davidg on 15.08.25.
+//
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct GB GB;
+
+/**
+ * Everything that happens at a known cycle. Each event is either scheduled
+ * exactly once or not at all.
+ */
+typedef enum {
+    EVENT_IRQ,    // IF, IE or IME changed: dispatch a pending interrupt
+    EVENT_EI,     // EI takes effect after the following instruction
+    EVENT_TIMER,  // TIMA overflow, see timer.c
+    EVENT_PPU,    // VBlank and STAT interrupts, see ppu.c
+    EVENT_REWIND, // next state for the rewind buffer
+    EVENT_COUNT
+} event_id_t;
+
+typedef void (*event_func_t)(GB* gb);
+
+typedef struct {
+    uint64_t when; // absolute cpu->cycles
+    uint8_t id;
+} Event;
+
+/**
+ * Binary min-heap of pending events, ordered by `when`
+ */
+typedef struct {
+    Event heap[EVENT_COUNT];
+    int8_t slot[EVENT_COUNT]; // heap index of each event, -1 if not scheduled
+    uint8_t count;
+    uint64_t next;            // earliest `when`, far ahead while nothing is scheduled
+    uint64_t deadline;        // where the running core stops: next event or end of budget
+} Scheduler;
+
+#define CYCLES_BEFORE(a, b) ((int64_t)((a) - (b)) < 0)
+
+void sched_init(GB* gb);
+
+/**
+ * (Re)schedules `id` at absolute cycle `when`. A time in the past fires at
+ * the next instruction boundary.
+ */
+void sched_schedule(GB* gb, event_id_t id, uint64_t when);
+void sched_cancel(GB* gb, event_id_t id);
+bool sched_is_scheduled(const GB* gb, event_id_t id);
+
+/**
+ * Replaces all pending events with `events`, each id at most once. A heap as
+ * found in Scheduler.heap comes back unchanged, so ties fire the same way.
+ */
+void sched_load(GB* gb, const Event* events, unsigned count);
+
+/**
+ * Fires every event that is due at the current cycle count, in order.
+ */
+void sched_run_due(GB* gb);
+
+/**
+ * Sets the deadline of the next core slice: the earlier of `end` and the
+ * next event.
+ */
+void sched_begin_slice(GB* gb, uint64_t end);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,46 @@
+//
+// Created by davidg on 07.09.25.
+//
+
+#ifndef STATE_SET_H
+#define STATE_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Set of state_hash values shared by any number of threads, for pruning
+ * states an exploration has seen before. Open addressing over one array of
+ * atomic slots, an insert is a probe and at most a CAS, nothing is locked.
+ * It does not grow: a hash is only looked for within STATE_SET_MAX_PROBE
+ * slots of its home, once `capacity` is exceeded by far inserts start
+ * coming back STATE_SET_FULL.
+ */
+typedef struct StateSet StateSet;
+
+#define STATE_SET_MAX_PROBE 64
+
+typedef enum {
+    STATE_SET_ADDED, // was not in the set yet, the state is new and worth exploring
+    STATE_SET_SEEN,  // in the set already
+    STATE_SET_FULL,  // not in the set and no free slot for it, nothing was stored
+} state_set_status_t;
+
+/**
+ * Room for at least `capacity` hashes, exits if there is no memory for it.
+ */
+StateSet* state_set_create(size_t capacity);
+void state_set_destroy(StateSet* set);
+
+/**
+ * Adds `hash`. Exactly one of several threads inserting the same hash gets
+ * STATE_SET_ADDED.
+ */
+state_set_status_t state_set_insert(StateSet* set, uint64_t hash);
+
+bool state_set_contains(const StateSet* set, uint64_t hash);
+
+size_t state_set_count(const StateSet* set);
+
+#endif // STATE_SET_H
@@ -0,0 +1,49 @@
+//
+// Created by davidg on 18.08.25.
+//
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DIV_ADDR 0xFF04
+#define TIMA_ADDR 0xFF05
+#define TMA_ADDR 0xFF06
+#define TAC_ADDR 0xFF07
+
+typedef struct GB GB;
+
+/**
+ * DIV/TIMA/TMA/TAC. DIV is the upper byte of a 16-bit counter that runs at
+ * the CPU clock, TIMA counts falling edges of one of its bits (picked by
+ * TAC) while TAC bit 2 is set.
+ *
+ * By default nothing is ticked: the counter follows from cpu->cycles and
+ * TIMA is brought up to date only when it is accessed, the one scheduled
+ * event is its next overflow. With per_cycle set the counter is stepped
+ * one cycle at a time instead, as reference for --lockstep.
+ * TIMA reloads from TMA in the same cycle it overflows.
+ */
+typedef struct {
+    bool per_cycle;
+    uint8_t tima, tma, tac;
+    uint64_t synced;   // cpu->cycles that tima (and counter, per cycle) belong to
+    uint64_t div_base; // cpu->cycles at which the counter was 0
+    uint16_t counter;  // per cycle only
+} Timer;
+
+void timer_init(GB* gb);
+
+/**
+ * Switches to per cycle ticking. Call right after gb_init.
+ */
+void timer_set_per_cycle(GB* gb, bool per_cycle);
+
+/**
+ * EVENT_TIMER: TIMA overflow, or a tick of the per cycle model
+ */
+void timer_event(GB* gb);
+
+#endif // TIMER_H
@@ -0,0 +1,99 @@
+//
+// Created by davidg on 27.08.25.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <cpu.h>
+
+#define TRACE_CHUNK_RECORDS 4096
+#define TRACE_CHUNKS 16 // chunks in flight between CPU and writer thread
+
+/**
+ * State before one instruction. The first 16 bytes are a copy of CPU,
+ * flags included in their lazy form.
+ */
+typedef struct {
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp, pc;
+    uint8_t flags_op;
+    uint8_t flags_xy;
+    uint16_t flags_result;
+    uint64_t cycles;
+    uint8_t opcode;
+    uint8_t reserved[7];
+} TraceRecord;
+
+#define TRACE_CPU_BYTES 16
+
+/**
+ * Per-machine trace. The CPU fills chunks of records, a writer thread
+ * compresses full chunks into the file. The two only share the head and
+ * tail chunk counters.
+ */
+typedef struct Trace {
+    TraceRecord* next; // CPU side: next free record
+    TraceRecord* chunk_end;
+    TraceRecord* chunks;
+    unsigned counts[TRACE_CHUNKS]; // records in each published chunk
+
+    atomic_uint head; // chunks published by the CPU
+    atomic_uint tail; // chunks written by the writer thread
+    atomic_bool stop;
+
+    FILE* file;
+    pthread_t writer;
+} Trace;
+
+/**
+ * Starts tracing every instruction of `gb` into `filename`.
+ * The translated code of the JIT is bypassed while tracing.
+ */
+bool trace_start(GB* gb, const char* filename);
+
+/**
+ * Writes what is left and closes the file. No-op if not tracing.
+ */
+void trace_stop(GB* gb);
+
+// Hands the full chunk to the writer thread, waits if all chunks are in flight
+void trace_publish(Trace* trace);
+
+/**
+ * Called by the dispatch cores before each instruction while gb->trace is set
+ */
+static inline void trace_record(Trace* trace, const CPU* cpu, uint8_t opcode) {
+    TraceRecord* record = trace->next++;
+    memcpy(record, cpu, TRACE_CPU_BYTES);
+    record->cycles = cpu->cycles;
+    record->opcode = opcode;
+    if (trace->next == trace->chunk_end) trace_publish(trace);
+}
+
+/**
+ * Sequential reader for trace files, used by trace_decode
+ */
+typedef struct {
+    FILE* file;
+    uint8_t* payload; // one compressed chunk
+    TraceRecord chunk[TRACE_CHUNK_RECORDS];
+    unsigned count;
+    unsigned index;
+} TraceReader;
+
+bool trace_open(TraceReader* reader, const char* filename);
+
+/**
+ * Next record of the file, false at the end or on a damaged chunk
+ */
+bool trace_read(TraceReader* reader, TraceRecord* record);
+void trace_close(TraceReader* reader);
+
+#endif // TRACE_H
@@ -0,0 +1,119 @@
+//
+// Created by davidg on 05.09.25.
+//
+
+#include <aot.h>
+#include <gb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AOT_DLOPEN
+#include <dlfcn.h>
+#endif
+
+uint32_t aot_rom_hash(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+#ifdef AOT_DLOPEN
+
+bool aot_load(GB* gb, const char* path) {
+    const RomImage* rom = gb->cart.rom;
+    if (!rom) {
+        fprintf(stderr, "AOT-Code %s braucht eine geladene ROM\n", path);
+        return false;
+    }
+
+    // Without a slash dlopen would search the library path instead of the working directory
+    char local[4096];
+    if (!strchr(path, '/') && snprintf(local, sizeof(local), "./%s", path) < (int)sizeof(local)) {
+        path = local;
+    }
+
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "AOT-Code nicht ladbar: %s\n", dlerror());
+        return false;
+    }
+
+    const AotImage* image = dlsym(handle, AOT_IMAGE_SYMBOL);
+    const char* mismatch = NULL;
+    if (!image) {
+        mismatch = "kein " AOT_IMAGE_SYMBOL;
+    } else if (image->abi != AOT_ABI_VERSION || image->gb_size != sizeof(GB)) {
+        mismatch = "für einen anderen Build übersetzt";
+    } else if (image->rom_hash != aot_rom_hash(rom->data, rom->size)) {
+        mismatch = "für eine andere ROM übersetzt";
+    }
+    if (mismatch) {
+        fprintf(stderr, "AOT-Code %s: %s\n", path, mismatch);
+        dlclose(handle);
+        return false;
+    }
+
+    Aot* aot = malloc(sizeof(Aot));
+    char* copy = malloc(strlen(path) + 1);
+    if (!aot || !copy) {
+        perror("Fehler beim Laden des AOT-Codes");
+        exit(1);
+    }
+    strcpy(copy, path);
+
+    aot_unload(gb);
+    *aot = (Aot){ .handle = handle, .image = image, .rom = rom, .path = copy };
+    gb->aot = aot;
+
+    // Blocks decoded so far pick up their native code when decoded again
+    if (gb->blocks) memset(gb->blocks, 0, sizeof(BlockCache));
+    return true;
+}
+
+void aot_unload(GB* gb) {
+    Aot* aot = gb->aot;
+    if (!aot) return;
+
+    gb->aot = NULL;
+    if (gb->blocks) memset(gb->blocks, 0, sizeof(BlockCache)); // no native pointers into the closed object
+    dlclose(aot->handle);
+    free(aot->path);
+    free(aot);
+}
+
+#else
+
+bool aot_load(GB* gb, const char* path) {
+    fprintf(stderr, "AOT-Code wird auf dieser Plattform nicht unterstützt\n");
+    return false;
+}
+
+void aot_unload(GB* gb) {
+}
+
+#endif
+
+native_block_fn aot_lookup(const GB* gb, uint16_t pc, uint16_t bank) {
+    const Aot* aot = gb->aot;
+
+    // Only ROM is translated, and only the ROM it was checked against
+    if (!aot || pc >= 0x8000 || gb->cart.rom != aot->rom) return NULL;
+
+    const AotEntry* entries = aot->image->entries;
+    uint32_t low = 0, high = aot->image->count;
+    uint32_t key = (uint32_t)bank << 16 | pc;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        uint32_t at = (uint32_t)entries[middle].bank << 16 | entries[middle].pc;
+        if (at == key) return entries[middle].fn;
+        if (at < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,797 @@
+//
+// Created by davidg on 04.09.25.
+//
+
+#include <batch.h>
+#include <scheduler.h>
+#include <string.h>
+#include "opcodes.h"
+
+#if defined(__GNUC__)
+
+#if defined(LR35902_SIMD) && defined(__x86_64__)
+#include <immintrin.h>
+#define BATCH_AVX2
+#endif
+
+#define SCALAR_BURST 64 // instructions a lone lane runs before the group is looked at again
+
+#define LANE(i) (1u << (i))
+#define EACH_LANE(i, lanes) \
+    for (unsigned rest_ = (lanes), i = 0; rest_ && ((i = __builtin_ctz(rest_)), 1); rest_ &= rest_ - 1)
+
+// One 32-bit lane per machine. GCC and Clang lower these to SSE2, AVX2 where the target allows
+typedef uint32_t lanes_t __attribute__((vector_size(4 * BATCH_LANES)));
+
+// Everything that handles lanes_t is inlined into the generic and the AVX2 copy of the run loop.
+// The only call that passes one (the AVX2 gather) is made from AVX2 code, so the ABI warning does not apply
+#define LANES_INLINE static inline __attribute__((always_inline))
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// All ones in the lanes where `condition` holds
+#define WHERE(condition) ((lanes_t)(condition))
+
+// Registers in opcode order, F sits where the operand encoding has (HL)
+enum { REG_B, REG_C, REG_D, REG_E, REG_H, REG_L, REG_F, REG_A };
+#define OPERAND_HLP 6
+
+typedef enum {
+    RUN_ON,     // executed, the lanes still agree on PC
+    RUN_SPLIT,  // executed, the lanes branched apart
+    RUN_SCALAR, // not executed, left to cpu_step
+} run_t;
+
+typedef struct {
+    GB* gb[BATCH_LANES];
+    uint64_t end[BATCH_LANES];
+    unsigned count;
+    unsigned live; // lanes with budget left
+    unsigned core; // lanes inside a slice: sched_begin_slice done, deadline not reached
+    BatchStats stats;
+
+    // The vector run, lanes in `active` only. They take the same path, so
+    // PC and the cycles spent are the same in all of them until they split
+    unsigned active;
+    unsigned width; // lanes in `active`
+    lanes_t r[8];
+    lanes_t sp;
+    lanes_t limit;    // delta at which each lane reaches its deadline
+    uint32_t soonest; // lowest limit of the active lanes
+    uint32_t delta;   // cycles since load()
+    uint64_t start[BATCH_LANES];
+    uint16_t pc;
+    bool split;
+    lanes_t pcs;   // once split
+    lanes_t extra; // once split: cycles of the branch taken on top of delta
+    int code_page; // page all lanes fetch code from, -1 until checked again
+    const uint8_t* code;
+#ifdef BATCH_AVX2
+    uint64_t tables[BATCH_LANES]; // address of each lane's read_pages
+#endif
+} Group;
+
+static const lanes_t lane_bit = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+LANES_INLINE unsigned lane_bits(lanes_t mask) {
+    unsigned bits = 0;
+    for (unsigned i = 0; i < BATCH_LANES; i++) bits |= mask[i] & lane_bit[i];
+    return bits;
+}
+
+LANES_INLINE lanes_t lane_mask(unsigned lanes) {
+    return WHERE((lane_bit & lanes) != 0);
+}
+
+// ---- Moving lanes in and out of the registers ----
+
+static void load(Group* g, unsigned lanes) {
+    g->active = lanes;
+    g->width = __builtin_popcount(lanes);
+    g->soonest = UINT32_MAX;
+    g->delta = 0;
+    g->split = false;
+    g->code_page = -1;
+
+    EACH_LANE(i, lanes) {
+        const GB* gb = g->gb[i];
+        const CPU* cpu = &gb->cpu;
+        int64_t left = (int64_t)(gb->sched.deadline - cpu->cycles);
+
+        g->r[REG_B][i] = cpu->b;
+        g->r[REG_C][i] = cpu->c;
+        g->r[REG_D][i] = cpu->d;
+        g->r[REG_E][i] = cpu->e;
+        g->r[REG_H][i] = cpu->h;
+        g->r[REG_L][i] = cpu->l;
+        g->r[REG_F][i] = cpu_flags(cpu);
+        g->r[REG_A][i] = cpu->a;
+        g->sp[i] = cpu->sp;
+        g->pc = cpu->pc;
+        g->start[i] = cpu->cycles;
+        g->limit[i] = left > 0 ? (uint32_t)left : 0;
+        if (g->limit[i] < g->soonest) g->soonest = g->limit[i];
+    }
+}
+
+static void store(Group* g, unsigned lanes) {
+    EACH_LANE(i, lanes) {
+        CPU* cpu = &g->gb[i]->cpu;
+
+        cpu->b = g->r[REG_B][i];
+        cpu->c = g->r[REG_C][i];
+        cpu->d = g->r[REG_D][i];
+        cpu->e = g->r[REG_E][i];
+        cpu->h = g->r[REG_H][i];
+        cpu->l = g->r[REG_L][i];
+        cpu_set_flags(cpu, g->r[REG_F][i]);
+        cpu->a = g->r[REG_A][i];
+        cpu->sp = g->sp[i];
+        cpu->pc = g->split ? g->pcs[i] : g->pc;
+        cpu->cycles = g->start[i] + g->delta + (g->split ? g->extra[i] : 0);
+    }
+}
+
+// ---- Memory ----
+
+// I/O handlers and the scheduler look at the cycle count of their machine
+static void sync_cycles(Group* g, unsigned i) {
+    g->gb[i]->cpu.cycles = g->start[i] + g->delta;
+}
+
+// A handler may have moved the deadline (interrupt request) or the map (bank switch)
+static void after_handler(Group* g, unsigned i) {
+    int64_t left = (int64_t)(g->gb[i]->sched.deadline - g->start[i]);
+    g->limit[i] = left > 0 ? (uint32_t)left : 0;
+    if (g->limit[i] < g->soonest) g->soonest = g->limit[i];
+    g->code_page = -1;
+}
+
+#ifdef BATCH_AVX2
+// Low dwords of two vectors of four 64-bit values
+__attribute__((target("avx2")))
+static __m256i narrow_avx2(__m256i lo, __m256i hi) {
+    const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    return _mm256_set_m128i(_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(hi, even)),
+                            _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(lo, even)));
+}
+
+/**
+ * Page of every lane's address from that lane's own read_pages, then the
+ * byte from the page: two gathers of pointers, two of bytes. Each byte is
+ * fetched as the aligned word around it, which never leaves the page.
+ * Lanes without a direct page come back in `slow`.
+ */
+__attribute__((target("avx2")))
+static lanes_t gather_avx2(const Group* g, unsigned lanes, lanes_t address, unsigned* slow) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bits_lo = _mm256_setr_epi64x(1, 2, 4, 8);
+    const __m256i bits_hi = _mm256_setr_epi64x(16, 32, 64, 128);
+    __m256i wanted = _mm256_set1_epi64x(lanes);
+    __m256i addr = (__m256i)address;
+    __m256i page = _mm256_srli_epi32(addr, 8);
+    __m256i offset = _mm256_and_si256(addr, _mm256_set1_epi32(0xFF));
+
+    __m256i slot_lo = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)g->tables),
+        _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(page)), 3));
+    __m256i slot_hi = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(g->tables + 4)),
+        _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(page, 1)), 3));
+    __m256i ptr_lo = _mm256_mask_i64gather_epi64(zero, (const long long*)0, slot_lo,
+        _mm256_cmpeq_epi64(_mm256_and_si256(wanted, bits_lo), bits_lo), 1);
+    __m256i ptr_hi = _mm256_mask_i64gather_epi64(zero, (const long long*)0, slot_hi,
+        _mm256_cmpeq_epi64(_mm256_and_si256(wanted, bits_hi), bits_hi), 1);
+
+    unsigned missing = _mm256_movemask_pd((__m256d)_mm256_cmpeq_epi64(ptr_lo, zero)) |
+                       _mm256_movemask_pd((__m256d)_mm256_cmpeq_epi64(ptr_hi, zero)) << 4;
+    *slow = lanes & missing;
+
+    __m256i byte_lo = _mm256_add_epi64(ptr_lo, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(offset)));
+    __m256i byte_hi = _mm256_add_epi64(ptr_hi, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(offset, 1)));
+    const __m256i align = _mm256_set1_epi64x(~3ll);
+    __m256i found = _mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_set1_epi32(lanes & ~missing), (__m256i)lane_bit), (__m256i)lane_bit);
+    __m128i word_lo = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), (const int*)0,
+        _mm256_and_si256(byte_lo, align), _mm256_castsi256_si128(found), 1);
+    __m128i word_hi = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), (const int*)0,
+        _mm256_and_si256(byte_hi, align), _mm256_extracti128_si256(found, 1), 1);
+
+    __m256i shift = _mm256_slli_epi32(_mm256_and_si256(narrow_avx2(byte_lo, byte_hi), _mm256_set1_epi32(3)), 3);
+    __m256i bytes = _mm256_srlv_epi32(_mm256_set_m128i(word_hi, word_lo), shift);
+    return (lanes_t)_mm256_and_si256(bytes, _mm256_set1_epi32(0xFF));
+}
+#endif
+
+// Addresses are 16 bits wide
+LANES_INLINE lanes_t load8(Group* g, unsigned lanes, lanes_t address, const bool avx2) {
+    lanes_t value = { 0 };
+    unsigned slow = 0;
+
+#ifdef BATCH_AVX2
+    if (avx2) {
+        value = gather_avx2(g, lanes, address, &slow);
+    } else
+#endif
+    {
+        EACH_LANE(i, lanes) {
+            const uint8_t* page = g->gb[i]->mem.read_pages[address[i] >> 8];
+            if (page) {
+                value[i] = page[address[i] & 0xFF];
+            } else {
+                slow |= LANE(i);
+            }
+        }
+    }
+
+    EACH_LANE(i, slow) {
+        sync_cycles(g, i);
+        value[i] = mem_read_slow(g->gb[i], address[i]);
+        after_handler(g, i);
+    }
+    return value;
+}
+
+// No scatter below AVX-512, every lane stores on its own
+LANES_INLINE void store8(Group* g, unsigned lanes, lanes_t address, lanes_t value) {
+    EACH_LANE(i, lanes) {
+        GB* gb = g->gb[i];
+        uint8_t* page = gb->mem.write_pages[address[i] >> 8];
+        if (page) {
+            page[address[i] & 0xFF] = value[i];
+            // Code written by the lanes themselves may differ between them now
+            if (address[i] >> 8 == g->code_page) g->code_page = -1;
+        } else {
+            sync_cycles(g, i);
+            mem_write_slow(gb, address[i], value[i]);
+            after_handler(g, i);
+        }
+    }
+}
+
+LANES_INLINE lanes_t load16(Group* g, unsigned lanes, lanes_t address, const bool avx2) {
+    lanes_t lo = load8(g, lanes, address, avx2);
+    return lo | load8(g, lanes, (address + 1) & 0xFFFF, avx2) << 8;
+}
+
+LANES_INLINE void store16(Group* g, unsigned lanes, lanes_t address, lanes_t value) {
+    store8(g, lanes, address, value & 0xFF);
+    store8(g, lanes, (address + 1) & 0xFFFF, value >> 8);
+}
+
+LANES_INLINE void push16(Group* g, unsigned lanes, lanes_t value) {
+    lanes_t mask = lane_mask(lanes);
+    g->sp = (g->sp & ~mask) | (((g->sp - 2) & 0xFFFF) & mask);
+    store16(g, lanes, g->sp, value);
+}
+
+LANES_INLINE lanes_t pop16(Group* g, unsigned lanes, const bool avx2) {
+    lanes_t mask = lane_mask(lanes);
+    lanes_t value = load16(g, lanes, g->sp, avx2);
+    g->sp = (g->sp & ~mask) | (((g->sp + 2) & 0xFFFF) & mask);
+    return value;
+}
+
+// Instruction bytes, read once for all lanes if the page holds the same code in all of them.
+// Forks of one machine share their ROM pages, and the pointers alone tell
+static bool fetch(Group* g, uint16_t address, uint8_t* byte) {
+    if (address >> 8 != g->code_page) {
+        const uint8_t* page = NULL;
+        EACH_LANE(i, g->active) {
+            const uint8_t* lane_page = g->gb[i]->mem.read_pages[address >> 8];
+            if (!lane_page) return false;
+            if (page && lane_page != page && memcmp(lane_page, page, PAGE_SIZE) != 0) return false;
+            if (!page) page = lane_page;
+        }
+        g->code_page = address >> 8;
+        g->code = page;
+    }
+    *byte = g->code[address & 0xFF];
+    return true;
+}
+
+// ---- Registers and flags ----
+
+LANES_INLINE lanes_t get_pair(const Group* g, unsigned pair) {
+    if (pair == 3) return g->sp;
+    return g->r[2 * pair] << 8 | g->r[2 * pair + 1];
+}
+
+LANES_INLINE void set_pair(Group* g, unsigned pair, lanes_t value) {
+    value &= 0xFFFF;
+    if (pair == 3) {
+        g->sp = value;
+    } else {
+        g->r[2 * pair] = value >> 8;
+        g->r[2 * pair + 1] = value & 0xFF;
+    }
+}
+
+LANES_INLINE lanes_t get_r8(Group* g, unsigned index, const bool avx2) {
+    if (index == OPERAND_HLP) return load8(g, g->active, get_pair(g, 2), avx2);
+    return g->r[index];
+}
+
+LANES_INLINE void set_r8(Group* g, unsigned index, lanes_t value) {
+    if (index == OPERAND_HLP) {
+        store8(g, g->active, get_pair(g, 2), value);
+    } else {
+        g->r[index] = value;
+    }
+}
+
+// Z N H C of an 8-bit add or subtract, as flags_from_result
+LANES_INLINE lanes_t arith_flags(lanes_t x, lanes_t y, lanes_t result, uint32_t n) {
+    lanes_t carries = x ^ y ^ result;
+    return (WHERE((result & 0xFF) == 0) & FLAG_Z) | n | (carries & 0x10) << 1 | (carries & 0x100) >> 4;
+}
+
+LANES_INLINE lanes_t zero_flag(lanes_t value) {
+    return WHERE(value == 0) & FLAG_Z;
+}
+
+LANES_INLINE void alu(Group* g, unsigned operation, lanes_t value) {
+    lanes_t a = g->r[REG_A];
+    lanes_t carry = g->r[REG_F] >> 4 & 1;
+    lanes_t result;
+
+    switch (operation) {
+        case 0: result = a + value; g->r[REG_F] = arith_flags(a, value, result, 0); break;
+        case 1: result = a + value + carry; g->r[REG_F] = arith_flags(a, value, result, 0); break;
+        case 2: result = a - value; g->r[REG_F] = arith_flags(a, value, result, FLAG_N); break;
+        case 3: result = a - value - carry; g->r[REG_F] = arith_flags(a, value, result, FLAG_N); break;
+        case 4: result = a & value; g->r[REG_F] = zero_flag(result) | FLAG_H; break;
+        case 5: result = a ^ value; g->r[REG_F] = zero_flag(result); break;
+        case 6: result = a | value; g->r[REG_F] = zero_flag(result); break;
+        default: g->r[REG_F] = arith_flags(a, value, a - value, FLAG_N); return; // CP
+    }
+    g->r[REG_A] = result & 0xFF;
+}
+
+// The CB rotates and shifts in opcode order, Z from the result and C from the bit shifted out
+LANES_INLINE lanes_t shift(Group* g, unsigned operation, lanes_t value) {
+    lanes_t carry_in = g->r[REG_F] >> 4 & 1;
+    lanes_t result, carry;
+
+    switch (operation) {
+        case 0: result = value << 1 | value >> 7; carry = value >> 7; break;
+        case 1: result = value >> 1 | value << 7; carry = value & 1; break;
+        case 2: result = value << 1 | carry_in; carry = value >> 7; break;
+        case 3: result = value >> 1 | carry_in << 7; carry = value & 1; break;
+        case 4: result = value << 1; carry = value >> 7; break;
+        case 5: result = value >> 1 | (value & 0x80); carry = value & 1; break;
+        case 6: result = value << 4 | value >> 4; carry = value & 0; break;
+        default: result = value >> 1; carry = value & 1; break;
+    }
+    result &= 0xFF;
+    g->r[REG_F] = zero_flag(result) | carry << 4;
+    return result;
+}
+
+// NZ Z NC C
+LANES_INLINE lanes_t condition(const Group* g, unsigned cc) {
+    lanes_t flag = g->r[REG_F] & (cc < 2 ? FLAG_Z : FLAG_C);
+    return cc & 1 ? WHERE(flag != 0) : WHERE(flag == 0);
+}
+
+// Every lane to its own target with its own extra cycles, fine as long as they are all the same
+LANES_INLINE run_t jump(Group* g, lanes_t target, lanes_t extra) {
+    unsigned first = __builtin_ctz(g->active);
+    if ((lane_bits(WHERE(target != target[first]) | WHERE(extra != extra[first])) & g->active) == 0) {
+        g->pc = target[first];
+        g->delta += extra[first];
+        return RUN_ON;
+    }
+    g->pcs = target;
+    g->extra = extra;
+    g->split = true;
+    return RUN_SPLIT;
+}
+
+// Lanes where `taken` holds go to `target` and spend `cycles` more, the others fall through
+LANES_INLINE run_t branch(Group* g, lanes_t taken, uint16_t target, uint32_t cycles) {
+    return jump(g, (taken & target) | (~taken & g->pc), taken & cycles);
+}
+
+// ---- The vector core ----
+
+LANES_INLINE run_t execute(Group* g, const bool avx2) {
+    uint8_t opcode, lo = 0, hi = 0;
+    if (!fetch(g, g->pc, &opcode)) return RUN_SCALAR;
+
+    const OpcodeInfo* info = &opcode_table[opcode];
+    switch (opcode) {
+        case 0x10: case 0x76: case 0xD9: case 0xF3: case 0xFB:
+            return RUN_SCALAR; // STOP, HALT, RETI, DI, EI: scheduler and interrupt state
+        default:
+            if (!info->handler) return RUN_SCALAR;
+    }
+    if (info->length > 1 && !fetch(g, g->pc + 1, &lo)) return RUN_SCALAR;
+    if (info->length > 2 && !fetch(g, g->pc + 2, &hi)) return RUN_SCALAR;
+
+    const uint16_t operand = lo | hi << 8;
+    const unsigned y = opcode >> 3 & 7, z = opcode & 7, pair = opcode >> 4 & 3;
+    const unsigned all = g->active;
+    lanes_t* r = g->r;
+    lanes_t value, taken;
+
+    // As in the cores: PC past the instruction and the base cycles before the handler
+    g->pc += info->length;
+    g->delta += opcode == OPCODE_PREFIX_CB ? cb_opcode_table[lo].cycles : info->cycles;
+    const lanes_t none = { 0 };
+
+    switch (opcode) {
+        case 0x00:
+            break;
+
+        // 16-bit loads and arithmetic
+        case 0x01: case 0x11: case 0x21: case 0x31:
+            set_pair(g, pair, operand + none);
+            break;
+        case 0x03: case 0x13: case 0x23: case 0x33:
+            set_pair(g, pair, get_pair(g, pair) + 1);
+            break;
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+            set_pair(g, pair, get_pair(g, pair) - 1);
+            break;
+        case 0x09: case 0x19: case 0x29: case 0x39: {
+            lanes_t hl = get_pair(g, 2), other = get_pair(g, pair), result = hl + other;
+            r[REG_F] = (r[REG_F] & FLAG_Z) | ((hl & 0x0FFF) + (other & 0x0FFF)) >> 12 << 5 | (result >> 16) << 4;
+            set_pair(g, 2, result);
+            break;
+        }
+        case 0x08:
+            store16(g, all, operand + none, g->sp);
+            break;
+        case 0xF9:
+            g->sp = get_pair(g, 2);
+            break;
+        case 0xE8: case 0xF8: {
+            lanes_t result = (g->sp + (int8_t)lo) & 0xFFFF;
+            r[REG_F] = ((g->sp & 0x0F) + (lo & 0x0F)) >> 4 << 5 | ((g->sp & 0xFF) + lo) >> 8 << 4;
+            if (opcode == 0xE8) {
+                g->sp = result;
+            } else {
+                set_pair(g, 2, result);
+            }
+            break;
+        }
+
+        // Loads through BC, DE, HL+ and HL-
+        case 0x02: case 0x12:
+            store8(g, all, get_pair(g, pair), r[REG_A]);
+            break;
+        case 0x0A: case 0x1A:
+            r[REG_A] = load8(g, all, get_pair(g, pair), avx2);
+            break;
+        case 0x22: case 0x32: {
+            lanes_t hl = get_pair(g, 2);
+            store8(g, all, hl, r[REG_A]);
+            set_pair(g, 2, opcode == 0x22 ? hl + 1 : hl - 1);
+            break;
+        }
+        case 0x2A: case 0x3A: {
+            lanes_t hl = get_pair(g, 2);
+            r[REG_A] = load8(g, all, hl, avx2);
+            set_pair(g, 2, opcode == 0x2A ? hl + 1 : hl - 1);
+            break;
+        }
+
+        // INC, DEC and LD r, d8, all with (HL)
+        case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C:
+            value = (get_r8(g, y, avx2) + 1) & 0xFF;
+            set_r8(g, y, value);
+            r[REG_F] = (r[REG_F] & FLAG_C) | zero_flag(value) | (WHERE((value & 0x0F) == 0) & FLAG_H);
+            break;
+        case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D:
+            value = (get_r8(g, y, avx2) - 1) & 0xFF;
+            set_r8(g, y, value);
+            r[REG_F] = (r[REG_F] & FLAG_C) | zero_flag(value) | FLAG_N | (WHERE((value & 0x0F) == 0x0F) & FLAG_H);
+            break;
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E:
+            set_r8(g, y, lo + none);
+            break;
+
+        // Accumulator rotates always clear Z
+        case 0x07: case 0x0F: case 0x17: case 0x1F:
+            r[REG_A] = shift(g, y, r[REG_A]);
+            r[REG_F] &= FLAG_C;
+            break;
+        case 0x27: {
+            lanes_t a = r[REG_A], f = r[REG_F];
+            lanes_t subtract = WHERE((f & FLAG_N) != 0), half = WHERE((f & FLAG_H) != 0), carry = WHERE((f & FLAG_C) != 0);
+            lanes_t low = half | (~subtract & WHERE((a & 0x0F) > 0x09));
+            lanes_t high = carry | (~subtract & WHERE(a > 0x99));
+            lanes_t adjust = (low & 0x06) | (high & 0x60);
+            a = ((subtract & (a - adjust)) | (~subtract & (a + adjust))) & 0xFF;
+            r[REG_A] = a;
+            r[REG_F] = zero_flag(a) | (f & FLAG_N) | (high & FLAG_C);
+            break;
+        }
+        case 0x2F:
+            r[REG_A] = ~r[REG_A] & 0xFF;
+            r[REG_F] |= FLAG_N | FLAG_H;
+            break;
+        case 0x37:
+            r[REG_F] = (r[REG_F] & FLAG_Z) | FLAG_C;
+            break;
+        case 0x3F:
+            r[REG_F] = (r[REG_F] & (FLAG_Z | FLAG_C)) ^ FLAG_C;
+            break;
+
+        // LD r, r' and the ALU, HALT went to cpu_step above
+        case 0x40 ... 0x7F:
+            set_r8(g, y, get_r8(g, z, avx2));
+            break;
+        case 0x80 ... 0xBF:
+            alu(g, y, get_r8(g, z, avx2));
+            break;
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            alu(g, y, lo + none);
+            break;
+
+        case OPCODE_PREFIX_CB: {
+            unsigned n = lo >> 3 & 7, index = lo & 7;
+            value = get_r8(g, index, avx2);
+            switch (lo >> 6) {
+                case 0: set_r8(g, index, shift(g, n, value)); break;
+                case 1: r[REG_F] = (r[REG_F] & FLAG_C) | FLAG_H | ((~value >> n & 1) << 7); break;
+                case 2: set_r8(g, index, value & ~(1u << n)); break;
+                default: set_r8(g, index, value | 1u << n); break;
+            }
+            break;
+        }
+
+        // I/O page and absolute addresses
+        case 0xE0:
+            store8(g, all, (0xFF00 | lo) + none, r[REG_A]);
+            break;
+        case 0xF0:
+            r[REG_A] = load8(g, all, (0xFF00 | lo) + none, avx2);
+            break;
+        case 0xE2:
+            store8(g, all, 0xFF00 | r[REG_C], r[REG_A]);
+            break;
+        case 0xF2:
+            r[REG_A] = load8(g, all, 0xFF00 | r[REG_C], avx2);
+            break;
+        case 0xEA:
+            store8(g, all, operand + none, r[REG_A]);
+            break;
+        case 0xFA:
+            r[REG_A] = load8(g, all, operand + none, avx2);
+            break;
+
+        // Stack
+        case 0xC5: case 0xD5: case 0xE5:
+            push16(g, all, get_pair(g, pair));
+            break;
+        case 0xF5:
+            push16(g, all, r[REG_A] << 8 | r[REG_F]);
+            break;
+        case 0xC1: case 0xD1: case 0xE1:
+            set_pair(g, pair, pop16(g, all, avx2));
+            break;
+        case 0xF1:
+            value = pop16(g, all, avx2);
+            r[REG_A] = value >> 8;
+            r[REG_F] = value & 0xF0;
+            break;
+
+        // Jumps, calls and returns. Taken conditional branches add their cycles
+        case 0x18:
+            g->pc += (int8_t)lo;
+            break;
+        case 0x20: case 0x28: case 0x30: case 0x38:
+            return branch(g, condition(g, y & 3), g->pc + (int8_t)lo, 4);
+        case 0xC3:
+            g->pc = operand;
+            break;
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+            return branch(g, condition(g, y & 3), operand, 4);
+        case 0xE9:
+            return jump(g, get_pair(g, 2), none);
+        case 0xCD:
+            push16(g, all, g->pc + none);
+            g->pc = operand;
+            break;
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC: {
+            taken = condition(g, y & 3);
+            unsigned calls = lane_bits(taken) & all;
+            if (calls) push16(g, calls, g->pc + none);
+            return branch(g, taken, operand, 12);
+        }
+        case 0xC9:
+            return jump(g, pop16(g, all, avx2), none);
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8: {
+            taken = condition(g, y & 3);
+            unsigned returns = lane_bits(taken) & all;
+            value = returns ? pop16(g, returns, avx2) : none;
+            return jump(g, (taken & value) | (~taken & g->pc), taken & 12);
+        }
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+            push16(g, all, g->pc + none);
+            g->pc = opcode & 0x38;
+            break;
+    }
+    return RUN_ON;
+}
+
+// Runs `lanes`, all at the same PC, together until they split, hit their deadlines or an opcode left to cpu_step
+LANES_INLINE run_t vector_run(Group* g, unsigned lanes, const bool avx2) {
+    run_t result = RUN_ON;
+    load(g, lanes);
+
+    for (;;) {
+        if (g->delta >= g->soonest) {
+            unsigned due = g->active & ~lane_bits(WHERE(g->delta < g->limit));
+            store(g, due);
+            g->core &= ~due;
+            g->active &= ~due;
+            g->width = __builtin_popcount(g->active);
+            g->soonest = UINT32_MAX;
+            EACH_LANE(i, g->active) {
+                if (g->limit[i] < g->soonest) g->soonest = g->limit[i];
+            }
+        }
+        if (g->width < 2) break;
+
+        result = execute(g, avx2);
+        if (result == RUN_SCALAR) break;
+        g->stats.vector_instructions++;
+        g->stats.lane_instructions += g->width;
+        if (result == RUN_SPLIT) {
+            g->stats.splits++;
+            break;
+        }
+    }
+
+    store(g, g->active);
+    return result;
+}
+
+// ---- Lanes on their own ----
+
+// What cpu_run does between slices: events, HALT, the next deadline
+static void enter_slice(Group* g, unsigned i) {
+    GB* gb = g->gb[i];
+    CPU* cpu = &gb->cpu;
+
+    for (;;) {
+        if (!CYCLES_BEFORE(cpu->cycles, g->end[i])) {
+            g->live &= ~LANE(i);
+            return;
+        }
+        sched_run_due(gb);
+
+        if (cpu->halted) {
+            if (gb->sched.count == 0) {
+                g->live &= ~LANE(i); // nothing left that could wake the CPU
+                return;
+            }
+            uint64_t wake = CYCLES_BEFORE(gb->sched.next, g->end[i]) ? gb->sched.next : g->end[i];
+            cpu->cycles += (wake - cpu->cycles + 3) & ~(uint64_t)3;
+            continue;
+        }
+
+        sched_begin_slice(gb, g->end[i]);
+        g->core |= LANE(i);
+        return;
+    }
+}
+
+// One instruction with the reference core, nothing is due before the deadline
+static void scalar_step(Group* g, unsigned i) {
+    GB* gb = g->gb[i];
+
+    if (!CYCLES_BEFORE(gb->cpu.cycles, gb->sched.deadline)) {
+        g->core &= ~LANE(i);
+        return;
+    }
+
+    cpu_status_t status = cpu_step(gb);
+    g->stats.scalar_instructions++;
+    if (status == CPU_UNKNOWN_OPCODE) {
+        g->live &= ~LANE(i);
+        g->core &= ~LANE(i);
+    } else if (gb->cpu.halted) {
+        g->core &= ~LANE(i);
+    }
+}
+
+// Lowest PC of `lanes` and the lanes sitting on it
+static unsigned lowest_pc(const Group* g, unsigned lanes, uint32_t* pc) {
+    unsigned found = 0;
+    *pc = 0x10000;
+    EACH_LANE(i, lanes) {
+        uint16_t lane_pc = g->gb[i]->cpu.pc;
+        if (lane_pc < *pc) {
+            *pc = lane_pc;
+            found = 0;
+        }
+        if (lane_pc == *pc) found |= LANE(i);
+    }
+    return found;
+}
+
+LANES_INLINE void run_group(Group* g, const bool avx2) {
+    while (g->live) {
+        EACH_LANE(i, g->live & ~g->core) enter_slice(g, i);
+        if (!g->core) continue;
+
+        uint32_t pc, others;
+        unsigned lanes = lowest_pc(g, g->core, &pc);
+
+        if (lanes & (lanes - 1)) {
+            if (vector_run(g, lanes, avx2) == RUN_SCALAR) {
+                EACH_LANE(i, g->active) scalar_step(g, i);
+            }
+            continue;
+        }
+
+        // Alone: on its own until it meets or passes the others
+        unsigned i = __builtin_ctz(lanes);
+        lowest_pc(g, g->core & ~lanes, &others);
+        for (unsigned n = 0; n < SCALAR_BURST && (g->core & lanes) && g->gb[i]->cpu.pc < others; n++) {
+            scalar_step(g, i);
+        }
+    }
+}
+
+static void run_group_generic(Group* g) {
+    run_group(g, false);
+}
+
+#ifdef BATCH_AVX2
+__attribute__((target("avx2")))
+static void run_group_avx2(Group* g) {
+    run_group(g, true);
+}
+#endif
+
+void batch_run(GB* const* machines, size_t count, uint32_t cycles, BatchStats* stats) {
+    Group g;
+    memset(&g, 0, sizeof(g));
+#ifdef BATCH_AVX2
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    for (size_t first = 0; first < count;) {
+        g.count = 0;
+        g.live = 0;
+        g.core = 0;
+
+        // Tracing and profiling hook every instruction, the JIT, AOT code and idle skipping replace the core
+        for (; first < count && g.count < BATCH_LANES; first++) {
+            GB* gb = machines[first];
+            if (gb->trace || gb->profile || gb->jit_enabled || gb->idle_skip || gb->aot || gb->debug) {
+                cpu_run(gb, cycles);
+                continue;
+            }
+            g.gb[g.count] = gb;
+            g.end[g.count] = gb->cpu.cycles + cycles;
+            g.live |= LANE(g.count);
+            g.count++;
+        }
+
+#ifdef BATCH_AVX2
+        for (unsigned i = 0; i < BATCH_LANES; i++) {
+            g.tables[i] = (uintptr_t)g.gb[i < g.count ? i : 0]->mem.read_pages;
+        }
+        if (avx2) {
+            run_group_avx2(&g);
+            continue;
+        }
+#endif
+        run_group_generic(&g);
+    }
+
+    if (stats) *stats = g.stats;
+}
+
+#else
+
+// Without vector extensions every machine simply runs on its own
+void batch_run(GB* const* machines, size_t count, uint32_t cycles, BatchStats* stats) {
+    for (size_t i = 0; i < count; i++) cpu_run(machines[i], cycles);
+    if (stats) *stats = (BatchStats){ .scalar_instructions = 0 };
+}
+
+#endif
@@ -0,0 +1,389 @@
+//
+// Created by davidg on 28.07.25.
+//
+
+#include <block_cache.h>
+#include <gb.h>
+#include <jit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opcodes.h"
+
+BlockCache* block_cache_create(void) {
+    BlockCache* cache = calloc(1, sizeof(BlockCache));
+    if (!cache) {
+        perror("Fehler beim Anlegen des Block-Caches");
+        exit(1);
+    }
+    return cache;
+}
+
+void block_cache_destroy(BlockCache* cache) {
+    free(cache);
+}
+
+// Same PC in another ROM or RAM bank is different code
+static uint16_t bank_at(const GB* gb, uint16_t pc) {
+    return cart_bank_at(gb, pc);
+}
+
+static Block* slot_for(BlockCache* cache, uint16_t pc, uint16_t bank) {
+    return &cache->slots[(pc ^ (bank << 6)) & (BLOCK_CACHE_SLOTS - 1)];
+}
+
+// A block is at most 48 bytes and spans two pages at most, the second one may be page 0 again
+static uint8_t last_page(const Block* block) {
+    return (uint16_t)(block->end - 1) >> 8;
+}
+
+static bool block_covers(const Block* block, uint16_t address) {
+    return (uint16_t)(address - block->pc) < block->end - block->pc;
+}
+
+static void mark_code_pages(GB* gb, const Block* block) {
+    mem_watch_code(gb, block->pc >> 8);
+    if (last_page(block) != block->pc >> 8) mem_watch_code(gb, last_page(block));
+}
+
+static void index_block(BlockCache* cache, const Block* block) {
+    unsigned slot = block - cache->slots;
+    for (uint32_t byte = block->pc; byte < block->end; byte++) {
+        uint16_t address = byte;
+        cache->page_slots[address >> 8][slot >> 6] |= 1ull << (slot & 63);
+        cache->code_bytes[address >> 3] |= 1u << (address & 7);
+    }
+}
+
+// code_bytes of a page again from the blocks still indexed there
+static void refresh_code_bytes(BlockCache* cache, uint8_t page) {
+    memset(cache->code_bytes + page * 0x20, 0, 0x20);
+    for (unsigned word = 0; word < BLOCK_CACHE_SLOTS / 64; word++) {
+        for (uint64_t bits = cache->page_slots[page][word]; bits; bits &= bits - 1) {
+            const Block* block = &cache->slots[word * 64 + __builtin_ctzll(bits)];
+            for (uint32_t byte = block->pc; byte < block->end; byte++) {
+                uint16_t address = byte;
+                if (address >> 8 == page) cache->code_bytes[address >> 3] |= 1u << (address & 7);
+            }
+        }
+    }
+}
+
+static void unindex_block(BlockCache* cache, const Block* block) {
+    unsigned slot = block - cache->slots;
+    uint8_t first = block->pc >> 8, last = last_page(block);
+
+    cache->page_slots[first][slot >> 6] &= ~(1ull << (slot & 63));
+    cache->page_slots[last][slot >> 6] &= ~(1ull << (slot & 63));
+    refresh_code_bytes(cache, first);
+    if (last != first) refresh_code_bytes(cache, last);
+}
+
+static bool page_has_blocks(const BlockCache* cache, uint8_t page) {
+    for (unsigned word = 0; word < BLOCK_CACHE_SLOTS / 64; word++) {
+        if (cache->page_slots[page][word]) return true;
+    }
+    return false;
+}
+
+#define IDLE_MAX_MISSES 8 // a loop that never settles (a counter) stops being probed
+
+// Opcodes an idle loop may contain: no memory writes, no stack, no IME or HALT
+static bool idle_pure(uint8_t opcode, uint8_t cb) {
+    if (opcode == OPCODE_PREFIX_CB) return cb < 0x40 ? (cb & 7) != 6 : cb < 0x80 || (cb & 7) != 6;
+    if (opcode >= 0x40 && opcode < 0x80) return (opcode & 0xF8) != 0x70;
+    if (opcode >= 0x80 && opcode < 0xC0) return true;
+    if ((opcode & 0xC7) == 0xC6) return true;                       // ALU A,d8
+    if ((opcode & 0xC7) == 0x06) return opcode != 0x36;             // LD r,d8
+    if ((opcode & 0xC7) == 0x04 || (opcode & 0xC7) == 0x05) return opcode != 0x34 && opcode != 0x35;
+    switch (opcode & 0xCF) {
+        case 0x01: case 0x03: case 0x09: case 0x0B: return true;   // LD rr,d16  INC rr  ADD HL,rr  DEC rr
+    }
+    switch (opcode) {
+        case 0x00: case 0x07: case 0x0F: case 0x17: case 0x1F: case 0x27: case 0x2F: case 0x37: case 0x3F:
+        case 0x0A: case 0x1A: case 0x2A: case 0x3A: case 0xF0: case 0xF2: case 0xFA: case 0xF9:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Address the instruction is about to read, false if it reads no memory
+static bool idle_read_address(const DecodedOp* op, const CPU* cpu, uint16_t* address) {
+    uint8_t opcode = op->opcode;
+    uint8_t low = opcode == OPCODE_PREFIX_CB ? op->operand & 7 : opcode & 7;
+
+    if ((opcode >= 0x40 && opcode < 0xC0 && low == 6) || (opcode == OPCODE_PREFIX_CB && low == 6) ||
+        opcode == 0x2A || opcode == 0x3A) {
+        *address = REG_HL(cpu);
+    } else if (opcode == 0x0A) {
+        *address = REG_BC(cpu);
+    } else if (opcode == 0x1A) {
+        *address = REG_DE(cpu);
+    } else if (opcode == 0xF0) {
+        *address = 0xFF00 | op->operand;
+    } else if (opcode == 0xF2) {
+        *address = 0xFF00 | cpu->c;
+    } else if (opcode == 0xFA) {
+        *address = op->operand;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// JR, JR cc, JP and JP cc back to the start of the block
+static bool branches_to(const DecodedOp* op, uint16_t pc) {
+    uint8_t opcode = op->opcode;
+    if (opcode == 0x18 || (opcode & 0xE7) == 0x20) return (uint16_t)(op->next_pc + (int8_t)op->operand) == pc;
+    if (opcode == 0xC3 || (opcode & 0xE7) == 0xC2) return op->operand == pc;
+    return false;
+}
+
+// DEC r (not (HL)) and JR NZ back to its start, see run_counter_loop
+static bool counter_candidate(const Block* block) {
+    uint8_t opcode = block->ops[0].opcode;
+    return block->count == 2 && (opcode & 0xC7) == 0x05 && opcode != 0x35 &&
+           block->ops[1].opcode == 0x20 && branches_to(&block->ops[1], block->pc);
+}
+
+static bool idle_candidate(const Block* block) {
+    const DecodedOp* last = &block->ops[block->count - 1];
+    if (!branches_to(last, block->pc)) return false;
+
+    for (const DecodedOp* op = block->ops; op < last; op++) {
+        if (!idle_pure(op->opcode, op->operand)) return false;
+    }
+    return true;
+}
+
+// Returns false if there is no handler for the opcode at pc
+static bool decode_block(GB* gb, Block* block, uint16_t pc, uint16_t bank) {
+    uint32_t addr = pc;
+
+    // The slot's previous block is evicted
+    if (block->valid) unindex_block(gb->blocks, block);
+    block->valid = false;
+    block->pc = pc;
+    block->bank = bank;
+    block->cycles = 0;
+    block->hits = 0;
+    block->native = aot_lookup(gb, pc, bank);
+    block->count = 0;
+    if (gb->debug) gb->debug->quiet = true; // fetching code is not what watchpoints are for
+
+    while (block->count < BLOCK_MAX_OPS) {
+        // The debugger only looks at block entries
+        if (block->count && gb->debug && debug_splits_before(gb->debug, addr)) break;
+
+        const OpcodeInfo* info = &opcode_table[mem_read(gb, addr)];
+        if (info->handler == 0) break;
+
+        DecodedOp* op = &block->ops[block->count++];
+        op->handler = info->handler;
+        op->operand = fetch_operand(gb, addr, info->length);
+        op->next_pc = addr + info->length;
+        op->opcode = mem_read(gb, addr);
+        op->cycles = info->cycles;
+
+        // CB opcodes get their own handler, the prefix is resolved once here
+        if (op->opcode == OPCODE_PREFIX_CB) {
+            const OpcodeInfo* cb = &cb_opcode_table[op->operand & 0xFF];
+            op->handler = cb->handler;
+            op->cycles = cb->cycles;
+        }
+
+        addr += info->length;
+        block->cycles += op->cycles;
+        if (info->flags & OPF_END_BLOCK) break;
+        // Operands wrap around to 0x0000 like in cpu_step, the code there gets a block of its own bank
+        if (addr >= MEMORY_SIZE) break;
+    }
+    if (gb->debug) gb->debug->quiet = false;
+
+    if (block->count == 0) return false;
+
+    block->end = addr;
+    block->counter_loop = counter_candidate(block);
+    block->idle_loop = !block->counter_loop && idle_candidate(block);
+    block->idle_misses = 0;
+    block->valid = true;
+    index_block(gb->blocks, block);
+    mark_code_pages(gb, block);
+    return true;
+}
+
+static bool same_state(const CPU* x, const CPU* y) {
+    return x->a == y->a && cpu_flags(x) == cpu_flags(y) && x->b == y->b && x->c == y->c &&
+           x->d == y->d && x->e == y->e && x->h == y->h && x->l == y->l &&
+           x->sp == y->sp && x->pc == y->pc && x->halted == y->halted && x->ime == y->ime;
+}
+
+/**
+ * One interpreted pass over an idle loop candidate, leaving early exactly
+ * like the loop in block_cache_run. Afterwards, if the pass was a fixed
+ * point, every further pass until the deadline would be too: nothing it
+ * reads can change before the next event. Those passes only cost cycles.
+ * Timed registers (LY, STAT, DIV, TIMA) do change without an event, a
+ * pass only counts as skippable while it reads them before their next
+ * change.
+ */
+static void run_idle_probe(GB* gb, Block* block) {
+    CPU* cpu = &gb->cpu;
+    const CPU before = *cpu;
+    uint64_t limit = gb->sched.deadline; // passes starting from here on might read something else
+
+    for (const DecodedOp* op = block->ops; op < block->ops + block->count; op++) {
+        uint16_t address;
+        mem_change_func_t change = idle_read_address(op, cpu, &address) ? mem_timed_change(gb, address) : NULL;
+
+        cpu->pc = op->next_pc;
+        cpu->cycles += op->cycles;
+        if (change) {
+            // The same read in a later pass happens this far into it
+            uint64_t edge = change(gb, address) - (cpu->cycles - before.cycles);
+            if (CYCLES_BEFORE(edge, limit)) limit = edge;
+        }
+        op->handler(gb, op->operand);
+
+        if (!CYCLES_BEFORE(cpu->cycles, gb->sched.next)) return;
+    }
+
+    if (!same_state(&before, cpu)) {
+        if (++block->idle_misses == IDLE_MAX_MISSES) block->idle_loop = false;
+        return;
+    }
+    block->idle_misses = 0;
+
+    // Only whole passes that end by the deadline and start before the limit, the last one is interpreted as usual
+    uint64_t period = cpu->cycles - before.cycles;
+    uint64_t passes = 0;
+    if (CYCLES_BEFORE(cpu->cycles, gb->sched.deadline)) passes = (gb->sched.deadline - cpu->cycles) / period;
+    if (!CYCLES_BEFORE(cpu->cycles, limit)) {
+        passes = 0;
+    } else if ((limit - cpu->cycles + period - 1) / period < passes) {
+        passes = (limit - cpu->cycles + period - 1) / period;
+    }
+    cpu->cycles += passes * period;
+}
+
+static uint8_t* counter_register(CPU* cpu, uint8_t opcode) {
+    switch ((opcode >> 3) & 7) {
+        case 0:  return &cpu->b;
+        case 1:  return &cpu->c;
+        case 2:  return &cpu->d;
+        case 3:  return &cpu->e;
+        case 4:  return &cpu->h;
+        case 5:  return &cpu->l;
+        default: return &cpu->a;
+    }
+}
+
+/**
+ * DEC r / JR NZ back to itself counts r down with nothing else going on.
+ * Skips the passes that jump back and end by the deadline in one step,
+ * leaving r, the flags of the last DEC and the cycles as interpreted.
+ * Returns false if not a single pass fits, the block then runs as usual.
+ */
+static bool run_counter_loop(GB* gb, const Block* block) {
+    CPU* cpu = &gb->cpu;
+    uint8_t* counter = counter_register(cpu, block->ops[0].opcode);
+    uint64_t period = block->cycles + 4; // JR NZ taken
+
+    // r - 1 passes jump back, 255 if r starts at 0
+    uint64_t passes = (uint8_t)(*counter - 1);
+    if (!CYCLES_BEFORE(cpu->cycles, gb->sched.deadline)) return false;
+    if ((gb->sched.deadline - cpu->cycles) / period < passes) passes = (gb->sched.deadline - cpu->cycles) / period;
+    if (passes == 0) return false;
+
+    *counter -= passes;
+    cpu_set_flags(cpu, (cpu_flags(cpu) & FLAG_C) | FLAG_N | ((*counter & 0x0F) == 0x0F ? FLAG_H : 0));
+    cpu->cycles += passes * period;
+    return true;
+}
+
+void block_cache_set_idle_skip(GB* gb, bool enabled) {
+    gb->idle_skip = enabled;
+}
+
+cpu_status_t block_cache_run(GB* gb) {
+    CPU* cpu = &gb->cpu;
+    const Scheduler* sched = &gb->sched;
+
+    if (!gb->blocks) gb->blocks = block_cache_create();
+
+    while (CYCLES_BEFORE(cpu->cycles, sched->deadline)) {
+        uint16_t bank = bank_at(gb, cpu->pc);
+        Block* block = slot_for(gb->blocks, cpu->pc, bank);
+
+        if (!block->valid || block->pc != cpu->pc || block->bank != bank) {
+            if (!decode_block(gb, block, cpu->pc, bank)) return CPU_UNKNOWN_OPCODE;
+        }
+
+        if (gb->debug && debug_should_stop(gb)) return CPU_BREAKPOINT;
+
+        // Skipped time would be missing from traces and profiles
+        if (gb->idle_skip && !gb->trace && !gb->profile) {
+            if (block->idle_loop) {
+                run_idle_probe(gb, block);
+                continue;
+            }
+            if (block->counter_loop && run_counter_loop(gb, block)) continue;
+        }
+
+        // Translated code does not record or stop, tracing, profiling and debugging fall back to the interpreted ops
+        if ((gb->jit_enabled || gb->aot) && !gb->trace && !gb->profile && !gb->debug) {
+            // Native code cannot stop halfway, so it only runs if no event falls due inside the block
+            if (block->native && (int64_t)(sched->next - cpu->cycles) >= block->cycles) {
+                uint64_t before = cpu->cycles;
+                cpu_sync_flags(cpu); // translated code works on f directly
+                block->native(gb);
+                if (cpu->cycles != before) continue;
+                // Bailed out on the very first instruction, interpret the block this time
+            }
+            // Blocks with AOT code keep it, it covers more than the JIT would
+            if (gb->jit_enabled && !block->native && ++block->hits == JIT_THRESHOLD) {
+                block->native = jit_compile(gb, block);
+            }
+        }
+
+        bool recording = gb->trace || gb->profile;
+        for (const DecodedOp* op = block->ops; op < block->ops + block->count; op++) {
+            if (recording) {
+                if (gb->trace) trace_record(gb->trace, cpu, op->opcode);
+                if (gb->profile) profile_record(gb, op->opcode);
+            }
+            cpu->pc = op->next_pc;
+            cpu->cycles += op->cycles;
+            op->handler(gb, op->operand);
+
+            // The block just overwrote its own code, or an event is due before the next instruction
+            if (!block->valid || !CYCLES_BEFORE(cpu->cycles, sched->next)) break;
+        }
+
+        if (cpu->halted) return CPU_HALTED;
+    }
+
+    return CPU_BUDGET_DONE;
+}
+
+void block_cache_invalidate(GB* gb, uint16_t address) {
+    BlockCache* cache = gb->blocks;
+    uint8_t page = address >> 8;
+    if (!cache) return;
+
+    // Data next to code (variables, the stack) misses in code_bytes and costs nothing more
+    if (block_cache_covers(cache, address)) {
+        for (unsigned word = 0; word < BLOCK_CACHE_SLOTS / 64; word++) {
+            for (uint64_t bits = cache->page_slots[page][word]; bits; bits &= bits - 1) {
+                Block* block = &cache->slots[word * 64 + __builtin_ctzll(bits)];
+                if (!block_covers(block, address)) continue;
+                block->valid = false;
+                unindex_block(cache, block);
+            }
+        }
+    }
+
+    // Writes to this page are free again until a block is decoded here
+    if (!page_has_blocks(cache, page)) mem_unwatch_code(gb, page);
+}
@@ -0,0 +1,418 @@
+//
+// Created by davidg on 12.08.25.
+//
+
+#include <cartridge.h>
+#include <gb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEADER_TITLE 0x134
+#define HEADER_TYPE 0x147
+#define HEADER_ROM_SIZE 0x148
+#define HEADER_RAM_SIZE 0x149
+#define HEADER_CHECKSUM 0x14D
+
+#define PAGES_PER_ROM_BANK (ROM_BANK_SIZE / PAGE_SIZE)
+#define PAGES_PER_RAM_BANK (RAM_BANK_SIZE / PAGE_SIZE)
+
+/*
+ * Every loaded ROM file, keyed by device and inode. Only touched while a
+ * cartridge is loaded or unloaded, never while machines run.
+ */
+static RomImage* images = NULL;
+static pthread_mutex_t images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const uint32_t ram_sizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+
+static void parse_header(RomImage* image) {
+    const uint8_t* rom = image->data;
+
+    memcpy(image->title, rom + HEADER_TITLE, 16);
+    image->title[16] = '\0';
+    image->type = rom[HEADER_TYPE];
+    image->header_rom_size = rom[HEADER_ROM_SIZE] <= 8 ? 0x8000u << rom[HEADER_ROM_SIZE] : 0;
+    image->header_ram_size = rom[HEADER_RAM_SIZE] < sizeof(ram_sizes) / sizeof(ram_sizes[0])
+                                 ? ram_sizes[rom[HEADER_RAM_SIZE]]
+                                 : 0;
+
+    uint8_t checksum = 0;
+    for (unsigned i = HEADER_TITLE; i < HEADER_CHECKSUM; i++) {
+        checksum = checksum - rom[i] - 1;
+    }
+    image->header_checksum_ok = checksum == rom[HEADER_CHECKSUM];
+}
+
+/*
+ * Maps the file read-only. Files that are not a whole number of banks (test
+ * ROMs, truncated dumps) are copied into a zero-padded buffer instead, so
+ * the last bank never reaches past the end of the mapping.
+ */
+static RomImage* open_image(int fd, const struct stat* st) {
+    RomImage* image = calloc(1, sizeof(RomImage));
+    if (!image) return NULL;
+
+    size_t size = (size_t)st->st_size;
+    if (size >= 2 * ROM_BANK_SIZE && size % ROM_BANK_SIZE == 0) {
+        void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            free(image);
+            return NULL;
+        }
+        image->data = data;
+        image->size = size;
+        image->mapped = true;
+    } else {
+        size_t padded = size < 2 * ROM_BANK_SIZE ? 2 * ROM_BANK_SIZE
+                                                 : (size + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE * ROM_BANK_SIZE;
+        uint8_t* data = calloc(1, padded);
+        if (!data) {
+            free(image);
+            return NULL;
+        }
+        for (size_t done = 0; done < size;) {
+            ssize_t n = pread(fd, data + done, size - done, (off_t)done);
+            if (n <= 0) {
+                free(data);
+                free(image);
+                if (n == 0) errno = EIO;
+                return NULL;
+            }
+            done += (size_t)n;
+        }
+        image->data = data;
+        image->size = padded;
+    }
+
+    image->dev = st->st_dev;
+    image->ino = st->st_ino;
+    parse_header(image);
+    return image;
+}
+
+// Said when the file is opened, machines loading it while it is open share the image and stay quiet
+static void check_header(const char* filename, const RomImage* image) {
+    if (!image->header_checksum_ok) {
+        fprintf(stderr, "%s: Header-Prüfsumme stimmt nicht, die ROM ist vielleicht beschädigt\n", filename);
+    }
+    if (image->header_rom_size == 0) {
+        fprintf(stderr, "%s: unbekannte ROM-Größe 0x%02X im Header, nutze die Dateigröße\n", filename,
+            image->data[HEADER_ROM_SIZE]);
+    } else if (image->header_rom_size != image->size) {
+        fprintf(stderr, "%s: laut Header %u KB, die Datei hat %zu KB\n", filename,
+            image->header_rom_size / 1024, image->size / 1024);
+    }
+    if (image->size / ROM_BANK_SIZE > CART_ROM_BANKS_MAX) {
+        fprintf(stderr, "%s: nur die ersten %u ROM-Bänke sind erreichbar\n", filename, CART_ROM_BANKS_MAX);
+    }
+}
+
+// Banks of the file, files too big for any MBC are cut off where the bank number ends
+static uint16_t rom_banks(const RomImage* image) {
+    size_t banks = image->size / ROM_BANK_SIZE;
+    return banks < CART_ROM_BANKS_MAX ? banks : CART_ROM_BANKS_MAX;
+}
+
+static RomImage* acquire_image(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&images_lock);
+    RomImage* image = images;
+    while (image && !(image->dev == (unsigned long long)st.st_dev && image->ino == (unsigned long long)st.st_ino)) {
+        image = image->next;
+    }
+    bool opened = !image;
+    if (!image) {
+        image = open_image(fd, &st);
+        if (image) {
+            image->next = images;
+            images = image;
+        }
+    }
+    if (image) image->refs++;
+    pthread_mutex_unlock(&images_lock);
+    if (opened && image) check_header(filename, image);
+
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return image;
+}
+
+void cart_image_retain(RomImage* image) {
+    pthread_mutex_lock(&images_lock);
+    image->refs++;
+    pthread_mutex_unlock(&images_lock);
+}
+
+void cart_image_release(RomImage* image) {
+    pthread_mutex_lock(&images_lock);
+    if (--image->refs == 0) {
+        RomImage** link = &images;
+        while (*link != image) link = &(*link)->next;
+        *link = image->next;
+
+        if (image->mapped) {
+            munmap((void*)image->data, image->size);
+        } else {
+            free((void*)image->data);
+        }
+        free(image);
+    }
+    pthread_mutex_unlock(&images_lock);
+}
+
+static mbc_type_t mbc_for_type(uint8_t type) {
+    switch (type) {
+        case 0x00: case 0x08: case 0x09:
+            return MBC_NONE;
+        case 0x01: case 0x02: case 0x03:
+            return MBC_1;
+        case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13:
+            return MBC_3;
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+            return MBC_5;
+        default:
+            fprintf(stderr, "Cartridge-Typ 0x%02X wird nicht unterstützt, nutze ROM ohne MBC\n", type);
+            return MBC_NONE;
+    }
+}
+
+static uint8_t ram_disabled_read(GB* gb, uint16_t address) {
+    (void)gb;
+    (void)address;
+    return 0xFF;
+}
+
+static uint8_t rtc_read(GB* gb, uint16_t address) {
+    (void)gb;
+    (void)address;
+    return 0x00; // clock stands still at zero
+}
+
+static void update_map(GB* gb);
+
+static void share_ram(Cartridge* cart, const uint8_t* const* frozen) {
+    for (unsigned index = 0; index < cart->ram_size / PAGE_SIZE; index++) {
+        cart->shared_ram[index] = frozen[index];
+        cart->unchanged_ram[index >> 3] |= 1u << (index & 7);
+    }
+}
+
+// Cartridge RAM page behind `address` in 0xA000–0xBFFF, 2 KB RAM repeats over the 8 KB window
+static unsigned ram_page_at(const Cartridge* cart, uint16_t address) {
+    unsigned window = cart->ram_size < RAM_BANK_SIZE ? cart->ram_size / PAGE_SIZE : PAGES_PER_RAM_BANK;
+    return cart->ram_bank * PAGES_PER_RAM_BANK + ((address >> 8) - 0xA0) % window;
+}
+
+// First write to a RAM page still shared with a savestate
+static void shared_ram_write(GB* gb, uint16_t address, uint8_t value) {
+    Cartridge* cart = &gb->cart;
+    unsigned index = ram_page_at(cart, address);
+
+    memcpy(cart->ram + (size_t)index * PAGE_SIZE, cart->shared_ram[index], PAGE_SIZE);
+    cart->shared_ram[index] = NULL;
+    cart->unchanged_ram[index >> 3] &= ~(1u << (index & 7));
+    update_map(gb);
+
+    // Blocks may have been decoded from the frozen copy without watching it
+    if (gb->blocks) {
+        for (unsigned page = 0xA0; page <= 0xBF; page++) {
+            if (ram_page_at(cart, page << 8) == index) mem_watch_code(gb, page);
+        }
+    }
+
+    mem_write(gb, address, value);
+}
+
+/*
+ * Recomputes the mapping from the MBC registers and swaps the page
+ * pointers. Runs only on register writes, reads never see the MBC.
+ */
+static void update_map(GB* gb) {
+    Cartridge* cart = &gb->cart;
+    uint16_t bank0 = 0, bank = 1;
+    uint8_t ram_bank = 0;
+    bool rtc = false;
+
+    switch (cart->mbc) {
+        case MBC_NONE:
+            bank = 1;
+            break;
+        case MBC_1:
+            bank = (uint16_t)(cart->bank_hi << 5 | (cart->bank_lo ? cart->bank_lo : 1));
+            if (cart->mode) {
+                bank0 = (uint16_t)(cart->bank_hi << 5);
+                ram_bank = cart->bank_hi;
+            }
+            break;
+        case MBC_3:
+            bank = cart->bank_lo ? cart->bank_lo : 1;
+            rtc = cart->bank_hi >= 0x08;
+            ram_bank = cart->bank_hi & 0x03;
+            break;
+        case MBC_5:
+            bank = cart->bank_lo;
+            ram_bank = cart->bank_hi & 0x0F;
+            break;
+    }
+
+    cart->rom_bank0 = bank0 % cart->rom_banks;
+    cart->rom_bank = bank % cart->rom_banks;
+    const uint8_t* rom = cart->rom->data;
+    mem_map_read(gb, 0x00, 0x3F, rom + (size_t)cart->rom_bank0 * ROM_BANK_SIZE, NULL);
+    mem_map_read(gb, 0x40, 0x7F, rom + (size_t)cart->rom_bank * ROM_BANK_SIZE, NULL);
+
+    if (cart->ram_enabled && rtc) {
+        mem_map_read(gb, 0xA0, 0xBF, NULL, rtc_read);
+        mem_map_write(gb, 0xA0, 0xBF, NULL, NULL);
+    } else if (cart->ram_enabled && cart->ram_size) {
+        uint32_t banks = (cart->ram_size + RAM_BANK_SIZE - 1) / RAM_BANK_SIZE;
+        cart->ram_bank = ram_bank % banks;
+        // Shared pages are read in place and copied on their first write
+        for (unsigned page = 0xA0; page <= 0xBF; page++) {
+            unsigned index = ram_page_at(cart, page << 8);
+            const uint8_t* shared = cart->shared_ram[index];
+            uint8_t* ram = cart->ram + (size_t)index * PAGE_SIZE;
+            mem_map_read(gb, page, page, shared ? shared : ram, NULL);
+            mem_map_write(gb, page, page, shared ? NULL : ram, shared ? shared_ram_write : NULL);
+        }
+    } else {
+        mem_map_read(gb, 0xA0, 0xBF, NULL, ram_disabled_read);
+        mem_map_write(gb, 0xA0, 0xBF, NULL, NULL);
+    }
+}
+
+static void mbc_write(GB* gb, uint16_t address, uint8_t value) {
+    Cartridge* cart = &gb->cart;
+
+    switch (address >> 13) {
+        case 0: // 0x0000–0x1FFF RAM enable
+            cart->ram_enabled = (value & 0x0F) == 0x0A;
+            break;
+        case 1: // 0x2000–0x3FFF ROM bank
+            if (cart->mbc == MBC_1) {
+                cart->bank_lo = value & 0x1F;
+            } else if (cart->mbc == MBC_3) {
+                cart->bank_lo = value & 0x7F;
+            } else if (address < 0x3000) {
+                cart->bank_lo = (cart->bank_lo & 0x100) | value;
+            } else {
+                cart->bank_lo = (uint16_t)((cart->bank_lo & 0xFF) | (value & 0x01) << 8);
+            }
+            break;
+        case 2: // 0x4000–0x5FFF RAM bank, upper ROM bits or RTC register
+            cart->bank_hi = cart->mbc == MBC_1 ? value & 0x03 : value & 0x0F;
+            break;
+        case 3: // 0x6000–0x7FFF MBC1 banking mode, MBC3 clock latch
+            if (cart->mbc == MBC_1) cart->mode = value & 0x01;
+            break;
+    }
+    update_map(gb);
+}
+
+bool cart_load(GB* gb, const char* filename) {
+    RomImage* image = acquire_image(filename);
+    if (!image) return false;
+
+    cart_unload(gb);
+
+    Cartridge* cart = &gb->cart;
+    cart->rom = image;
+    cart->mbc = mbc_for_type(image->type);
+    cart->rom_banks = rom_banks(image);
+    cart->ram_size = image->type == 0x00 ? 0 : image->header_ram_size;
+    cart->ram = cart->ram_size ? calloc(1, cart->ram_size) : NULL;
+    if (cart->ram_size && !cart->ram) {
+        cart_unload(gb);
+        return false;
+    }
+
+    // Carts without MBC have their RAM (if any) always on
+    cart->ram_enabled = cart->mbc == MBC_NONE;
+    cart->bank_lo = 1;
+
+    mem_map_write(gb, 0x00, 0x7F, NULL, cart->mbc == MBC_NONE ? NULL : mbc_write);
+    update_map(gb);
+    return true;
+}
+
+bool cart_attach(GB* gb, RomImage* image, const Cartridge* state, const uint8_t* const* ram) {
+    Cartridge* cart = &gb->cart;
+
+    if (cart->rom != image) {
+        cart_unload(gb);
+        cart_image_retain(image);
+        cart->rom = image;
+    }
+    if (cart->ram_size != state->ram_size) {
+        free(cart->ram);
+        cart->ram_size = state->ram_size;
+        cart->ram = cart->ram_size ? malloc(cart->ram_size) : NULL;
+        if (cart->ram_size && !cart->ram) {
+            cart_unload(gb);
+            return false;
+        }
+    }
+    // Nothing is copied yet, the pages fault in one by one as they are written
+    share_ram(cart, ram);
+
+    cart->mbc = state->mbc;
+    cart->rom_banks = rom_banks(image);
+    cart->ram_enabled = state->ram_enabled;
+    cart->bank_lo = state->bank_lo;
+    cart->bank_hi = state->bank_hi;
+    cart->mode = state->mode;
+
+    mem_map_write(gb, 0x00, 0x7F, NULL, cart->mbc == MBC_NONE ? NULL : mbc_write);
+    update_map(gb);
+    return true;
+}
+
+void cart_share_ram(GB* gb, const uint8_t* const* frozen) {
+    share_ram(&gb->cart, frozen);
+    update_map(gb);
+}
+
+const uint8_t* cart_ram_page(const GB* gb, unsigned index) {
+    const Cartridge* cart = &gb->cart;
+    return cart->shared_ram[index] ? cart->shared_ram[index] : cart->ram + (size_t)index * PAGE_SIZE;
+}
+
+void cart_unload(GB* gb) {
+    Cartridge* cart = &gb->cart;
+    if (!cart->rom) return;
+
+    cart_image_release(cart->rom);
+    free(cart->ram);
+    memset(cart, 0, sizeof(*cart));
+
+    // Back to the built-in 32 KB ROM area and plain cartridge RAM
+    mem_map_read(gb, 0x00, 0x7F, gb->mem.data, NULL);
+    mem_map_write(gb, 0x00, 0x7F, NULL, NULL);
+    mem_map_read(gb, 0xA0, 0xBF, gb->mem.data + 0xA000, NULL);
+    mem_map_write(gb, 0xA0, 0xBF, gb->mem.data + 0xA000, NULL);
+}
+
+uint16_t cart_bank_at(const GB* gb, uint16_t address) {
+    const Cartridge* cart = &gb->cart;
+    if (!cart->rom) return 0;
+    if (address < 0x4000) return cart->rom_bank0;
+    if (address < 0x8000) return cart->rom_bank;
+    if (address >= 0xA000 && address < 0xC000) return 0x100 + cart->ram_bank;
+    return 0;
+}
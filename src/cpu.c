@@ -3,16 +3,17 @@
 //
 
 #include <cpu.h>
-#include <memory.h>
+#include <gb.h>
+#include <block_cache.h>
+#include <scheduler.h>
+#include "opcodes.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-#define REGISTER_OPCODE(code, func) opcode_table[code] = func
+#define REGISTER_OPCODE(code, func, len, cyc, flags) [code] = { func, len, cyc, flags },
 
-static opcode_func_t opcode_table[256];
-static void execute_opcode(CPU* cpu, uint8_t opcode);
-static void init_opcode_table(void);
+static cpu_status_t execute_opcode(GB* gb, uint8_t opcode);
 
 void cpu_init(CPU* cpu) {
     memset(cpu, 0, sizeof(CPU));
@@ -32,467 +33,688 @@ void cpu_init(CPU* cpu) {
     cpu->halted = 0;
     cpu->ime = 0; // Interrupt Master Enable
     cpu->cycles = 0; // Cycle count
-
-    init_opcode_table();
 }
 
 static uint16_t cpu_get_hl(const CPU* cpu) {
     return cpu->h << 8 | cpu->l;
 }
 
-static void op_ld_r_d8(CPU* cpu, uint8_t* reg) {
-    *reg = mem_read(cpu->pc++);
-    cpu->cycles += 8;
-}
+// Flags of an 8-bit add/subtract: recorded for later with LR35902_LAZY_FLAGS, computed right away without
+static void alu_flags(CPU* cpu, uint8_t op, uint8_t x, uint8_t y, uint16_t result) {
+#ifdef LR35902_LAZY_FLAGS
+    cpu->flags_op = op;
+    cpu->flags_xy = x ^ y;
+    cpu->flags_result = result;
+#else
+    cpu_set_flags(cpu, flags_from_result(op, x ^ y, result));
+#endif
+}
+
+/*
+ * Operand access for the generated handlers below. Every handler is
+ * expanded with a fixed register, so GET_b/SET_b compile to a direct
+ * field access and only the (HL) forms go through memory.
+ */
+#define GET_b(gb) ((gb)->cpu.b)
+#define GET_c(gb) ((gb)->cpu.c)
+#define GET_d(gb) ((gb)->cpu.d)
+#define GET_e(gb) ((gb)->cpu.e)
+#define GET_h(gb) ((gb)->cpu.h)
+#define GET_l(gb) ((gb)->cpu.l)
+#define GET_a(gb) ((gb)->cpu.a)
+#define GET_hlp(gb) mem_read((gb), cpu_get_hl(&(gb)->cpu))
+#define GET_d8(gb) ((uint8_t)operand)
+
+#define SET_b(gb, value) ((gb)->cpu.b = (value))
+#define SET_c(gb, value) ((gb)->cpu.c = (value))
+#define SET_d(gb, value) ((gb)->cpu.d = (value))
+#define SET_e(gb, value) ((gb)->cpu.e = (value))
+#define SET_h(gb, value) ((gb)->cpu.h = (value))
+#define SET_l(gb, value) ((gb)->cpu.l = (value))
+#define SET_a(gb, value) ((gb)->cpu.a = (value))
+#define SET_hlp(gb, value) mem_write((gb), cpu_get_hl(&(gb)->cpu), (value))
+
+#define GET16_bc(cpu) ((cpu)->b << 8 | (cpu)->c)
+#define GET16_de(cpu) ((cpu)->d << 8 | (cpu)->e)
+#define GET16_hl(cpu) ((cpu)->h << 8 | (cpu)->l)
+#define GET16_sp(cpu) ((cpu)->sp)
+#define GET16_af(cpu) REG_AF(cpu)
+
+#define SET16(hi, lo, value) \
+    do { \
+        uint16_t value_ = (value); \
+        (hi) = value_ >> 8; \
+        (lo) = value_ & 0xFF; \
+    } while (0)
+#define SET16_bc(cpu, value) SET16((cpu)->b, (cpu)->c, value)
+#define SET16_de(cpu, value) SET16((cpu)->d, (cpu)->e, value)
+#define SET16_hl(cpu, value) SET16((cpu)->h, (cpu)->l, value)
+#define SET16_sp(cpu, value) ((cpu)->sp = (value))
+#define SET16_af(cpu, value) \
+    do { \
+        uint16_t value_ = (value); \
+        (cpu)->a = value_ >> 8; \
+        cpu_set_flags((cpu), value_ & 0xF0); /* the low nibble of F does not exist */ \
+    } while (0)
+
+#define COND_nz(cpu) (!GET_FLAG(cpu, FLAG_Z))
+#define COND_z(cpu) GET_FLAG(cpu, FLAG_Z)
+#define COND_nc(cpu) (!GET_FLAG(cpu, FLAG_C))
+#define COND_c(cpu) GET_FLAG(cpu, FLAG_C)
+
+// X(..., r) for every 8-bit operand in opcode order, with and without (HL)
+#define EACH_R8(X, ...) \
+    X(__VA_ARGS__, b) X(__VA_ARGS__, c) X(__VA_ARGS__, d) X(__VA_ARGS__, e) \
+    X(__VA_ARGS__, h) X(__VA_ARGS__, l) X(__VA_ARGS__, a)
+#define EACH_R8_HLP(X, ...) EACH_R8(X, __VA_ARGS__) X(__VA_ARGS__, hlp)
+
+static void push16(GB* gb, uint16_t value) {
+    CPU* cpu = &gb->cpu;
+    cpu->sp -= 2;
+    mem_write(gb, cpu->sp, value & 0xFF); // Low byte
+    mem_write(gb, cpu->sp + 1, value >> 8); // High byte
+}
+
+static uint16_t pop16(GB* gb) {
+    CPU* cpu = &gb->cpu;
+    uint16_t value = mem_read(gb, cpu->sp) | (mem_read(gb, cpu->sp + 1) << 8);
+    cpu->sp += 2;
+    return value;
+}
+
+static void op_nop(GB* gb, uint16_t operand) {
+}
+
+// ---- 8-bit loads ----
+
+#define DEFINE_LD(dst, src) \
+    static void op_load_##dst##_##src(GB* gb, uint16_t operand) { SET_##dst(gb, GET_##src(gb)); }
+
+EACH_R8_HLP(DEFINE_LD, b)
+EACH_R8_HLP(DEFINE_LD, c)
+EACH_R8_HLP(DEFINE_LD, d)
+EACH_R8_HLP(DEFINE_LD, e)
+EACH_R8_HLP(DEFINE_LD, h)
+EACH_R8_HLP(DEFINE_LD, l)
+EACH_R8_HLP(DEFINE_LD, a)
+EACH_R8(DEFINE_LD, hlp)
+
+#define DEFINE_LD_D8(unused, r) \
+    static void op_ld_##r##_d8(GB* gb, uint16_t operand) { SET_##r(gb, GET_d8(gb)); }
+
+EACH_R8_HLP(DEFINE_LD_D8, )
+
+static void op_ld_bcp_a(GB* gb, uint16_t operand) { mem_write(gb, GET16_bc(&gb->cpu), gb->cpu.a); }
+static void op_ld_dep_a(GB* gb, uint16_t operand) { mem_write(gb, GET16_de(&gb->cpu), gb->cpu.a); }
+static void op_ld_a_bcp(GB* gb, uint16_t operand) { gb->cpu.a = mem_read(gb, GET16_bc(&gb->cpu)); }
+static void op_ld_a_dep(GB* gb, uint16_t operand) { gb->cpu.a = mem_read(gb, GET16_de(&gb->cpu)); }
+
+static void op_ld_hlip_a(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    uint16_t hl = cpu_get_hl(cpu);
+    mem_write(gb, hl, cpu->a);
+    SET16_hl(cpu, (uint16_t)(hl + 1));
+}
+
+static void op_ld_hldp_a(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    uint16_t hl = cpu_get_hl(cpu);
+    mem_write(gb, hl, cpu->a);
+    SET16_hl(cpu, (uint16_t)(hl - 1));
+}
+
+static void op_ld_a_hlip(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    uint16_t hl = cpu_get_hl(cpu);
+    cpu->a = mem_read(gb, hl);
+    SET16_hl(cpu, (uint16_t)(hl + 1));
+}
+
+static void op_ld_a_hldp(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    uint16_t hl = cpu_get_hl(cpu);
+    cpu->a = mem_read(gb, hl);
+    SET16_hl(cpu, (uint16_t)(hl - 1));
+}
+
+static void op_ldh_a8_a(GB* gb, uint16_t operand) { mem_write(gb, 0xFF00 | operand, gb->cpu.a); }
+static void op_ldh_a_a8(GB* gb, uint16_t operand) { gb->cpu.a = mem_read(gb, 0xFF00 | operand); }
+static void op_ld_cp_a(GB* gb, uint16_t operand) { mem_write(gb, 0xFF00 | gb->cpu.c, gb->cpu.a); }
+static void op_ld_a_cp(GB* gb, uint16_t operand) { gb->cpu.a = mem_read(gb, 0xFF00 | gb->cpu.c); }
+static void op_ld_a16_a(GB* gb, uint16_t operand) { mem_write(gb, operand, gb->cpu.a); }
+static void op_ld_a_a16(GB* gb, uint16_t operand) { gb->cpu.a = mem_read(gb, operand); }
+
+// ---- 16-bit loads and arithmetic ----
+
+#define DEFINE_R16(unused, rr) \
+    static void op_ld_##rr##_d16(GB* gb, uint16_t operand) { SET16_##rr(&gb->cpu, operand); } \
+    static void op_inc_##rr(GB* gb, uint16_t operand) { SET16_##rr(&gb->cpu, (uint16_t)(GET16_##rr(&gb->cpu) + 1)); } \
+    static void op_dec_##rr(GB* gb, uint16_t operand) { SET16_##rr(&gb->cpu, (uint16_t)(GET16_##rr(&gb->cpu) - 1)); } \
+    static void op_add_hl_##rr(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        uint16_t hl = cpu_get_hl(cpu); \
+        uint16_t value = GET16_##rr(cpu); \
+        uint32_t result = hl + value; \
+        cpu_set_flags(cpu, (cpu_flags(cpu) & FLAG_Z) | \
+                           ((hl & 0x0FFF) + (value & 0x0FFF) > 0x0FFF ? FLAG_H : 0) | \
+                           (result > 0xFFFF ? FLAG_C : 0)); \
+        SET16_hl(cpu, (uint16_t)result); \
+    }
 
-static void op_nop(CPU* cpu) {
-    cpu->cycles += 4;
-}
+DEFINE_R16(, bc)
+DEFINE_R16(, de)
+DEFINE_R16(, hl)
+DEFINE_R16(, sp)
 
-static void op_ld_a_d8(CPU* cpu) { op_ld_r_d8(cpu, &cpu->a); }
-static void op_ld_b_d8(CPU* cpu) { op_ld_r_d8(cpu, &cpu->b); }
-static void op_ld_c_d8(CPU* cpu) { op_ld_r_d8(cpu, &cpu->c); }
-static void op_ld_d_d8(CPU* cpu) { op_ld_r_d8(cpu, &cpu->d); }
-static void op_ld_e_d8(CPU* cpu) { op_ld_r_d8(cpu, &cpu->e); }
-static void op_ld_h_d8(CPU* cpu) { op_ld_r_d8(cpu, &cpu->h); }
-static void op_ld_l_d8(CPU* cpu) { op_ld_r_d8(cpu, &cpu->l); }
+#define DEFINE_STACK(unused, rr) \
+    static void op_push_##rr(GB* gb, uint16_t operand) { push16(gb, GET16_##rr(&gb->cpu)); } \
+    static void op_pop_##rr(GB* gb, uint16_t operand) { uint16_t value = pop16(gb); SET16_##rr(&gb->cpu, value); }
 
-static void op_xor_a(CPU* cpu) {
-    cpu->a ^= cpu->a; // XOR A with itself results in 0
-    cpu->f = FLAG_Z; // Set Z flag
-    cpu->cycles += 4;
-}
+DEFINE_STACK(, bc)
+DEFINE_STACK(, de)
+DEFINE_STACK(, hl)
+DEFINE_STACK(, af)
 
-static void op_jp_a16(CPU* cpu) {
-    uint16_t address = mem_read(cpu->pc) | (mem_read(cpu->pc + 1) << 8);
-    cpu->pc += 2;
-    cpu->pc = address;
-    cpu->cycles += 16;
+static void op_ld_a16_sp(GB* gb, uint16_t operand) {
+    mem_write(gb, operand, gb->cpu.sp & 0xFF);
+    mem_write(gb, operand + 1, gb->cpu.sp >> 8);
 }
 
-static void op_call_a16(CPU* cpu) {
-    uint16_t address = mem_read(cpu->pc) | (mem_read(cpu->pc + 1) << 8);
-    cpu->sp -= 2; // Stack pointer decrement
-    mem_write(cpu->sp, cpu->pc & 0xFF); // Low byte
-    mem_write(cpu->sp + 1, (cpu->pc >> 8) & 0xFF); // High byte
-    cpu->pc = address; // Jump to address
-    cpu->cycles += 24;
-}
+static void op_ld_sp_hl(GB* gb, uint16_t operand) { gb->cpu.sp = cpu_get_hl(&gb->cpu); }
 
-static void op_ret(CPU* cpu) {
-    cpu->pc = mem_read(cpu->sp) | (mem_read(cpu->sp + 1) << 8); // Load PC from stack
-    cpu->sp += 2; // Stack pointer increment
-    cpu->cycles += 16;
+// SP + signed offset, H and C come from the unsigned add of the low bytes
+static uint16_t sp_offset(CPU* cpu, uint16_t operand) {
+    uint8_t offset = operand;
+    cpu_set_flags(cpu, ((cpu->sp & 0x0F) + (offset & 0x0F) > 0x0F ? FLAG_H : 0) |
+                       ((cpu->sp & 0xFF) + offset > 0xFF ? FLAG_C : 0));
+    return cpu->sp + (int8_t)offset;
 }
 
-static void op_cp_d8(CPU* cpu) {
-    uint8_t value = mem_read(cpu->pc++);
-    uint8_t result = cpu->a - value;
-
-    // Set flags
-    cpu->f = 0;
-    if (result == 0) cpu->f |= FLAG_Z;
-    cpu->f |= FLAG_N;
-    if ((cpu->a & 0x0F) < (value & 0x0F)) cpu->f |= FLAG_H;
-    if (cpu->a < value) cpu->f |= FLAG_C;
+static void op_add_sp_r8(GB* gb, uint16_t operand) { gb->cpu.sp = sp_offset(&gb->cpu, operand); }
+static void op_ld_hl_sp_r8(GB* gb, uint16_t operand) { SET16_hl(&gb->cpu, sp_offset(&gb->cpu, operand)); }
 
-    cpu->cycles += 8;
-}
+// ---- 8-bit arithmetic and logic ----
 
-static void op_add_a_d8(CPU* cpu) {
-    uint8_t value = mem_read(cpu->pc++);
+static void alu_add(CPU* cpu, uint8_t value) {
     uint16_t result = cpu->a + value;
 
-    cpu->f = 0;
-    if ((result & 0xFF) == 0) cpu->f |= FLAG_Z;
-    if ((cpu->a & 0x0F) + (value & 0x0F) > 0x0F) cpu->f |= FLAG_H;
-    if (result > 0xFF) cpu->f |= FLAG_C;
-
+    alu_flags(cpu, FLAGS_ADD, cpu->a, value, result);
     cpu->a = result & 0xFF;
-    cpu->cycles += 8;
 }
 
-static void op_add_a_a(CPU* cpu) {
-    uint16_t result = cpu->a + cpu->a;
+static void alu_adc(CPU* cpu, uint8_t value) {
+    uint8_t carry = GET_FLAG(cpu, FLAG_C);
+    uint16_t result = cpu->a + value + carry;
 
-    cpu->f = 0;
-    if ((result & 0xFF) == 0) cpu->f |= FLAG_Z;
-    if ((cpu->a & 0x0F) + (cpu->a & 0x0F) > 0x0F) cpu->f |= FLAG_H;
-    if (result > 0xFF) cpu->f |= FLAG_C;
+    alu_flags(cpu, FLAGS_ADD, cpu->a, value, result);
+    cpu->a = result & 0xFF;
+}
 
+static void alu_sub(CPU* cpu, uint8_t value) {
+    uint16_t result = cpu->a - value;
+
+    alu_flags(cpu, FLAGS_SUB, cpu->a, value, result);
     cpu->a = result & 0xFF;
-    cpu->cycles += 4;
 }
 
-static void op_jr_nz_r8(CPU* cpu) {
-    int8_t offset = (int8_t)mem_read(cpu->pc++);
-    if (!(cpu->f & FLAG_Z)) { // Z flag not set
-        cpu->pc += offset; // Jump
-        cpu->cycles += 12;
-    } else {
-        cpu->cycles += 8; // No jump
-    }
+static void alu_sbc(CPU* cpu, uint8_t value) {
+    uint8_t carry = GET_FLAG(cpu, FLAG_C);
+    uint16_t result = cpu->a - value - carry;
+
+    alu_flags(cpu, FLAGS_SUB, cpu->a, value, result);
+    cpu->a = result & 0xFF;
 }
-static void op_load_b_b(CPU* cpu) { cpu->b = cpu->b; cpu->cycles += 4; }
-static void op_load_b_c(CPU* cpu) { cpu->b = cpu->c; cpu->cycles += 4; }
-static void op_load_b_d(CPU* cpu) { cpu->b = cpu->d; cpu->cycles += 4; }
-static void op_load_b_e(CPU* cpu) { cpu->b = cpu->e; cpu->cycles += 4; }
-static void op_load_b_h(CPU* cpu) { cpu->b = cpu->h; cpu->cycles += 4; }
-static void op_load_b_l(CPU* cpu) { cpu->b = cpu->l; cpu->cycles += 4; }
-static void op_load_b_hlp(CPU* cpu) {
-    cpu->b = mem_read(cpu_get_hl(cpu));
-    cpu->cycles += 8;
-}
-static void op_load_b_a(CPU* cpu) { cpu->b = cpu->a; cpu->cycles += 4; }
-
-static void op_load_c_b(CPU* cpu) { cpu->c = cpu->b; cpu->cycles += 4; }
-static void op_load_c_c(CPU* cpu) { cpu->c = cpu->c; cpu->cycles += 4; }
-static void op_load_c_d(CPU* cpu) { cpu->c = cpu->d; cpu->cycles += 4; }
-static void op_load_c_e(CPU* cpu) { cpu->c = cpu->e; cpu->cycles += 4; }
-static void op_load_c_h(CPU* cpu) { cpu->c = cpu->h; cpu->cycles += 4; }
-static void op_load_c_l(CPU* cpu) { cpu->c = cpu->l; cpu->cycles += 4; }
-static void op_load_c_hlp(CPU* cpu) {
-    cpu->c = mem_read(cpu_get_hl(cpu));
-    cpu->cycles += 8;
-}
-static void op_load_c_a(CPU* cpu) { cpu->c = cpu->a; cpu->cycles += 4; }
-
-static void op_load_d_b(CPU* cpu) { cpu->d = cpu->b; cpu->cycles += 4; }
-static void op_load_d_c(CPU* cpu) { cpu->d = cpu->c; cpu->cycles += 4; }
-static void op_load_d_d(CPU* cpu) { cpu->d = cpu->d; cpu->cycles += 4; }
-static void op_load_d_e(CPU* cpu) { cpu->d = cpu->e; cpu->cycles += 4; }
-static void op_load_d_h(CPU* cpu) { cpu->d = cpu->h; cpu->cycles += 4; }
-static void op_load_d_l(CPU* cpu) { cpu->d = cpu->l; cpu->cycles += 4; }
-static void op_load_d_hlp(CPU* cpu) {
-    cpu->d = mem_read(cpu_get_hl(cpu));
-    cpu->cycles += 8;
-}
-static void op_load_d_a(CPU* cpu) { cpu->d = cpu->a; cpu->cycles += 4; }
-
-static void op_load_e_b(CPU* cpu) { cpu->e = cpu->b; cpu->cycles += 4; }
-static void op_load_e_c(CPU* cpu) { cpu->e = cpu->c; cpu->cycles += 4; }
-static void op_load_e_d(CPU* cpu) { cpu->e = cpu->d; cpu->cycles += 4; }
-static void op_load_e_e(CPU* cpu) { cpu->e = cpu->e; cpu->cycles += 4; }
-static void op_load_e_h(CPU* cpu) { cpu->e = cpu->h; cpu->cycles += 4; }
-static void op_load_e_l(CPU* cpu) { cpu->e = cpu->l; cpu->cycles += 4; }
-static void op_load_e_hlp(CPU* cpu) {
-    cpu->e = mem_read(cpu_get_hl(cpu));
-    cpu->cycles += 8;
-}
-static void op_load_e_a(CPU* cpu) { cpu->e = cpu->a; cpu->cycles += 4; }
-
-static void op_load_h_b(CPU* cpu) { cpu->h = cpu->b; cpu->cycles += 4; }
-static void op_load_h_c(CPU* cpu) { cpu->h = cpu->c; cpu->cycles += 4; }
-static void op_load_h_d(CPU* cpu) { cpu->h = cpu->d; cpu->cycles += 4; }
-static void op_load_h_e(CPU* cpu) { cpu->h = cpu->e; cpu->cycles += 4; }
-static void op_load_h_h(CPU* cpu) { cpu->h = cpu->h; cpu->cycles += 4; }
-static void op_load_h_l(CPU* cpu) { cpu->h = cpu->l; cpu->cycles += 4; }
-static void op_load_h_hlp(CPU* cpu) {
-    cpu->h = mem_read(cpu_get_hl(cpu));
-    cpu->cycles += 8;
-}
-static void op_load_h_a(CPU* cpu) { cpu->h = cpu->a; cpu->cycles += 4; }
-
-static void op_load_l_b(CPU* cpu) { cpu->l = cpu->b; cpu->cycles += 4; }
-static void op_load_l_c(CPU* cpu) { cpu->l = cpu->c; cpu->cycles += 4; }
-static void op_load_l_d(CPU* cpu) { cpu->l = cpu->d; cpu->cycles += 4; }
-static void op_load_l_e(CPU* cpu) { cpu->l = cpu->e; cpu->cycles += 4; }
-static void op_load_l_h(CPU* cpu) { cpu->l = cpu->h; cpu->cycles += 4; }
-static void op_load_l_l(CPU* cpu) { cpu->l = cpu->l; cpu->cycles += 4; }
-static void op_load_l_hlp(CPU* cpu) {
-    cpu->l = mem_read(cpu_get_hl(cpu));
-    cpu->cycles += 8;
-}
-static void op_load_l_a(CPU* cpu) { cpu->l = cpu->a; cpu->cycles += 4; }
-
-static void op_load_hlp_b(CPU* cpu) {
-    mem_write(cpu_get_hl(cpu), cpu->b);
-    cpu->cycles += 8;
-}
-
-static void op_load_hlp_c(CPU* cpu) {
-    mem_write(cpu_get_hl(cpu), cpu->c);
-    cpu->cycles += 8;
-}
-
-static void op_load_hlp_d(CPU* cpu) {
-    mem_write(cpu_get_hl(cpu), cpu->d);
-    cpu->cycles += 8;
-}
-
-static void op_load_hlp_e(CPU* cpu) {
-    mem_write(cpu_get_hl(cpu), cpu->e);
-    cpu->cycles += 8;
-}
-
-static void op_load_hlp_h(CPU* cpu) {
-    mem_write(cpu_get_hl(cpu), cpu->h);
-    cpu->cycles += 8;
-}
-
-static void op_load_hlp_l(CPU* cpu) {
-    mem_write(cpu_get_hl(cpu), cpu->l);
-    cpu->cycles += 8;
-}
-
-static void op_halt(CPU* cpu) {
-    cpu->halted = 1;
-    cpu->cycles += 4;
+
+static void alu_and(CPU* cpu, uint8_t value) {
+    cpu->a &= value;
+    cpu_set_flags(cpu, (cpu->a == 0 ? FLAG_Z : 0) | FLAG_H);
 }
 
-static void op_load_hlp_a(CPU* cpu) {
-    mem_write(cpu_get_hl(cpu), cpu->a);
-    cpu->cycles += 8;
+static void alu_xor(CPU* cpu, uint8_t value) {
+    cpu->a ^= value;
+    cpu_set_flags(cpu, cpu->a == 0 ? FLAG_Z : 0);
 }
 
-static void op_load_a_b(CPU* cpu) { cpu->a = cpu->b; cpu->cycles += 4; }
-static void op_load_a_c(CPU* cpu) { cpu->a = cpu->c; cpu->cycles += 4; }
-static void op_load_a_d(CPU* cpu) { cpu->a = cpu->d; cpu->cycles += 4; }
-static void op_load_a_e(CPU* cpu) { cpu->a = cpu->e; cpu->cycles += 4; }
-static void op_load_a_h(CPU* cpu) { cpu->a = cpu->h; cpu->cycles += 4; }
-static void op_load_a_l(CPU* cpu) { cpu->a = cpu->l; cpu->cycles += 4; }
-static void op_load_a_hlp(CPU* cpu) {
-    cpu->a = mem_read(cpu_get_hl(cpu));
-    cpu->cycles += 8;
+static void alu_or(CPU* cpu, uint8_t value) {
+    cpu->a |= value;
+    cpu_set_flags(cpu, cpu->a == 0 ? FLAG_Z : 0);
 }
-static void op_load_a_a(CPU* cpu) { cpu->a = cpu->a; cpu->cycles += 4; }
 
-static void alu_add(CPU* cpu, uint8_t value) {
-    uint16_t result = cpu->a + value;
+static void alu_cp(CPU* cpu, uint8_t value) {
+    uint16_t result = cpu->a - value;
 
-    cpu->f = 0;
-    if ((result & 0xFF) == 0) cpu->f |= FLAG_Z;
-    if (((cpu->a & 0x0F) + (value & 0x0F)) > 0x0F) cpu->f |= FLAG_H;
-    if (result > 0xFF) cpu->f |= FLAG_C;
+    // Only the flags are kept
+    alu_flags(cpu, FLAGS_SUB, cpu->a, value, result);
+}
+
+#define DEFINE_ALU(name, alu, src) \
+    static void op_##name##_##src(GB* gb, uint16_t operand) { alu(&gb->cpu, GET_##src(gb)); }
+#define DEFINE_ALU_ALL(name, alu) EACH_R8_HLP(DEFINE_ALU, name, alu) DEFINE_ALU(name, alu, d8)
+
+DEFINE_ALU_ALL(add_a, alu_add)
+DEFINE_ALU_ALL(adc_a, alu_adc)
+DEFINE_ALU_ALL(sub, alu_sub)
+DEFINE_ALU_ALL(sbc_a, alu_sbc)
+DEFINE_ALU_ALL(and, alu_and)
+DEFINE_ALU_ALL(xor, alu_xor)
+DEFINE_ALU_ALL(or, alu_or)
+DEFINE_ALU_ALL(cp, alu_cp)
+
+// INC and DEC leave C alone, which the lazy form cannot express
+#define DEFINE_INC_DEC(unused, r) \
+    static void op_inc_##r(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        uint8_t value = GET_##r(gb) + 1; \
+        SET_##r(gb, value); \
+        cpu_set_flags(cpu, (cpu_flags(cpu) & FLAG_C) | (value == 0 ? FLAG_Z : 0) | \
+                           ((value & 0x0F) == 0 ? FLAG_H : 0)); \
+    } \
+    static void op_dec_##r(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        uint8_t value = GET_##r(gb) - 1; \
+        SET_##r(gb, value); \
+        cpu_set_flags(cpu, (cpu_flags(cpu) & FLAG_C) | (value == 0 ? FLAG_Z : 0) | FLAG_N | \
+                           ((value & 0x0F) == 0x0F ? FLAG_H : 0)); \
+    }
 
-    cpu->a = result & 0xFF;
+EACH_R8_HLP(DEFINE_INC_DEC, )
+
+static void op_daa(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    uint8_t f = cpu_flags(cpu);
+    uint8_t adjust = 0;
+    bool carry = f & FLAG_C;
+
+    if (f & FLAG_N) {
+        if (f & FLAG_H) adjust |= 0x06;
+        if (carry) adjust |= 0x60;
+        cpu->a -= adjust;
+    } else {
+        if ((f & FLAG_H) || (cpu->a & 0x0F) > 0x09) adjust |= 0x06;
+        if (carry || cpu->a > 0x99) {
+            adjust |= 0x60;
+            carry = true;
+        }
+        cpu->a += adjust;
+    }
+
+    cpu_set_flags(cpu, (cpu->a == 0 ? FLAG_Z : 0) | (f & FLAG_N) | (carry ? FLAG_C : 0));
 }
 
-static void op_add_a_b(CPU* cpu) { alu_add(cpu, cpu->b); cpu->cycles += 4; }
-static void op_add_a_c(CPU* cpu) { alu_add(cpu, cpu->c); cpu->cycles += 4; }
-static void op_add_a_d(CPU* cpu) { alu_add(cpu, cpu->d); cpu->cycles += 4; }
-static void op_add_a_e(CPU* cpu) { alu_add(cpu, cpu->e); cpu->cycles += 4; }
-static void op_add_a_h(CPU* cpu) { alu_add(cpu, cpu->h); cpu->cycles += 4; }
-static void op_add_a_l(CPU* cpu) { alu_add(cpu, cpu->l); cpu->cycles += 4; }
-static void op_add_a_hlp(CPU* cpu) {
-    alu_add(cpu, mem_read(cpu_get_hl(cpu)));
-    cpu->cycles += 8;
+static void op_cpl(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    cpu->a = ~cpu->a;
+    cpu_set_flags(cpu, cpu_flags(cpu) | FLAG_N | FLAG_H);
 }
 
-static void alu_adc(CPU* cpu, uint8_t value) {
-    uint8_t carry = cpu->f & FLAG_C ? 1 : 0;
-    uint16_t result = cpu->a + value + carry;
+static void op_scf(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    cpu_set_flags(cpu, (cpu_flags(cpu) & FLAG_Z) | FLAG_C);
+}
 
-    cpu->f = 0;
-    if ((result & 0xFF) == 0) cpu->f |= FLAG_Z;
-    if ((cpu->a & 0x0F) + (value & 0x0F) + carry > 0x0F) cpu->f |= FLAG_H;
-    if (result > 0xFF) cpu->f |= FLAG_C;
+static void op_ccf(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    cpu_set_flags(cpu, (cpu_flags(cpu) & (FLAG_Z | FLAG_C)) ^ FLAG_C);
+}
+
+// ---- Rotates, shifts and bit operations ----
+
+// Result of a CB rotate/shift, with Z from the result and C from the bit shifted out
+static uint8_t shift_flags(CPU* cpu, uint8_t result, bool carry) {
+    cpu_set_flags(cpu, (result == 0 ? FLAG_Z : 0) | (carry ? FLAG_C : 0));
+    return result;
+}
+
+static uint8_t cb_rlc(CPU* cpu, uint8_t value) { return shift_flags(cpu, value << 1 | value >> 7, value & 0x80); }
+static uint8_t cb_rrc(CPU* cpu, uint8_t value) { return shift_flags(cpu, value >> 1 | value << 7, value & 0x01); }
+static uint8_t cb_rl(CPU* cpu, uint8_t value) { return shift_flags(cpu, value << 1 | GET_FLAG(cpu, FLAG_C), value & 0x80); }
+static uint8_t cb_rr(CPU* cpu, uint8_t value) { return shift_flags(cpu, value >> 1 | GET_FLAG(cpu, FLAG_C) << 7, value & 0x01); }
+static uint8_t cb_sla(CPU* cpu, uint8_t value) { return shift_flags(cpu, value << 1, value & 0x80); }
+static uint8_t cb_sra(CPU* cpu, uint8_t value) { return shift_flags(cpu, value >> 1 | (value & 0x80), value & 0x01); }
+static uint8_t cb_swap(CPU* cpu, uint8_t value) { return shift_flags(cpu, value << 4 | value >> 4, false); }
+static uint8_t cb_srl(CPU* cpu, uint8_t value) { return shift_flags(cpu, value >> 1, value & 0x01); }
+
+// The accumulator forms always clear Z
+static void op_rlca(GB* gb, uint16_t operand) { CPU* cpu = &gb->cpu; cpu->a = cb_rlc(cpu, cpu->a); cpu->f &= FLAG_C; }
+static void op_rrca(GB* gb, uint16_t operand) { CPU* cpu = &gb->cpu; cpu->a = cb_rrc(cpu, cpu->a); cpu->f &= FLAG_C; }
+static void op_rla(GB* gb, uint16_t operand) { CPU* cpu = &gb->cpu; cpu->a = cb_rl(cpu, cpu->a); cpu->f &= FLAG_C; }
+static void op_rra(GB* gb, uint16_t operand) { CPU* cpu = &gb->cpu; cpu->a = cb_rr(cpu, cpu->a); cpu->f &= FLAG_C; }
+
+#define DEFINE_SHIFT(name, r) \
+    static void op_##name##_##r(GB* gb, uint16_t operand) { SET_##r(gb, cb_##name(&gb->cpu, GET_##r(gb))); }
+
+EACH_R8_HLP(DEFINE_SHIFT, rlc)
+EACH_R8_HLP(DEFINE_SHIFT, rrc)
+EACH_R8_HLP(DEFINE_SHIFT, rl)
+EACH_R8_HLP(DEFINE_SHIFT, rr)
+EACH_R8_HLP(DEFINE_SHIFT, sla)
+EACH_R8_HLP(DEFINE_SHIFT, sra)
+EACH_R8_HLP(DEFINE_SHIFT, swap)
+EACH_R8_HLP(DEFINE_SHIFT, srl)
+
+#define DEFINE_BIT(n, r) \
+    static void op_bit_##n##_##r(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        uint8_t value = GET_##r(gb); \
+        cpu_set_flags(cpu, (cpu_flags(cpu) & FLAG_C) | FLAG_H | (value & 1 << n ? 0 : FLAG_Z)); \
+    } \
+    static void op_res_##n##_##r(GB* gb, uint16_t operand) { SET_##r(gb, GET_##r(gb) & ~(1 << n)); } \
+    static void op_set_##n##_##r(GB* gb, uint16_t operand) { SET_##r(gb, GET_##r(gb) | 1 << n); }
+
+EACH_R8_HLP(DEFINE_BIT, 0)
+EACH_R8_HLP(DEFINE_BIT, 1)
+EACH_R8_HLP(DEFINE_BIT, 2)
+EACH_R8_HLP(DEFINE_BIT, 3)
+EACH_R8_HLP(DEFINE_BIT, 4)
+EACH_R8_HLP(DEFINE_BIT, 5)
+EACH_R8_HLP(DEFINE_BIT, 6)
+EACH_R8_HLP(DEFINE_BIT, 7)
+
+// ---- Jumps, calls and returns ----
+
+static void op_jp_a16(GB* gb, uint16_t operand) {
+    gb->cpu.pc = operand;
+}
+
+static void op_jp_hl(GB* gb, uint16_t operand) {
+    gb->cpu.pc = cpu_get_hl(&gb->cpu);
+}
+
+static void op_jr_r8(GB* gb, uint16_t operand) {
+    gb->cpu.pc += (int8_t)operand;
+}
+
+static void op_call_a16(GB* gb, uint16_t operand) {
+    push16(gb, gb->cpu.pc); // return address
+    gb->cpu.pc = operand; // Jump to address
+}
+
+static void op_ret(GB* gb, uint16_t operand) {
+    gb->cpu.pc = pop16(gb); // Load PC from stack
+}
+
+// Taken branches add their extra cycles to the base cost in the opcode list
+#define DEFINE_CONDITIONAL(unused, cc) \
+    static void op_jr_##cc##_r8(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        if (COND_##cc(cpu)) { \
+            cpu->pc += (int8_t)operand; \
+            cpu->cycles += 4; \
+        } \
+    } \
+    static void op_jp_##cc##_a16(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        if (COND_##cc(cpu)) { \
+            cpu->pc = operand; \
+            cpu->cycles += 4; \
+        } \
+    } \
+    static void op_call_##cc##_a16(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        if (COND_##cc(cpu)) { \
+            push16(gb, cpu->pc); \
+            cpu->pc = operand; \
+            cpu->cycles += 12; \
+        } \
+    } \
+    static void op_ret_##cc(GB* gb, uint16_t operand) { \
+        CPU* cpu = &gb->cpu; \
+        if (COND_##cc(cpu)) { \
+            cpu->pc = pop16(gb); \
+            cpu->cycles += 12; \
+        } \
+    }
 
-    cpu->a = result & 0xFF;
+DEFINE_CONDITIONAL(, nz)
+DEFINE_CONDITIONAL(, z)
+DEFINE_CONDITIONAL(, nc)
+DEFINE_CONDITIONAL(, c)
+
+#define DEFINE_RST(vector) \
+    static void op_rst_##vector(GB* gb, uint16_t operand) { push16(gb, gb->cpu.pc); gb->cpu.pc = 0x##vector; }
+
+DEFINE_RST(00)
+DEFINE_RST(08)
+DEFINE_RST(10)
+DEFINE_RST(18)
+DEFINE_RST(20)
+DEFINE_RST(28)
+DEFINE_RST(30)
+DEFINE_RST(38)
+
+// ---- CPU control ----
+
+static void op_halt(GB* gb, uint16_t operand) {
+    CPU* cpu = &gb->cpu;
+    cpu->halted = 1;
+    sched_schedule(gb, EVENT_IRQ, cpu->cycles); // wakes up right away if an interrupt is pending
 }
 
-static void op_adc_a_b(CPU* cpu) { alu_adc(cpu, cpu->b); cpu->cycles += 4; }
-static void op_adc_a_c(CPU* cpu) { alu_adc(cpu, cpu->c); cpu->cycles += 4; }
-static void op_adc_a_d(CPU* cpu) { alu_adc(cpu, cpu->d); cpu->cycles += 4; }
-static void op_adc_a_e(CPU* cpu) { alu_adc(cpu, cpu->e); cpu->cycles += 4; }
-static void op_adc_a_h(CPU* cpu) { alu_adc(cpu, cpu->h); cpu->cycles += 4; }
-static void op_adc_a_l(CPU* cpu) { alu_adc(cpu, cpu->l); cpu->cycles += 4; }
-static void op_adc_a_hlp(CPU* cpu) {
-    alu_adc(cpu, mem_read(cpu_get_hl(cpu)));
-    cpu->cycles += 8;
+// Without a joypad nothing could end the low power mode, only the DIV reset is kept
+static void op_stop(GB* gb, uint16_t operand) {
+    mem_write(gb, DIV_ADDR, 0);
 }
-static void op_adc_a_a(CPU* cpu) {alu_adc(cpu, cpu->a); cpu->cycles += 4; }
 
-static void alu_sub(CPU* cpu, uint8_t value) {
-    uint16_t result = cpu->a - value;
+static void op_reti(GB* gb, uint16_t operand) {
+    op_ret(gb, operand);
+    gb->cpu.ime = 1; // no delay, unlike EI
+    sched_schedule(gb, EVENT_IRQ, gb->cpu.cycles);
+}
 
-    cpu->f = FLAG_N;
-    if ((result & 0xFF) == 0) cpu->f |= FLAG_Z;
-    if ((cpu->a & 0x0F) < (value & 0x0F)) cpu->f |= FLAG_H;
-    if (cpu->a < value) cpu->f |= FLAG_C;
+static void op_di(GB* gb, uint16_t operand) {
+    gb->cpu.ime = 0;
+    sched_cancel(gb, EVENT_EI);
+}
 
-    cpu->a = result & 0xFF;
+static void op_ei(GB* gb, uint16_t operand) {
+    // Fires at the boundary after the next instruction
+    sched_schedule(gb, EVENT_EI, gb->cpu.cycles + 1);
 }
 
-static void op_sub_b(CPU* cpu) { alu_sub(cpu, cpu->b); cpu->cycles += 4; }
-static void op_sub_c(CPU* cpu) { alu_sub(cpu, cpu->c); cpu->cycles += 4; }
-static void op_sub_d(CPU* cpu) { alu_sub(cpu, cpu->d); cpu->cycles += 4; }
-static void op_sub_e(CPU* cpu) { alu_sub(cpu, cpu->e); cpu->cycles += 4; }
-static void op_sub_h(CPU* cpu) { alu_sub(cpu, cpu->h); cpu->cycles += 4; }
-static void op_sub_l(CPU* cpu) { alu_sub(cpu, cpu->l); cpu->cycles += 4; }
-static void op_sub_hlp(CPU* cpu) {
-    alu_sub(cpu, mem_read(cpu_get_hl(cpu)));
-    cpu->cycles += 8;
+// Reference path for the prefix, the cores that can dispatch CB opcodes directly do so
+static void op_prefix_cb(GB* gb, uint16_t operand) {
+    const OpcodeInfo* info = &cb_opcode_table[operand & 0xFF];
+    gb->cpu.cycles += info->cycles;
+    info->handler(gb, operand);
 }
-static void op_sub_a(CPU* cpu) { alu_sub(cpu, cpu->a); cpu->cycles += 4; }
 
-static void alu_sbc(CPU* cpu, uint8_t value) {
-    uint8_t carry = (cpu->f & FLAG_C) ? 1 : 0;
-    int result = cpu->a - value - carry;
+// Read-only after compilation, so any number of machines can share it
+const OpcodeInfo opcode_table[256] = {
+    OPCODE_LIST(REGISTER_OPCODE)
+};
 
-    cpu->f = FLAG_N;
-    if ((result & 0xFF) == 0) cpu->f |= FLAG_Z;
-    if (((cpu->a & 0x0F) - (value & 0x0F) - carry) < 0) cpu->f |= FLAG_H;
-    if (result < 0) cpu->f |= FLAG_C;
+const OpcodeInfo cb_opcode_table[256] = {
+    CB_OPCODE_LIST(REGISTER_OPCODE)
+};
 
-    cpu->a = result & 0xFF;
-}
+cpu_status_t cpu_step(GB* gb) {
+    CPU* cpu = &gb->cpu;
+    uint64_t before = cpu->cycles;
+
+    sched_run_due(gb);
+    if (cpu->cycles != before) return CPU_OK; // this step went to an interrupt dispatch
 
-static void op_sbc_a_b(CPU* cpu) { alu_sbc(cpu, cpu->b); cpu->cycles += 4; }
-static void op_sbc_a_c(CPU* cpu) { alu_sbc(cpu, cpu->c); cpu->cycles += 4; }
-static void op_sbc_a_d(CPU* cpu) { alu_sbc(cpu, cpu->d); cpu->cycles += 4; }
-static void op_sbc_a_e(CPU* cpu) { alu_sbc(cpu, cpu->e); cpu->cycles += 4; }
-static void op_sbc_a_h(CPU* cpu) { alu_sbc(cpu, cpu->h); cpu->cycles += 4; }
-static void op_sbc_a_l(CPU* cpu) { alu_sbc(cpu, cpu->l); cpu->cycles += 4; }
-static void op_sbc_a_hlp(CPU* cpu) {
-    alu_sbc(cpu, mem_read(cpu_get_hl(cpu)));
-    cpu->cycles += 8;
-}
-static void op_sbc_a_a(CPU* cpu) { alu_sbc(cpu, cpu->a); cpu->cycles += 4; }
-
-// TODO implement 0xAx ...
-
-static void init_opcode_table() {
-    memset(opcode_table, 0, sizeof(opcode_table));
-
-    REGISTER_OPCODE(0x00, op_nop);
-    REGISTER_OPCODE(0x3E, op_ld_a_d8);
-    REGISTER_OPCODE(0x06, op_ld_b_d8);
-    REGISTER_OPCODE(0x0E, op_ld_c_d8);
-    REGISTER_OPCODE(0x16, op_ld_d_d8);
-    REGISTER_OPCODE(0x1E, op_ld_e_d8);
-    REGISTER_OPCODE(0x26, op_ld_h_d8);
-    REGISTER_OPCODE(0x2E, op_ld_l_d8);
-    REGISTER_OPCODE(0xAF, op_xor_a);
-    REGISTER_OPCODE(0xC3, op_jp_a16);
-    REGISTER_OPCODE(0xCD, op_call_a16);
-    REGISTER_OPCODE(0xC9, op_ret);
-    REGISTER_OPCODE(0xFE, op_cp_d8);
-    REGISTER_OPCODE(0xC6, op_add_a_d8);
-    REGISTER_OPCODE(0x87, op_add_a_a);
-    REGISTER_OPCODE(0x20, op_jr_nz_r8);
-    REGISTER_OPCODE(0x40, op_load_b_b);
-    REGISTER_OPCODE(0x41, op_load_b_c);
-    REGISTER_OPCODE(0x42, op_load_b_d);
-    REGISTER_OPCODE(0x43, op_load_b_e);
-    REGISTER_OPCODE(0x44, op_load_b_h);
-    REGISTER_OPCODE(0x45, op_load_b_l);
-    REGISTER_OPCODE(0x46, op_load_b_hlp);
-    REGISTER_OPCODE(0x47, op_load_b_a);
-    REGISTER_OPCODE(0x48, op_load_c_b);
-    REGISTER_OPCODE(0x49, op_load_c_c);
-    REGISTER_OPCODE(0x4A, op_load_c_d);
-    REGISTER_OPCODE(0x4B, op_load_c_e);
-    REGISTER_OPCODE(0x4C, op_load_c_h);
-    REGISTER_OPCODE(0x4D, op_load_c_l);
-    REGISTER_OPCODE(0x4E, op_load_c_hlp);
-    REGISTER_OPCODE(0x4F, op_load_c_a);
-    REGISTER_OPCODE(0x50, op_load_d_b);
-    REGISTER_OPCODE(0x51, op_load_d_c);
-    REGISTER_OPCODE(0x52, op_load_d_d);
-    REGISTER_OPCODE(0x53, op_load_d_e);
-    REGISTER_OPCODE(0x54, op_load_d_h);
-    REGISTER_OPCODE(0x55, op_load_d_l);
-    REGISTER_OPCODE(0x56, op_load_d_hlp);
-    REGISTER_OPCODE(0x57, op_load_d_a);
-    REGISTER_OPCODE(0x58, op_load_e_b);
-    REGISTER_OPCODE(0x59, op_load_e_c);
-    REGISTER_OPCODE(0x5A, op_load_e_d);
-    REGISTER_OPCODE(0x5B, op_load_e_e);
-    REGISTER_OPCODE(0x5C, op_load_e_h);
-    REGISTER_OPCODE(0x5D, op_load_e_l);
-    REGISTER_OPCODE(0x5E, op_load_e_hlp);
-    REGISTER_OPCODE(0x5F, op_load_e_a);
-    REGISTER_OPCODE(0x60, op_load_h_b);
-    REGISTER_OPCODE(0x61, op_load_h_c);
-    REGISTER_OPCODE(0x62, op_load_h_d);
-    REGISTER_OPCODE(0x63, op_load_h_e);
-    REGISTER_OPCODE(0x64, op_load_h_h);
-    REGISTER_OPCODE(0x65, op_load_h_l);
-    REGISTER_OPCODE(0x66, op_load_h_hlp);
-    REGISTER_OPCODE(0x67, op_load_h_a);
-    REGISTER_OPCODE(0x68, op_load_l_b);
-    REGISTER_OPCODE(0x69, op_load_l_c);
-    REGISTER_OPCODE(0x6A, op_load_l_d);
-    REGISTER_OPCODE(0x6B, op_load_l_e);
-    REGISTER_OPCODE(0x6C, op_load_l_h);
-    REGISTER_OPCODE(0x6D, op_load_l_l);
-    REGISTER_OPCODE(0x6E, op_load_l_hlp);
-    REGISTER_OPCODE(0x6F, op_load_l_a);
-    REGISTER_OPCODE(0x70, op_load_hlp_b);
-    REGISTER_OPCODE(0x71, op_load_hlp_c);
-    REGISTER_OPCODE(0x72, op_load_hlp_d);
-    REGISTER_OPCODE(0x73, op_load_hlp_e);
-    REGISTER_OPCODE(0x74, op_load_hlp_h);
-    REGISTER_OPCODE(0x75, op_load_hlp_l);
-    REGISTER_OPCODE(0x76, op_halt);
-    REGISTER_OPCODE(0x77, op_load_hlp_a);
-    REGISTER_OPCODE(0x78, op_load_a_b);
-    REGISTER_OPCODE(0x79, op_load_a_c);
-    REGISTER_OPCODE(0x7A, op_load_a_d);
-    REGISTER_OPCODE(0x7B, op_load_a_e);
-    REGISTER_OPCODE(0x7C, op_load_a_h);
-    REGISTER_OPCODE(0x7D, op_load_a_l);
-    REGISTER_OPCODE(0x7E, op_load_a_hlp);
-    REGISTER_OPCODE(0x7F, op_load_a_a);
-    REGISTER_OPCODE(0x80, op_add_a_b);
-    REGISTER_OPCODE(0x81, op_add_a_c);
-    REGISTER_OPCODE(0x82, op_add_a_d);
-    REGISTER_OPCODE(0x83, op_add_a_e);
-    REGISTER_OPCODE(0x84, op_add_a_h);
-    REGISTER_OPCODE(0x85, op_add_a_l);
-    REGISTER_OPCODE(0x86, op_add_a_hlp);
-    REGISTER_OPCODE(0x88, op_adc_a_b);
-    REGISTER_OPCODE(0x89, op_adc_a_c);
-    REGISTER_OPCODE(0x8A, op_adc_a_d);
-    REGISTER_OPCODE(0x8B, op_adc_a_e);
-    REGISTER_OPCODE(0x8C, op_adc_a_h);
-    REGISTER_OPCODE(0x8D, op_adc_a_l);
-    REGISTER_OPCODE(0x8E, op_adc_a_hlp);
-    REGISTER_OPCODE(0x8F, op_adc_a_a);
-    REGISTER_OPCODE(0x90, op_sub_b);
-    REGISTER_OPCODE(0x91, op_sub_c);
-    REGISTER_OPCODE(0x92, op_sub_d);
-    REGISTER_OPCODE(0x93, op_sub_e);
-    REGISTER_OPCODE(0x94, op_sub_h);
-    REGISTER_OPCODE(0x95, op_sub_l);
-    REGISTER_OPCODE(0x96, op_sub_hlp);
-    REGISTER_OPCODE(0x97, op_sub_a);
-    REGISTER_OPCODE(0x98, op_sbc_a_b);
-    REGISTER_OPCODE(0x99, op_sbc_a_c);
-    REGISTER_OPCODE(0x9A, op_sbc_a_d);
-    REGISTER_OPCODE(0x9B, op_sbc_a_e);
-    REGISTER_OPCODE(0x9C, op_sbc_a_h);
-    REGISTER_OPCODE(0x9D, op_sbc_a_l);
-    REGISTER_OPCODE(0x9E, op_sbc_a_hlp);
-    REGISTER_OPCODE(0x9F, op_sbc_a_a);
-}
-
-void cpu_step(CPU* cpu) {
     if (cpu->halted) {
-        cpu->cycles += 4; // maybe do nothing or wait for an interrupt
-        return;
+        if (gb->sched.count == 0) return CPU_HALTED; // nothing left that could wake the CPU
+        cpu->cycles += 4;
+        return CPU_OK;
     }
 
-    uint8_t opcode = mem_read(cpu->pc++);
-    execute_opcode(cpu, opcode);
+    uint8_t opcode = mem_read(gb, cpu->pc);
+    return execute_opcode(gb, opcode);
+}
+
+// Computed goto is a GCC/Clang extension, everything else gets the switch core
+#if defined(LR35902_DISPATCH_THREADED) && !defined(__GNUC__)
+#undef LR35902_DISPATCH_THREADED
+#define LR35902_DISPATCH_SWITCH
+#endif
+
+// Only HALT can stop the loop early, the check folds away for every other opcode
+#define OPCODE_HALT 0x76
+
+#define THREADED_LABEL(code, func, len, cyc, flags) [code] = &&L_##code,
+#define THREADED_CASE(code, func, len, cyc, flags) \
+    L_##code: { \
+        if (gb->trace) trace_record(gb->trace, cpu, code); \
+        if (gb->profile) profile_record(gb, code); \
+        uint16_t operand = fetch_operand(gb, cpu->pc, len); \
+        cpu->pc += len; \
+        cpu->cycles += cyc; \
+        if (code == OPCODE_PREFIX_CB) goto *cb_labels[operand & 0xFF]; \
+        func(gb, operand); \
+        if (code == OPCODE_HALT && cpu->halted) return CPU_HALTED; \
+        DISPATCH(); \
+    }
+
+// The prefix jumps straight to the label of the second byte, see THREADED_CASE
+#define THREADED_CB_LABEL(code, func, len, cyc, flags) [code] = &&L_CB_##code,
+#define THREADED_CB_CASE(code, func, len, cyc, flags) \
+    L_CB_##code: \
+        cpu->cycles += cyc; \
+        func(gb, 0); \
+        DISPATCH();
+
+#define SWITCH_CASE(code, func, len, cyc, flags) \
+    case code: { \
+        if (gb->trace) trace_record(gb->trace, cpu, code); \
+        if (gb->profile) profile_record(gb, code); \
+        uint16_t operand = fetch_operand(gb, cpu->pc, len); \
+        cpu->pc += len; \
+        cpu->cycles += cyc; \
+        if (code == OPCODE_PREFIX_CB) { \
+            cb = operand; \
+            goto cb_dispatch; \
+        } \
+        func(gb, operand); \
+        if (code == OPCODE_HALT && cpu->halted) return CPU_HALTED; \
+        break; \
+    }
+
+#define SWITCH_CB_CASE(code, func, len, cyc, flags) \
+    case code: \
+        cpu->cycles += cyc; \
+        func(gb, 0); \
+        break;
+
+// Runs the configured core until the scheduler deadline, a HALT or an unknown opcode
+static cpu_status_t run_core(GB* gb) {
+    // Translated code, idle loop detection and breakpoints only exist for cached blocks
+    if (gb->jit_enabled || gb->idle_skip || gb->aot || gb->debug) return block_cache_run(gb);
+
+#if defined(LR35902_DISPATCH_BLOCK)
+    // Pre-decoded basic blocks, see block_cache.c
+    return block_cache_run(gb);
+#else
+    CPU* cpu = &gb->cpu;
+
+    // Re-read every instruction: handlers move the deadline when they schedule an event.
+    // Signed distance keeps the comparison correct across a cycle counter wrap
+#define BUDGET_LEFT() CYCLES_BEFORE(cpu->cycles, gb->sched.deadline)
+
+#if defined(LR35902_DISPATCH_THREADED)
+    // Every handler is inlined behind its own label and jumps straight to the next one
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static const void* const labels[256] = {
+        [0 ... 255] = &&unknown,
+        OPCODE_LIST(THREADED_LABEL)
+    };
+#pragma GCC diagnostic pop
+    static const void* const cb_labels[256] = {
+        CB_OPCODE_LIST(THREADED_CB_LABEL)
+    };
+
+#define DISPATCH() \
+    do { \
+        if (!BUDGET_LEFT()) return CPU_BUDGET_DONE; \
+        goto *labels[mem_read(gb, cpu->pc)]; \
+    } while (0)
+
+    DISPATCH();
+    OPCODE_LIST(THREADED_CASE)
+    CB_OPCODE_LIST(THREADED_CB_CASE)
+
+unknown:
+    return CPU_UNKNOWN_OPCODE;
+
+#undef DISPATCH
+#elif defined(LR35902_DISPATCH_SWITCH)
+    uint8_t cb;
+
+    while (BUDGET_LEFT()) {
+        switch (mem_read(gb, cpu->pc)) {
+            OPCODE_LIST(SWITCH_CASE)
+            default:
+                return CPU_UNKNOWN_OPCODE;
+        }
+        continue;
+
+    cb_dispatch:
+        switch (cb) {
+            CB_OPCODE_LIST(SWITCH_CB_CASE)
+        }
+    }
+
+    return CPU_BUDGET_DONE;
+#else
+    // Reference core: one indirect call per instruction through opcode_table
+    while (BUDGET_LEFT()) {
+        if (execute_opcode(gb, mem_read(gb, cpu->pc)) != CPU_OK) return CPU_UNKNOWN_OPCODE;
+        if (cpu->halted) return CPU_HALTED;
+    }
+
+    return CPU_BUDGET_DONE;
+#endif
+
+#undef BUDGET_LEFT
+#endif
 }
 
-void execute_opcode(CPU* cpu, uint8_t opcode) {
-    opcode_func_t handler = opcode_table[opcode];
+cpu_status_t cpu_run(GB* gb, uint32_t cycle_budget) {
+    CPU* cpu = &gb->cpu;
+    const uint64_t end = cpu->cycles + cycle_budget;
 
-    // NULL
-    if (handler != 0) {
-        handler(cpu);
-    } else {
-        printf("Unknown opcode: 0x%02X at PC: 0x%04X\n", opcode, cpu->pc - 1);
-        exit(1);
+    // Events due at the end of the budget fire on the next call, the same boundary cpu_step uses
+    while (CYCLES_BEFORE(cpu->cycles, end)) {
+        sched_run_due(gb);
+
+        if (cpu->halted) {
+            if (gb->sched.count == 0) return CPU_HALTED; // nothing left that could wake the CPU
+
+            // Sleep straight to the next event, in whole machine cycles like cpu_step
+            uint64_t wake = CYCLES_BEFORE(gb->sched.next, end) ? gb->sched.next : end;
+            cpu->cycles += (wake - cpu->cycles + 3) & ~(uint64_t)3;
+            continue;
+        }
+
+        sched_begin_slice(gb, end);
+        cpu_status_t status = run_core(gb);
+        if (status == CPU_UNKNOWN_OPCODE || status == CPU_BREAKPOINT) return status;
     }
+
+    return CPU_BUDGET_DONE;
+}
+
+cpu_status_t execute_opcode(GB* gb, uint8_t opcode) {
+    const OpcodeInfo* info = &opcode_table[opcode];
+    CPU* cpu = &gb->cpu;
+
+    // NULL, PC stays on the offending opcode
+    if (info->handler == 0) return CPU_UNKNOWN_OPCODE;
+    if (gb->trace) trace_record(gb->trace, cpu, opcode);
+    if (gb->profile) profile_record(gb, opcode);
+
+    uint16_t operand = fetch_operand(gb, cpu->pc, info->length);
+    cpu->pc += info->length;
+    cpu->cycles += info->cycles;
+    info->handler(gb, operand);
+    return CPU_OK;
 }
 
 void cpu_print_state(const CPU* cpu) {
     printf("PC=%04X SP=%04X AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X\n",
         cpu->pc, cpu->sp,
-        cpu->a, cpu->f, cpu->b, cpu->c,
+        cpu->a, cpu_flags(cpu), cpu->b, cpu->c,
         cpu->d, cpu->e, cpu->h, cpu->l);
 }
@@ -0,0 +1,176 @@
+//
+// Created by davidg on 06.09.25.
+//
+
+#include <debugger.h>
+#include <gb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIT_SET(bits, address) ((bits)[(address) >> 3] & (1u << ((address) & 7)))
+
+static void set_bit(uint8_t* bits, uint16_t address, bool enabled) {
+    if (enabled) {
+        bits[address >> 3] |= 1u << (address & 7);
+    } else {
+        bits[address >> 3] &= ~(1u << (address & 7));
+    }
+}
+
+// MEM_WATCH_* flags a page needs for the watchpoints on it
+static uint8_t page_flags(const Debugger* debug, uint8_t page) {
+    uint8_t flags = 0;
+    for (unsigned i = page * PAGE_SIZE / 8; i < (page + 1u) * PAGE_SIZE / 8; i++) {
+        if (debug->read_watch[i]) flags |= MEM_WATCH_READ;
+        if (debug->write_watch[i]) flags |= MEM_WATCH_WRITE;
+    }
+    return flags;
+}
+
+// Blocks are cut by the breakpoints and watchpoints there were when they were decoded
+static void drop_blocks(GB* gb) {
+    if (gb->blocks) memset(gb->blocks, 0, sizeof(BlockCache));
+}
+
+void debug_attach(GB* gb) {
+    if (gb->debug) return;
+
+    gb->debug = calloc(1, sizeof(Debugger));
+    if (!gb->debug) {
+        perror("Fehler beim Anlegen des Debuggers");
+        exit(1);
+    }
+}
+
+void debug_detach(GB* gb) {
+    Debugger* debug = gb->debug;
+    if (!debug) return;
+
+    gb->debug = NULL;
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        if (gb->mem.debug_watch[page]) mem_debug_watch(gb, page, 0);
+    }
+    drop_blocks(gb);
+    free(debug);
+}
+
+void debug_set_breakpoint(GB* gb, uint16_t address, bool enabled) {
+    Debugger* debug = gb->debug;
+    if (!debug || (bool)BIT_SET(debug->breakpoints, address) == enabled) return;
+
+    set_bit(debug->breakpoints, address, enabled);
+    drop_blocks(gb);
+}
+
+void debug_set_watchpoint(GB* gb, uint16_t address, uint8_t kinds, bool enabled) {
+    Debugger* debug = gb->debug;
+    if (!debug) return;
+
+    bool before = BIT_SET(debug->read_watch, address) || BIT_SET(debug->write_watch, address);
+    if (kinds & MEM_WATCH_READ) set_bit(debug->read_watch, address, enabled);
+    if (kinds & MEM_WATCH_WRITE) set_bit(debug->write_watch, address, enabled);
+    bool after = BIT_SET(debug->read_watch, address) || BIT_SET(debug->write_watch, address);
+
+    mem_debug_watch(gb, address >> 8, page_flags(debug, address >> 8));
+    if (before == after) return;
+
+    if (after) {
+        debug->watch_count++;
+    } else {
+        debug->watch_count--;
+    }
+    // Blocks end after every instruction while any watchpoint is set
+    if (debug->watch_count == (after ? 1u : 0u)) drop_blocks(gb);
+}
+
+void debug_resume(GB* gb) {
+    Debugger* debug = gb->debug;
+    if (!debug) return;
+
+    debug->stop = DEBUG_RUNNING;
+    debug->resuming = true;
+    debug->resume_pc = gb->cpu.pc;
+}
+
+cpu_status_t debug_step(GB* gb) {
+    Debugger* debug = gb->debug;
+
+    debug_resume(gb);
+    debug->stepping = true;
+    drop_blocks(gb);
+
+    cpu_status_t status = CPU_BUDGET_DONE;
+    while (status == CPU_BUDGET_DONE) status = cpu_run(gb, GB_FRAME_CYCLES);
+
+    debug->stepping = false;
+    drop_blocks(gb);
+    return status;
+}
+
+bool debug_splits_before(const Debugger* debug, uint16_t address) {
+    return debug->watch_count || debug->stepping || BIT_SET(debug->breakpoints, address);
+}
+
+bool debug_should_stop(GB* gb) {
+    Debugger* debug = gb->debug;
+    uint16_t pc = gb->cpu.pc;
+
+    if (debug->stop != DEBUG_RUNNING) return true;
+
+    bool resumed = debug->resuming && debug->resume_pc == pc;
+    debug->resuming = false;
+    if (resumed) return false;
+
+    if (debug->stepping) {
+        debug->stop = DEBUG_STEP;
+        debug->stop_address = pc;
+        return true;
+    }
+    if (!BIT_SET(debug->breakpoints, pc)) return false;
+
+    debug->stop = DEBUG_BREAKPOINT;
+    debug->stop_address = pc;
+    return true;
+}
+
+void debug_access(GB* gb, uint16_t address, bool write) {
+    Debugger* debug = gb->debug;
+    if (!debug || debug->quiet || debug->stop != DEBUG_RUNNING) return;
+
+    bool read_watched = BIT_SET(debug->read_watch, address);
+    bool write_watched = BIT_SET(debug->write_watch, address);
+    if (!(write ? write_watched : read_watched)) return;
+
+    debug->stop = read_watched && write_watched ? DEBUG_ACCESS_WATCH : write ? DEBUG_WRITE_WATCH : DEBUG_READ_WATCH;
+    debug->stop_address = address;
+}
+
+uint8_t debug_peek(GB* gb, uint16_t address) {
+    Debugger* debug = gb->debug;
+    bool quiet = debug->quiet;
+
+    debug->quiet = true;
+    uint8_t value = mem_read(gb, address);
+    debug->quiet = quiet;
+    return value;
+}
+
+void debug_poke(GB* gb, uint16_t address, uint8_t value) {
+    Debugger* debug = gb->debug;
+    bool quiet = debug->quiet;
+
+    debug->quiet = true;
+    mem_write(gb, address, value);
+    debug->quiet = quiet;
+}
+
+void debug_restore_watches(GB* gb) {
+    Debugger* debug = gb->debug;
+    if (!debug || debug->watch_count == 0) return;
+
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        uint8_t flags = page_flags(debug, page);
+        if (flags) mem_debug_watch(gb, page, flags);
+    }
+}
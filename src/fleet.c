@@ -0,0 +1,119 @@
+//
+// Created by davidg on 21.07.25.
+//
+
+#include <fleet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Range [head, tail) of machine indices, packed into one word so the owner
+ * (popping at the head) and thieves (popping at the tail) agree with a single CAS.
+ */
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} Shard;
+
+typedef struct {
+    GB* const* machines;
+    Shard* shards;
+    unsigned workers;
+    uint32_t cycles;
+} Fleet;
+
+typedef struct {
+    Fleet* fleet;
+    unsigned id;
+} Worker;
+
+#define RANGE(head, tail) (((uint64_t)(head) << 32) | (uint32_t)(tail))
+#define RANGE_HEAD(range) ((uint32_t)((range) >> 32))
+#define RANGE_TAIL(range) ((uint32_t)(range))
+
+static bool shard_pop(Shard* shard, bool from_tail, uint32_t* index) {
+    uint64_t range = atomic_load(&shard->range);
+
+    for (;;) {
+        uint32_t head = RANGE_HEAD(range);
+        uint32_t tail = RANGE_TAIL(range);
+        if (head >= tail) return false;
+
+        uint64_t next = from_tail ? RANGE(head, tail - 1) : RANGE(head + 1, tail);
+        if (atomic_compare_exchange_weak(&shard->range, &range, next)) {
+            *index = from_tail ? tail - 1 : head;
+            return true;
+        }
+    }
+}
+
+static void run_machine(GB* gb, uint32_t cycles) {
+    // A machine that halts or hits an unknown opcode simply stops early
+    cpu_run(gb, cycles);
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    Fleet* fleet = worker->fleet;
+    uint32_t index;
+
+    // Own shard first, front to back
+    while (shard_pop(&fleet->shards[worker->id], false, &index)) {
+        run_machine(fleet->machines[index], fleet->cycles);
+    }
+
+    // Then steal from the back of the others until everything is drained
+    for (unsigned n = 1; n < fleet->workers; n++) {
+        Shard* victim = &fleet->shards[(worker->id + n) % fleet->workers];
+        while (shard_pop(victim, true, &index)) {
+            run_machine(fleet->machines[index], fleet->cycles);
+        }
+    }
+
+    return NULL;
+}
+
+void fleet_run(GB* const* machines, size_t count, unsigned workers, uint32_t cycles) {
+    if (count == 0) return;
+
+    if (workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (unsigned)cores : 1;
+    }
+    if (workers > count) workers = (unsigned)count;
+
+    Shard* shards = aligned_alloc(_Alignof(Shard), workers * sizeof(Shard));
+    pthread_t* threads = malloc(workers * sizeof(pthread_t));
+    Worker* pool = malloc(workers * sizeof(Worker));
+    if (!shards || !threads || !pool) {
+        perror("Fehler beim Anlegen des Thread-Pools");
+        exit(1);
+    }
+
+    Fleet fleet = { machines, shards, workers, cycles };
+    for (unsigned i = 0; i < workers; i++) {
+        size_t head = count * i / workers;
+        size_t tail = count * (i + 1) / workers;
+        atomic_init(&shards[i].range, RANGE(head, tail));
+        pool[i] = (Worker){ &fleet, i };
+    }
+
+    // Worker 0 is the calling thread
+    for (unsigned i = 1; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, worker_main, &pool[i]) != 0) {
+            perror("Fehler beim Starten eines Worker-Threads");
+            exit(1);
+        }
+    }
+    worker_main(&pool[0]);
+    for (unsigned i = 1; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(pool);
+    free(threads);
+    free(shards);
+}
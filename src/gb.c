@@ -0,0 +1,89 @@
+//
+// Created by davidg on 21.07.25.
+//
+
+#include <gb.h>
+#include <interrupt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Everything but the contents of Memory.data
+static void init_machine(GB* gb) {
+    memset(&gb->cart, 0, sizeof(gb->cart));
+    memory_map_default(gb);
+    cpu_init(&gb->cpu);
+    sched_init(gb);
+    interrupt_init(gb);
+    timer_init(gb);
+    gb->ppu.reference = false;
+    gb->ppu.kernel = ppu_best_kernel();
+    gb->ppu.pipe = NULL;
+    ppu_init(gb);
+    gb->blocks = NULL;
+    gb->jit = NULL;
+    gb->jit_enabled = false;
+    gb->aot = NULL;
+    gb->idle_skip = false;
+    gb->debug = NULL;
+    gb->state = NULL;
+    gb->rewind = NULL;
+    gb->trace = NULL;
+    gb->profile = NULL;
+}
+
+static GB* allocate(void) {
+    GB* gb = malloc(sizeof(GB));
+    if (!gb) {
+        perror("Fehler beim Anlegen der Maschine");
+        exit(1);
+    }
+    return gb;
+}
+
+void gb_init(GB* gb) {
+    memset(gb->mem.data, 0, sizeof(gb->mem.data));
+    init_machine(gb);
+}
+
+GB* gb_create(void) {
+    GB* gb = allocate();
+    gb_init(gb);
+    return gb;
+}
+
+GB* gb_create_unmapped(void) {
+    GB* gb = allocate();
+    init_machine(gb);
+    return gb;
+}
+
+void gb_destroy(GB* gb) {
+    debug_detach(gb);
+    ppu_pipeline_stop(gb);
+    trace_stop(gb);
+    profile_stop(gb);
+    rewind_detach(gb);
+    cart_unload(gb);
+    if (gb->state) state_release(gb->state);
+    aot_unload(gb);
+    jit_destroy(gb->jit);
+    block_cache_destroy(gb->blocks);
+    free(gb);
+}
+
+GB* gb_fork(GB* gb) {
+    SaveState* state = state_capture(gb);
+    GB* clone = state_fork(state);
+    state_release(state);
+
+    if (clone && gb->jit_enabled) jit_set_enabled(clone, true);
+    if (clone && gb->aot) aot_load(clone, gb->aot->path);
+    if (clone) {
+        clone->idle_skip = gb->idle_skip;
+        clone->ppu.reference = gb->ppu.reference;
+        clone->ppu.kernel = gb->ppu.kernel;
+        if (gb->ppu.pipe) ppu_pipeline_start(clone);
+    }
+    return clone;
+}
@@ -0,0 +1,404 @@
+//
+// Created by davidg on 06.09.25.
+//
+
+#include <gdb_stub.h>
+#include <gb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define PACKET_SIZE 4096
+#define REGISTER_COUNT 6 // AF, BC, DE, HL, SP, PC
+
+typedef struct {
+    GB* gb;
+    int fd;
+    char packet[PACKET_SIZE];
+    char reply[PACKET_SIZE];
+    cpu_status_t status; // of the last run, for '?'
+} Session;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parses hex digits up to the first other character, which `end` is left pointing at
+static unsigned long parse_hex(const char* text, const char** end) {
+    unsigned long value = 0;
+    int digit;
+    while ((digit = hex_value(*text)) >= 0) {
+        value = value << 4 | digit;
+        text++;
+    }
+    if (end) *end = text;
+    return value;
+}
+
+static char* put_byte(char* out, uint8_t value) {
+    *out++ = hex_digits[value >> 4];
+    *out++ = hex_digits[value & 0x0F];
+    return out;
+}
+
+static bool send_all(int fd, const char* data, size_t size) {
+    while (size) {
+        ssize_t sent = send(fd, data, size, 0);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool send_packet(Session* session, const char* body) {
+    char frame[PACKET_SIZE + 4];
+    uint8_t checksum = 0;
+    size_t length = strlen(body);
+
+    frame[0] = '$';
+    for (size_t i = 0; i < length; i++) checksum += (uint8_t)body[i];
+    memcpy(frame + 1, body, length);
+    frame[length + 1] = '#';
+    put_byte(frame + length + 2, checksum);
+    return send_all(session->fd, frame, length + 4);
+}
+
+static int read_byte(int fd) {
+    uint8_t byte;
+    return recv(fd, &byte, 1, 0) == 1 ? byte : -1;
+}
+
+// Next packet into session->packet, acknowledged. 0x03 (Ctrl-C) outside a packet is ignored
+static bool receive_packet(Session* session) {
+    int c;
+    for (;;) {
+        do {
+            c = read_byte(session->fd);
+            if (c < 0) return false;
+        } while (c != '$');
+
+        size_t length = 0;
+        uint8_t checksum = 0;
+        while ((c = read_byte(session->fd)) >= 0 && c != '#') {
+            if (length + 1 < PACKET_SIZE) session->packet[length++] = (char)c;
+            checksum += (uint8_t)c;
+        }
+        int high = read_byte(session->fd), low = read_byte(session->fd);
+        if (c < 0 || high < 0 || low < 0) return false;
+        session->packet[length] = '\0';
+
+        bool valid = hex_value((char)high) << 4 == (checksum & 0xF0) && hex_value((char)low) == (checksum & 0x0F);
+        if (!send_all(session->fd, valid ? "+" : "-", 1)) return false;
+        if (valid) return true;
+    }
+}
+
+// Ctrl-C from the client while the CPU runs
+static bool interrupted(int fd) {
+    struct pollfd poll_fd = { .fd = fd, .events = POLLIN };
+    if (poll(&poll_fd, 1, 0) <= 0) return false;
+
+    uint8_t byte;
+    return recv(fd, &byte, 1, MSG_PEEK) == 1 && byte == 0x03 && read_byte(fd) == 0x03;
+}
+
+static uint16_t get_register(const CPU* cpu, unsigned index) {
+    switch (index) {
+        case 0: return cpu->a << 8 | cpu_flags(cpu);
+        case 1: return cpu->b << 8 | cpu->c;
+        case 2: return cpu->d << 8 | cpu->e;
+        case 3: return cpu->h << 8 | cpu->l;
+        case 4: return cpu->sp;
+        default: return cpu->pc;
+    }
+}
+
+static void set_register(CPU* cpu, unsigned index, uint16_t value) {
+    switch (index) {
+        case 0: cpu->a = value >> 8; cpu_set_flags(cpu, value & 0xF0); break;
+        case 1: cpu->b = value >> 8; cpu->c = value & 0xFF; break;
+        case 2: cpu->d = value >> 8; cpu->e = value & 0xFF; break;
+        case 3: cpu->h = value >> 8; cpu->l = value & 0xFF; break;
+        case 4: cpu->sp = value; break;
+        default: cpu->pc = value; break;
+    }
+}
+
+// Registers travel little endian
+static uint16_t parse_register(const char* text) {
+    unsigned long value = parse_hex(text, NULL);
+    return (uint16_t)((value >> 8 & 0xFF) | (value & 0xFF) << 8);
+}
+
+// Stop reply for the last run: T05 with the watchpoint that hit, S04 for an unknown opcode, S02 for Ctrl-C
+static void stop_reply(Session* session, bool was_interrupted) {
+    const Debugger* debug = session->gb->debug;
+    const char* watch = NULL;
+
+    switch (debug->stop) {
+        case DEBUG_READ_WATCH: watch = "rwatch"; break;
+        case DEBUG_WRITE_WATCH: watch = "watch"; break;
+        case DEBUG_ACCESS_WATCH: watch = "awatch"; break;
+        default: break;
+    }
+
+    if (was_interrupted) {
+        strcpy(session->reply, "S02");
+    } else if (session->status == CPU_UNKNOWN_OPCODE) {
+        strcpy(session->reply, "S04");
+    } else if (watch) {
+        snprintf(session->reply, PACKET_SIZE, "T05%s:%04x;", watch, debug->stop_address);
+    } else {
+        strcpy(session->reply, "S05");
+    }
+}
+
+static void run(Session* session, bool step) {
+    GB* gb = session->gb;
+    bool was_interrupted = false;
+
+    if (step) {
+        session->status = debug_step(gb);
+    } else {
+        debug_resume(gb);
+        do {
+            session->status = cpu_run(gb, GB_FRAME_CYCLES);
+            was_interrupted = session->status == CPU_BUDGET_DONE && interrupted(session->fd);
+        } while (session->status == CPU_BUDGET_DONE && !was_interrupted);
+    }
+    stop_reply(session, was_interrupted);
+}
+
+// Z/z packets: type,address,kind
+static void set_point(Session* session, const char* args, bool enabled) {
+    const char* end;
+    unsigned long type = parse_hex(args, &end);
+    if (*end != ',') {
+        strcpy(session->reply, "E01");
+        return;
+    }
+    uint16_t address = (uint16_t)parse_hex(end + 1, NULL);
+
+    switch (type) {
+        case 0:
+        case 1: debug_set_breakpoint(session->gb, address, enabled); break;
+        case 2: debug_set_watchpoint(session->gb, address, MEM_WATCH_WRITE, enabled); break;
+        case 3: debug_set_watchpoint(session->gb, address, MEM_WATCH_READ, enabled); break;
+        case 4: debug_set_watchpoint(session->gb, address, MEM_WATCH_READ | MEM_WATCH_WRITE, enabled); break;
+        default:
+            session->reply[0] = '\0'; // not supported
+            return;
+    }
+    strcpy(session->reply, "OK");
+}
+
+static void read_memory(Session* session, const char* args) {
+    const char* end;
+    unsigned long address = parse_hex(args, &end);
+    unsigned long length = *end == ',' ? parse_hex(end + 1, NULL) : 0;
+    if (length > (PACKET_SIZE - 1) / 2) length = (PACKET_SIZE - 1) / 2;
+
+    char* out = session->reply;
+    for (unsigned long i = 0; i < length; i++) out = put_byte(out, debug_peek(session->gb, (uint16_t)(address + i)));
+    *out = '\0';
+}
+
+static void write_memory(Session* session, const char* args) {
+    const char* end;
+    unsigned long address = parse_hex(args, &end);
+    unsigned long length = *end == ',' ? parse_hex(end + 1, &end) : 0;
+    const char* data = end + 1;
+    // Length is bounded before it is doubled, and every digit is checked before the first byte is poked
+    if (*end != ':' || length > (PACKET_SIZE - 1) / 2 || length > strlen(data) / 2) {
+        strcpy(session->reply, "E01");
+        return;
+    }
+    for (unsigned long i = 0; i < length * 2; i++) {
+        if (hex_value(data[i]) < 0) {
+            strcpy(session->reply, "E01");
+            return;
+        }
+    }
+
+    for (unsigned long i = 0; i < length; i++) {
+        uint8_t value = hex_value(data[2 * i]) << 4 | hex_value(data[2 * i + 1]);
+        debug_poke(session->gb, (uint16_t)(address + i), value);
+    }
+    strcpy(session->reply, "OK");
+}
+
+// Handles one packet, false ends the session
+static bool handle(Session* session) {
+    const char* packet = session->packet;
+    CPU* cpu = &session->gb->cpu;
+    char* reply = session->reply;
+    reply[0] = '\0'; // empty reply: not supported
+
+    switch (packet[0]) {
+        case '?':
+            stop_reply(session, false);
+            break;
+        case 'g':
+            for (unsigned i = 0; i < REGISTER_COUNT; i++) {
+                uint16_t value = get_register(cpu, i);
+                reply = put_byte(put_byte(reply, value & 0xFF), value >> 8);
+            }
+            *reply = '\0';
+            break;
+        case 'G':
+            for (unsigned i = 0; i < REGISTER_COUNT && strlen(packet + 1) >= 4 * (i + 1); i++) {
+                char value[5] = { 0 };
+                memcpy(value, packet + 1 + 4 * i, 4);
+                set_register(cpu, i, parse_register(value));
+            }
+            strcpy(reply, "OK");
+            break;
+        case 'p': {
+            unsigned long index = parse_hex(packet + 1, NULL);
+            if (index < REGISTER_COUNT) {
+                uint16_t value = get_register(cpu, index);
+                put_byte(put_byte(reply, value & 0xFF), value >> 8)[0] = '\0';
+            } else {
+                strcpy(reply, "xxxx"); // unavailable
+            }
+            break;
+        }
+        case 'P': {
+            const char* end;
+            unsigned long index = parse_hex(packet + 1, &end);
+            if (index < REGISTER_COUNT && *end == '=') set_register(cpu, index, parse_register(end + 1));
+            strcpy(reply, "OK");
+            break;
+        }
+        case 'm':
+            read_memory(session, packet + 1);
+            break;
+        case 'M':
+            write_memory(session, packet + 1);
+            break;
+        case 'c':
+        case 's':
+            if (packet[1]) cpu->pc = (uint16_t)parse_hex(packet + 1, NULL);
+            run(session, packet[0] == 's');
+            break;
+        case 'Z':
+        case 'z':
+            set_point(session, packet + 1, packet[0] == 'Z');
+            break;
+        case 'H':
+            strcpy(reply, "OK");
+            break;
+        case 'q':
+            if (strncmp(packet, "qSupported", 10) == 0) {
+                snprintf(reply, PACKET_SIZE, "PacketSize=%x", PACKET_SIZE - 1);
+            } else if (strcmp(packet, "qAttached") == 0) {
+                strcpy(reply, "1");
+            }
+            break;
+        case 'D':
+            send_packet(session, "OK");
+            return false;
+        case 'k':
+            return false;
+        default:
+            break;
+    }
+    return send_packet(session, session->reply);
+}
+
+// Listening socket for `address`, -1 with errno set on failure
+static int open_listener(const char* address) {
+    int fd;
+
+    if (strchr(address, '/')) {
+        struct sockaddr_un local = { .sun_family = AF_UNIX };
+        if (strlen(address) >= sizeof(local.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(local.sun_path, address);
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        // Only ever on the loopback interface, the stub reads and writes guest memory for anyone
+        const char* port = strrchr(address, ':');
+        struct sockaddr_in local = {
+            .sin_family = AF_INET,
+            .sin_port = htons((uint16_t)strtoul(port ? port + 1 : address, NULL, 10)),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        int reuse = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool gdb_serve(GB* gb, const char* address) {
+    int listener = open_listener(address);
+    if (listener < 0) return false;
+
+    printf("Warte auf GDB an %s\n", address);
+    fflush(stdout);
+    int fd = accept(listener, NULL, NULL);
+    close(listener);
+    if (strchr(address, '/')) unlink(address);
+    if (fd < 0) return false;
+
+    Session* session = malloc(sizeof(Session));
+    if (!session) {
+        perror("Fehler beim Anlegen der GDB-Sitzung");
+        exit(1);
+    }
+    *session = (Session){ .gb = gb, .fd = fd, .status = CPU_OK };
+
+    debug_attach(gb);
+    while (receive_packet(session) && handle(session)) {
+    }
+    debug_detach(gb);
+
+    close(fd);
+    free(session);
+    return true;
+}
+
+#else
+
+bool gdb_serve(GB* gb, const char* address) {
+    fprintf(stderr, "GDB-Stub wird auf dieser Plattform nicht unterstützt\n");
+    return false;
+}
+
+#endif
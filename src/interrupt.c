@@ -0,0 +1,53 @@
+//
+// Created by davidg on 15.08.25.
+//
+
+#include <interrupt.h>
+#include <gb.h>
+#include <scheduler.h>
+
+#define INTERRUPT_CYCLES 20
+
+static uint8_t if_read(GB* gb, uint16_t address) {
+    return gb->mem.data[address] | 0xE0; // upper bits are not wired
+}
+
+static void irq_write(GB* gb, uint16_t address, uint8_t value) {
+    gb->mem.data[address] = value;
+    sched_schedule(gb, EVENT_IRQ, gb->cpu.cycles);
+}
+
+void interrupt_init(GB* gb) {
+    mem_map_io(gb, IF_ADDR, if_read, irq_write);
+    mem_map_io(gb, IE_ADDR, NULL, irq_write);
+}
+
+void interrupt_request(GB* gb, interrupt_t irq) {
+    gb->mem.data[IF_ADDR] |= 1u << irq;
+    sched_schedule(gb, EVENT_IRQ, gb->cpu.cycles);
+}
+
+void interrupt_dispatch(GB* gb) {
+    CPU* cpu = &gb->cpu;
+    uint8_t pending = gb->mem.data[IE_ADDR] & gb->mem.data[IF_ADDR] & 0x1F;
+    if (!pending) return;
+
+    cpu->halted = 0;
+    if (!cpu->ime) return;
+
+    unsigned irq = __builtin_ctz(pending); // lowest bit has the highest priority
+    gb->mem.data[IF_ADDR] &= ~(1u << irq);
+    cpu->ime = 0;
+
+    if (gb->profile) profile_interrupt(gb, 0x40 + 8 * irq);
+    cpu->sp -= 2;
+    mem_write(gb, cpu->sp, cpu->pc & 0xFF);
+    mem_write(gb, cpu->sp + 1, cpu->pc >> 8);
+    cpu->pc = 0x40 + 8 * irq;
+    cpu->cycles += INTERRUPT_CYCLES;
+}
+
+void interrupt_enable(GB* gb) {
+    gb->cpu.ime = 1;
+    interrupt_dispatch(gb);
+}
@@ -0,0 +1,931 @@
+//
+// Created by davidg on 04.08.25.
+//
+
+#include <jit.h>
+#include <gb.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(LR35902_JIT) && defined(__x86_64__) && defined(__unix__)
+#define JIT_X86_64
+#include <cpuid.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef JIT_X86_64
+
+#define JIT_MAX_BLOCK_BYTES 8192 // upper bound for one translated block
+
+/*
+ * Register allocation inside a translated block:
+ *   rdi        GB*
+ *   rbx        flag_table
+ *   r8b..r15b  A F B C D E H L
+ *   bp         SP
+ *   rax, rcx, rdx, rsi  scratch, cl holds (HL) operands
+ * Guest registers are loaded once on entry and stored back on every exit
+ * and around every call into C.
+ */
+
+// Guest register numbers as encoded in the opcode bits: B C D E H L (HL) A, plus F and SP
+enum { G_B, G_C, G_D, G_E, G_H, G_L, G_HLP, G_A, G_F, G_SP, G_COUNT };
+
+#define HOST_AL 0
+#define HOST_CL 1
+#define HOST_DX 2
+#define HOST_BP 5
+#define HOST_SI 6
+
+static const uint8_t host_reg[G_COUNT] = {
+    [G_A] = 8, [G_F] = 9, [G_B] = 10, [G_C] = 11,
+    [G_D] = 12, [G_E] = 13, [G_H] = 14, [G_L] = 15,
+    [G_HLP] = HOST_CL, [G_SP] = HOST_BP,
+};
+
+static const uint8_t guest_offset[G_COUNT] = {
+    [G_A] = offsetof(GB, cpu.a), [G_F] = offsetof(GB, cpu.f),
+    [G_B] = offsetof(GB, cpu.b), [G_C] = offsetof(GB, cpu.c),
+    [G_D] = offsetof(GB, cpu.d), [G_E] = offsetof(GB, cpu.e),
+    [G_H] = offsetof(GB, cpu.h), [G_L] = offsetof(GB, cpu.l),
+    [G_SP] = offsetof(GB, cpu.sp),
+};
+
+// 16-bit pairs in opcode bits 4-5, the last one is SP or AF depending on the opcode
+static const uint8_t pair_hi[4] = { G_B, G_D, G_H, G_A };
+static const uint8_t pair_lo[4] = { G_C, G_E, G_L, G_F };
+
+#define REG_BIT(r) (1u << (r))
+#define HL_BITS (REG_BIT(G_H) | REG_BIT(G_L))
+
+// x86 opcodes of the "op r/m8, r8" form
+#define X86_ADD 0x00
+#define X86_OR  0x08
+#define X86_ADC 0x10
+#define X86_SBB 0x18
+#define X86_AND 0x20
+#define X86_SUB 0x28
+#define X86_XOR 0x30
+#define X86_CMP 0x38
+#define X86_MOV 0x88
+
+/**
+ * LAHF leaves SF ZF - AF - PF - CF in AH. Indexed by AH, this gives the
+ * matching Z H C bits of the GB flag register; the second half also sets N.
+ */
+#define LAHF_TO_F(ah) (((ah) & 0x40 ? FLAG_Z : 0) | ((ah) & 0x10 ? FLAG_H : 0) | ((ah) & 0x01 ? FLAG_C : 0))
+#define FT4(ah, n) LAHF_TO_F(ah) | (n), LAHF_TO_F((ah) + 1) | (n), LAHF_TO_F((ah) + 2) | (n), LAHF_TO_F((ah) + 3) | (n)
+#define FT16(ah, n) FT4(ah, n), FT4((ah) + 4, n), FT4((ah) + 8, n), FT4((ah) + 12, n)
+#define FT64(ah, n) FT16(ah, n), FT16((ah) + 16, n), FT16((ah) + 32, n), FT16((ah) + 48, n)
+#define FT256(n) FT64(0, n), FT64(64, n), FT64(128, n), FT64(192, n)
+
+static const uint8_t flag_table[512] = { FT256(0), FT256(FLAG_N) };
+
+typedef enum {
+    K_UNSUPPORTED,
+    K_NOP,
+    K_LD_R_R,     // LD r,r' and LD r,(HL)
+    K_LD_R_D8,
+    K_LD_HLP,     // LD (HL),r and LD (HL),d8
+    K_ALU_R,      // ADD/ADC/SUB/SBC/AND/XOR/OR/CP A,r and A,(HL)
+    K_ALU_D8,     // the same with an immediate
+    K_INC_DEC,    // INC r, DEC r and the (HL) forms
+    K_INC_DEC16,  // INC rr and DEC rr
+    K_LD_RR_D16,  // LD rr,d16 and LD SP,HL
+    K_STORE_A,    // LD (BC),A  LD (DE),A  LD (HL+),A  LD (HL-),A  LD (a16),A
+    K_LOAD_A,     // the same loads the other way round
+    K_STORE_IO,   // LDH (a8),A and LD (C),A
+    K_LOAD_IO,    // LDH A,(a8) and LD A,(C)
+    K_PUSH,
+    K_POP,
+    // Everything from here on ends the block
+    K_JP_A16,
+    K_JR,         // JR r8 and JR cc,r8
+    K_CALL,       // CALL a16 and CALL cc,a16
+    K_RET,        // RET and RET cc
+} Kind;
+
+typedef struct {
+    uint8_t* p;
+    unsigned touched;   // guest registers held in host registers
+    const Block* block;
+    uint32_t cycles;    // base cycles of all translated instructions
+} Emitter;
+
+// Slow paths of the stack accesses, SP already points at the two bytes
+static void slow_push(GB* gb, uint16_t value) {
+    mem_write(gb, gb->cpu.sp, value & 0xFF);
+    mem_write(gb, gb->cpu.sp + 1, value >> 8);
+}
+
+static uint16_t slow_pop(GB* gb) {
+    return mem_read(gb, gb->cpu.sp) | mem_read(gb, gb->cpu.sp + 1) << 8;
+}
+
+static void emit8(Emitter* e, uint8_t byte) { *e->p++ = byte; }
+static void emit16(Emitter* e, uint16_t value) { memcpy(e->p, &value, 2); e->p += 2; }
+static void emit32(Emitter* e, uint32_t value) { memcpy(e->p, &value, 4); e->p += 4; }
+static void emit64(Emitter* e, uint64_t value) { memcpy(e->p, &value, 8); e->p += 8; }
+
+// ModRM (+ displacement) for [rdi + disp]
+static void emit_rdi_disp(Emitter* e, uint8_t reg, uint32_t disp) {
+    if (disp < 0x80) {
+        emit8(e, 0x40 | (reg & 7) << 3 | 7);
+        emit8(e, disp);
+    } else {
+        emit8(e, 0x80 | (reg & 7) << 3 | 7);
+        emit32(e, disp);
+    }
+}
+
+static void emit_rr8(Emitter* e, uint8_t opcode, uint8_t dst, uint8_t src) {
+    emit8(e, 0x40 | (src >= 8 ? 0x04 : 0) | (dst >= 8 ? 0x01 : 0));
+    emit8(e, opcode);
+    emit8(e, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+// 0x80 /digit ib
+static void emit_ri8(Emitter* e, uint8_t digit, uint8_t reg, uint8_t imm) {
+    emit8(e, 0x40 | (reg >= 8 ? 0x01 : 0));
+    emit8(e, 0x80);
+    emit8(e, 0xC0 | digit << 3 | (reg & 7));
+    emit8(e, imm);
+}
+
+static void emit_mov_ri8(Emitter* e, uint8_t reg, uint8_t imm) {
+    emit8(e, 0x40 | (reg >= 8 ? 0x01 : 0));
+    emit8(e, 0xB0 | (reg & 7));
+    emit8(e, imm);
+}
+
+// movzx dst32, reg8
+static void emit_movzx8(Emitter* e, uint8_t dst, uint8_t reg) {
+    emit8(e, 0x40 | (reg >= 8 ? 0x01 : 0));
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0xC0 | dst << 3 | (reg & 7));
+}
+
+static void emit_load_guest(Emitter* e, int g) {
+    if (g == G_SP) {
+        emit8(e, 0x66);
+        emit8(e, 0x8B);
+    } else {
+        emit8(e, 0x40 | (host_reg[g] >= 8 ? 0x04 : 0));
+        emit8(e, 0x8A);
+    }
+    emit_rdi_disp(e, host_reg[g], guest_offset[g]);
+}
+
+static void emit_store_guest(Emitter* e, int g) {
+    if (g == G_SP) {
+        emit8(e, 0x66);
+        emit8(e, 0x89);
+    } else {
+        emit8(e, 0x40 | (host_reg[g] >= 8 ? 0x04 : 0));
+        emit8(e, 0x88);
+    }
+    emit_rdi_disp(e, host_reg[g], guest_offset[g]);
+}
+
+static void emit_guest_regs(Emitter* e, bool store) {
+    for (int g = 0; g < G_COUNT; g++) {
+        if (g == G_HLP || !(e->touched & REG_BIT(g))) continue;
+        if (store) {
+            emit_store_guest(e, g);
+        } else {
+            emit_load_guest(e, g);
+        }
+    }
+}
+
+static uint8_t* emit_jcc32(Emitter* e, uint8_t cc) {
+    emit8(e, 0x0F);
+    emit8(e, cc);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+static uint8_t* emit_jmp32(Emitter* e) {
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+static void patch_jump(Emitter* e, uint8_t* rel) {
+    int32_t distance = (int32_t)(e->p - (rel + 4));
+    memcpy(rel, &distance, 4);
+}
+
+static void emit_set_pc(Emitter* e, uint16_t pc) {
+    emit8(e, 0x66); // mov word [rdi + pc], imm16
+    emit8(e, 0xC7);
+    emit_rdi_disp(e, 0, offsetof(GB, cpu.pc));
+    emit16(e, pc);
+}
+
+static void emit_add_cycles(Emitter* e, uint32_t cycles) {
+    if (!cycles) return;
+    emit8(e, 0x48); // add qword [rdi + cycles], imm32
+    emit8(e, 0x81);
+    emit_rdi_disp(e, 0, offsetof(GB, cpu.cycles));
+    emit32(e, cycles);
+}
+
+// Stores the guest registers and returns, PC has to be written already
+static void emit_leave(Emitter* e, uint32_t cycles) {
+    emit_guest_regs(e, true);
+
+    // Cycle accounting happens once per exit
+    emit_add_cycles(e, cycles);
+
+    emit8(e, 0x41); emit8(e, 0x5F); // pop r15
+    emit8(e, 0x41); emit8(e, 0x5E); // pop r14
+    emit8(e, 0x41); emit8(e, 0x5D); // pop r13
+    emit8(e, 0x41); emit8(e, 0x5C); // pop r12
+    emit8(e, 0x5D);                 // pop rbp
+    emit8(e, 0x5B);                 // pop rbx
+    emit8(e, 0xC3);                 // ret
+}
+
+static void emit_exit(Emitter* e, uint16_t pc, uint32_t cycles) {
+    emit_set_pc(e, pc);
+    emit_leave(e, cycles);
+}
+
+/*
+ * Calls `function`(gb, esi, edx) the way the interpreter calls a handler:
+ * guest registers in the GB, PC past the instruction and the cycles up to
+ * its end accounted. A result stays in eax. emit_resume undoes the cycles.
+ */
+static void emit_call(Emitter* e, uintptr_t function, uint16_t next_pc, uint32_t through) {
+    emit_guest_regs(e, true);
+    emit_set_pc(e, next_pc);
+    emit_add_cycles(e, through);
+
+    emit8(e, 0x57);                                     // push rdi, also aligns the stack
+    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, function); // mov rax, function
+    emit8(e, 0xFF); emit8(e, 0xD0);                     // call rax
+    emit8(e, 0x5F);                                     // pop rdi
+    emit_guest_regs(e, false);
+}
+
+/*
+ * After a call into C, with the instruction complete. The call may have
+ * overwritten this block (`wrote`) or scheduled an event before its end:
+ * then the block is left at the next instruction, where the interpreter
+ * would stop too. Otherwise it goes on. Returns the jump to the code that
+ * follows.
+ */
+static uint8_t* emit_resume(Emitter* e, uint16_t next_pc, uint32_t through, bool wrote) {
+    uint8_t* stop[2];
+    int stops = 0;
+
+    if (wrote) {
+        emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uintptr_t)&e->block->valid); // mov rax, &block->valid
+        emit8(e, 0x80); emit8(e, 0x38); emit8(e, 0);                             // cmp byte [rax], 0
+        stop[stops++] = emit_jcc32(e, 0x84);                                     // je
+    }
+
+    emit8(e, 0x48); emit8(e, 0x8B); emit_rdi_disp(e, 0, offsetof(GB, sched.next));  // mov rax, [rdi + next]
+    emit8(e, 0x48); emit8(e, 0x2B); emit_rdi_disp(e, 0, offsetof(GB, cpu.cycles)); // sub rax, [rdi + cycles]
+    emit8(e, 0x48); emit8(e, 0x3D); emit32(e, e->cycles - through);                 // cmp rax, cycles still to run
+    stop[stops++] = emit_jcc32(e, 0x8C);                                            // jl
+
+    emit8(e, 0x48); emit8(e, 0x81); emit_rdi_disp(e, 5, offsetof(GB, cpu.cycles)); // sub qword [rdi + cycles], imm32
+    emit32(e, through);
+    uint8_t* done = emit_jmp32(e);
+
+    for (int i = 0; i < stops; i++) patch_jump(e, stop[i]);
+    emit_exit(e, next_pc, 0);
+    return done;
+}
+
+// eax = hi:lo
+static void emit_get16(Emitter* e, int hi, int lo) {
+    emit_movzx8(e, HOST_AL, host_reg[hi]);
+    emit8(e, 0xC1); emit8(e, 0xE0); emit8(e, 8); // shl eax, 8
+    emit_rr8(e, X86_MOV, HOST_AL, host_reg[lo]);
+}
+
+// hi:lo = ax, eax is lost
+static void emit_set16(Emitter* e, int hi, int lo) {
+    emit_rr8(e, X86_MOV, host_reg[lo], HOST_AL);
+    emit8(e, 0xC1); emit8(e, 0xE8); emit8(e, 8); // shr eax, 8
+    emit_rr8(e, X86_MOV, host_reg[hi], HOST_AL);
+}
+
+// HL += delta, eax keeps the old HL
+static void emit_hl_step(Emitter* e, int8_t delta) {
+    emit8(e, 0x8D); emit8(e, 0x50); emit8(e, delta); // lea edx, [rax + delta]
+    emit_rr8(e, X86_MOV, host_reg[G_L], HOST_DX);
+    emit8(e, 0xC1); emit8(e, 0xEA); emit8(e, 8);     // shr edx, 8
+    emit_rr8(e, X86_MOV, host_reg[G_H], HOST_DX);
+}
+
+static void emit_sp_add(Emitter* e, int8_t delta) {
+    emit8(e, 0x66); emit8(e, 0x83); emit8(e, 0xC5); emit8(e, delta); // add bp, delta
+}
+
+// reg = page pointer in `table` for the address in eax, ZF if there is none
+static void emit_page(Emitter* e, uint8_t reg, uint32_t table) {
+    emit8(e, 0x89); emit8(e, 0xC2);                                            // mov edx, eax
+    emit8(e, 0xC1); emit8(e, 0xEA); emit8(e, 8);                               // shr edx, 8
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x84 | reg << 3); emit8(e, 0xD7); // mov reg, [rdi + rdx * 8 + table]
+    emit32(e, table);
+    emit8(e, 0x48); emit8(e, 0x85); emit8(e, 0xC0 | reg << 3 | reg);           // test reg, reg
+}
+
+// ecx = byte at the address in eax, or leave the block if its page has no direct pointer
+static void emit_load(Emitter* e, uint16_t pc, uint32_t cycles) {
+    emit_page(e, HOST_DX, offsetof(GB, mem.read_pages));
+    uint8_t* fast = emit_jcc32(e, 0x85); // jnz fast
+
+    // Slow path: the interpreter redoes this instruction through the handler
+    emit_exit(e, pc, cycles);
+
+    patch_jump(e, fast);
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);               // movzx eax, al
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x0C); emit8(e, 0x02); // movzx ecx, byte [rdx + rax]
+}
+
+/*
+ * [address in eax] = host register `reg` (or `imm` if reg < 0) through the
+ * write page table. Pages without a direct pointer (code, I/O, watched or
+ * shared pages) go through mem_write_slow like the interpreter's store.
+ */
+static void emit_store(Emitter* e, const DecodedOp* op, uint32_t cycles, int reg, uint8_t imm) {
+    emit_page(e, HOST_DX, offsetof(GB, mem.write_pages));
+    uint8_t* slow = emit_jcc32(e, 0x84);                   // jz slow
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC8);        // movzx ecx, al
+    if (reg < 0) {
+        emit8(e, 0xC6); emit8(e, 0x04); emit8(e, 0x0A); emit8(e, imm); // mov byte [rdx + rcx], imm8
+    } else {
+        emit8(e, 0x40 | (reg >= 8 ? 0x04 : 0)); emit8(e, 0x88);     // mov [rdx + rcx], reg
+        emit8(e, 0x04 | (reg & 7) << 3); emit8(e, 0x0A);
+    }
+    uint8_t* done = emit_jmp32(e);
+
+    patch_jump(e, slow);
+    emit8(e, 0x89); emit8(e, 0xC6); // mov esi, eax
+    if (reg < 0) {
+        emit8(e, 0xBA); emit32(e, imm); // mov edx, imm32
+    } else {
+        emit_movzx8(e, HOST_DX, reg);
+    }
+    emit_call(e, (uintptr_t)mem_write_slow, op->next_pc, cycles + op->cycles);
+    patch_jump(e, emit_resume(e, op->next_pc, cycles + op->cycles, true));
+    patch_jump(e, done);
+}
+
+// esi = 0xFF00 + a8, or + C for the (C) forms
+static void emit_io_address(Emitter* e, const DecodedOp* op) {
+    if ((op->opcode & 0x0F) == 0x02) {
+        emit_movzx8(e, HOST_SI, host_reg[G_C]);
+        emit8(e, 0x81); emit8(e, 0xCE); emit32(e, 0xFF00); // or esi, 0xFF00
+    } else {
+        emit8(e, 0xBE); emit32(e, 0xFF00 | (op->operand & 0xFF)); // mov esi, imm32
+    }
+}
+
+// The I/O page never has direct pointers, these go straight through the slow accessors
+static void emit_store_io(Emitter* e, const DecodedOp* op, uint32_t cycles) {
+    emit_movzx8(e, HOST_DX, host_reg[G_A]);
+    emit_call(e, (uintptr_t)mem_write_slow, op->next_pc, cycles + op->cycles);
+    patch_jump(e, emit_resume(e, op->next_pc, cycles + op->cycles, true));
+}
+
+static void emit_load_io(Emitter* e, const DecodedOp* op, uint32_t cycles) {
+    emit_call(e, (uintptr_t)mem_read_slow, op->next_pc, cycles + op->cycles);
+    emit_rr8(e, X86_MOV, host_reg[G_A], HOST_AL);
+    // Reading a register can catch up a device and move its next event
+    patch_jump(e, emit_resume(e, op->next_pc, cycles + op->cycles, false));
+}
+
+// rdx:rcx = page and offset of the two bytes at SP, jumps to `slow` if they straddle pages or have no direct pointer
+static void emit_stack_page(Emitter* e, uint32_t table, uint8_t* slow[2]) {
+    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0xC5); // movzx eax, bp
+    emit8(e, 0x3C); emit8(e, 0xFF);                 // cmp al, 0xFF
+    slow[0] = emit_jcc32(e, 0x84);                  // je slow
+    emit_page(e, HOST_DX, table);
+    slow[1] = emit_jcc32(e, 0x84);                  // jz slow
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC8); // movzx ecx, al
+}
+
+// SP -= 2 and the pair (or `value` if pair < 0) onto the stack. Returns the jump at the end of the fast path.
+static uint8_t* emit_push(Emitter* e, int pair, uint16_t value, uint16_t next_pc, uint32_t through) {
+    uint8_t* slow[2];
+
+    emit_sp_add(e, -2);
+    emit_stack_page(e, offsetof(GB, mem.write_pages), slow);
+    if (pair < 0) {
+        emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x04); emit8(e, 0x0A); emit16(e, value); // mov word [rdx + rcx], imm16
+    } else {
+        for (int i = 0; i < 2; i++) {
+            uint8_t reg = host_reg[i ? pair_hi[pair] : pair_lo[pair]];
+            emit8(e, 0x40 | (reg >= 8 ? 0x04 : 0)); emit8(e, 0x88);          // mov [rdx + rcx + i], reg
+            emit8(e, 0x44 | (reg & 7) << 3); emit8(e, 0x0A); emit8(e, i);
+        }
+    }
+    uint8_t* done = emit_jmp32(e);
+
+    patch_jump(e, slow[0]);
+    patch_jump(e, slow[1]);
+    if (pair < 0) {
+        emit8(e, 0xBE); emit32(e, value); // mov esi, imm32
+    } else {
+        emit_get16(e, pair_hi[pair], pair_lo[pair]);
+        emit8(e, 0x89); emit8(e, 0xC6);  // mov esi, eax
+    }
+    emit_call(e, (uintptr_t)slow_push, next_pc, through);
+    return done;
+}
+
+// eax = the two bytes at SP. Returns the jump taken by the fast path, the slow path falls through.
+static uint8_t* emit_pop(Emitter* e, uint16_t next_pc, uint32_t through) {
+    uint8_t* slow[2];
+
+    emit_stack_page(e, offsetof(GB, mem.read_pages), slow);
+    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x04); emit8(e, 0x0A); // movzx eax, word [rdx + rcx]
+    uint8_t* fast = emit_jmp32(e);
+
+    patch_jump(e, slow[0]);
+    patch_jump(e, slow[1]);
+    emit_call(e, (uintptr_t)slow_pop, next_pc, through);
+    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0xC0); // movzx eax, ax
+    return fast;
+}
+
+static void emit_pop_pair(Emitter* e, int pair) {
+    emit_set16(e, pair_hi[pair], pair_lo[pair]);
+    if (pair == 3) emit_ri8(e, 4, host_reg[G_F], 0xF0); // and r9b, 0xF0: the low nibble of F reads as zero
+    emit_sp_add(e, 2);
+}
+
+// f = flag_table[lahf] (+ N)
+static void emit_flags(Emitter* e, bool subtract) {
+    emit8(e, 0x9F);                                 // lahf
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC4); // movzx eax, ah
+    emit8(e, 0x44); emit8(e, 0x8A);                 // mov r9b, [rbx + rax (+ 256)]
+    if (subtract) {
+        emit8(e, 0x8C); emit8(e, 0x03); emit32(e, 256);
+    } else {
+        emit8(e, 0x0C); emit8(e, 0x03);
+    }
+}
+
+// INC and DEC keep C: f = Z N H from lahf, C from before
+static void emit_inc_dec_flags(Emitter* e, bool dec) {
+    emit8(e, 0x9F);                                 // lahf
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC4); // movzx eax, ah
+    emit8(e, 0x8A);                                 // mov al, [rbx + rax (+ 256)]
+    if (dec) {
+        emit8(e, 0x84); emit8(e, 0x03); emit32(e, 256);
+    } else {
+        emit8(e, 0x04); emit8(e, 0x03);
+    }
+    emit8(e, 0x24); emit8(e, FLAG_Z | FLAG_N | FLAG_H); // and al, Z N H
+    emit_ri8(e, 4, host_reg[G_F], FLAG_C);               // and r9b, FLAG_C
+    emit_rr8(e, X86_OR, host_reg[G_F], HOST_AL);
+}
+
+// INC (HL) and DEC (HL), only straight through pages with direct pointers both ways
+static void emit_inc_dec_hlp(Emitter* e, bool dec, uint16_t pc, uint32_t cycles) {
+    emit_get16(e, G_H, G_L);
+    emit_page(e, HOST_SI, offsetof(GB, mem.write_pages));
+    uint8_t* no_write = emit_jcc32(e, 0x84);
+    emit_page(e, HOST_DX, offsetof(GB, mem.read_pages));
+    uint8_t* no_read = emit_jcc32(e, 0x84);
+    uint8_t* fast = emit_jmp32(e);
+
+    // Slow path: the interpreter redoes this instruction through the handler
+    patch_jump(e, no_write);
+    patch_jump(e, no_read);
+    emit_exit(e, pc, cycles);
+
+    patch_jump(e, fast);
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);               // movzx eax, al
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x0C); emit8(e, 0x02); // movzx ecx, byte [rdx + rax]
+    emit8(e, 0xFE); emit8(e, dec ? 0xC9 : 0xC1);                  // inc cl / dec cl
+    emit8(e, 0x88); emit8(e, 0x0C); emit8(e, 0x06);               // mov [rsi + rax], cl
+    emit_inc_dec_flags(e, dec);
+}
+
+// CF = GB carry before ADC and SBC
+static void emit_carry_in(Emitter* e, int kind) {
+    if (kind == 1 || kind == 3) {
+        emit8(e, 0x41); emit8(e, 0x0F); emit8(e, 0xBA); emit8(e, 0xE1); emit8(e, 4); // bt r9d, 4
+    }
+}
+
+// Flags after ALU operation `kind` in opcode order: ADD ADC SUB SBC AND XOR OR CP
+static void emit_alu_flags(Emitter* e, int kind) {
+    if (kind < 4 || kind == 7) {
+        emit_flags(e, kind >= 2);
+        return;
+    }
+
+    // AF is undefined after x86 logic ops, build Z (and H for AND) by hand
+    emit8(e, 0x0F); emit8(e, 0x94); emit8(e, 0xC0);              // sete al
+    emit8(e, 0xC0); emit8(e, 0xE0); emit8(e, 7);                 // shl al, 7
+    if (kind == 4) { emit8(e, 0x0C); emit8(e, FLAG_H); }         // or al, FLAG_H
+    emit8(e, 0x41); emit8(e, 0x88); emit8(e, 0xC1);              // mov r9b, al
+}
+
+// NZ Z NC C: test the flag, returns the jump taken if the condition fails
+static uint8_t* emit_condition(Emitter* e, uint8_t opcode) {
+    int cc = (opcode >> 3) & 3;
+    emit8(e, 0x41); emit8(e, 0xF6); emit8(e, 0xC1); emit8(e, cc < 2 ? FLAG_Z : FLAG_C); // test r9b, flag
+    return emit_jcc32(e, cc & 1 ? 0x84 : 0x85);                                      // jz / jnz
+}
+
+static Kind classify(uint8_t opcode) {
+    if (opcode == 0x00) return K_NOP;
+    if (opcode == 0x76) return K_UNSUPPORTED; // HALT
+    if (opcode >= 0x70 && opcode <= 0x77) return K_LD_HLP;
+    if (opcode >= 0x40 && opcode <= 0x7F) return K_LD_R_R;
+    if (opcode == 0x36) return K_LD_HLP;
+    if ((opcode & 0xC7) == 0x06) return K_LD_R_D8;
+    if ((opcode & 0xC6) == 0x04) return K_INC_DEC;
+    if ((opcode & 0xC7) == 0x03) return K_INC_DEC16;
+    if ((opcode & 0xCF) == 0x01 || opcode == 0xF9) return K_LD_RR_D16;
+    if ((opcode & 0xC7) == 0x02) return opcode & 0x08 ? K_LOAD_A : K_STORE_A;
+    if (opcode == 0xEA) return K_STORE_A;
+    if (opcode == 0xFA) return K_LOAD_A;
+    if (opcode == 0xE0 || opcode == 0xE2) return K_STORE_IO;
+    if (opcode == 0xF0 || opcode == 0xF2) return K_LOAD_IO;
+    if (opcode >= 0x80 && opcode <= 0xBF) return K_ALU_R;
+    if ((opcode & 0xC7) == 0xC6) return K_ALU_D8;
+    if ((opcode & 0xCF) == 0xC5) return K_PUSH;
+    if ((opcode & 0xCF) == 0xC1) return K_POP;
+    if (opcode == 0xC3) return K_JP_A16;
+    if (opcode == 0x18 || (opcode & 0xE7) == 0x20) return K_JR;
+    if (opcode == 0xCD || (opcode & 0xE7) == 0xC4) return K_CALL;
+    if (opcode == 0xC9 || (opcode & 0xE7) == 0xC0) return K_RET;
+    return K_UNSUPPORTED;
+}
+
+// Address registers of LD (rr),A and LD A,(rr): BC, DE, then HL+ and HL-
+static unsigned indirect_regs(uint8_t opcode) {
+    if (opcode >= 0xE0) return 0;
+    int pair = (opcode >> 4) & 3;
+    return pair < 2 ? REG_BIT(pair_hi[pair]) | REG_BIT(pair_lo[pair]) : HL_BITS;
+}
+
+static unsigned touched_regs(uint8_t opcode, Kind kind) {
+    unsigned src = REG_BIT(opcode & 7);
+    if ((opcode & 7) == G_HLP) src = HL_BITS;
+    unsigned dst = REG_BIT((opcode >> 3) & 7);
+    if (((opcode >> 3) & 7) == G_HLP) dst = HL_BITS;
+    int pair = (opcode >> 4) & 3;
+    unsigned pair_bits = REG_BIT(pair_hi[pair]) | REG_BIT(pair_lo[pair]);
+
+    switch (kind) {
+        case K_LD_R_R:     return dst | src;
+        case K_LD_R_D8:    return dst;
+        case K_LD_HLP:     return HL_BITS | (opcode == 0x36 ? 0 : src);
+        case K_ALU_R:      return REG_BIT(G_A) | REG_BIT(G_F) | src;
+        case K_ALU_D8:     return REG_BIT(G_A) | REG_BIT(G_F);
+        case K_INC_DEC:    return dst | REG_BIT(G_F);
+        case K_INC_DEC16:  return pair == 3 ? REG_BIT(G_SP) : pair_bits;
+        case K_LD_RR_D16:
+            if (opcode == 0xF9) return REG_BIT(G_SP) | HL_BITS;
+            return pair == 3 ? REG_BIT(G_SP) : pair_bits;
+        case K_STORE_A:
+        case K_LOAD_A:     return REG_BIT(G_A) | indirect_regs(opcode);
+        case K_STORE_IO:
+        case K_LOAD_IO:    return REG_BIT(G_A) | (opcode & 0x02 ? REG_BIT(G_C) : 0);
+        case K_PUSH:
+        case K_POP:        return REG_BIT(G_SP) | pair_bits;
+        case K_JR:         return opcode == 0x18 ? 0 : REG_BIT(G_F);
+        case K_CALL:       return REG_BIT(G_SP) | (opcode == 0xCD ? 0 : REG_BIT(G_F));
+        case K_RET:        return REG_BIT(G_SP) | (opcode == 0xC9 ? 0 : REG_BIT(G_F));
+        default:           return 0;
+    }
+}
+
+// `cycles` are the block's cycles before this instruction
+static void emit_op(Emitter* e, const DecodedOp* op, uint16_t pc, uint32_t cycles) {
+    uint8_t opcode = op->opcode;
+    int src = opcode & 7;
+    int dst = (opcode >> 3) & 7;
+    int pair = (opcode >> 4) & 3;
+
+    switch (classify(opcode)) {
+        case K_NOP:
+            break;
+
+        case K_LD_R_R:
+            if (src == G_HLP) {
+                emit_get16(e, G_H, G_L);
+                emit_load(e, pc, cycles);
+            }
+            emit_rr8(e, X86_MOV, host_reg[dst], host_reg[src]);
+            break;
+
+        case K_LD_R_D8:
+            emit_mov_ri8(e, host_reg[dst], op->operand);
+            break;
+
+        case K_LD_HLP:
+            emit_get16(e, G_H, G_L);
+            emit_store(e, op, cycles, opcode == 0x36 ? -1 : host_reg[src], op->operand);
+            break;
+
+        case K_ALU_R: {
+            static const uint8_t alu[8] = { X86_ADD, X86_ADC, X86_SUB, X86_SBB, X86_AND, X86_XOR, X86_OR, X86_CMP };
+
+            if (src == G_HLP) {
+                emit_get16(e, G_H, G_L);
+                emit_load(e, pc, cycles);
+            }
+            emit_carry_in(e, dst);
+            emit_rr8(e, alu[dst], host_reg[G_A], host_reg[src]);
+            emit_alu_flags(e, dst);
+            break;
+        }
+
+        case K_ALU_D8: {
+            // 0x80 /digit of each GB operation
+            static const uint8_t digit[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+
+            emit_carry_in(e, dst);
+            emit_ri8(e, digit[dst], host_reg[G_A], op->operand);
+            emit_alu_flags(e, dst);
+            break;
+        }
+
+        case K_INC_DEC:
+            if (dst == G_HLP) {
+                emit_inc_dec_hlp(e, opcode & 1, pc, cycles);
+                break;
+            }
+            emit8(e, 0x40 | (host_reg[dst] >= 8 ? 0x01 : 0)); // inc r / dec r
+            emit8(e, 0xFE);
+            emit8(e, 0xC0 | (opcode & 1) << 3 | (host_reg[dst] & 7));
+            emit_inc_dec_flags(e, opcode & 1);
+            break;
+
+        case K_INC_DEC16:
+            if (pair == 3) {
+                emit8(e, 0x66); emit8(e, 0xFF); emit8(e, opcode & 0x08 ? 0xCD : 0xC5); // dec bp / inc bp
+                break;
+            }
+            emit_get16(e, pair_hi[pair], pair_lo[pair]);
+            emit8(e, 0xFF); emit8(e, opcode & 0x08 ? 0xC8 : 0xC0); // dec eax / inc eax
+            emit_set16(e, pair_hi[pair], pair_lo[pair]);
+            break;
+
+        case K_LD_RR_D16:
+            if (opcode == 0xF9) {
+                emit_get16(e, G_H, G_L);
+                emit8(e, 0x66); emit8(e, 0x89); emit8(e, 0xC5); // mov bp, ax
+            } else if (pair == 3) {
+                emit8(e, 0x66); emit8(e, 0xBD); emit16(e, op->operand); // mov bp, imm16
+            } else {
+                emit_mov_ri8(e, host_reg[pair_lo[pair]], op->operand & 0xFF);
+                emit_mov_ri8(e, host_reg[pair_hi[pair]], op->operand >> 8);
+            }
+            break;
+
+        case K_STORE_A:
+            if (opcode == 0xEA && op->operand >= 0xFF00) {
+                emit8(e, 0xBE); emit32(e, op->operand); // mov esi, imm32
+                emit_store_io(e, op, cycles);
+                break;
+            }
+            if (opcode == 0xEA) {
+                emit8(e, 0xB8); emit32(e, op->operand); // mov eax, imm32
+            } else {
+                emit_get16(e, pair < 2 ? pair_hi[pair] : G_H, pair < 2 ? pair_lo[pair] : G_L);
+                // The store may leave the block, so HL moves on first
+                if (pair >= 2) emit_hl_step(e, pair == 2 ? 1 : -1);
+            }
+            emit_store(e, op, cycles, host_reg[G_A], 0);
+            break;
+
+        case K_LOAD_A:
+            if (opcode == 0xFA && op->operand >= 0xFF00) {
+                emit8(e, 0xBE); emit32(e, op->operand); // mov esi, imm32
+                emit_load_io(e, op, cycles);
+                break;
+            }
+            if (opcode == 0xFA) {
+                emit8(e, 0xB8); emit32(e, op->operand); // mov eax, imm32
+            } else {
+                emit_get16(e, pair < 2 ? pair_hi[pair] : G_H, pair < 2 ? pair_lo[pair] : G_L);
+            }
+            emit_load(e, pc, cycles);
+            emit_rr8(e, X86_MOV, host_reg[G_A], HOST_CL);
+            // A failed load redoes the whole instruction, so HL moves on last
+            if (pair >= 2 && opcode != 0xFA) {
+                emit_get16(e, G_H, G_L);
+                emit_hl_step(e, pair == 2 ? 1 : -1);
+            }
+            break;
+
+        case K_STORE_IO:
+            emit_io_address(e, op);
+            emit_store_io(e, op, cycles);
+            break;
+
+        case K_LOAD_IO:
+            emit_io_address(e, op);
+            emit_load_io(e, op, cycles);
+            break;
+
+        case K_PUSH: {
+            uint8_t* done = emit_push(e, pair, 0, op->next_pc, cycles + op->cycles);
+            patch_jump(e, emit_resume(e, op->next_pc, cycles + op->cycles, true));
+            patch_jump(e, done);
+            break;
+        }
+
+        case K_POP: {
+            uint8_t* fast = emit_pop(e, op->next_pc, cycles + op->cycles);
+            emit_pop_pair(e, pair);
+            uint8_t* done = emit_resume(e, op->next_pc, cycles + op->cycles, false);
+            patch_jump(e, fast);
+            emit_pop_pair(e, pair);
+            patch_jump(e, done);
+            break;
+        }
+
+        case K_JP_A16:
+            emit_exit(e, op->operand, cycles + op->cycles);
+            break;
+
+        case K_JR:
+            if (opcode == 0x18) {
+                emit_exit(e, op->next_pc + (int8_t)op->operand, cycles + op->cycles);
+            } else {
+                uint8_t* not_taken = emit_condition(e, opcode);
+                emit_exit(e, op->next_pc + (int8_t)op->operand, cycles + op->cycles + 4);
+                patch_jump(e, not_taken);
+                emit_exit(e, op->next_pc, cycles + op->cycles);
+            }
+            break;
+
+        case K_CALL: {
+            uint8_t* not_taken = opcode == 0xCD ? NULL : emit_condition(e, opcode);
+            uint32_t taken = cycles + op->cycles + (not_taken ? 12 : 0);
+
+            // Slow path first, it already accounted the cycles
+            uint8_t* fast = emit_push(e, -1, op->next_pc, op->next_pc, taken);
+            emit_exit(e, op->operand, 0);
+            patch_jump(e, fast);
+            emit_exit(e, op->operand, taken);
+
+            if (not_taken) {
+                patch_jump(e, not_taken);
+                emit_exit(e, op->next_pc, cycles + op->cycles);
+            }
+            break;
+        }
+
+        case K_RET: {
+            uint8_t* not_taken = opcode == 0xC9 ? NULL : emit_condition(e, opcode);
+            uint32_t taken = cycles + op->cycles + (not_taken ? 12 : 0);
+
+            uint8_t* fast = emit_pop(e, op->next_pc, taken);
+            for (int path = 0; path < 2; path++) {
+                if (path) patch_jump(e, fast);
+                emit_sp_add(e, 2);
+                emit8(e, 0x66); emit8(e, 0x89); emit_rdi_disp(e, 0, offsetof(GB, cpu.pc)); // mov [rdi + pc], ax
+                emit_leave(e, path ? taken : 0);
+            }
+
+            if (not_taken) {
+                patch_jump(e, not_taken);
+                emit_exit(e, op->next_pc, cycles + op->cycles);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static void flush(GB* gb) {
+    Jit* jit = gb->jit;
+    jit->used = 0;
+
+    // AOT code lives in its shared object and stays
+    for (Block* block = gb->blocks->slots; block < gb->blocks->slots + BLOCK_CACHE_SLOTS; block++) {
+        block->native = aot_lookup(gb, block->pc, block->bank);
+    }
+}
+
+bool jit_available(void) {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (ecx & 1); // LAHF in 64-bit mode
+}
+
+native_block_fn jit_compile(GB* gb, const Block* block) {
+    Jit* jit = gb->jit;
+
+    // Find the supported prefix and the guest registers it needs
+    unsigned touched = 0;
+    uint32_t total = 0;
+    int count = 0;
+    bool terminated = false;
+    for (; count < block->count; count++) {
+        Kind kind = classify(block->ops[count].opcode);
+        if (kind == K_UNSUPPORTED) break;
+
+        touched |= touched_regs(block->ops[count].opcode, kind);
+        total += block->ops[count].cycles;
+        if (kind >= K_JP_A16) {
+            terminated = true;
+            count++;
+            break;
+        }
+    }
+    if (count == 0) return NULL;
+
+    if (jit->used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE) flush(gb);
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0) return NULL;
+
+    uint8_t* start = jit->code + jit->used;
+    Emitter e = { start, touched, block, total };
+
+    emit8(&e, 0x53);                  // push rbx
+    emit8(&e, 0x55);                  // push rbp
+    emit8(&e, 0x41); emit8(&e, 0x54); // push r12
+    emit8(&e, 0x41); emit8(&e, 0x55); // push r13
+    emit8(&e, 0x41); emit8(&e, 0x56); // push r14
+    emit8(&e, 0x41); emit8(&e, 0x57); // push r15
+    emit8(&e, 0x48); emit8(&e, 0xBB); emit64(&e, (uint64_t)(uintptr_t)flag_table); // mov rbx, imm64
+    emit_guest_regs(&e, false);
+
+    uint16_t pc = block->pc;
+    uint32_t cycles = 0;
+    for (int i = 0; i < count; i++) {
+        const DecodedOp* op = &block->ops[i];
+        emit_op(&e, op, pc, cycles);
+        pc = op->next_pc;
+        cycles += op->cycles;
+    }
+
+    // Ran into an unsupported instruction, the interpreter continues there
+    if (!terminated) emit_exit(&e, pc, cycles);
+
+    jit->used += e.p - start;
+    mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+
+    return (native_block_fn)(void*)start;
+}
+
+static Jit* jit_create(void) {
+    Jit* jit = calloc(1, sizeof(Jit));
+    if (!jit) {
+        perror("Fehler beim Anlegen des JIT");
+        exit(1);
+    }
+
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+void jit_destroy(Jit* jit) {
+    if (!jit) return;
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+#else
+
+bool jit_available(void) {
+    return false;
+}
+
+native_block_fn jit_compile(GB* gb, const Block* block) {
+    return NULL;
+}
+
+static Jit* jit_create(void) {
+    return NULL;
+}
+
+void jit_destroy(Jit* jit) {
+}
+
+#endif
+
+bool jit_set_enabled(GB* gb, bool enabled) {
+    if (enabled && !gb->jit) {
+        if (!jit_available()) return false;
+        gb->jit = jit_create();
+        if (!gb->jit) return false;
+    }
+
+    gb->jit_enabled = enabled;
+    return true;
+}
@@ -1,21 +1,288 @@
 #include <stdio.h>
-#include <cpu.h>
-#include <memory.h>
+#include <string.h>
+#include <stdlib.h>
+#include <gb.h>
+#include <batch.h>
+#include <pacer.h>
+#include <gdb_stub.h>
 
-int main(void) {
-    CPU cpu;
-    memory_init();
-    cpu_init(&cpu);
+#define RUN_CYCLES 4194304 // one second of emulated time
+#define LOCKSTEP_STEPS 100000
+#define BATCH_SLICE 456 // cycles per batch_run in the batch lockstep, one LCD line
 
-    load_rom("test.bin");
+static bool timer_equal(GB* x, GB* y) {
+    for (uint16_t address = DIV_ADDR; address <= TAC_ADDR; address++) {
+        if (mem_read(x, address) != mem_read(y, address)) return false;
+    }
+    return true;
+}
+
+// The SIMD renderer, reusing unchanged lines, against the scalar one rendering all
+static bool frame_equal(GB* x, GB* y) {
+    ppu_flush(x);
+    ppu_flush(y);
+    return x->ppu.frames == y->ppu.frames && memcmp(x->ppu.frame, y->ppu.frame, sizeof(x->ppu.frame)) == 0;
+}
+
+static bool cpu_equal(const CPU* x, const CPU* y) {
+    return x->a == y->a && cpu_flags(x) == cpu_flags(y) && x->b == y->b && x->c == y->c &&
+           x->d == y->d && x->e == y->e && x->h == y->h && x->l == y->l &&
+           x->sp == y->sp && x->pc == y->pc &&
+           x->halted == y->halted && x->ime == y->ime && x->cycles == y->cycles;
+}
+
+// Runs the reference core (cpu_step) and the configured cpu_run core side by side.
+// cpu_run may retire a whole block per call, so the reference catches up to the
+// same cycle count before both machines are compared. The reference also ticks
+// its timer cycle by cycle, cpu_run derives it from the cycle counter.
+// With idle skipping cpu_run gets a whole frame so it has something to skip.
+static int run_lockstep(const char* rom, bool jit, bool idle, bool pipeline, const char* aot) {
+    GB* ref = gb_create();
+    GB* fast = gb_create();
+    load_rom(ref, rom);
+    load_rom(fast, rom);
+    timer_set_per_cycle(ref, true);
+    ppu_set_reference(ref, true);
+
+    if (jit && !jit_set_enabled(fast, true)) {
+        printf("JIT not available in this build\n");
+    }
+    if (aot && !aot_load(fast, aot)) return 1;
+    block_cache_set_idle_skip(fast, idle);
+    if (pipeline && !ppu_pipeline_start(fast)) {
+        perror("Fehler beim Starten des Render-Threads");
+        return 1;
+    }
+
+    int result = 0;
+    int steps = 0;
+    while (steps < LOCKSTEP_STEPS) {
+        cpu_status_t fast_status = cpu_run(fast, idle ? GB_FRAME_CYCLES : 1);
+        cpu_status_t ref_status = CPU_OK;
+
+        while (ref_status == CPU_OK && CYCLES_BEFORE(ref->cpu.cycles, fast->cpu.cycles)) {
+            ref_status = cpu_step(ref);
+            steps++;
+        }
+        if (fast_status == CPU_UNKNOWN_OPCODE) ref_status = cpu_step(ref);
+
+        bool stopped = fast_status == CPU_HALTED || fast_status == CPU_UNKNOWN_OPCODE;
+        if ((stopped && fast_status != ref_status && !ref->cpu.halted) ||
+            !cpu_equal(&ref->cpu, &fast->cpu) || !timer_equal(ref, fast) || !frame_equal(ref, fast) ||
+            memcmp(ref->mem.data, fast->mem.data, MEMORY_SIZE) != 0) {
+            printf("Cores diverge after %d instructions\n", steps);
+            printf("Reference: ");
+            cpu_print_state(&ref->cpu);
+            printf("cpu_run:   ");
+            cpu_print_state(&fast->cpu);
+            result = 1;
+            break;
+        }
+
+        if (stopped) break;
+    }
+
+    if (result == 0) {
+        printf("Cores agree after %d instructions: ", steps);
+        cpu_print_state(&ref->cpu);
+    }
+
+    gb_destroy(fast);
+    gb_destroy(ref);
+    return result;
+}
+
+// batch_run on BATCH_LANES machines that differ in A against cpu_step on a
+// copy of each, compared after every slice. The references catch up with
+// the lanes like in run_lockstep, cpu_run may stop a block past the budget.
+static int run_batch_lockstep(const char* rom) {
+    GB* lanes[BATCH_LANES];
+    GB* refs[BATCH_LANES];
+    for (unsigned i = 0; i < BATCH_LANES; i++) {
+        lanes[i] = gb_create();
+        refs[i] = gb_create();
+        load_rom(lanes[i], rom);
+        load_rom(refs[i], rom);
+        lanes[i]->cpu.a = refs[i]->cpu.a = i;
+    }
+
+    int result = 0;
+    unsigned running = (1u << BATCH_LANES) - 1;
+    uint64_t slices = 0;
+    while (running && slices * BATCH_SLICE < (uint64_t)LOCKSTEP_STEPS * 4) {
+        batch_run(lanes, BATCH_LANES, BATCH_SLICE, NULL);
+        slices++;
+
+        for (unsigned i = 0; i < BATCH_LANES && result == 0; i++) {
+            cpu_status_t status = CPU_OK;
+            while (status == CPU_OK && CYCLES_BEFORE(refs[i]->cpu.cycles, lanes[i]->cpu.cycles)) {
+                status = cpu_step(refs[i]);
+            }
+            if (status == CPU_HALTED || status == CPU_UNKNOWN_OPCODE) running &= ~(1u << i);
+
+            if (!cpu_equal(&refs[i]->cpu, &lanes[i]->cpu) || !timer_equal(refs[i], lanes[i]) ||
+                !frame_equal(refs[i], lanes[i]) || memcmp(refs[i]->mem.data, lanes[i]->mem.data, MEMORY_SIZE) != 0) {
+                printf("Lane %u diverges after %llu slices\n", i, (unsigned long long)slices);
+                printf("cpu_run:   ");
+                cpu_print_state(&refs[i]->cpu);
+                printf("batch_run: ");
+                cpu_print_state(&lanes[i]->cpu);
+                result = 1;
+            }
+        }
+        if (result) break;
+    }
+
+    if (result == 0) {
+        printf("Batch lanes agree after %llu slices: ", (unsigned long long)slices);
+        cpu_print_state(&lanes[BATCH_LANES - 1]->cpu);
+    }
+
+    for (unsigned i = 0; i < BATCH_LANES; i++) {
+        gb_destroy(lanes[i]);
+        gb_destroy(refs[i]);
+    }
+    return result;
+}
+
+// Paced frames for `seconds` of emulated time, 0 speed runs unlimited
+static cpu_status_t run_realtime(GB* gb, double speed, unsigned seconds) {
+    Pacer pacer;
+    PacerStats stats;
+    const uint64_t end = gb->cpu.cycles + (uint64_t)seconds * GB_CLOCK_HZ;
+    cpu_status_t status = CPU_BUDGET_DONE;
+
+    pacer_init(&pacer, gb, speed);
+    while (status == CPU_BUDGET_DONE && CYCLES_BEFORE(gb->cpu.cycles, end)) {
+        status = pacer_run_frame(gb, &pacer);
+    }
+
+    pacer_stats(&pacer, &stats);
+    printf("Frames: %llu, late: %llu, resyncs: %llu\n", (unsigned long long)stats.frames,
+        (unsigned long long)stats.late_frames, (unsigned long long)stats.resyncs);
+    printf("Jitter: mean %.1f us, stddev %.1f us, max %.1f us\n",
+        stats.jitter_mean_us, stats.jitter_stddev_us, stats.jitter_max_us);
+    printf("Drift: %.1f us, speed %.3fx, CPU load %.1f%%\n",
+        stats.drift_us, stats.guest_speed, stats.cpu_load * 100);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    const char* rom = "test.bin";
+    bool lockstep = false;
+    bool jit = false;
+    bool idle = false;
+    bool pipeline = false;
+    bool batch = false;
+    const char* aot = NULL;
+    const char* gdb = NULL;
+    const char* trace = NULL;
+    const char* profile = NULL;
+    const char* screenshot = NULL;
+    double speed = -1; // --realtime, below 0 runs RUN_CYCLES as fast as possible
+    unsigned seconds = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        } else if (strcmp(argv[i], "--idle") == 0) {
+            idle = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipeline = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+            aot = argv[++i];
+        } else if (strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) {
+            gdb = argv[++i];
+        } else if (strcmp(argv[i], "--realtime") == 0 && i + 1 < argc) {
+            speed = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc) {
+            screenshot = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile = argv[++i];
+        } else {
+            rom = argv[i];
+        }
+    }
+
+    if (lockstep && batch) return run_batch_lockstep(rom);
+    if (lockstep) return run_lockstep(rom, jit, idle, pipeline, aot);
+
+    GB* gb = gb_create();
+
+    load_rom(gb, rom);
+    if (jit && !jit_set_enabled(gb, true)) {
+        printf("JIT not available in this build\n");
+    }
+    if (aot && !aot_load(gb, aot)) return 1;
+    block_cache_set_idle_skip(gb, idle);
+    if (pipeline && !ppu_pipeline_start(gb)) {
+        perror("Fehler beim Starten des Render-Threads");
+        return 1;
+    }
+    if (trace && !trace_start(gb, trace)) {
+        perror("Fehler beim Anlegen des Traces");
+        return 1;
+    }
+    if (profile && !profile_start(gb)) {
+        perror("Fehler beim Anlegen des Profils");
+        return 1;
+    }
+
+    if (gdb) {
+        if (!gdb_serve(gb, gdb)) {
+            perror("Fehler beim Öffnen des GDB-Sockets");
+            return 1;
+        }
+        gb_destroy(gb);
+        return 0;
+    }
 
     printf("=== LR35902 Emulator Test ===\n");
 
-    for (int i = 0; i < 20; i++) {
-        printf("Step %d: ", i + 1);
-        cpu_print_state(&cpu);
-        cpu_step(&cpu);
+    printf("Start: ");
+    cpu_print_state(&gb->cpu);
+
+    cpu_status_t status = speed < 0 ? cpu_run(gb, RUN_CYCLES) : run_realtime(gb, speed, seconds);
+    if (status == CPU_UNKNOWN_OPCODE) {
+        printf("Unknown opcode: 0x%02X at PC: 0x%04X\n", mem_read(gb, gb->cpu.pc), gb->cpu.pc);
+    } else if (status == CPU_HALTED) {
+        printf("CPU halted after %llu cycles\n", (unsigned long long)gb->cpu.cycles);
+    }
+
+    printf("End:   ");
+    cpu_print_state(&gb->cpu);
+
+    PpuPipelineStats render;
+    if (ppu_pipeline_stats(gb, &render)) {
+        printf("Render thread: stalls %llu, waits %llu, max lag %llu cycles\n", (unsigned long long)render.stalls,
+            (unsigned long long)render.waits, (unsigned long long)render.max_lag_cycles);
+    }
+
+    if (screenshot) {
+        ppu_flush(gb);
+        printf("Frames: %llu\n", (unsigned long long)gb->ppu.frames);
+        if (!ppu_save_pgm(gb, screenshot)) perror("Fehler beim Schreiben des Bildschirmfotos");
+    }
+
+    if (profile) {
+        FILE* file = fopen(profile, "w");
+        if (!file) {
+            perror("Fehler beim Schreiben des Profils");
+        } else {
+            profile_write_collapsed(gb, file);
+            fclose(file);
+        }
+        profile_write_report(gb, stdout, 10);
     }
 
-    return 0;
+    gb_destroy(gb);
+    return status == CPU_UNKNOWN_OPCODE;
 }
\ No newline at end of file
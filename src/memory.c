@@ -3,35 +3,257 @@
 //
 
 #include <memory.h>
+#include <gb.h>
+#include <block_cache.h>
+#include <cartridge.h>
+#include <debugger.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define MEMORY_SIZE 0x10000 // 64 KB
+#define PAGE_BIT(page) (1u << ((page) & 7))
+#define HAS_CODE(mem, page) ((mem)->code_pages[(page) >> 3] & PAGE_BIT(page))
+#define HRAM_ADDR 0xFF80
+#define SLOW_WRITES(mem, page) (HAS_CODE(mem, page) || (mem)->write_watch[page] || ((mem)->debug_watch[page] & MEM_WATCH_WRITE))
 
-static uint8_t memory[MEMORY_SIZE];
+// Direct read page, held back from read_pages while a debugger watches reads
+static const uint8_t* direct_read(const Memory* mem, unsigned page) {
+    return mem->read_pages[page] ? mem->read_pages[page] : mem->watched_reads[page];
+}
 
-void memory_init(void) {
-    memset(memory, 0, sizeof(memory));
+static void set_direct_read(Memory* mem, unsigned page, const uint8_t* direct) {
+    bool watched = mem->debug_watch[page] & MEM_WATCH_READ;
+    mem->read_pages[page] = watched ? NULL : direct;
+    mem->watched_reads[page] = watched ? direct : NULL;
 }
 
-uint8_t mem_read(uint16_t address) {
-    return memory[address];
+static uint8_t io_read(GB* gb, uint16_t address) {
+    mem_read_func_t hook = gb->mem.io_read[address & 0xFF];
+    return hook ? hook(gb, address) : gb->mem.data[address];
 }
 
-void mem_write(uint16_t address, uint8_t value) {
-    // Für den Anfang einfach direkt schreiben
-    memory[address] = value;
+static void io_write(GB* gb, uint16_t address, uint8_t value) {
+    mem_write_func_t hook = gb->mem.io_write[address & 0xFF];
+    if (hook) {
+        hook(gb, address, value);
+    } else {
+        gb->mem.data[address] = value;
+    }
+    // HRAM can hold cached code, it is looked up byte by byte as the page is shared with the registers.
+    // IE too, an instruction at the end of HRAM takes its operand from there
+    if (address >= HRAM_ADDR && block_cache_covers(gb->blocks, address)) {
+        block_cache_invalidate(gb, address);
+    }
 }
 
-void load_rom(const char* filename) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        perror("Fehler beim Öffnen der ROM-Datei");
-        exit(1);
+void memory_init(GB* gb) {
+    memset(gb->mem.data, 0, sizeof(gb->mem.data));
+    memory_map_default(gb);
+}
+
+void memory_map_default(GB* gb) {
+    Memory* mem = &gb->mem;
+    memset(mem, 0, offsetof(Memory, data));
+
+    // 0x0000–0x7FFF ROM, writes are dropped
+    mem_map_read(gb, 0x00, 0x7F, mem->data, NULL);
+    mem_map_write(gb, 0x00, 0x7F, NULL, NULL);
+
+    // 0x8000–0xDFFF VRAM, cartridge RAM, WRAM
+    mem_map_read(gb, 0x80, 0xDF, mem->data + 0x8000, NULL);
+    mem_map_write(gb, 0x80, 0xDF, mem->data + 0x8000, NULL);
+
+    // 0xE000–0xFDFF echo of 0xC000–0xDDFF
+    mem_map_read(gb, 0xE0, 0xFD, mem->data + 0xC000, NULL);
+    mem_map_write(gb, 0xE0, 0xFD, mem->data + 0xC000, NULL);
+
+    // 0xFE00–0xFEFF OAM
+    mem_map_read(gb, 0xFE, 0xFE, mem->data + 0xFE00, NULL);
+    mem_map_write(gb, 0xFE, 0xFE, mem->data + 0xFE00, NULL);
+
+    // 0xFF00–0xFFFF I/O, HRAM and IE
+    mem_map_read(gb, 0xFF, 0xFF, NULL, io_read);
+    mem_map_write(gb, 0xFF, 0xFF, NULL, io_write);
+}
+
+void mem_map_read(GB* gb, uint8_t first_page, uint8_t last_page, const uint8_t* base, mem_read_func_t handler) {
+    Memory* mem = &gb->mem;
+    for (unsigned page = first_page; page <= last_page; page++) {
+        set_direct_read(mem, page, base ? base + (page - first_page) * PAGE_SIZE : NULL);
+        mem->read_handlers[page] = handler;
+    }
+}
+
+void mem_map_write(GB* gb, uint8_t first_page, uint8_t last_page, uint8_t* base, mem_write_func_t handler) {
+    Memory* mem = &gb->mem;
+    for (unsigned page = first_page; page <= last_page; page++) {
+        mem->ram_pages[page] = base ? base + (page - first_page) * PAGE_SIZE : NULL;
+        // A page that still holds cached code or is watched keeps its writes on the slow path
+        mem->write_pages[page] = SLOW_WRITES(mem, page) ? NULL : mem->ram_pages[page];
+        mem->write_handlers[page] = handler;
+    }
+}
+
+void mem_map_io(GB* gb, uint16_t address, mem_read_func_t read, mem_write_func_t write) {
+    gb->mem.io_read[address & 0xFF] = read;
+    gb->mem.io_write[address & 0xFF] = write;
+}
+
+void mem_mark_io_timed(GB* gb, uint16_t address, mem_change_func_t next_change) {
+    gb->mem.io_timed[address & 0xFF] = next_change;
+}
+
+void mem_watch_writes(GB* gb, uint8_t first_page, uint8_t last_page, mem_write_func_t watch) {
+    Memory* mem = &gb->mem;
+    for (unsigned page = first_page; page <= last_page; page++) {
+        mem->write_watch[page] = watch;
+        mem->write_pages[page] = SLOW_WRITES(mem, page) ? NULL : mem->ram_pages[page];
+    }
+}
+
+void mem_debug_watch(GB* gb, uint8_t page, uint8_t flags) {
+    Memory* mem = &gb->mem;
+    const uint8_t* direct = direct_read(mem, page);
+
+    mem->debug_watch[page] = flags;
+    set_direct_read(mem, page, direct);
+    mem->write_pages[page] = SLOW_WRITES(mem, page) ? NULL : mem->ram_pages[page];
+}
+
+void mem_watch_code(GB* gb, uint8_t page) {
+    Memory* mem = &gb->mem;
+    uint8_t* ram = mem->ram_pages[page];
+    if (!ram || HAS_CODE(mem, page)) return;
+
+    mem->code_pages[page >> 3] |= PAGE_BIT(page);
+
+    // Echo RAM maps the same backing page twice, both views must stop writing directly
+    for (unsigned alias = 0; alias < PAGE_COUNT; alias++) {
+        if (mem->ram_pages[alias] == ram) mem->write_pages[alias] = NULL;
+    }
+}
+
+void mem_unwatch_code(GB* gb, uint8_t page) {
+    Memory* mem = &gb->mem;
+    uint8_t* ram = mem->ram_pages[page];
+    mem->code_pages[page >> 3] &= ~PAGE_BIT(page);
+    if (!ram) return;
+
+    for (unsigned alias = 0; alias < PAGE_COUNT; alias++) {
+        if (mem->ram_pages[alias] == ram && HAS_CODE(mem, alias)) return;
+    }
+    for (unsigned alias = 0; alias < PAGE_COUNT; alias++) {
+        if (mem->ram_pages[alias] == ram && !SLOW_WRITES(mem, alias)) mem->write_pages[alias] = ram;
+    }
+}
+
+static void shared_write(GB* gb, uint16_t address, uint8_t value) {
+    Memory* mem = &gb->mem;
+    uint8_t home = mem->shared_home[address >> 8];
+    uint8_t* ram = mem->data + home * PAGE_SIZE;
+
+    if (mem->shared_pages[home]) {
+        memcpy(ram, mem->shared_pages[home], PAGE_SIZE);
+        mem->shared_pages[home] = NULL;
+    }
+    mem_touch_page(gb, home);
+
+    // Every view of the page (echo RAM) gets the private copy back
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        if (mem->write_handlers[page] != shared_write || mem->shared_home[page] != home) continue;
+        mem_map_read(gb, page, page, ram, NULL);
+        mem_map_write(gb, page, page, ram, NULL);
+        // Blocks may have been decoded from the frozen copy without watching it
+        if (gb->blocks) mem_watch_code(gb, page);
+    }
+
+    mem_write(gb, address, value);
+}
+
+void mem_share_pages(GB* gb, const uint8_t* const frozen[PAGE_COUNT]) {
+    Memory* mem = &gb->mem;
+
+    // Pages still reading the frozen copies being replaced move on to the new ones below,
+    // the state that owns the old copies may be freed (a keyframe ends the chain)
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        uint8_t home = mem->shared_home[page];
+        const uint8_t* read = direct_read(mem, page);
+        if (read && read == mem->shared_pages[home]) set_direct_read(mem, page, mem->data + home * PAGE_SIZE);
     }
 
-    fread(memory, 1, 0x8000, file); // Lade bis zu 32 KB ROM in 0x0000–0x7FFF
-    fclose(file);
+    for (unsigned home = 0; home < PAGE_COUNT - 1; home++) {
+        mem->unchanged_pages[home >> 3] |= PAGE_BIT(home);
+        // Devices render from data directly, watched pages get their copy right away
+        if (mem->write_watch[home]) {
+            if (frozen[home] != mem->data + home * PAGE_SIZE) memcpy(mem->data + home * PAGE_SIZE, frozen[home], PAGE_SIZE);
+            mem->shared_pages[home] = NULL;
+            continue;
+        }
+        mem->shared_pages[home] = frozen[home];
+    }
+
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        const uint8_t* read = direct_read(mem, page);
+        if (!read || read < mem->data || read >= mem->data + MEMORY_SIZE) continue;
+
+        uint8_t home = (read - mem->data) / PAGE_SIZE;
+        if (!mem->shared_pages[home]) continue;
+
+        set_direct_read(mem, page, mem->shared_pages[home]);
+        mem->shared_home[page] = home;
+        if (mem->ram_pages[page] == mem->data + home * PAGE_SIZE) {
+            mem->ram_pages[page] = NULL;
+            mem->write_pages[page] = NULL;
+            mem->write_handlers[page] = shared_write;
+        }
+    }
 }
 
+void mem_touch_page(GB* gb, uint8_t page) {
+    gb->mem.unchanged_pages[page >> 3] &= ~PAGE_BIT(page);
+}
+
+uint8_t mem_read_slow(GB* gb, uint16_t address) {
+    Memory* mem = &gb->mem;
+    if (mem->debug_watch[address >> 8] & MEM_WATCH_READ) {
+        debug_access(gb, address, false);
+        const uint8_t* direct = mem->watched_reads[address >> 8];
+        if (direct) return direct[address & 0xFF];
+    }
+
+    mem_read_func_t handler = mem->read_handlers[address >> 8];
+    return handler ? handler(gb, address) : 0xFF; // open bus
+}
+
+void mem_write_slow(GB* gb, uint16_t address, uint8_t value) {
+    Memory* mem = &gb->mem;
+    uint8_t* ram = mem->ram_pages[address >> 8];
+
+    if (mem->debug_watch[address >> 8] & MEM_WATCH_WRITE) debug_access(gb, address, true);
+
+    if (!ram) {
+        mem_write_func_t handler = mem->write_handlers[address >> 8];
+        if (handler) handler(gb, address, value);
+        return;
+    }
+
+    // RAM page that only comes here because it is watched or holds cached code
+    mem_write_func_t watch = mem->write_watch[address >> 8];
+    if (watch) watch(gb, address, value);
+    ram[address & 0xFF] = value;
+    if (ram >= mem->data && ram < mem->data + MEMORY_SIZE) mem_touch_page(gb, (ram - mem->data) / PAGE_SIZE);
+    if (watch && !HAS_CODE(mem, address >> 8)) return; // watched pages have no echo
+    for (unsigned alias = 0; alias < PAGE_COUNT; alias++) {
+        if (mem->ram_pages[alias] == ram && HAS_CODE(mem, alias)) {
+            block_cache_invalidate(gb, alias << 8 | (address & 0xFF));
+        }
+    }
+}
+
+void load_rom(GB* gb, const char* filename) {
+    if (!cart_load(gb, filename)) {
+        perror("Fehler beim Öffnen der ROM-Datei");
+        exit(1);
+    }
+}
@@ -0,0 +1,555 @@
+//
+// Created by davidg on 24.07.25.
+//
+
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <cpu.h>
+#include <memory.h>
+
+#define OPF_END_BLOCK 0x01 // writes PC or stops the CPU, ends a basic block
+#define OPF_CALL      0x02 // pushes a return address and jumps, for the profiler
+#define OPF_RETURN    0x04 // pops the return address
+
+/**
+ * Static description of one opcode. `cycles` is the base cost, handlers
+ * only add the extra cycles of a taken branch themselves.
+ */
+typedef struct {
+    opcode_func_t handler;
+    uint8_t length; // bytes including the opcode
+    uint8_t cycles;
+    uint8_t flags;
+} OpcodeInfo;
+
+extern const OpcodeInfo opcode_table[256];
+extern const OpcodeInfo cb_opcode_table[256];
+
+/**
+ * Reads the immediate operand that follows the opcode at `pc`.
+ */
+static inline uint16_t fetch_operand(GB* gb, uint16_t pc, uint8_t length) {
+    if (length == 2) return mem_read(gb, pc + 1);
+    if (length == 3) return mem_read(gb, pc + 1) | (mem_read(gb, pc + 2) << 8);
+    return 0;
+}
+
+/**
+ * Every opcode and its handler in src/cpu.c, the eleven opcodes that lock
+ * up the real CPU are left out. X(code, handler, length, cycles, flags) is
+ * expanded once per entry to build each dispatch core. Cycles of a
+ * conditional branch are those of the branch not taken.
+ */
+#define OPCODE_LIST(X) \
+    X(0x00, op_nop, 1, 4, 0) \
+    X(0x01, op_ld_bc_d16, 3, 12, 0) \
+    X(0x02, op_ld_bcp_a, 1, 8, 0) \
+    X(0x03, op_inc_bc, 1, 8, 0) \
+    X(0x04, op_inc_b, 1, 4, 0) \
+    X(0x05, op_dec_b, 1, 4, 0) \
+    X(0x06, op_ld_b_d8, 2, 8, 0) \
+    X(0x07, op_rlca, 1, 4, 0) \
+    X(0x08, op_ld_a16_sp, 3, 20, 0) \
+    X(0x09, op_add_hl_bc, 1, 8, 0) \
+    X(0x0A, op_ld_a_bcp, 1, 8, 0) \
+    X(0x0B, op_dec_bc, 1, 8, 0) \
+    X(0x0C, op_inc_c, 1, 4, 0) \
+    X(0x0D, op_dec_c, 1, 4, 0) \
+    X(0x0E, op_ld_c_d8, 2, 8, 0) \
+    X(0x0F, op_rrca, 1, 4, 0) \
+    X(0x10, op_stop, 2, 4, OPF_END_BLOCK) \
+    X(0x11, op_ld_de_d16, 3, 12, 0) \
+    X(0x12, op_ld_dep_a, 1, 8, 0) \
+    X(0x13, op_inc_de, 1, 8, 0) \
+    X(0x14, op_inc_d, 1, 4, 0) \
+    X(0x15, op_dec_d, 1, 4, 0) \
+    X(0x16, op_ld_d_d8, 2, 8, 0) \
+    X(0x17, op_rla, 1, 4, 0) \
+    X(0x18, op_jr_r8, 2, 12, OPF_END_BLOCK) \
+    X(0x19, op_add_hl_de, 1, 8, 0) \
+    X(0x1A, op_ld_a_dep, 1, 8, 0) \
+    X(0x1B, op_dec_de, 1, 8, 0) \
+    X(0x1C, op_inc_e, 1, 4, 0) \
+    X(0x1D, op_dec_e, 1, 4, 0) \
+    X(0x1E, op_ld_e_d8, 2, 8, 0) \
+    X(0x1F, op_rra, 1, 4, 0) \
+    X(0x20, op_jr_nz_r8, 2, 8, OPF_END_BLOCK) \
+    X(0x21, op_ld_hl_d16, 3, 12, 0) \
+    X(0x22, op_ld_hlip_a, 1, 8, 0) \
+    X(0x23, op_inc_hl, 1, 8, 0) \
+    X(0x24, op_inc_h, 1, 4, 0) \
+    X(0x25, op_dec_h, 1, 4, 0) \
+    X(0x26, op_ld_h_d8, 2, 8, 0) \
+    X(0x27, op_daa, 1, 4, 0) \
+    X(0x28, op_jr_z_r8, 2, 8, OPF_END_BLOCK) \
+    X(0x29, op_add_hl_hl, 1, 8, 0) \
+    X(0x2A, op_ld_a_hlip, 1, 8, 0) \
+    X(0x2B, op_dec_hl, 1, 8, 0) \
+    X(0x2C, op_inc_l, 1, 4, 0) \
+    X(0x2D, op_dec_l, 1, 4, 0) \
+    X(0x2E, op_ld_l_d8, 2, 8, 0) \
+    X(0x2F, op_cpl, 1, 4, 0) \
+    X(0x30, op_jr_nc_r8, 2, 8, OPF_END_BLOCK) \
+    X(0x31, op_ld_sp_d16, 3, 12, 0) \
+    X(0x32, op_ld_hldp_a, 1, 8, 0) \
+    X(0x33, op_inc_sp, 1, 8, 0) \
+    X(0x34, op_inc_hlp, 1, 12, 0) \
+    X(0x35, op_dec_hlp, 1, 12, 0) \
+    X(0x36, op_ld_hlp_d8, 2, 12, 0) \
+    X(0x37, op_scf, 1, 4, 0) \
+    X(0x38, op_jr_c_r8, 2, 8, OPF_END_BLOCK) \
+    X(0x39, op_add_hl_sp, 1, 8, 0) \
+    X(0x3A, op_ld_a_hldp, 1, 8, 0) \
+    X(0x3B, op_dec_sp, 1, 8, 0) \
+    X(0x3C, op_inc_a, 1, 4, 0) \
+    X(0x3D, op_dec_a, 1, 4, 0) \
+    X(0x3E, op_ld_a_d8, 2, 8, 0) \
+    X(0x3F, op_ccf, 1, 4, 0) \
+    X(0x40, op_load_b_b, 1, 4, 0) \
+    X(0x41, op_load_b_c, 1, 4, 0) \
+    X(0x42, op_load_b_d, 1, 4, 0) \
+    X(0x43, op_load_b_e, 1, 4, 0) \
+    X(0x44, op_load_b_h, 1, 4, 0) \
+    X(0x45, op_load_b_l, 1, 4, 0) \
+    X(0x46, op_load_b_hlp, 1, 8, 0) \
+    X(0x47, op_load_b_a, 1, 4, 0) \
+    X(0x48, op_load_c_b, 1, 4, 0) \
+    X(0x49, op_load_c_c, 1, 4, 0) \
+    X(0x4A, op_load_c_d, 1, 4, 0) \
+    X(0x4B, op_load_c_e, 1, 4, 0) \
+    X(0x4C, op_load_c_h, 1, 4, 0) \
+    X(0x4D, op_load_c_l, 1, 4, 0) \
+    X(0x4E, op_load_c_hlp, 1, 8, 0) \
+    X(0x4F, op_load_c_a, 1, 4, 0) \
+    X(0x50, op_load_d_b, 1, 4, 0) \
+    X(0x51, op_load_d_c, 1, 4, 0) \
+    X(0x52, op_load_d_d, 1, 4, 0) \
+    X(0x53, op_load_d_e, 1, 4, 0) \
+    X(0x54, op_load_d_h, 1, 4, 0) \
+    X(0x55, op_load_d_l, 1, 4, 0) \
+    X(0x56, op_load_d_hlp, 1, 8, 0) \
+    X(0x57, op_load_d_a, 1, 4, 0) \
+    X(0x58, op_load_e_b, 1, 4, 0) \
+    X(0x59, op_load_e_c, 1, 4, 0) \
+    X(0x5A, op_load_e_d, 1, 4, 0) \
+    X(0x5B, op_load_e_e, 1, 4, 0) \
+    X(0x5C, op_load_e_h, 1, 4, 0) \
+    X(0x5D, op_load_e_l, 1, 4, 0) \
+    X(0x5E, op_load_e_hlp, 1, 8, 0) \
+    X(0x5F, op_load_e_a, 1, 4, 0) \
+    X(0x60, op_load_h_b, 1, 4, 0) \
+    X(0x61, op_load_h_c, 1, 4, 0) \
+    X(0x62, op_load_h_d, 1, 4, 0) \
+    X(0x63, op_load_h_e, 1, 4, 0) \
+    X(0x64, op_load_h_h, 1, 4, 0) \
+    X(0x65, op_load_h_l, 1, 4, 0) \
+    X(0x66, op_load_h_hlp, 1, 8, 0) \
+    X(0x67, op_load_h_a, 1, 4, 0) \
+    X(0x68, op_load_l_b, 1, 4, 0) \
+    X(0x69, op_load_l_c, 1, 4, 0) \
+    X(0x6A, op_load_l_d, 1, 4, 0) \
+    X(0x6B, op_load_l_e, 1, 4, 0) \
+    X(0x6C, op_load_l_h, 1, 4, 0) \
+    X(0x6D, op_load_l_l, 1, 4, 0) \
+    X(0x6E, op_load_l_hlp, 1, 8, 0) \
+    X(0x6F, op_load_l_a, 1, 4, 0) \
+    X(0x70, op_load_hlp_b, 1, 8, 0) \
+    X(0x71, op_load_hlp_c, 1, 8, 0) \
+    X(0x72, op_load_hlp_d, 1, 8, 0) \
+    X(0x73, op_load_hlp_e, 1, 8, 0) \
+    X(0x74, op_load_hlp_h, 1, 8, 0) \
+    X(0x75, op_load_hlp_l, 1, 8, 0) \
+    X(0x76, op_halt, 1, 4, OPF_END_BLOCK) \
+    X(0x77, op_load_hlp_a, 1, 8, 0) \
+    X(0x78, op_load_a_b, 1, 4, 0) \
+    X(0x79, op_load_a_c, 1, 4, 0) \
+    X(0x7A, op_load_a_d, 1, 4, 0) \
+    X(0x7B, op_load_a_e, 1, 4, 0) \
+    X(0x7C, op_load_a_h, 1, 4, 0) \
+    X(0x7D, op_load_a_l, 1, 4, 0) \
+    X(0x7E, op_load_a_hlp, 1, 8, 0) \
+    X(0x7F, op_load_a_a, 1, 4, 0) \
+    X(0x80, op_add_a_b, 1, 4, 0) \
+    X(0x81, op_add_a_c, 1, 4, 0) \
+    X(0x82, op_add_a_d, 1, 4, 0) \
+    X(0x83, op_add_a_e, 1, 4, 0) \
+    X(0x84, op_add_a_h, 1, 4, 0) \
+    X(0x85, op_add_a_l, 1, 4, 0) \
+    X(0x86, op_add_a_hlp, 1, 8, 0) \
+    X(0x87, op_add_a_a, 1, 4, 0) \
+    X(0x88, op_adc_a_b, 1, 4, 0) \
+    X(0x89, op_adc_a_c, 1, 4, 0) \
+    X(0x8A, op_adc_a_d, 1, 4, 0) \
+    X(0x8B, op_adc_a_e, 1, 4, 0) \
+    X(0x8C, op_adc_a_h, 1, 4, 0) \
+    X(0x8D, op_adc_a_l, 1, 4, 0) \
+    X(0x8E, op_adc_a_hlp, 1, 8, 0) \
+    X(0x8F, op_adc_a_a, 1, 4, 0) \
+    X(0x90, op_sub_b, 1, 4, 0) \
+    X(0x91, op_sub_c, 1, 4, 0) \
+    X(0x92, op_sub_d, 1, 4, 0) \
+    X(0x93, op_sub_e, 1, 4, 0) \
+    X(0x94, op_sub_h, 1, 4, 0) \
+    X(0x95, op_sub_l, 1, 4, 0) \
+    X(0x96, op_sub_hlp, 1, 8, 0) \
+    X(0x97, op_sub_a, 1, 4, 0) \
+    X(0x98, op_sbc_a_b, 1, 4, 0) \
+    X(0x99, op_sbc_a_c, 1, 4, 0) \
+    X(0x9A, op_sbc_a_d, 1, 4, 0) \
+    X(0x9B, op_sbc_a_e, 1, 4, 0) \
+    X(0x9C, op_sbc_a_h, 1, 4, 0) \
+    X(0x9D, op_sbc_a_l, 1, 4, 0) \
+    X(0x9E, op_sbc_a_hlp, 1, 8, 0) \
+    X(0x9F, op_sbc_a_a, 1, 4, 0) \
+    X(0xA0, op_and_b, 1, 4, 0) \
+    X(0xA1, op_and_c, 1, 4, 0) \
+    X(0xA2, op_and_d, 1, 4, 0) \
+    X(0xA3, op_and_e, 1, 4, 0) \
+    X(0xA4, op_and_h, 1, 4, 0) \
+    X(0xA5, op_and_l, 1, 4, 0) \
+    X(0xA6, op_and_hlp, 1, 8, 0) \
+    X(0xA7, op_and_a, 1, 4, 0) \
+    X(0xA8, op_xor_b, 1, 4, 0) \
+    X(0xA9, op_xor_c, 1, 4, 0) \
+    X(0xAA, op_xor_d, 1, 4, 0) \
+    X(0xAB, op_xor_e, 1, 4, 0) \
+    X(0xAC, op_xor_h, 1, 4, 0) \
+    X(0xAD, op_xor_l, 1, 4, 0) \
+    X(0xAE, op_xor_hlp, 1, 8, 0) \
+    X(0xAF, op_xor_a, 1, 4, 0) \
+    X(0xB0, op_or_b, 1, 4, 0) \
+    X(0xB1, op_or_c, 1, 4, 0) \
+    X(0xB2, op_or_d, 1, 4, 0) \
+    X(0xB3, op_or_e, 1, 4, 0) \
+    X(0xB4, op_or_h, 1, 4, 0) \
+    X(0xB5, op_or_l, 1, 4, 0) \
+    X(0xB6, op_or_hlp, 1, 8, 0) \
+    X(0xB7, op_or_a, 1, 4, 0) \
+    X(0xB8, op_cp_b, 1, 4, 0) \
+    X(0xB9, op_cp_c, 1, 4, 0) \
+    X(0xBA, op_cp_d, 1, 4, 0) \
+    X(0xBB, op_cp_e, 1, 4, 0) \
+    X(0xBC, op_cp_h, 1, 4, 0) \
+    X(0xBD, op_cp_l, 1, 4, 0) \
+    X(0xBE, op_cp_hlp, 1, 8, 0) \
+    X(0xBF, op_cp_a, 1, 4, 0) \
+    X(0xC0, op_ret_nz, 1, 8, OPF_END_BLOCK | OPF_RETURN) \
+    X(0xC1, op_pop_bc, 1, 12, 0) \
+    X(0xC2, op_jp_nz_a16, 3, 12, OPF_END_BLOCK) \
+    X(0xC3, op_jp_a16, 3, 16, OPF_END_BLOCK) \
+    X(0xC4, op_call_nz_a16, 3, 12, OPF_END_BLOCK | OPF_CALL) \
+    X(0xC5, op_push_bc, 1, 16, 0) \
+    X(0xC6, op_add_a_d8, 2, 8, 0) \
+    X(0xC7, op_rst_00, 1, 16, OPF_END_BLOCK | OPF_CALL) \
+    X(0xC8, op_ret_z, 1, 8, OPF_END_BLOCK | OPF_RETURN) \
+    X(0xC9, op_ret, 1, 16, OPF_END_BLOCK | OPF_RETURN) \
+    X(0xCA, op_jp_z_a16, 3, 12, OPF_END_BLOCK) \
+    X(0xCB, op_prefix_cb, 2, 0, 0) \
+    X(0xCC, op_call_z_a16, 3, 12, OPF_END_BLOCK | OPF_CALL) \
+    X(0xCD, op_call_a16, 3, 24, OPF_END_BLOCK | OPF_CALL) \
+    X(0xCE, op_adc_a_d8, 2, 8, 0) \
+    X(0xCF, op_rst_08, 1, 16, OPF_END_BLOCK | OPF_CALL) \
+    X(0xD0, op_ret_nc, 1, 8, OPF_END_BLOCK | OPF_RETURN) \
+    X(0xD1, op_pop_de, 1, 12, 0) \
+    X(0xD2, op_jp_nc_a16, 3, 12, OPF_END_BLOCK) \
+    X(0xD4, op_call_nc_a16, 3, 12, OPF_END_BLOCK | OPF_CALL) \
+    X(0xD5, op_push_de, 1, 16, 0) \
+    X(0xD6, op_sub_d8, 2, 8, 0) \
+    X(0xD7, op_rst_10, 1, 16, OPF_END_BLOCK | OPF_CALL) \
+    X(0xD8, op_ret_c, 1, 8, OPF_END_BLOCK | OPF_RETURN) \
+    X(0xD9, op_reti, 1, 16, OPF_END_BLOCK | OPF_RETURN) \
+    X(0xDA, op_jp_c_a16, 3, 12, OPF_END_BLOCK) \
+    X(0xDC, op_call_c_a16, 3, 12, OPF_END_BLOCK | OPF_CALL) \
+    X(0xDE, op_sbc_a_d8, 2, 8, 0) \
+    X(0xDF, op_rst_18, 1, 16, OPF_END_BLOCK | OPF_CALL) \
+    X(0xE0, op_ldh_a8_a, 2, 12, 0) \
+    X(0xE1, op_pop_hl, 1, 12, 0) \
+    X(0xE2, op_ld_cp_a, 1, 8, 0) \
+    X(0xE5, op_push_hl, 1, 16, 0) \
+    X(0xE6, op_and_d8, 2, 8, 0) \
+    X(0xE7, op_rst_20, 1, 16, OPF_END_BLOCK | OPF_CALL) \
+    X(0xE8, op_add_sp_r8, 2, 16, 0) \
+    X(0xE9, op_jp_hl, 1, 4, OPF_END_BLOCK) \
+    X(0xEA, op_ld_a16_a, 3, 16, 0) \
+    X(0xEE, op_xor_d8, 2, 8, 0) \
+    X(0xEF, op_rst_28, 1, 16, OPF_END_BLOCK | OPF_CALL) \
+    X(0xF0, op_ldh_a_a8, 2, 12, 0) \
+    X(0xF1, op_pop_af, 1, 12, 0) \
+    X(0xF2, op_ld_a_cp, 1, 8, 0) \
+    X(0xF3, op_di, 1, 4, 0) \
+    X(0xF5, op_push_af, 1, 16, 0) \
+    X(0xF6, op_or_d8, 2, 8, 0) \
+    X(0xF7, op_rst_30, 1, 16, OPF_END_BLOCK | OPF_CALL) \
+    X(0xF8, op_ld_hl_sp_r8, 2, 12, 0) \
+    X(0xF9, op_ld_sp_hl, 1, 8, 0) \
+    X(0xFA, op_ld_a_a16, 3, 16, 0) \
+    X(0xFB, op_ei, 1, 4, 0) \
+    X(0xFE, op_cp_d8, 2, 8, 0) \
+    X(0xFF, op_rst_38, 1, 16, OPF_END_BLOCK | OPF_CALL)
+
+#define OPCODE_PREFIX_CB 0xCB // cycles come from CB_OPCODE_LIST
+
+/**
+ * Opcodes behind the 0xCB prefix, by their second byte. Length and cycles
+ * include the prefix.
+ */
+#define CB_OPCODE_LIST(X) \
+    X(0x00, op_rlc_b, 2, 8, 0) \
+    X(0x01, op_rlc_c, 2, 8, 0) \
+    X(0x02, op_rlc_d, 2, 8, 0) \
+    X(0x03, op_rlc_e, 2, 8, 0) \
+    X(0x04, op_rlc_h, 2, 8, 0) \
+    X(0x05, op_rlc_l, 2, 8, 0) \
+    X(0x06, op_rlc_hlp, 2, 16, 0) \
+    X(0x07, op_rlc_a, 2, 8, 0) \
+    X(0x08, op_rrc_b, 2, 8, 0) \
+    X(0x09, op_rrc_c, 2, 8, 0) \
+    X(0x0A, op_rrc_d, 2, 8, 0) \
+    X(0x0B, op_rrc_e, 2, 8, 0) \
+    X(0x0C, op_rrc_h, 2, 8, 0) \
+    X(0x0D, op_rrc_l, 2, 8, 0) \
+    X(0x0E, op_rrc_hlp, 2, 16, 0) \
+    X(0x0F, op_rrc_a, 2, 8, 0) \
+    X(0x10, op_rl_b, 2, 8, 0) \
+    X(0x11, op_rl_c, 2, 8, 0) \
+    X(0x12, op_rl_d, 2, 8, 0) \
+    X(0x13, op_rl_e, 2, 8, 0) \
+    X(0x14, op_rl_h, 2, 8, 0) \
+    X(0x15, op_rl_l, 2, 8, 0) \
+    X(0x16, op_rl_hlp, 2, 16, 0) \
+    X(0x17, op_rl_a, 2, 8, 0) \
+    X(0x18, op_rr_b, 2, 8, 0) \
+    X(0x19, op_rr_c, 2, 8, 0) \
+    X(0x1A, op_rr_d, 2, 8, 0) \
+    X(0x1B, op_rr_e, 2, 8, 0) \
+    X(0x1C, op_rr_h, 2, 8, 0) \
+    X(0x1D, op_rr_l, 2, 8, 0) \
+    X(0x1E, op_rr_hlp, 2, 16, 0) \
+    X(0x1F, op_rr_a, 2, 8, 0) \
+    X(0x20, op_sla_b, 2, 8, 0) \
+    X(0x21, op_sla_c, 2, 8, 0) \
+    X(0x22, op_sla_d, 2, 8, 0) \
+    X(0x23, op_sla_e, 2, 8, 0) \
+    X(0x24, op_sla_h, 2, 8, 0) \
+    X(0x25, op_sla_l, 2, 8, 0) \
+    X(0x26, op_sla_hlp, 2, 16, 0) \
+    X(0x27, op_sla_a, 2, 8, 0) \
+    X(0x28, op_sra_b, 2, 8, 0) \
+    X(0x29, op_sra_c, 2, 8, 0) \
+    X(0x2A, op_sra_d, 2, 8, 0) \
+    X(0x2B, op_sra_e, 2, 8, 0) \
+    X(0x2C, op_sra_h, 2, 8, 0) \
+    X(0x2D, op_sra_l, 2, 8, 0) \
+    X(0x2E, op_sra_hlp, 2, 16, 0) \
+    X(0x2F, op_sra_a, 2, 8, 0) \
+    X(0x30, op_swap_b, 2, 8, 0) \
+    X(0x31, op_swap_c, 2, 8, 0) \
+    X(0x32, op_swap_d, 2, 8, 0) \
+    X(0x33, op_swap_e, 2, 8, 0) \
+    X(0x34, op_swap_h, 2, 8, 0) \
+    X(0x35, op_swap_l, 2, 8, 0) \
+    X(0x36, op_swap_hlp, 2, 16, 0) \
+    X(0x37, op_swap_a, 2, 8, 0) \
+    X(0x38, op_srl_b, 2, 8, 0) \
+    X(0x39, op_srl_c, 2, 8, 0) \
+    X(0x3A, op_srl_d, 2, 8, 0) \
+    X(0x3B, op_srl_e, 2, 8, 0) \
+    X(0x3C, op_srl_h, 2, 8, 0) \
+    X(0x3D, op_srl_l, 2, 8, 0) \
+    X(0x3E, op_srl_hlp, 2, 16, 0) \
+    X(0x3F, op_srl_a, 2, 8, 0) \
+    X(0x40, op_bit_0_b, 2, 8, 0) \
+    X(0x41, op_bit_0_c, 2, 8, 0) \
+    X(0x42, op_bit_0_d, 2, 8, 0) \
+    X(0x43, op_bit_0_e, 2, 8, 0) \
+    X(0x44, op_bit_0_h, 2, 8, 0) \
+    X(0x45, op_bit_0_l, 2, 8, 0) \
+    X(0x46, op_bit_0_hlp, 2, 12, 0) \
+    X(0x47, op_bit_0_a, 2, 8, 0) \
+    X(0x48, op_bit_1_b, 2, 8, 0) \
+    X(0x49, op_bit_1_c, 2, 8, 0) \
+    X(0x4A, op_bit_1_d, 2, 8, 0) \
+    X(0x4B, op_bit_1_e, 2, 8, 0) \
+    X(0x4C, op_bit_1_h, 2, 8, 0) \
+    X(0x4D, op_bit_1_l, 2, 8, 0) \
+    X(0x4E, op_bit_1_hlp, 2, 12, 0) \
+    X(0x4F, op_bit_1_a, 2, 8, 0) \
+    X(0x50, op_bit_2_b, 2, 8, 0) \
+    X(0x51, op_bit_2_c, 2, 8, 0) \
+    X(0x52, op_bit_2_d, 2, 8, 0) \
+    X(0x53, op_bit_2_e, 2, 8, 0) \
+    X(0x54, op_bit_2_h, 2, 8, 0) \
+    X(0x55, op_bit_2_l, 2, 8, 0) \
+    X(0x56, op_bit_2_hlp, 2, 12, 0) \
+    X(0x57, op_bit_2_a, 2, 8, 0) \
+    X(0x58, op_bit_3_b, 2, 8, 0) \
+    X(0x59, op_bit_3_c, 2, 8, 0) \
+    X(0x5A, op_bit_3_d, 2, 8, 0) \
+    X(0x5B, op_bit_3_e, 2, 8, 0) \
+    X(0x5C, op_bit_3_h, 2, 8, 0) \
+    X(0x5D, op_bit_3_l, 2, 8, 0) \
+    X(0x5E, op_bit_3_hlp, 2, 12, 0) \
+    X(0x5F, op_bit_3_a, 2, 8, 0) \
+    X(0x60, op_bit_4_b, 2, 8, 0) \
+    X(0x61, op_bit_4_c, 2, 8, 0) \
+    X(0x62, op_bit_4_d, 2, 8, 0) \
+    X(0x63, op_bit_4_e, 2, 8, 0) \
+    X(0x64, op_bit_4_h, 2, 8, 0) \
+    X(0x65, op_bit_4_l, 2, 8, 0) \
+    X(0x66, op_bit_4_hlp, 2, 12, 0) \
+    X(0x67, op_bit_4_a, 2, 8, 0) \
+    X(0x68, op_bit_5_b, 2, 8, 0) \
+    X(0x69, op_bit_5_c, 2, 8, 0) \
+    X(0x6A, op_bit_5_d, 2, 8, 0) \
+    X(0x6B, op_bit_5_e, 2, 8, 0) \
+    X(0x6C, op_bit_5_h, 2, 8, 0) \
+    X(0x6D, op_bit_5_l, 2, 8, 0) \
+    X(0x6E, op_bit_5_hlp, 2, 12, 0) \
+    X(0x6F, op_bit_5_a, 2, 8, 0) \
+    X(0x70, op_bit_6_b, 2, 8, 0) \
+    X(0x71, op_bit_6_c, 2, 8, 0) \
+    X(0x72, op_bit_6_d, 2, 8, 0) \
+    X(0x73, op_bit_6_e, 2, 8, 0) \
+    X(0x74, op_bit_6_h, 2, 8, 0) \
+    X(0x75, op_bit_6_l, 2, 8, 0) \
+    X(0x76, op_bit_6_hlp, 2, 12, 0) \
+    X(0x77, op_bit_6_a, 2, 8, 0) \
+    X(0x78, op_bit_7_b, 2, 8, 0) \
+    X(0x79, op_bit_7_c, 2, 8, 0) \
+    X(0x7A, op_bit_7_d, 2, 8, 0) \
+    X(0x7B, op_bit_7_e, 2, 8, 0) \
+    X(0x7C, op_bit_7_h, 2, 8, 0) \
+    X(0x7D, op_bit_7_l, 2, 8, 0) \
+    X(0x7E, op_bit_7_hlp, 2, 12, 0) \
+    X(0x7F, op_bit_7_a, 2, 8, 0) \
+    X(0x80, op_res_0_b, 2, 8, 0) \
+    X(0x81, op_res_0_c, 2, 8, 0) \
+    X(0x82, op_res_0_d, 2, 8, 0) \
+    X(0x83, op_res_0_e, 2, 8, 0) \
+    X(0x84, op_res_0_h, 2, 8, 0) \
+    X(0x85, op_res_0_l, 2, 8, 0) \
+    X(0x86, op_res_0_hlp, 2, 16, 0) \
+    X(0x87, op_res_0_a, 2, 8, 0) \
+    X(0x88, op_res_1_b, 2, 8, 0) \
+    X(0x89, op_res_1_c, 2, 8, 0) \
+    X(0x8A, op_res_1_d, 2, 8, 0) \
+    X(0x8B, op_res_1_e, 2, 8, 0) \
+    X(0x8C, op_res_1_h, 2, 8, 0) \
+    X(0x8D, op_res_1_l, 2, 8, 0) \
+    X(0x8E, op_res_1_hlp, 2, 16, 0) \
+    X(0x8F, op_res_1_a, 2, 8, 0) \
+    X(0x90, op_res_2_b, 2, 8, 0) \
+    X(0x91, op_res_2_c, 2, 8, 0) \
+    X(0x92, op_res_2_d, 2, 8, 0) \
+    X(0x93, op_res_2_e, 2, 8, 0) \
+    X(0x94, op_res_2_h, 2, 8, 0) \
+    X(0x95, op_res_2_l, 2, 8, 0) \
+    X(0x96, op_res_2_hlp, 2, 16, 0) \
+    X(0x97, op_res_2_a, 2, 8, 0) \
+    X(0x98, op_res_3_b, 2, 8, 0) \
+    X(0x99, op_res_3_c, 2, 8, 0) \
+    X(0x9A, op_res_3_d, 2, 8, 0) \
+    X(0x9B, op_res_3_e, 2, 8, 0) \
+    X(0x9C, op_res_3_h, 2, 8, 0) \
+    X(0x9D, op_res_3_l, 2, 8, 0) \
+    X(0x9E, op_res_3_hlp, 2, 16, 0) \
+    X(0x9F, op_res_3_a, 2, 8, 0) \
+    X(0xA0, op_res_4_b, 2, 8, 0) \
+    X(0xA1, op_res_4_c, 2, 8, 0) \
+    X(0xA2, op_res_4_d, 2, 8, 0) \
+    X(0xA3, op_res_4_e, 2, 8, 0) \
+    X(0xA4, op_res_4_h, 2, 8, 0) \
+    X(0xA5, op_res_4_l, 2, 8, 0) \
+    X(0xA6, op_res_4_hlp, 2, 16, 0) \
+    X(0xA7, op_res_4_a, 2, 8, 0) \
+    X(0xA8, op_res_5_b, 2, 8, 0) \
+    X(0xA9, op_res_5_c, 2, 8, 0) \
+    X(0xAA, op_res_5_d, 2, 8, 0) \
+    X(0xAB, op_res_5_e, 2, 8, 0) \
+    X(0xAC, op_res_5_h, 2, 8, 0) \
+    X(0xAD, op_res_5_l, 2, 8, 0) \
+    X(0xAE, op_res_5_hlp, 2, 16, 0) \
+    X(0xAF, op_res_5_a, 2, 8, 0) \
+    X(0xB0, op_res_6_b, 2, 8, 0) \
+    X(0xB1, op_res_6_c, 2, 8, 0) \
+    X(0xB2, op_res_6_d, 2, 8, 0) \
+    X(0xB3, op_res_6_e, 2, 8, 0) \
+    X(0xB4, op_res_6_h, 2, 8, 0) \
+    X(0xB5, op_res_6_l, 2, 8, 0) \
+    X(0xB6, op_res_6_hlp, 2, 16, 0) \
+    X(0xB7, op_res_6_a, 2, 8, 0) \
+    X(0xB8, op_res_7_b, 2, 8, 0) \
+    X(0xB9, op_res_7_c, 2, 8, 0) \
+    X(0xBA, op_res_7_d, 2, 8, 0) \
+    X(0xBB, op_res_7_e, 2, 8, 0) \
+    X(0xBC, op_res_7_h, 2, 8, 0) \
+    X(0xBD, op_res_7_l, 2, 8, 0) \
+    X(0xBE, op_res_7_hlp, 2, 16, 0) \
+    X(0xBF, op_res_7_a, 2, 8, 0) \
+    X(0xC0, op_set_0_b, 2, 8, 0) \
+    X(0xC1, op_set_0_c, 2, 8, 0) \
+    X(0xC2, op_set_0_d, 2, 8, 0) \
+    X(0xC3, op_set_0_e, 2, 8, 0) \
+    X(0xC4, op_set_0_h, 2, 8, 0) \
+    X(0xC5, op_set_0_l, 2, 8, 0) \
+    X(0xC6, op_set_0_hlp, 2, 16, 0) \
+    X(0xC7, op_set_0_a, 2, 8, 0) \
+    X(0xC8, op_set_1_b, 2, 8, 0) \
+    X(0xC9, op_set_1_c, 2, 8, 0) \
+    X(0xCA, op_set_1_d, 2, 8, 0) \
+    X(0xCB, op_set_1_e, 2, 8, 0) \
+    X(0xCC, op_set_1_h, 2, 8, 0) \
+    X(0xCD, op_set_1_l, 2, 8, 0) \
+    X(0xCE, op_set_1_hlp, 2, 16, 0) \
+    X(0xCF, op_set_1_a, 2, 8, 0) \
+    X(0xD0, op_set_2_b, 2, 8, 0) \
+    X(0xD1, op_set_2_c, 2, 8, 0) \
+    X(0xD2, op_set_2_d, 2, 8, 0) \
+    X(0xD3, op_set_2_e, 2, 8, 0) \
+    X(0xD4, op_set_2_h, 2, 8, 0) \
+    X(0xD5, op_set_2_l, 2, 8, 0) \
+    X(0xD6, op_set_2_hlp, 2, 16, 0) \
+    X(0xD7, op_set_2_a, 2, 8, 0) \
+    X(0xD8, op_set_3_b, 2, 8, 0) \
+    X(0xD9, op_set_3_c, 2, 8, 0) \
+    X(0xDA, op_set_3_d, 2, 8, 0) \
+    X(0xDB, op_set_3_e, 2, 8, 0) \
+    X(0xDC, op_set_3_h, 2, 8, 0) \
+    X(0xDD, op_set_3_l, 2, 8, 0) \
+    X(0xDE, op_set_3_hlp, 2, 16, 0) \
+    X(0xDF, op_set_3_a, 2, 8, 0) \
+    X(0xE0, op_set_4_b, 2, 8, 0) \
+    X(0xE1, op_set_4_c, 2, 8, 0) \
+    X(0xE2, op_set_4_d, 2, 8, 0) \
+    X(0xE3, op_set_4_e, 2, 8, 0) \
+    X(0xE4, op_set_4_h, 2, 8, 0) \
+    X(0xE5, op_set_4_l, 2, 8, 0) \
+    X(0xE6, op_set_4_hlp, 2, 16, 0) \
+    X(0xE7, op_set_4_a, 2, 8, 0) \
+    X(0xE8, op_set_5_b, 2, 8, 0) \
+    X(0xE9, op_set_5_c, 2, 8, 0) \
+    X(0xEA, op_set_5_d, 2, 8, 0) \
+    X(0xEB, op_set_5_e, 2, 8, 0) \
+    X(0xEC, op_set_5_h, 2, 8, 0) \
+    X(0xED, op_set_5_l, 2, 8, 0) \
+    X(0xEE, op_set_5_hlp, 2, 16, 0) \
+    X(0xEF, op_set_5_a, 2, 8, 0) \
+    X(0xF0, op_set_6_b, 2, 8, 0) \
+    X(0xF1, op_set_6_c, 2, 8, 0) \
+    X(0xF2, op_set_6_d, 2, 8, 0) \
+    X(0xF3, op_set_6_e, 2, 8, 0) \
+    X(0xF4, op_set_6_h, 2, 8, 0) \
+    X(0xF5, op_set_6_l, 2, 8, 0) \
+    X(0xF6, op_set_6_hlp, 2, 16, 0) \
+    X(0xF7, op_set_6_a, 2, 8, 0) \
+    X(0xF8, op_set_7_b, 2, 8, 0) \
+    X(0xF9, op_set_7_c, 2, 8, 0) \
+    X(0xFA, op_set_7_d, 2, 8, 0) \
+    X(0xFB, op_set_7_e, 2, 8, 0) \
+    X(0xFC, op_set_7_h, 2, 8, 0) \
+    X(0xFD, op_set_7_l, 2, 8, 0) \
+    X(0xFE, op_set_7_hlp, 2, 16, 0) \
+    X(0xFF, op_set_7_a, 2, 8, 0)
+
+#endif // OPCODES_H
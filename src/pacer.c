@@ -0,0 +1,116 @@
+//
+// Created by davidg on 01.09.25.
+//
+
+#include <pacer.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#define SPIN_INITIAL_NS 200000   // 0.2 ms until the first sleep tells better
+#define SPIN_MIN_NS 20000
+#define SPIN_MAX_NS 2000000
+#define LATE_NS 1000000          // a frame this far past its deadline counts as late
+#define MAX_LAG_NS 100000000     // further behind than this (host suspended, debugger) starts over
+
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void spin_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Host nanoseconds that `cycles` guest cycles take at the pacer's speed
+static int64_t guest_ns(const Pacer* pacer, uint64_t cycles) {
+    return (int64_t)(cycles * 1e9 / (GB_CLOCK_HZ * pacer->speed));
+}
+
+// Sleeps most of the way and spins the rest, returns the time it woke up
+static int64_t wait_until(Pacer* pacer, int64_t deadline) {
+    int64_t now = clock_ns(CLOCK_MONOTONIC);
+
+    if (deadline - now > pacer->spin_ns) {
+        int64_t wake = deadline - pacer->spin_ns;
+        struct timespec time = { wake / 1000000000, wake % 1000000000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, NULL) == EINTR) {}
+        now = clock_ns(CLOCK_MONOTONIC);
+
+        // Keep half the observed oversleep in reserve. Widen at once, narrow slowly
+        int64_t margin = (now - wake) + (now - wake) / 2;
+        if (margin > pacer->spin_ns) {
+            pacer->spin_ns = margin;
+        } else {
+            pacer->spin_ns += (margin - pacer->spin_ns) / 16;
+        }
+        if (pacer->spin_ns < SPIN_MIN_NS) pacer->spin_ns = SPIN_MIN_NS;
+        if (pacer->spin_ns > SPIN_MAX_NS) pacer->spin_ns = SPIN_MAX_NS;
+    }
+
+    while (now < deadline) {
+        spin_pause();
+        now = clock_ns(CLOCK_MONOTONIC);
+    }
+    return now;
+}
+
+void pacer_init(Pacer* pacer, const GB* gb, double speed) {
+    *pacer = (Pacer){0};
+    pacer->speed = speed > 0 ? speed : 0;
+    pacer->spin_ns = SPIN_INITIAL_NS;
+    pacer->start_ns = pacer->anchor_ns = clock_ns(CLOCK_MONOTONIC);
+    pacer->start_cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    pacer->start_cycles = pacer->anchor_cycles = pacer->cycles = gb->cpu.cycles;
+}
+
+cpu_status_t pacer_run_frame(GB* gb, Pacer* pacer) {
+    cpu_status_t status = cpu_run(gb, GB_FRAME_CYCLES);
+    pacer->cycles = gb->cpu.cycles;
+    if (status != CPU_BUDGET_DONE) return status;
+
+    pacer->frames++;
+    if (pacer->speed == 0) return status;
+
+    int64_t deadline = pacer->anchor_ns + guest_ns(pacer, gb->cpu.cycles - pacer->anchor_cycles);
+    int64_t now = wait_until(pacer, deadline);
+    double jitter = now - deadline;
+
+    pacer->jitter_sum += jitter;
+    pacer->jitter_squares += jitter * jitter;
+    if (jitter > pacer->jitter_max) pacer->jitter_max = jitter;
+    if (jitter > LATE_NS) pacer->late_frames++;
+
+    // Catching up on a long stall would run the guest flat out for just as long
+    if (jitter > MAX_LAG_NS) {
+        pacer->anchor_ns = now;
+        pacer->anchor_cycles = gb->cpu.cycles;
+        pacer->resyncs++;
+    }
+
+    pacer->drift_ns = (now - pacer->start_ns) - guest_ns(pacer, gb->cpu.cycles - pacer->start_cycles);
+    return status;
+}
+
+void pacer_stats(const Pacer* pacer, PacerStats* stats) {
+    double wall = clock_ns(CLOCK_MONOTONIC) - pacer->start_ns;
+    double cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - pacer->start_cpu_ns;
+    double frames = pacer->frames ? pacer->frames : 1;
+    double mean = pacer->jitter_sum / frames;
+    double variance = pacer->jitter_squares / frames - mean * mean;
+
+    *stats = (PacerStats){
+        .frames = pacer->frames,
+        .late_frames = pacer->late_frames,
+        .resyncs = pacer->resyncs,
+        .jitter_mean_us = mean / 1e3,
+        .jitter_stddev_us = variance > 0 ? sqrt(variance) / 1e3 : 0,
+        .jitter_max_us = pacer->jitter_max / 1e3,
+        .drift_us = pacer->drift_ns / 1e3,
+        .guest_speed = wall > 0 ? (pacer->cycles - pacer->start_cycles) / (double)GB_CLOCK_HZ / (wall / 1e9) : 0,
+        .cpu_load = wall > 0 ? cpu / wall : 0,
+    };
+}
@@ -0,0 +1,295 @@
+//
+// Created by davidg on 02.09.25.
+//
+
+#include <ppu.h>
+#include <gb.h>
+#include <interrupt.h>
+#include <scheduler.h>
+#include <stdio.h>
+#include <string.h>
+#include "ppu_pipeline.h"
+
+#define LINE_CYCLES 456
+#define MODE3_END 252 // mode 2 takes 80 cycles, mode 3 at least 172
+#define FRAME_LINES 154
+#define OAM_BYTES 160
+
+#define STAT_MODE0_IRQ 0x08
+#define STAT_MODE1_IRQ 0x10
+#define STAT_MODE2_IRQ 0x20
+#define STAT_LYC_IRQ   0x40
+#define STAT_SOURCES   0x78
+
+static bool lcd_on(const GB* gb) {
+    return gb->mem.data[LCDC_ADDR] & LCDC_LCD_ON;
+}
+
+// Cycles into the current frame, also if ppu_sync has not moved frame_start on yet
+static uint32_t frame_cycles(const GB* gb) {
+    return (gb->cpu.cycles - gb->ppu.frame_start) % GB_FRAME_CYCLES;
+}
+
+static uint8_t current_ly(const GB* gb) {
+    return lcd_on(gb) ? frame_cycles(gb) / LINE_CYCLES : 0;
+}
+
+static void render_line(GB* gb) {
+    Ppu* ppu = &gb->ppu;
+    const uint8_t* regs = gb->mem.data + LCDC_ADDR;
+    unsigned line = ppu->line++;
+
+    if (ppu->reference || ppu->line_version[line] != ppu->version || ppu->line_window[line] != ppu->window_line) {
+        if (ppu->pipe) {
+            ppu_pipeline_line(gb, line, ppu->window_line);
+        } else {
+            ppu_render_line(ppu->kernel, gb->mem.data + 0x8000, gb->mem.data + 0xFE00, regs,
+                            line, ppu->window_line, ppu->screen[line]);
+        }
+        ppu->line_version[line] = ppu->version;
+        ppu->line_window[line] = ppu->window_line;
+    }
+    if (ppu_window_visible(regs, line)) ppu->window_line++;
+
+    if (ppu->line == SCREEN_HEIGHT) {
+        if (ppu->pipe) {
+            ppu_pipeline_frame(gb);
+        } else {
+            memcpy(ppu->frame, ppu->screen, sizeof(ppu->frame));
+        }
+        ppu->frames++;
+    }
+}
+
+void ppu_sync(GB* gb) {
+    Ppu* ppu = &gb->ppu;
+    if (!lcd_on(gb)) return;
+
+    for (;;) {
+        if (ppu->line < SCREEN_HEIGHT) {
+            if (CYCLES_BEFORE(gb->cpu.cycles, ppu->frame_start + ppu->line * LINE_CYCLES + MODE3_END)) return;
+            render_line(gb);
+        } else {
+            uint64_t next = ppu->frame_start + GB_FRAME_CYCLES;
+            if (CYCLES_BEFORE(gb->cpu.cycles, next)) return;
+            ppu->frame_start = next;
+            ppu->line = 0;
+            ppu->window_line = 0;
+        }
+    }
+}
+
+void ppu_invalidate(GB* gb) {
+    Ppu* ppu = &gb->ppu;
+    ppu->version = 1;
+    memset(ppu->line_version, 0, sizeof(ppu->line_version));
+    if (ppu->pipe) ppu_pipeline_reload(gb, false);
+}
+
+// First frame relative time >= t of `offset` into a line in first..last, maybe in the next frame
+static uint64_t next_point(uint64_t t, unsigned first, unsigned last, unsigned offset) {
+    uint64_t frame = t - t % GB_FRAME_CYCLES;
+    uint64_t within = t - frame;
+    uint64_t line = within <= first * LINE_CYCLES + offset ? first : (within - offset + LINE_CYCLES - 1) / LINE_CYCLES;
+
+    if (line > last) return frame + GB_FRAME_CYCLES + first * LINE_CYCLES + offset;
+    return frame + line * LINE_CYCLES + offset;
+}
+
+// Moves EVENT_PPU to the next VBlank or enabled STAT source after `after`
+static void ppu_reschedule(GB* gb, uint64_t after) {
+    Ppu* ppu = &gb->ppu;
+    if (!lcd_on(gb)) {
+        sched_cancel(gb, EVENT_PPU);
+        return;
+    }
+
+    uint64_t t = after + 1 - ppu->frame_start;
+    uint64_t when = next_point(t, SCREEN_HEIGHT, SCREEN_HEIGHT, 0);
+    uint8_t lyc = gb->mem.data[LYC_ADDR];
+
+    if (ppu->stat & STAT_MODE2_IRQ) {
+        uint64_t mode2 = next_point(t, 0, SCREEN_HEIGHT - 1, 0);
+        if (mode2 < when) when = mode2;
+    }
+    if (ppu->stat & STAT_MODE0_IRQ) {
+        uint64_t mode0 = next_point(t, 0, SCREEN_HEIGHT - 1, MODE3_END);
+        if (mode0 < when) when = mode0;
+    }
+    if ((ppu->stat & STAT_LYC_IRQ) && lyc < FRAME_LINES) {
+        uint64_t match = next_point(t, lyc, lyc, 0);
+        if (match < when) when = match;
+    }
+
+    ppu->next_event = ppu->frame_start + when;
+    sched_schedule(gb, EVENT_PPU, ppu->next_event);
+}
+
+void ppu_event(GB* gb) {
+    Ppu* ppu = &gb->ppu;
+    uint32_t within = (ppu->next_event - ppu->frame_start) % GB_FRAME_CYCLES;
+    unsigned line = within / LINE_CYCLES;
+    unsigned dot = within % LINE_CYCLES;
+    bool stat = false;
+
+    if (line == SCREEN_HEIGHT && dot == 0) {
+        ppu_sync(gb); // completes the frame
+        interrupt_request(gb, INT_VBLANK);
+        stat = ppu->stat & STAT_MODE1_IRQ;
+    } else if (line < SCREEN_HEIGHT) {
+        stat = (dot == 0 && (ppu->stat & STAT_MODE2_IRQ)) || (dot == MODE3_END && (ppu->stat & STAT_MODE0_IRQ));
+    }
+    if (dot == 0 && line == gb->mem.data[LYC_ADDR] && (ppu->stat & STAT_LYC_IRQ)) stat = true;
+
+    if (stat) interrupt_request(gb, INT_STAT);
+    ppu_reschedule(gb, ppu->next_event);
+}
+
+static uint8_t ly_read(GB* gb, uint16_t address) {
+    return current_ly(gb);
+}
+
+static uint8_t stat_read(GB* gb, uint16_t address) {
+    uint8_t mode = 0;
+    uint8_t ly = current_ly(gb);
+
+    if (lcd_on(gb)) {
+        uint32_t dot = frame_cycles(gb) % LINE_CYCLES;
+        mode = ly >= SCREEN_HEIGHT ? 1 : dot < 80 ? 2 : dot < MODE3_END ? 3 : 0;
+    }
+    return 0x80 | gb->ppu.stat | (ly == gb->mem.data[LYC_ADDR] ? 0x04 : 0) | mode;
+}
+
+// LY moves on at the end of each line
+static uint64_t ly_change(GB* gb, uint16_t address) {
+    if (!lcd_on(gb)) return gb->cpu.cycles + MEM_CHANGE_NEVER;
+    return gb->cpu.cycles + LINE_CYCLES - frame_cycles(gb) % LINE_CYCLES;
+}
+
+// The mode also changes at dots 80 and MODE3_END of the visible lines, the LYC flag with LY
+static uint64_t stat_change(GB* gb, uint16_t address) {
+    if (!lcd_on(gb)) return gb->cpu.cycles + MEM_CHANGE_NEVER;
+
+    uint32_t dot = frame_cycles(gb) % LINE_CYCLES;
+    uint32_t edge = LINE_CYCLES;
+    if (current_ly(gb) < SCREEN_HEIGHT) edge = dot < 80 ? 80 : dot < MODE3_END ? MODE3_END : LINE_CYCLES;
+    return gb->cpu.cycles + edge - dot;
+}
+
+static void stat_write(GB* gb, uint16_t address, uint8_t value) {
+    gb->ppu.stat = value & STAT_SOURCES;
+    ppu_reschedule(gb, gb->cpu.cycles);
+}
+
+static void lyc_write(GB* gb, uint16_t address, uint8_t value) {
+    gb->mem.data[address] = value;
+    ppu_reschedule(gb, gb->cpu.cycles);
+}
+
+static void ignore_write(GB* gb, uint16_t address, uint8_t value) {
+}
+
+// SCY, SCX, the palettes and the window position: render what is due with the old value
+static void register_write(GB* gb, uint16_t address, uint8_t value) {
+    if (gb->mem.data[address] == value) return;
+    ppu_sync(gb);
+    gb->mem.data[address] = value;
+    gb->ppu.version++;
+    if (gb->ppu.pipe) ppu_pipeline_write(gb, address, value);
+}
+
+static void lcdc_write(GB* gb, uint16_t address, uint8_t value) {
+    Ppu* ppu = &gb->ppu;
+    uint8_t old = gb->mem.data[address];
+    if (old == value) return;
+
+    ppu_sync(gb);
+    gb->mem.data[address] = value;
+    ppu->version++;
+    if (ppu->pipe) ppu_pipeline_write(gb, address, value);
+
+    // Switched on, LY 0 starts right away
+    if (!(old & LCDC_LCD_ON) && (value & LCDC_LCD_ON)) {
+        ppu->frame_start = gb->cpu.cycles;
+        ppu->line = 0;
+        ppu->window_line = 0;
+    }
+    if ((old ^ value) & LCDC_LCD_ON) ppu_reschedule(gb, gb->cpu.cycles - 1);
+}
+
+// OAM DMA, done at once
+static void dma_write(GB* gb, uint16_t address, uint8_t value) {
+    uint8_t oam[OAM_BYTES];
+    gb->mem.data[address] = value;
+
+    for (unsigned i = 0; i < OAM_BYTES; i++) oam[i] = mem_read(gb, value << 8 | i);
+    if (memcmp(gb->mem.data + 0xFE00, oam, OAM_BYTES) == 0) return;
+
+    ppu_sync(gb);
+    if (gb->ppu.pipe) {
+        for (unsigned i = 0; i < OAM_BYTES; i++) {
+            if (gb->mem.data[0xFE00 + i] != oam[i]) ppu_pipeline_write(gb, 0xFE00 + i, oam[i]);
+        }
+    }
+    memcpy(gb->mem.data + 0xFE00, oam, OAM_BYTES);
+    mem_touch_page(gb, 0xFE);
+    gb->ppu.version++;
+}
+
+// VRAM and OAM
+static void video_watch(GB* gb, uint16_t address, uint8_t value) {
+    if (gb->mem.data[address] == value) return;
+    ppu_sync(gb);
+    gb->ppu.version++;
+    if (gb->ppu.pipe) ppu_pipeline_write(gb, address, value);
+}
+
+void ppu_init(GB* gb) {
+    Ppu* ppu = &gb->ppu;
+    ppu->frame_start = gb->cpu.cycles;
+    ppu->next_event = gb->cpu.cycles;
+    ppu->line = 0;
+    ppu->window_line = 0;
+    ppu->stat = 0;
+    ppu->frames = 0;
+    ppu->version = 1;
+    memset(ppu->line_version, 0, sizeof(ppu->line_version));
+    memset(ppu->screen, 0, sizeof(ppu->screen));
+    memset(ppu->frame, 0, sizeof(ppu->frame));
+    if (ppu->pipe) ppu_pipeline_reload(gb, true);
+
+    mem_map_io(gb, LCDC_ADDR, NULL, lcdc_write);
+    mem_map_io(gb, STAT_ADDR, stat_read, stat_write);
+    mem_map_io(gb, LY_ADDR, ly_read, ignore_write);
+    mem_map_io(gb, LYC_ADDR, NULL, lyc_write);
+    mem_map_io(gb, DMA_ADDR, NULL, dma_write);
+    static const uint16_t plain[] = { SCY_ADDR, SCX_ADDR, BGP_ADDR, OBP0_ADDR, OBP1_ADDR, WY_ADDR, WX_ADDR };
+    for (unsigned i = 0; i < sizeof(plain) / sizeof(plain[0]); i++) mem_map_io(gb, plain[i], NULL, register_write);
+
+    // LY and the mode move on between events
+    mem_mark_io_timed(gb, LY_ADDR, ly_change);
+    mem_mark_io_timed(gb, STAT_ADDR, stat_change);
+
+    mem_watch_writes(gb, 0x80, 0x9F, video_watch);
+    mem_watch_writes(gb, 0xFE, 0xFE, video_watch);
+}
+
+void ppu_set_reference(GB* gb, bool reference) {
+    gb->ppu.reference = reference;
+    gb->ppu.kernel = reference ? PPU_KERNEL_SCALAR : ppu_best_kernel();
+}
+
+bool ppu_save_pgm(const GB* gb, const char* filename) {
+    static const uint8_t grey[4] = { 255, 170, 85, 0 };
+    uint8_t pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+    for (unsigned y = 0; y < SCREEN_HEIGHT; y++) {
+        for (unsigned x = 0; x < SCREEN_WIDTH; x++) pixels[y][x] = grey[gb->ppu.frame[y][x] & 3];
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+    fprintf(file, "P5\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+    bool ok = fwrite(pixels, sizeof(pixels), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
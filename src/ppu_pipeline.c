@@ -0,0 +1,293 @@
+//
+// Created by davidg on 03.09.25.
+//
+
+#include <ppu.h>
+#include <gb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ppu_pipeline.h"
+
+#define QUEUE_SIZE (1u << 16) // entries, a full frame of tile uploads fits many times over
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+#define PUBLISH_EVERY 256     // writes between two lines are handed over in batches this big
+#define SPIN_ROUNDS 4096      // the renderer polls this long before it goes to sleep
+
+typedef enum {
+    ENTRY_WRITE,
+    ENTRY_LINE,
+    ENTRY_FRAME,
+} entry_kind_t;
+
+typedef struct {
+    uint64_t cycles;  // cpu->cycles when it was queued
+    uint16_t address; // ENTRY_WRITE: address, ENTRY_LINE: line
+    uint8_t value;    // ENTRY_WRITE: value, ENTRY_LINE: window row
+    uint8_t kind;     // entry_kind_t
+    uint8_t kernel;   // ENTRY_LINE: ppu_kernel_t
+} Entry;
+
+/**
+ * Single producer (the CPU thread), single consumer (the render thread).
+ * Each side writes its own cache line and only reads the other's. Entries
+ * are handed over in batches, at least once per rendered line, and the
+ * producer keeps what it last saw of the renderer's progress, so the
+ * shared lines move about once per line rather than once per write.
+ */
+struct PpuPipeline {
+    uint32_t head;      // next entry the CPU thread fills
+    uint32_t tail_seen; // tail as the CPU thread last saw it
+    uint64_t stalls;
+    uint64_t waits;
+    uint64_t max_lag;
+    uint64_t flushed;   // Ppu.frames the last time Ppu.frame was brought up to date
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+
+    _Alignas(64) _Atomic uint32_t published; // entries before this one are the renderer's
+
+    _Alignas(64) _Atomic uint32_t tail; // next entry the renderer replays
+    _Atomic uint64_t replayed;          // cycle stamp of the last replayed entry
+    _Atomic bool sleeping;
+
+    // Owned by the renderer while it runs, by the CPU thread while the queue is drained
+    uint8_t vram[0x2000];
+    uint8_t oam[0x100];
+    uint8_t regs[PPU_REGS];
+    uint8_t screen[SCREEN_HEIGHT][SCREEN_WIDTH];
+    uint8_t frame[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+    Entry entries[QUEUE_SIZE];
+};
+
+static void spin_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void replay(PpuPipeline* pipe, const Entry* entry) {
+    switch (entry->kind) {
+        case ENTRY_WRITE:
+            if (entry->address >= 0xFF00) {
+                pipe->regs[entry->address - LCDC_ADDR] = entry->value;
+            } else if (entry->address >= 0xFE00) {
+                pipe->oam[entry->address - 0xFE00] = entry->value;
+            } else {
+                pipe->vram[entry->address - 0x8000] = entry->value;
+            }
+            break;
+        case ENTRY_LINE:
+            ppu_render_line(entry->kernel, pipe->vram, pipe->oam, pipe->regs,
+                            entry->address, entry->value, pipe->screen[entry->address]);
+            break;
+        case ENTRY_FRAME:
+            memcpy(pipe->frame, pipe->screen, sizeof(pipe->frame));
+            break;
+    }
+}
+
+// Waits for the CPU thread to publish more than `tail`, false once stopped
+static bool await_entries(PpuPipeline* pipe, uint32_t tail) {
+    for (unsigned i = 0; i < SPIN_ROUNDS; i++) {
+        if (atomic_load_explicit(&pipe->published, memory_order_acquire) != tail) return true;
+        spin_pause();
+    }
+
+    // Sleeping is announced before published is looked at again, publish()
+    // stores published before it looks at sleeping: one of the two sees the other
+    pthread_mutex_lock(&pipe->lock);
+    atomic_store(&pipe->sleeping, true);
+    while (atomic_load(&pipe->published) == tail && !pipe->stop) {
+        pthread_cond_wait(&pipe->wake, &pipe->lock);
+    }
+    atomic_store(&pipe->sleeping, false);
+    bool stop = pipe->stop && atomic_load(&pipe->published) == tail;
+    pthread_mutex_unlock(&pipe->lock);
+    return !stop;
+}
+
+static void* render_main(void* arg) {
+    PpuPipeline* pipe = arg;
+    uint32_t tail = 0;
+
+    while (await_entries(pipe, tail)) {
+        uint32_t head = atomic_load_explicit(&pipe->published, memory_order_acquire);
+        uint64_t cycles = 0;
+        while (tail != head) {
+            const Entry* entry = &pipe->entries[tail & QUEUE_MASK];
+            replay(pipe, entry);
+            cycles = entry->cycles;
+            tail++;
+        }
+        atomic_store_explicit(&pipe->replayed, cycles, memory_order_relaxed);
+        atomic_store_explicit(&pipe->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+static void publish(PpuPipeline* pipe) {
+    if (atomic_load_explicit(&pipe->published, memory_order_relaxed) == pipe->head) return;
+    atomic_store(&pipe->published, pipe->head);
+
+    if (atomic_load(&pipe->sleeping)) {
+        pthread_mutex_lock(&pipe->lock);
+        pthread_cond_signal(&pipe->wake);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+}
+
+static void wait_for_tail(PpuPipeline* pipe, uint32_t tail) {
+    for (unsigned i = 0; pipe->head - pipe->tail_seen > tail; i++) {
+        if (i < SPIN_ROUNDS) {
+            spin_pause();
+        } else {
+            sched_yield();
+        }
+        pipe->tail_seen = atomic_load_explicit(&pipe->tail, memory_order_acquire);
+    }
+}
+
+// Until the renderer has replayed everything, so its buffers can be touched
+static void drain(PpuPipeline* pipe) {
+    publish(pipe);
+    pipe->tail_seen = atomic_load_explicit(&pipe->tail, memory_order_acquire);
+    if (pipe->tail_seen == pipe->head) return;
+
+    pipe->waits++;
+    wait_for_tail(pipe, 0);
+}
+
+static void push(GB* gb, Entry entry) {
+    PpuPipeline* pipe = gb->ppu.pipe;
+
+    if (pipe->head - pipe->tail_seen == QUEUE_SIZE) {
+        pipe->tail_seen = atomic_load_explicit(&pipe->tail, memory_order_acquire);
+        if (pipe->head - pipe->tail_seen == QUEUE_SIZE) {
+            // The only place the CPU thread waits: the renderer is a whole queue behind
+            pipe->stalls++;
+            publish(pipe);
+            wait_for_tail(pipe, QUEUE_SIZE - 1);
+        }
+    }
+
+    entry.cycles = gb->cpu.cycles;
+    pipe->entries[pipe->head++ & QUEUE_MASK] = entry;
+    if (entry.kind != ENTRY_WRITE ||
+        pipe->head - atomic_load_explicit(&pipe->published, memory_order_relaxed) >= PUBLISH_EVERY) {
+        publish(pipe);
+    }
+}
+
+void ppu_pipeline_write(GB* gb, uint16_t address, uint8_t value) {
+    push(gb, (Entry){ .kind = ENTRY_WRITE, .address = address, .value = value });
+}
+
+void ppu_pipeline_line(GB* gb, unsigned line, unsigned window_line) {
+    push(gb, (Entry){ .kind = ENTRY_LINE, .address = line, .value = window_line, .kernel = gb->ppu.kernel });
+}
+
+void ppu_pipeline_frame(GB* gb) {
+    PpuPipeline* pipe = gb->ppu.pipe;
+    push(gb, (Entry){ .kind = ENTRY_FRAME });
+
+    uint64_t replayed = atomic_load_explicit(&pipe->replayed, memory_order_relaxed);
+    if (replayed && gb->cpu.cycles - replayed > pipe->max_lag) pipe->max_lag = gb->cpu.cycles - replayed;
+}
+
+void ppu_pipeline_reload(GB* gb, bool clear) {
+    PpuPipeline* pipe = gb->ppu.pipe;
+    drain(pipe);
+
+    memcpy(pipe->vram, gb->mem.data + 0x8000, sizeof(pipe->vram));
+    memcpy(pipe->oam, gb->mem.data + 0xFE00, sizeof(pipe->oam));
+    memcpy(pipe->regs, gb->mem.data + LCDC_ADDR, sizeof(pipe->regs));
+    if (clear) {
+        memset(pipe->screen, 0, sizeof(pipe->screen));
+        memset(pipe->frame, 0, sizeof(pipe->frame));
+        pipe->flushed = gb->ppu.frames;
+    }
+}
+
+bool ppu_pipeline_start(GB* gb) {
+    if (gb->ppu.pipe) return true;
+
+    PpuPipeline* pipe = aligned_alloc(_Alignof(PpuPipeline), sizeof(PpuPipeline));
+    if (!pipe) return false;
+    atomic_init(&pipe->published, 0);
+    atomic_init(&pipe->tail, 0);
+    atomic_init(&pipe->replayed, 0);
+    atomic_init(&pipe->sleeping, false);
+    pipe->head = 0;
+    pipe->tail_seen = 0;
+    pipe->stalls = 0;
+    pipe->waits = 0;
+    pipe->max_lag = 0;
+    pipe->stop = false;
+
+    // The renderer takes over whatever is on screen right now
+    memcpy(pipe->screen, gb->ppu.screen, sizeof(pipe->screen));
+    memcpy(pipe->frame, gb->ppu.frame, sizeof(pipe->frame));
+    pipe->flushed = gb->ppu.frames;
+    gb->ppu.pipe = pipe;
+    ppu_pipeline_reload(gb, false);
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->wake, NULL);
+    if (pthread_create(&pipe->thread, NULL, render_main, pipe) != 0) {
+        gb->ppu.pipe = NULL;
+        pthread_cond_destroy(&pipe->wake);
+        pthread_mutex_destroy(&pipe->lock);
+        free(pipe);
+        return false;
+    }
+    return true;
+}
+
+void ppu_pipeline_stop(GB* gb) {
+    PpuPipeline* pipe = gb->ppu.pipe;
+    if (!pipe) return;
+
+    // Rendering continues in place from where the thread left off
+    drain(pipe);
+    memcpy(gb->ppu.screen, pipe->screen, sizeof(gb->ppu.screen));
+    memcpy(gb->ppu.frame, pipe->frame, sizeof(gb->ppu.frame));
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->stop = true;
+    pthread_cond_signal(&pipe->wake);
+    pthread_mutex_unlock(&pipe->lock);
+    pthread_join(pipe->thread, NULL);
+
+    pthread_cond_destroy(&pipe->wake);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe);
+    gb->ppu.pipe = NULL;
+}
+
+void ppu_flush(GB* gb) {
+    PpuPipeline* pipe = gb->ppu.pipe;
+    if (!pipe || pipe->flushed == gb->ppu.frames) return;
+
+    drain(pipe);
+    memcpy(gb->ppu.frame, pipe->frame, sizeof(gb->ppu.frame));
+    pipe->flushed = gb->ppu.frames;
+}
+
+bool ppu_pipeline_stats(const GB* gb, PpuPipelineStats* stats) {
+    const PpuPipeline* pipe = gb->ppu.pipe;
+    if (!pipe) return false;
+
+    *stats = (PpuPipelineStats){
+        .stalls = pipe->stalls,
+        .waits = pipe->waits,
+        .max_lag_cycles = pipe->max_lag,
+    };
+    return true;
+}
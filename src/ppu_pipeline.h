@@ -0,0 +1,34 @@
+//
+// Created by davidg on 03.09.25.
+//
+
+#ifndef PPU_PIPELINE_H
+#define PPU_PIPELINE_H
+
+#include <gb.h>
+
+// Producer side of the render thread, called by ppu.c on the CPU thread
+
+/**
+ * A write to VRAM, OAM or a register lines are rendered from
+ */
+void ppu_pipeline_write(GB* gb, uint16_t address, uint8_t value);
+
+/**
+ * Line `line` is due and showing window row `window_line`
+ */
+void ppu_pipeline_line(GB* gb, unsigned line, unsigned window_line);
+
+/**
+ * The last line of the frame is through
+ */
+void ppu_pipeline_frame(GB* gb);
+
+/**
+ * Waits for the renderer and hands it VRAM, OAM and the registers as they
+ * are now, after they changed without going through the hooks (ppu_init,
+ * savestates). `clear` blanks its screen as well.
+ */
+void ppu_pipeline_reload(GB* gb, bool clear);
+
+#endif // PPU_PIPELINE_H
@@ -0,0 +1,360 @@
+//
+// Created by davidg on 02.09.25.
+//
+
+#include <ppu.h>
+#include <string.h>
+
+#if defined(LR35902_SIMD) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_SIMD
+#endif
+
+#define ATTR_BEHIND 0x80
+#define ATTR_YFLIP  0x40
+#define ATTR_XFLIP  0x20
+#define ATTR_OBP1   0x10
+
+#define OAM_SPRITES 40
+#define LINE_SPRITES 10
+#define STRIP_TILES 24 // 21 tiles cover 160 pixels at any fine scroll, rounded up for the AVX2 kernel
+#define MARGIN 8       // sprite layer padding, sprites hang off either edge
+
+#define SPREAD 0x0101010101010101ull // byte to all 8 bytes of a lane
+
+typedef struct {
+    int x;      // screen column of the leftmost pixel
+    uint8_t lo; // row bytes, already mirrored for X flip
+    uint8_t hi;
+    uint8_t palette;
+    uint8_t behind; // 0xFF if BG colours 1–3 cover it
+} Sprite;
+
+// Tile rows of one BG or window line, decoded into a strip of colour numbers
+typedef struct {
+    uint8_t lo[STRIP_TILES];
+    uint8_t hi[STRIP_TILES];
+    unsigned tiles;
+} Strip;
+
+// The highest priority opaque sprite pixel in each column
+typedef struct {
+    uint8_t colour[SCREEN_WIDTH + 2 * MARGIN];
+    uint8_t shade[SCREEN_WIDTH + 2 * MARGIN];
+    uint8_t behind[SCREEN_WIDTH + 2 * MARGIN];
+} SpriteLayer;
+
+static uint8_t reverse_bits(uint8_t b) {
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    return (b & 0xAA) >> 1 | (b & 0x55) << 1;
+}
+
+// VRAM offset of row `row` of BG/window tile `index`
+static unsigned bg_tile_row(uint8_t lcdc, uint8_t index, unsigned row) {
+    unsigned base = (lcdc & LCDC_TILES_8000) ? index * 16u : 0x1000 + (int8_t)index * 16;
+    return base + row * 2;
+}
+
+// `tiles` tiles of map row `y` from map column `column` on, wrapping around
+static void fetch_strip(const uint8_t* vram, uint8_t lcdc, unsigned map, unsigned column, unsigned y,
+                        unsigned tiles, Strip* strip) {
+    const uint8_t* row = vram + map + (y / 8) * 32;
+    for (unsigned t = 0; t < tiles; t++) {
+        unsigned address = bg_tile_row(lcdc, row[(column + t) & 31], y & 7);
+        strip->lo[t] = vram[address];
+        strip->hi[t] = vram[address + 1];
+    }
+    for (unsigned t = tiles; t < STRIP_TILES; t++) strip->lo[t] = strip->hi[t] = 0;
+    strip->tiles = tiles;
+}
+
+// Up to 10 sprites on the line in OAM order, then sorted: lower X first, OAM order on ties
+static unsigned select_sprites(const uint8_t* vram, const uint8_t* oam, uint8_t lcdc, const uint8_t* regs,
+                               unsigned line, Sprite* sprites) {
+    unsigned height = (lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+    uint8_t x_of[LINE_SPRITES];
+    unsigned count = 0;
+
+    for (unsigned i = 0; i < OAM_SPRITES && count < LINE_SPRITES; i++) {
+        const uint8_t* entry = oam + i * 4;
+        unsigned row = line + 16 - entry[0];
+        if (row >= height) continue;
+
+        uint8_t attr = entry[3];
+        if (attr & ATTR_YFLIP) row = height - 1 - row;
+        uint8_t tile = height == 16 ? entry[2] & 0xFE : entry[2];
+        unsigned address = tile * 16u + row * 2;
+
+        Sprite sprite = {
+            .x = entry[1] - 8,
+            .lo = vram[address],
+            .hi = vram[address + 1],
+            .palette = (attr & ATTR_OBP1) ? PPU_REG(regs, OBP1) : PPU_REG(regs, OBP0),
+            .behind = (attr & ATTR_BEHIND) ? 0xFF : 0,
+        };
+        if (attr & ATTR_XFLIP) {
+            sprite.lo = reverse_bits(sprite.lo);
+            sprite.hi = reverse_bits(sprite.hi);
+        }
+
+        // Insertion keeps equal X in OAM order
+        unsigned at = count++;
+        while (at > 0 && x_of[at - 1] > entry[1]) {
+            sprites[at] = sprites[at - 1];
+            x_of[at] = x_of[at - 1];
+            at--;
+        }
+        sprites[at] = sprite;
+        x_of[at] = entry[1];
+    }
+    return count;
+}
+
+// Scalar reference
+
+static void decode_scalar(const Strip* strip, uint8_t* out) {
+    for (unsigned t = 0; t < strip->tiles; t++) {
+        for (unsigned i = 0; i < 8; i++) {
+            unsigned bit = 7 - i;
+            out[t * 8 + i] = (strip->hi[t] >> bit & 1) << 1 | (strip->lo[t] >> bit & 1);
+        }
+    }
+}
+
+static void palette_scalar(const uint8_t* colours, uint8_t palette, uint8_t* out) {
+    for (unsigned x = 0; x < SCREEN_WIDTH; x++) out[x] = palette >> (colours[x] * 2) & 3;
+}
+
+static void sprite_scalar(const Sprite* sprite, SpriteLayer* layer) {
+    for (unsigned i = 0; i < 8; i++) {
+        unsigned at = sprite->x + MARGIN + i;
+        unsigned bit = 7 - i;
+        uint8_t colour = (sprite->hi >> bit & 1) << 1 | (sprite->lo >> bit & 1);
+        if (!colour || layer->colour[at]) continue;
+
+        layer->colour[at] = colour;
+        layer->shade[at] = sprite->palette >> (colour * 2) & 3;
+        layer->behind[at] = sprite->behind;
+    }
+}
+
+static void compose_scalar(const uint8_t* bg, const uint8_t* bg_shade, const SpriteLayer* layer, uint8_t* out) {
+    for (unsigned x = 0; x < SCREEN_WIDTH; x++) {
+        unsigned at = x + MARGIN;
+        bool show = layer->colour[at] && !(layer->behind[at] && bg[x]);
+        out[x] = show ? layer->shade[at] : bg_shade[x];
+    }
+}
+
+#ifdef HAVE_SIMD
+
+static const uint8_t bit_masks[32] = {
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+};
+
+// Colour numbers of the tiles whose row bytes are spread over the 8 byte lanes of lo and hi
+static inline __m128i decode_sse2(__m128i lo, __m128i hi) {
+    const __m128i masks = _mm_loadu_si128((const __m128i*)bit_masks);
+    __m128i plane0 = _mm_cmpeq_epi8(_mm_and_si128(lo, masks), masks);
+    __m128i plane1 = _mm_cmpeq_epi8(_mm_and_si128(hi, masks), masks);
+    return _mm_or_si128(_mm_and_si128(plane0, _mm_set1_epi8(1)), _mm_and_si128(plane1, _mm_set1_epi8(2)));
+}
+
+// Shades of 16 colour numbers, one compare per colour
+static inline __m128i shade_sse2(__m128i colours, uint8_t palette) {
+    __m128i out = _mm_setzero_si128();
+    for (int colour = 1; colour < 4; colour++) {
+        __m128i hit = _mm_cmpeq_epi8(colours, _mm_set1_epi8(colour));
+        out = _mm_or_si128(out, _mm_and_si128(hit, _mm_set1_epi8(palette >> (colour * 2) & 3)));
+    }
+    __m128i zero = _mm_cmpeq_epi8(colours, _mm_setzero_si128());
+    return _mm_or_si128(out, _mm_and_si128(zero, _mm_set1_epi8(palette & 3)));
+}
+
+// Two tiles per iteration
+static void decode_strip_sse2(const Strip* strip, uint8_t* out) {
+    for (unsigned t = 0; t < strip->tiles; t += 2) {
+        __m128i lo = _mm_set_epi64x((long long)(strip->lo[t + 1] * SPREAD), (long long)(strip->lo[t] * SPREAD));
+        __m128i hi = _mm_set_epi64x((long long)(strip->hi[t + 1] * SPREAD), (long long)(strip->hi[t] * SPREAD));
+        _mm_storeu_si128((__m128i*)(out + t * 8), decode_sse2(lo, hi));
+    }
+}
+
+static void palette_sse2(const uint8_t* colours, uint8_t palette, uint8_t* out) {
+    for (unsigned x = 0; x < SCREEN_WIDTH; x += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(colours + x));
+        _mm_storeu_si128((__m128i*)(out + x), shade_sse2(c, palette));
+    }
+}
+
+// All 8 pixels of a sprite at once, only where the layer is still empty
+static void sprite_sse2(const Sprite* sprite, SpriteLayer* layer) {
+    unsigned at = sprite->x + MARGIN;
+    __m128i colours = decode_sse2(_mm_cvtsi64_si128((long long)(sprite->lo * SPREAD)),
+                                  _mm_cvtsi64_si128((long long)(sprite->hi * SPREAD)));
+    __m128i zero = _mm_setzero_si128();
+    __m128i old = _mm_loadl_epi64((const __m128i*)(layer->colour + at));
+    __m128i take = _mm_andnot_si128(_mm_cmpeq_epi8(colours, zero), _mm_cmpeq_epi8(old, zero));
+
+    __m128i shade = _mm_loadl_epi64((const __m128i*)(layer->shade + at));
+    __m128i behind = _mm_loadl_epi64((const __m128i*)(layer->behind + at));
+    shade = _mm_or_si128(_mm_andnot_si128(take, shade), _mm_and_si128(take, shade_sse2(colours, sprite->palette)));
+    behind = _mm_or_si128(_mm_andnot_si128(take, behind), _mm_and_si128(take, _mm_set1_epi8((char)sprite->behind)));
+
+    _mm_storel_epi64((__m128i*)(layer->colour + at), _mm_or_si128(old, _mm_and_si128(take, colours)));
+    _mm_storel_epi64((__m128i*)(layer->shade + at), shade);
+    _mm_storel_epi64((__m128i*)(layer->behind + at), behind);
+}
+
+static void compose_sse2(const uint8_t* bg, const uint8_t* bg_shade, const SpriteLayer* layer, uint8_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    for (unsigned x = 0; x < SCREEN_WIDTH; x += 16) {
+        __m128i colour = _mm_loadu_si128((const __m128i*)(layer->colour + MARGIN + x));
+        __m128i behind = _mm_loadu_si128((const __m128i*)(layer->behind + MARGIN + x));
+        __m128i bg_colour = _mm_loadu_si128((const __m128i*)(bg + x));
+        __m128i visible = _mm_or_si128(_mm_cmpeq_epi8(behind, zero), _mm_cmpeq_epi8(bg_colour, zero));
+        __m128i show = _mm_andnot_si128(_mm_cmpeq_epi8(colour, zero), visible);
+
+        __m128i shade = _mm_loadu_si128((const __m128i*)(layer->shade + MARGIN + x));
+        __m128i back = _mm_loadu_si128((const __m128i*)(bg_shade + x));
+        _mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm_and_si128(show, shade), _mm_andnot_si128(show, back)));
+    }
+}
+
+// Four tiles per iteration
+__attribute__((target("avx2")))
+static void decode_strip_avx2(const Strip* strip, uint8_t* out) {
+    const __m256i masks = _mm256_loadu_si256((const __m256i*)bit_masks);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+
+    for (unsigned t = 0; t < strip->tiles; t += 4) {
+        __m256i lo = _mm256_set_epi64x((long long)(strip->lo[t + 3] * SPREAD), (long long)(strip->lo[t + 2] * SPREAD),
+                                       (long long)(strip->lo[t + 1] * SPREAD), (long long)(strip->lo[t] * SPREAD));
+        __m256i hi = _mm256_set_epi64x((long long)(strip->hi[t + 3] * SPREAD), (long long)(strip->hi[t + 2] * SPREAD),
+                                       (long long)(strip->hi[t + 1] * SPREAD), (long long)(strip->hi[t] * SPREAD));
+        __m256i plane0 = _mm256_cmpeq_epi8(_mm256_and_si256(lo, masks), masks);
+        __m256i plane1 = _mm256_cmpeq_epi8(_mm256_and_si256(hi, masks), masks);
+        __m256i colours = _mm256_or_si256(_mm256_and_si256(plane0, one), _mm256_and_si256(plane1, two));
+        _mm256_storeu_si256((__m256i*)(out + t * 8), colours);
+    }
+}
+
+// The palette as a 4 entry shuffle table
+__attribute__((target("avx2")))
+static void palette_avx2(const uint8_t* colours, uint8_t palette, uint8_t* out) {
+    const __m256i table = _mm256_setr_epi8(
+        palette & 3, palette >> 2 & 3, palette >> 4 & 3, palette >> 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        palette & 3, palette >> 2 & 3, palette >> 4 & 3, palette >> 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (unsigned x = 0; x < SCREEN_WIDTH; x += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(colours + x));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_shuffle_epi8(table, c));
+    }
+}
+
+__attribute__((target("avx2")))
+static void compose_avx2(const uint8_t* bg, const uint8_t* bg_shade, const SpriteLayer* layer, uint8_t* out) {
+    const __m256i zero = _mm256_setzero_si256();
+    for (unsigned x = 0; x < SCREEN_WIDTH; x += 32) {
+        __m256i colour = _mm256_loadu_si256((const __m256i*)(layer->colour + MARGIN + x));
+        __m256i behind = _mm256_loadu_si256((const __m256i*)(layer->behind + MARGIN + x));
+        __m256i bg_colour = _mm256_loadu_si256((const __m256i*)(bg + x));
+        __m256i visible = _mm256_or_si256(_mm256_cmpeq_epi8(behind, zero), _mm256_cmpeq_epi8(bg_colour, zero));
+        __m256i show = _mm256_andnot_si256(_mm256_cmpeq_epi8(colour, zero), visible);
+
+        __m256i shade = _mm256_loadu_si256((const __m256i*)(layer->shade + MARGIN + x));
+        __m256i back = _mm256_loadu_si256((const __m256i*)(bg_shade + x));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_blendv_epi8(back, shade, show));
+    }
+}
+
+#endif // HAVE_SIMD
+
+ppu_kernel_t ppu_best_kernel(void) {
+#ifdef HAVE_SIMD
+    return __builtin_cpu_supports("avx2") ? PPU_KERNEL_AVX2 : PPU_KERNEL_SSE2;
+#else
+    return PPU_KERNEL_SCALAR;
+#endif
+}
+
+static void decode_strip(ppu_kernel_t kernel, const Strip* strip, uint8_t* out) {
+    switch (kernel) {
+#ifdef HAVE_SIMD
+        case PPU_KERNEL_AVX2:
+            decode_strip_avx2(strip, out);
+            break;
+        case PPU_KERNEL_SSE2:
+            decode_strip_sse2(strip, out);
+            break;
+#endif
+        default:
+            decode_scalar(strip, out);
+            break;
+    }
+}
+
+void ppu_render_line(ppu_kernel_t kernel, const uint8_t* vram, const uint8_t* oam, const uint8_t* regs,
+                     unsigned line, unsigned window_line, uint8_t* out) {
+    uint8_t lcdc = PPU_REG(regs, LCDC);
+    uint8_t decoded[STRIP_TILES * 8];
+    uint8_t bg[SCREEN_WIDTH];
+    uint8_t bg_shade[SCREEN_WIDTH];
+    Strip strip;
+
+    // BG, then the window over it from WX - 7 on. Without BG both stay white
+    if (lcdc & LCDC_BG_ON) {
+        unsigned scx = PPU_REG(regs, SCX);
+        unsigned y = (line + PPU_REG(regs, SCY)) & 0xFF;
+        fetch_strip(vram, lcdc, (lcdc & LCDC_BG_MAP) ? 0x1C00 : 0x1800, scx / 8, y, 21, &strip);
+        decode_strip(kernel, &strip, decoded);
+        memcpy(bg, decoded + (scx & 7), SCREEN_WIDTH);
+    } else {
+        memset(bg, 0, sizeof(bg));
+    }
+
+    if (ppu_window_visible(regs, line)) {
+        int start = PPU_REG(regs, WX) - 7;
+        unsigned skip = start < 0 ? -start : 0; // WX < 7 cuts off the left of the window
+        unsigned x0 = start < 0 ? 0 : start;
+        unsigned width = SCREEN_WIDTH - x0;
+        fetch_strip(vram, lcdc, (lcdc & LCDC_WINDOW_MAP) ? 0x1C00 : 0x1800, 0, window_line,
+                    (skip + width + 7) / 8, &strip);
+        decode_strip(kernel, &strip, decoded);
+        memcpy(bg + x0, decoded + skip, width);
+    }
+
+    uint8_t bg_palette = (lcdc & LCDC_BG_ON) ? PPU_REG(regs, BGP) : 0;
+    SpriteLayer layer;
+    Sprite sprites[LINE_SPRITES];
+    unsigned count = (lcdc & LCDC_OBJ_ON) ? select_sprites(vram, oam, lcdc, regs, line, sprites) : 0;
+    memset(&layer, 0, sizeof(layer));
+
+    switch (kernel) {
+#ifdef HAVE_SIMD
+        case PPU_KERNEL_AVX2:
+            palette_avx2(bg, bg_palette, bg_shade);
+            for (unsigned i = 0; i < count; i++) {
+                if (sprites[i].x > -8 && sprites[i].x < SCREEN_WIDTH) sprite_sse2(&sprites[i], &layer);
+            }
+            compose_avx2(bg, bg_shade, &layer, out);
+            break;
+        case PPU_KERNEL_SSE2:
+            palette_sse2(bg, bg_palette, bg_shade);
+            for (unsigned i = 0; i < count; i++) {
+                if (sprites[i].x > -8 && sprites[i].x < SCREEN_WIDTH) sprite_sse2(&sprites[i], &layer);
+            }
+            compose_sse2(bg, bg_shade, &layer, out);
+            break;
+#endif
+        default:
+            palette_scalar(bg, bg_palette, bg_shade);
+            for (unsigned i = 0; i < count; i++) {
+                if (sprites[i].x > -8 && sprites[i].x < SCREEN_WIDTH) sprite_scalar(&sprites[i], &layer);
+            }
+            compose_scalar(bg, bg_shade, &layer, out);
+            break;
+    }
+}
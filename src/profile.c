@@ -0,0 +1,284 @@
+//
+// Created by davidg on 29.08.25.
+//
+
+#include <profile.h>
+#include <gb.h>
+#include <stdlib.h>
+#include <string.h>
+#include "opcodes.h"
+
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_MAX_NODES 65536 // deeper call paths are charged to the caller
+#define ROM_BANKS 512
+#define NO_BANK 0xFFFF // code outside the cartridge ROM
+
+/**
+ * Call tree: one node per distinct path of routine entry points
+ */
+typedef struct {
+    uint16_t pc;
+    uint16_t bank;
+    uint32_t parent;
+    uint32_t child;   // first callee, 0 if none (node 0 is the root)
+    uint32_t sibling;
+    uint64_t cycles;  // self cycles
+} CallNode;
+
+typedef struct {
+    uint32_t node;
+    uint16_t sp; // SP right after the return address was pushed
+} Frame;
+
+struct Profile {
+    uint64_t op_count[256];
+    uint64_t op_cycles[256];
+    uint64_t bank_cycles[ROM_BANKS];
+    uint64_t* pc_cycles; // 64K entries
+
+    CallNode* nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    Frame frames[PROFILE_MAX_DEPTH];
+    unsigned depth;
+    uint32_t current;
+
+    // The instruction the cycles since `last` belong to
+    bool has_prev;
+    uint8_t prev_opcode;
+    uint16_t prev_pc;
+    uint16_t prev_bank;
+    uint16_t prev_sp;
+    uint64_t last;
+};
+
+#define OPCODE_NAME(code, func, len, cyc, flags) [code] = #func,
+
+static const char* const opcode_names[256] = {
+    OPCODE_LIST(OPCODE_NAME)
+};
+
+static uint16_t rom_bank(const GB* gb, uint16_t pc) {
+    return pc < 0x8000 ? cart_bank_at(gb, pc) : NO_BANK;
+}
+
+bool profile_start(GB* gb) {
+    profile_stop(gb);
+
+    Profile* profile = calloc(1, sizeof(Profile));
+    uint64_t* pc_cycles = calloc(0x10000, sizeof(uint64_t));
+    CallNode* nodes = calloc(1024, sizeof(CallNode));
+    if (!profile || !pc_cycles || !nodes) {
+        free(nodes);
+        free(pc_cycles);
+        free(profile);
+        return false;
+    }
+
+    profile->pc_cycles = pc_cycles;
+    profile->nodes = nodes;
+    profile->node_capacity = 1024;
+    profile->node_count = 1; // root, everything outside a known call
+    profile->last = gb->cpu.cycles;
+    gb->profile = profile;
+    return true;
+}
+
+void profile_stop(GB* gb) {
+    Profile* profile = gb->profile;
+    if (!profile) return;
+
+    free(profile->nodes);
+    free(profile->pc_cycles);
+    free(profile);
+    gb->profile = NULL;
+}
+
+// Child of the current node for routine pc/bank, created on first call
+static uint32_t callee(Profile* profile, uint16_t pc, uint16_t bank) {
+    uint32_t parent = profile->current;
+
+    for (uint32_t n = profile->nodes[parent].child; n; n = profile->nodes[n].sibling) {
+        if (profile->nodes[n].pc == pc && profile->nodes[n].bank == bank) return n;
+    }
+
+    if (profile->node_count == profile->node_capacity) {
+        if (profile->node_capacity == PROFILE_MAX_NODES) return parent;
+
+        CallNode* nodes = realloc(profile->nodes, 2 * profile->node_capacity * sizeof(CallNode));
+        if (!nodes) return parent;
+        profile->nodes = nodes;
+        profile->node_capacity *= 2;
+    }
+
+    uint32_t n = profile->node_count++;
+    profile->nodes[n] = (CallNode){
+        .pc = pc,
+        .bank = bank,
+        .parent = parent,
+        .sibling = profile->nodes[parent].child,
+    };
+    profile->nodes[parent].child = n;
+    return n;
+}
+
+static void enter(Profile* profile, GB* gb) {
+    if (profile->depth == PROFILE_MAX_DEPTH) return; // runaway recursion stays in the caller
+
+    uint16_t pc = gb->cpu.pc;
+    uint32_t node = callee(profile, pc, rom_bank(gb, pc));
+    profile->frames[profile->depth++] = (Frame){ node, gb->cpu.sp };
+    profile->current = node;
+}
+
+static void leave(Profile* profile, uint16_t sp) {
+    // Also drops frames the guest abandoned by moving SP itself
+    while (profile->depth > 0 && profile->frames[profile->depth - 1].sp < sp) profile->depth--;
+    profile->current = profile->depth ? profile->frames[profile->depth - 1].node : 0;
+}
+
+// Charges the cycles of the previous instruction and follows its CALL or RET
+static void settle(Profile* profile, GB* gb) {
+    const CPU* cpu = &gb->cpu;
+    uint64_t cycles = cpu->cycles - profile->last;
+
+    profile->last = cpu->cycles;
+    profile->nodes[profile->current].cycles += cycles;
+    if (!profile->has_prev) return;
+
+    profile->op_cycles[profile->prev_opcode] += cycles;
+    profile->pc_cycles[profile->prev_pc] += cycles;
+    if (profile->prev_bank != NO_BANK) profile->bank_cycles[profile->prev_bank % ROM_BANKS] += cycles;
+
+    // Conditional calls and returns only count when they moved SP
+    uint8_t flags = opcode_table[profile->prev_opcode].flags;
+    if ((flags & OPF_CALL) && cpu->sp == (uint16_t)(profile->prev_sp - 2)) {
+        enter(profile, gb);
+    } else if ((flags & OPF_RETURN) && cpu->sp == (uint16_t)(profile->prev_sp + 2)) {
+        leave(profile, cpu->sp);
+    }
+    profile->has_prev = false;
+}
+
+void profile_record(GB* gb, uint8_t opcode) {
+    Profile* profile = gb->profile;
+    const CPU* cpu = &gb->cpu;
+
+    settle(profile, gb);
+    profile->has_prev = true;
+    profile->prev_opcode = opcode;
+    profile->prev_pc = cpu->pc;
+    profile->prev_bank = rom_bank(gb, cpu->pc);
+    profile->prev_sp = cpu->sp;
+    profile->op_count[opcode]++;
+}
+
+void profile_interrupt(GB* gb, uint16_t vector) {
+    Profile* profile = gb->profile;
+    settle(profile, gb);
+
+    // The handler frame opens before the dispatch, its 20 cycles are charged to the handler
+    if (profile->depth == PROFILE_MAX_DEPTH) return;
+    uint32_t node = callee(profile, vector, rom_bank(gb, vector));
+    profile->frames[profile->depth++] = (Frame){ node, (uint16_t)(gb->cpu.sp - 2) };
+    profile->current = node;
+}
+
+static void frame_name(const CallNode* node, char* out, size_t size) {
+    if (node->bank == NO_BANK) {
+        snprintf(out, size, "%04X", node->pc);
+    } else {
+        snprintf(out, size, "%02X:%04X", node->bank, node->pc);
+    }
+}
+
+static void write_node(const Profile* profile, uint32_t n, char* path, size_t length, FILE* file) {
+    const CallNode* node = &profile->nodes[n];
+
+    if (n != 0) {
+        path[length++] = ';';
+        frame_name(node, path + length, 16);
+        length += strlen(path + length);
+    }
+    if (node->cycles) fprintf(file, "%s %llu\n", path, (unsigned long long)node->cycles);
+
+    for (uint32_t child = node->child; child; child = profile->nodes[child].sibling) {
+        write_node(profile, child, path, length, file);
+    }
+}
+
+void profile_write_collapsed(GB* gb, FILE* file) {
+    Profile* profile = gb->profile;
+    if (!profile) return;
+
+    // Node depth is bounded by the shadow stack
+    char* path = malloc((PROFILE_MAX_DEPTH + 1) * 16);
+    if (!path) return;
+
+    settle(profile, gb);
+    strcpy(path, "main");
+    write_node(profile, 0, path, strlen(path), file);
+    free(path);
+}
+
+typedef struct {
+    uint32_t index;
+    uint64_t cycles;
+} Entry;
+
+// Descending by cycles, ties by index
+static int by_cycles(const void* x, const void* y) {
+    const Entry* a = x;
+    const Entry* b = y;
+    if (a->cycles != b->cycles) return a->cycles < b->cycles ? 1 : -1;
+    return a->index < b->index ? -1 : 1;
+}
+
+// Sorts the non-zero counters into `order`, returns how many of them to print
+static unsigned hottest(const uint64_t* cycles, uint32_t count, Entry* order, unsigned top) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (cycles[i]) order[used++] = (Entry){ i, cycles[i] };
+    }
+    qsort(order, used, sizeof(Entry), by_cycles);
+    return used < top ? used : top;
+}
+
+void profile_write_report(GB* gb, FILE* file, unsigned top) {
+    Profile* profile = gb->profile;
+    if (!profile) return;
+
+    Entry* order = malloc(0x10000 * sizeof(Entry));
+    if (!order) return;
+    settle(profile, gb);
+
+    uint64_t total = 0;
+    for (unsigned op = 0; op < 256; op++) total += profile->op_cycles[op];
+    if (total == 0) total = 1;
+
+    fprintf(file, "Opcodes by cycles:\n");
+    unsigned n = hottest(profile->op_cycles, 256, order, top);
+    for (unsigned i = 0; i < n; i++) {
+        unsigned op = order[i].index;
+        fprintf(file, "  %02X %-16s %12llu cycles %5.1f%% %10llu executed\n", op,
+            opcode_names[op] ? opcode_names[op] : "?",
+            (unsigned long long)profile->op_cycles[op], 100.0 * profile->op_cycles[op] / total,
+            (unsigned long long)profile->op_count[op]);
+    }
+
+    fprintf(file, "PCs by cycles:\n");
+    n = hottest(profile->pc_cycles, 0x10000, order, top);
+    for (unsigned i = 0; i < n; i++) {
+        fprintf(file, "  %04X %12llu cycles %5.1f%%\n", order[i].index,
+            (unsigned long long)order[i].cycles, 100.0 * order[i].cycles / total);
+    }
+
+    fprintf(file, "ROM banks by cycles:\n");
+    n = hottest(profile->bank_cycles, ROM_BANKS, order, ROM_BANKS);
+    for (unsigned i = 0; i < n; i++) {
+        fprintf(file, "  %03X %12llu cycles %5.1f%%\n", order[i].index,
+            (unsigned long long)order[i].cycles, 100.0 * order[i].cycles / total);
+    }
+
+    free(order);
+}
@@ -0,0 +1,100 @@
+//
+// Created by davidg on 25.08.25.
+//
+
+#include <rewind.h>
+#include <gb.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void rewind_attach(GB* gb, unsigned capacity, uint32_t interval, unsigned keyframe_every) {
+    rewind_detach(gb);
+
+    // An empty ring has nothing to index and a zero interval would fire in the same cycle forever
+    if (capacity == 0) capacity = 1;
+    if (interval == 0) interval = 1;
+
+    Rewind* rewind = calloc(1, sizeof(Rewind));
+    SaveState** ring = calloc(capacity, sizeof(SaveState*));
+    if (!rewind || !ring) {
+        perror("Fehler beim Anlegen des Rückspulpuffers");
+        exit(1);
+    }
+
+    rewind->ring = ring;
+    rewind->capacity = capacity;
+    rewind->keyframe_every = keyframe_every ? keyframe_every : 1;
+    rewind->interval = interval;
+    gb->rewind = rewind;
+
+    // The first state has nothing to be a delta of
+    rewind->since_keyframe = rewind->keyframe_every;
+    sched_schedule(gb, EVENT_REWIND, gb->cpu.cycles);
+}
+
+void rewind_detach(GB* gb) {
+    Rewind* rewind = gb->rewind;
+    if (!rewind) return;
+
+    for (unsigned i = 0; i < rewind->count; i++) {
+        state_release(rewind->ring[(rewind->newest + rewind->capacity - i) % rewind->capacity]);
+    }
+    free(rewind->ring);
+    free(rewind);
+    gb->rewind = NULL;
+    sched_cancel(gb, EVENT_REWIND);
+}
+
+void rewind_event(GB* gb) {
+    Rewind* rewind = gb->rewind;
+    if (!rewind) return; // restored from a state recorded elsewhere
+
+    // Scheduled before capturing, so every recorded state keeps recording after a restore
+    sched_schedule(gb, EVENT_REWIND, gb->cpu.cycles + rewind->interval);
+
+    SaveState* state;
+    if (rewind->since_keyframe >= rewind->keyframe_every) {
+        state = state_capture_keyframe(gb);
+        rewind->since_keyframe = 0;
+    } else {
+        state = state_capture(gb);
+    }
+    rewind->since_keyframe++;
+
+    rewind->newest = (rewind->newest + 1) % rewind->capacity;
+    if (rewind->count == rewind->capacity) {
+        state_release(rewind->ring[rewind->newest]);
+    } else {
+        rewind->count++;
+    }
+    rewind->ring[rewind->newest] = state;
+}
+
+bool rewind_step_back(GB* gb) {
+    Rewind* rewind = gb->rewind;
+    if (!rewind || rewind->count == 0) return false;
+
+    SaveState* state = rewind->ring[rewind->newest];
+    rewind->newest = (rewind->newest + rewind->capacity - 1) % rewind->capacity;
+    rewind->count--;
+
+    bool restored = state_restore(gb, state);
+    state_release(state);
+    return restored;
+}
+
+size_t rewind_memory(const GB* gb) {
+    const Rewind* rewind = gb->rewind;
+    if (!rewind) return 0;
+
+    // Deltas that fell out of the ring live on as long as newer ones share their pages,
+    // those all hang off the oldest state still in the ring
+    size_t bytes = sizeof(Rewind) + rewind->capacity * sizeof(SaveState*);
+    for (unsigned i = 0; i + 1 < rewind->count; i++) {
+        bytes += state_size(rewind->ring[(rewind->newest + rewind->capacity - i) % rewind->capacity]);
+    }
+    if (rewind->count) {
+        bytes += state_chain_size(rewind->ring[(rewind->newest + rewind->capacity - rewind->count + 1) % rewind->capacity]);
+    }
+    return bytes;
+}
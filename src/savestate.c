@@ -0,0 +1,566 @@
+//
+// Created by davidg on 22.08.25.
+//
+
+#include <savestate.h>
+#include <gb.h>
+#include <interrupt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STATE_MAGIC "LR35SAV"
+#define STATE_MAX_EVENTS 16
+#define STATE_FILE_ALIGN 4096 // pages start on a host page boundary
+#define HASH_PRIME1 0x9E3779B185EBCA87ull
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4Full
+
+_Static_assert(EVENT_COUNT <= STATE_MAX_EVENTS, "savestate header has no room for all events");
+
+/*
+ * Everything but memory. Fixed width fields, written to disk as is, so
+ * state files only move between little endian hosts.
+ */
+typedef struct {
+    char magic[8];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t page_offset;             // file offset of the first stored page
+    uint8_t page_map[PAGE_COUNT / 8]; // pages stored in the file, all others are zero
+
+    // CPU
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp, pc;
+    uint8_t halted, ime;
+    uint64_t cycles;
+
+    // Timer
+    uint8_t tima, tma, tac, timer_per_cycle;
+    uint64_t timer_synced;
+    uint64_t timer_div_base;
+    uint16_t timer_counter;
+
+    // PPU, its registers are in the I/O page
+    uint64_t ppu_frame_start;
+    uint64_t ppu_next_event;
+    uint8_t ppu_line, ppu_window_line, ppu_stat;
+
+    // Scheduler, in heap order
+    uint8_t event_count;
+    uint8_t event_ids[STATE_MAX_EVENTS];
+    uint64_t event_when[STATE_MAX_EVENTS];
+
+    // Cartridge
+    uint8_t has_cart, mbc, bank_hi, mode, ram_enabled;
+    uint16_t bank_lo;
+    uint32_t ram_size;
+    uint8_t rom_checksums[3]; // header and global checksum, 0x14D–0x14F
+} StateHeader;
+
+struct SaveState {
+    atomic_int refs;
+    StateHeader header;
+    const uint8_t* pages[PAGE_COUNT]; // contents of Memory.data, page by page
+    uint64_t page_hashes[PAGE_COUNT]; // hash_bytes of every page
+    uint64_t memory_hash;             // page_term of pages 0x00–0xFE folded together
+    uint64_t* ram_hashes;             // hash_bytes of every cartridge RAM page, after ram_pages
+    uint64_t ram_hash;                // their page_term folded together
+    SaveState* base;                  // state some of the pages are shared with
+    RomImage* rom;                    // NULL for states loaded from a file
+    uint8_t* storage;                 // pages copied at capture, cartridge RAM included
+    size_t storage_size;
+    void* mapping;                    // state file
+    size_t mapping_size;
+    const uint8_t* ram_pages[];       // cartridge RAM, page by page
+};
+
+static const uint8_t zero_page[PAGE_SIZE];
+
+static bool page_is_zero(const uint8_t* page) {
+    return page == zero_page || memcmp(page, zero_page, PAGE_SIZE) == 0;
+}
+
+static uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+// Four independent multiply-rotate lanes over 8 byte words, then the tail byte by byte
+static uint64_t hash_bytes(const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    uint64_t lanes[4] = {HASH_PRIME1, HASH_PRIME2, 0, -HASH_PRIME1};
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        for (unsigned lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + lane * 8, sizeof(word));
+            uint64_t h = lanes[lane] + word * HASH_PRIME2;
+            lanes[lane] = (h << 31 | h >> 33) * HASH_PRIME1;
+        }
+    }
+
+    uint64_t h = size;
+    for (unsigned lane = 0; lane < 4; lane++) h = (h ^ hash_mix(lanes[lane])) * HASH_PRIME1;
+    for (; i < size; i++) h = (h ^ bytes[i]) * HASH_PRIME2;
+    return hash_mix(h);
+}
+
+// Contribution of one page to memory_hash, XOR lets a single page be swapped out
+static uint64_t page_term(unsigned page, uint64_t hash) {
+    return hash_mix(hash ^ (page + 1) * HASH_PRIME2);
+}
+
+static bool page_unchanged(const Memory* mem, unsigned page) {
+    return mem->unchanged_pages[page >> 3] & (1u << (page & 7));
+}
+
+static bool ram_page_unchanged(const Cartridge* cart, unsigned index) {
+    return cart->unchanged_ram[index >> 3] & (1u << (index & 7));
+}
+
+// Hash of a page of the machine, taken from the state it shares with while it has not been written
+static uint64_t machine_page_hash(const GB* gb, unsigned page) {
+    const Memory* mem = &gb->mem;
+    if (gb->state && page_unchanged(mem, page)) return gb->state->page_hashes[page];
+    return hash_bytes(mem->shared_pages[page] ? mem->shared_pages[page] : mem->data + page * PAGE_SIZE, PAGE_SIZE);
+}
+
+// Cartridge RAM pages are numbered on after the address space
+static uint64_t machine_ram_page_hash(const GB* gb, unsigned index) {
+    if (gb->state && ram_page_unchanged(&gb->cart, index)) return gb->state->ram_hashes[index];
+    return hash_bytes(cart_ram_page(gb, index), PAGE_SIZE);
+}
+
+static void fold_page_hashes(SaveState* state) {
+    state->memory_hash = 0;
+    for (unsigned page = 0; page < PAGE_COUNT - 1; page++) {
+        state->memory_hash ^= page_term(page, state->page_hashes[page]);
+    }
+    state->ram_hash = 0;
+    for (unsigned index = 0; index < state->header.ram_size / PAGE_SIZE; index++) {
+        state->ram_hash ^= page_term(PAGE_COUNT + index, state->ram_hashes[index]);
+    }
+}
+
+// The cartridge RAM page table and its hashes follow the struct
+static SaveState* allocate_state(unsigned ram_pages) {
+    SaveState* state = calloc(1, sizeof(SaveState) + ram_pages * (sizeof(state->ram_pages[0]) + sizeof(uint64_t)));
+    if (state) state->ram_hashes = (uint64_t*)(state->ram_pages + ram_pages);
+    return state;
+}
+
+static void capture_devices(GB* gb, StateHeader* header) {
+    const CPU* cpu = &gb->cpu;
+    memcpy(header->magic, STATE_MAGIC, sizeof(header->magic));
+    header->version = SAVESTATE_VERSION;
+    header->header_size = sizeof(StateHeader);
+
+    header->a = cpu->a;
+    header->f = cpu_flags(cpu);
+    header->b = cpu->b;
+    header->c = cpu->c;
+    header->d = cpu->d;
+    header->e = cpu->e;
+    header->h = cpu->h;
+    header->l = cpu->l;
+    header->sp = cpu->sp;
+    header->pc = cpu->pc;
+    header->halted = cpu->halted;
+    header->ime = cpu->ime;
+    header->cycles = cpu->cycles;
+
+    const Timer* timer = &gb->timer;
+    header->tima = timer->tima;
+    header->tma = timer->tma;
+    header->tac = timer->tac;
+    header->timer_per_cycle = timer->per_cycle;
+    header->timer_synced = timer->synced;
+    header->timer_div_base = timer->div_base;
+    header->timer_counter = timer->counter;
+
+    const Ppu* ppu = &gb->ppu;
+    header->ppu_frame_start = ppu->frame_start;
+    header->ppu_next_event = ppu->next_event;
+    header->ppu_line = ppu->line;
+    header->ppu_window_line = ppu->window_line;
+    header->ppu_stat = ppu->stat;
+
+    const Scheduler* sched = &gb->sched;
+    header->event_count = sched->count;
+    for (unsigned i = 0; i < sched->count; i++) {
+        header->event_ids[i] = sched->heap[i].id;
+        header->event_when[i] = sched->heap[i].when;
+    }
+
+    const Cartridge* cart = &gb->cart;
+    header->has_cart = cart->rom != NULL;
+    if (cart->rom) {
+        header->mbc = cart->mbc;
+        header->bank_lo = cart->bank_lo;
+        header->bank_hi = cart->bank_hi;
+        header->mode = cart->mode;
+        header->ram_enabled = cart->ram_enabled;
+        header->ram_size = cart->ram_size;
+        memcpy(header->rom_checksums, cart->rom->data + 0x14D, 3);
+    }
+}
+
+static void restore_devices(GB* gb, const StateHeader* header) {
+    CPU* cpu = &gb->cpu;
+    cpu->a = header->a;
+    cpu_set_flags(cpu, header->f);
+    cpu->b = header->b;
+    cpu->c = header->c;
+    cpu->d = header->d;
+    cpu->e = header->e;
+    cpu->h = header->h;
+    cpu->l = header->l;
+    cpu->sp = header->sp;
+    cpu->pc = header->pc;
+    cpu->halted = header->halted;
+    cpu->ime = header->ime;
+    cpu->cycles = header->cycles;
+
+    Timer* timer = &gb->timer;
+    timer->tima = header->tima;
+    timer->tma = header->tma;
+    timer->tac = header->tac;
+    timer->per_cycle = header->timer_per_cycle;
+    timer->synced = header->timer_synced;
+    timer->div_base = header->timer_div_base;
+    timer->counter = header->timer_counter;
+
+    Ppu* ppu = &gb->ppu;
+    ppu->frame_start = header->ppu_frame_start;
+    ppu->next_event = header->ppu_next_event;
+    ppu->line = header->ppu_line;
+    ppu->window_line = header->ppu_window_line;
+    ppu->stat = header->ppu_stat;
+    ppu_invalidate(gb); // the pixels on screen belong to whatever ran before
+
+    Event events[STATE_MAX_EVENTS];
+    for (unsigned i = 0; i < header->event_count; i++) {
+        events[i].id = header->event_ids[i];
+        events[i].when = header->event_when[i];
+    }
+    sched_load(gb, events, header->event_count);
+}
+
+// Only private, non-zero pages need a copy, a keyframe copies shared ones as well
+static bool needs_copy(const uint8_t* data, const uint8_t* shared, bool keyframe) {
+    return (keyframe || !shared) && !page_is_zero(data);
+}
+
+static const uint8_t* keep_page(const uint8_t* data, const uint8_t* shared, bool keyframe, uint8_t** storage) {
+    if (page_is_zero(data)) return zero_page;
+    if (shared && !keyframe) return shared;
+
+    uint8_t* copy = *storage;
+    memcpy(copy, data, PAGE_SIZE);
+    *storage += PAGE_SIZE;
+    return copy;
+}
+
+static SaveState* capture(GB* gb, bool keyframe) {
+    Memory* mem = &gb->mem;
+    const Cartridge* cart = &gb->cart;
+    unsigned ram_pages = cart->rom ? cart->ram_size / PAGE_SIZE : 0;
+
+    size_t copies = 0;
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        const uint8_t* data = mem->shared_pages[page] ? mem->shared_pages[page] : mem->data + page * PAGE_SIZE;
+        copies += needs_copy(data, mem->shared_pages[page], keyframe);
+    }
+    // Cartridge RAM the same way, pages not written since the last capture stay with the base
+    for (unsigned index = 0; index < ram_pages; index++) {
+        copies += needs_copy(cart_ram_page(gb, index), cart->shared_ram[index], keyframe);
+    }
+
+    size_t storage_size = copies * PAGE_SIZE;
+    SaveState* state = allocate_state(ram_pages);
+    uint8_t* storage = malloc(storage_size + 1);
+    if (!state || !storage) {
+        perror("Fehler beim Anlegen des Spielstands");
+        exit(1);
+    }
+
+    atomic_init(&state->refs, 1);
+    state->storage = storage;
+    state->storage_size = storage_size;
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        const uint8_t* shared = mem->shared_pages[page];
+        const uint8_t* data = shared ? shared : mem->data + page * PAGE_SIZE;
+        state->page_hashes[page] = page == 0xFF ? hash_bytes(data, PAGE_SIZE) : machine_page_hash(gb, page);
+        state->pages[page] = keep_page(data, shared, keyframe, &storage);
+    }
+    for (unsigned index = 0; index < ram_pages; index++) {
+        state->ram_hashes[index] = machine_ram_page_hash(gb, index);
+        state->ram_pages[index] = keep_page(cart_ram_page(gb, index), cart->shared_ram[index], keyframe, &storage);
+    }
+    capture_devices(gb, &state->header);
+    fold_page_hashes(state);
+
+    if (cart->rom) {
+        cart_image_retain(cart->rom);
+        state->rom = cart->rom;
+    }
+
+    // Shared pages stay alive through the state the machine sits on. A keyframe
+    // needs none of them, which ends the chain
+    if (keyframe) {
+        if (gb->state) state_release(gb->state);
+    } else {
+        state->base = gb->state;
+    }
+    gb->state = state;
+    state_retain(state);
+    mem_share_pages(gb, state->pages);
+    if (ram_pages) cart_share_ram(gb, state->ram_pages);
+    return state;
+}
+
+SaveState* state_capture(GB* gb) {
+    return capture(gb, false);
+}
+
+SaveState* state_capture_keyframe(GB* gb) {
+    return capture(gb, true);
+}
+
+uint64_t state_hash(GB* gb) {
+    const Memory* mem = &gb->mem;
+    const SaveState* state = gb->state;
+
+    // Start from the state the machine sits on and swap in the pages written since
+    uint64_t memory_hash = state ? state->memory_hash : 0;
+    for (unsigned page = 0; page < PAGE_COUNT - 1; page++) {
+        if (state && page_unchanged(mem, page)) continue;
+        if (state) memory_hash ^= page_term(page, state->page_hashes[page]);
+        memory_hash ^= page_term(page, machine_page_hash(gb, page));
+    }
+
+    // Cartridge RAM the same way, as long as the state has the same amount
+    const Cartridge* cart = &gb->cart;
+    unsigned ram_pages = cart->rom ? cart->ram_size / PAGE_SIZE : 0;
+    const SaveState* ram_state = state && state->header.ram_size / PAGE_SIZE == ram_pages ? state : NULL;
+    uint64_t ram_hash = ram_state ? ram_state->ram_hash : 0;
+    for (unsigned index = 0; index < ram_pages; index++) {
+        if (ram_state && ram_page_unchanged(cart, index)) continue;
+        if (ram_state) ram_hash ^= page_term(PAGE_COUNT + index, ram_state->ram_hashes[index]);
+        ram_hash ^= page_term(PAGE_COUNT + index, machine_ram_page_hash(gb, index));
+    }
+
+    // Device state with every point in time relative to the CPU clock, so
+    // the same situation reached at different cycles hashes the same
+    StateHeader header;
+    memset(&header, 0, sizeof(header)); // padding as well
+    capture_devices(gb, &header);
+    uint64_t now = header.cycles;
+    header.cycles = 0;
+    header.timer_synced -= now;
+    header.timer_div_base -= now;
+    header.ppu_frame_start -= now;
+    header.ppu_next_event -= now;
+    for (unsigned i = 0; i < header.event_count; i++) header.event_when[i] -= now;
+
+    uint64_t hash = hash_mix(memory_hash ^ hash_bytes(&header, sizeof(header)));
+    hash = hash_mix(hash ^ hash_bytes(mem->data + 0xFF00, PAGE_SIZE));
+    return hash_mix(hash ^ ram_hash);
+}
+
+size_t state_size(const SaveState* state) {
+    return sizeof(SaveState) + state->header.ram_size / PAGE_SIZE * (sizeof(state->ram_pages[0]) + sizeof(uint64_t)) +
+           state->storage_size;
+}
+
+size_t state_chain_size(const SaveState* state) {
+    size_t bytes = 0;
+    for (; state; state = state->base) bytes += state_size(state);
+    return bytes;
+}
+
+static bool rom_matches(const RomImage* rom, const StateHeader* header) {
+    return memcmp(rom->data + 0x14D, header->rom_checksums, 3) == 0;
+}
+
+bool state_restore(GB* gb, SaveState* state) {
+    const StateHeader* header = &state->header;
+
+    RomImage* rom = NULL;
+    if (header->has_cart) {
+        rom = state->rom ? state->rom : gb->cart.rom;
+        if (!rom || !rom_matches(rom, header)) return false;
+    }
+
+    // Cached code belongs to the old memory contents
+    block_cache_destroy(gb->blocks);
+    gb->blocks = NULL;
+
+    // Rebuild the map from scratch, then let the devices hook in again.
+    // Every page of data but the I/O page is about to be shared, so it is not cleared
+    memory_map_default(gb);
+    interrupt_init(gb);
+    timer_init(gb);
+    ppu_init(gb);
+
+    if (rom) {
+        Cartridge regs = {
+            .mbc = header->mbc,
+            .ram_size = header->ram_size,
+            .ram_enabled = header->ram_enabled,
+            .bank_lo = header->bank_lo,
+            .bank_hi = header->bank_hi,
+            .mode = header->mode,
+        };
+        if (!cart_attach(gb, rom, &regs, state->ram_pages)) return false;
+    } else {
+        cart_unload(gb);
+    }
+
+    // The I/O page is small and goes through handlers anyway, it is always private
+    memcpy(gb->mem.data + 0xFF00, state->pages[0xFF], PAGE_SIZE);
+    mem_share_pages(gb, state->pages);
+    debug_restore_watches(gb);
+    restore_devices(gb, header);
+
+    state_retain(state);
+    if (gb->state) state_release(gb->state);
+    gb->state = state;
+    return true;
+}
+
+GB* state_fork(SaveState* state) {
+    GB* gb = gb_create_unmapped();
+    if (!state_restore(gb, state)) {
+        gb_destroy(gb);
+        return NULL;
+    }
+    return gb;
+}
+
+void state_retain(SaveState* state) {
+    atomic_fetch_add_explicit(&state->refs, 1, memory_order_relaxed);
+}
+
+void state_release(SaveState* state) {
+    while (state && atomic_fetch_sub_explicit(&state->refs, 1, memory_order_acq_rel) == 1) {
+        SaveState* base = state->base;
+        if (state->rom) cart_image_release(state->rom);
+        if (state->mapping) munmap(state->mapping, state->mapping_size);
+        free(state->storage);
+        free(state);
+        state = base;
+    }
+}
+
+bool state_save(const SaveState* state, const char* filename) {
+    StateHeader header = state->header;
+    header.page_offset = (sizeof(StateHeader) + STATE_FILE_ALIGN - 1) / STATE_FILE_ALIGN * STATE_FILE_ALIGN;
+    memset(header.page_map, 0, sizeof(header.page_map));
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        if (!page_is_zero(state->pages[page])) header.page_map[page >> 3] |= 1u << (page & 7);
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t pad = sizeof(header); ok && pad < header.page_offset; pad++) {
+        ok = fputc(0, file) != EOF;
+    }
+    for (unsigned page = 0; ok && page < PAGE_COUNT; page++) {
+        if (header.page_map[page >> 3] & (1u << (page & 7))) ok = fwrite(state->pages[page], PAGE_SIZE, 1, file) == 1;
+    }
+    for (unsigned index = 0; ok && index < header.ram_size / PAGE_SIZE; index++) {
+        ok = fwrite(state->ram_pages[index], PAGE_SIZE, 1, file) == 1;
+    }
+
+    int saved = errno;
+    if (fclose(file) != 0) ok = false;
+    errno = saved;
+    return ok;
+}
+
+// Every event at most once and with a known id, the scheduler indexes its tables by id
+static bool valid_events(const StateHeader* header) {
+    uint32_t seen = 0;
+    if (header->event_count > EVENT_COUNT) return false;
+    for (unsigned i = 0; i < header->event_count; i++) {
+        uint8_t id = header->event_ids[i];
+        if (id >= EVENT_COUNT || seen & (1u << id)) return false;
+        seen |= 1u << id;
+    }
+    return true;
+}
+
+SaveState* state_load(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(StateHeader)) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    } else {
+        errno = EINVAL;
+    }
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    if (mapping == MAP_FAILED) return NULL;
+
+    size_t size = st.st_size;
+    const StateHeader* header = mapping;
+    size_t stored = 0;
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        if (header->page_map[page >> 3] & (1u << (page & 7))) stored++;
+    }
+
+    if (memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SAVESTATE_VERSION || header->header_size != sizeof(StateHeader) ||
+        !valid_events(header) || header->ram_size > CART_RAM_MAX || header->ram_size % PAGE_SIZE != 0 ||
+        header->page_offset > size || size - header->page_offset < stored * PAGE_SIZE + header->ram_size) {
+        munmap(mapping, size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    SaveState* state = allocate_state(header->ram_size / PAGE_SIZE);
+    if (!state) {
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    atomic_init(&state->refs, 1);
+    state->header = *header;
+    state->mapping = mapping;
+    state->mapping_size = size;
+
+    const uint8_t* page_data = (const uint8_t*)mapping + header->page_offset;
+    for (unsigned page = 0; page < PAGE_COUNT; page++) {
+        if (header->page_map[page >> 3] & (1u << (page & 7))) {
+            state->pages[page] = page_data;
+            page_data += PAGE_SIZE;
+        } else {
+            state->pages[page] = zero_page;
+        }
+        state->page_hashes[page] = hash_bytes(state->pages[page], PAGE_SIZE);
+    }
+    for (unsigned index = 0; index < header->ram_size / PAGE_SIZE; index++) {
+        state->ram_pages[index] = page_data;
+        state->ram_hashes[index] = hash_bytes(page_data, PAGE_SIZE);
+        page_data += PAGE_SIZE;
+    }
+    fold_page_hashes(state);
+    return state;
+}
@@ -0,0 +1,127 @@
+//
+// Created by davidg on 15.08.25.
+//
+
+#include <scheduler.h>
+#include <gb.h>
+#include <interrupt.h>
+#include <timer.h>
+#include <ppu.h>
+#include <rewind.h>
+
+#define FAR_AHEAD 0x7FFFFFFFu
+
+static const event_func_t handlers[EVENT_COUNT] = {
+    [EVENT_IRQ] = interrupt_dispatch,
+    [EVENT_EI] = interrupt_enable,
+    [EVENT_TIMER] = timer_event,
+    [EVENT_PPU] = ppu_event,
+    [EVENT_REWIND] = rewind_event,
+};
+
+static void place(Scheduler* sched, unsigned index, Event event) {
+    sched->heap[index] = event;
+    sched->slot[event.id] = (int8_t)index;
+}
+
+static void sift_up(Scheduler* sched, unsigned index) {
+    Event event = sched->heap[index];
+    while (index > 0) {
+        unsigned parent = (index - 1) / 2;
+        if (!CYCLES_BEFORE(event.when, sched->heap[parent].when)) break;
+        place(sched, index, sched->heap[parent]);
+        index = parent;
+    }
+    place(sched, index, event);
+}
+
+static void sift_down(Scheduler* sched, unsigned index) {
+    Event event = sched->heap[index];
+    // Never more than EVENT_COUNT, spelled out for the compiler's bounds check
+    const unsigned count = sched->count <= EVENT_COUNT ? sched->count : EVENT_COUNT;
+    for (;;) {
+        unsigned child = 2 * index + 1;
+        if (child >= count) break;
+        if (child + 1 < count && CYCLES_BEFORE(sched->heap[child + 1].when, sched->heap[child].when)) child++;
+        if (!CYCLES_BEFORE(sched->heap[child].when, event.when)) break;
+        place(sched, index, sched->heap[child]);
+        index = child;
+    }
+    place(sched, index, event);
+}
+
+static void remove_at(Scheduler* sched, unsigned index) {
+    sched->slot[sched->heap[index].id] = -1;
+    if (index == --sched->count) return;
+
+    // The former last entry may belong above or below the gap
+    uint8_t moved = sched->heap[sched->count].id;
+    place(sched, index, sched->heap[sched->count]);
+    sift_down(sched, index);
+    sift_up(sched, (unsigned)sched->slot[moved]);
+}
+
+static void update_next(GB* gb) {
+    Scheduler* sched = &gb->sched;
+    sched->next = sched->count ? sched->heap[0].when : gb->cpu.cycles + FAR_AHEAD;
+    if (CYCLES_BEFORE(sched->next, sched->deadline)) sched->deadline = sched->next;
+}
+
+void sched_init(GB* gb) {
+    Scheduler* sched = &gb->sched;
+    sched->count = 0;
+    for (unsigned id = 0; id < EVENT_COUNT; id++) sched->slot[id] = -1;
+    sched->deadline = gb->cpu.cycles;
+    sched->next = gb->cpu.cycles + FAR_AHEAD;
+}
+
+void sched_schedule(GB* gb, event_id_t id, uint64_t when) {
+    Scheduler* sched = &gb->sched;
+    Event event = { when, (uint8_t)id };
+
+    if (sched->slot[id] >= 0) {
+        unsigned index = (unsigned)sched->slot[id];
+        place(sched, index, event);
+        sift_down(sched, index);
+        sift_up(sched, (unsigned)sched->slot[id]);
+    } else {
+        place(sched, sched->count, event);
+        sift_up(sched, sched->count++);
+    }
+    update_next(gb);
+}
+
+void sched_cancel(GB* gb, event_id_t id) {
+    Scheduler* sched = &gb->sched;
+    if (sched->slot[id] < 0) return;
+
+    remove_at(sched, (unsigned)sched->slot[id]);
+    // A later next only matters for the following slice, the deadline stays
+    sched->next = sched->count ? sched->heap[0].when : gb->cpu.cycles + FAR_AHEAD;
+}
+
+bool sched_is_scheduled(const GB* gb, event_id_t id) {
+    return gb->sched.slot[id] >= 0;
+}
+
+void sched_load(GB* gb, const Event* events, unsigned count) {
+    // Inserting a valid heap in array order leaves it as it was, anything else gets sorted
+    sched_init(gb);
+    for (unsigned index = 0; index < count; index++) sched_schedule(gb, events[index].id, events[index].when);
+}
+
+void sched_run_due(GB* gb) {
+    Scheduler* sched = &gb->sched;
+
+    while (sched->count && !CYCLES_BEFORE(gb->cpu.cycles, sched->heap[0].when)) {
+        event_id_t id = sched->heap[0].id;
+        remove_at(sched, 0);
+        handlers[id](gb);
+    }
+    sched->next = sched->count ? sched->heap[0].when : gb->cpu.cycles + FAR_AHEAD;
+}
+
+void sched_begin_slice(GB* gb, uint64_t end) {
+    Scheduler* sched = &gb->sched;
+    sched->deadline = CYCLES_BEFORE(sched->next, end) ? sched->next : end;
+}
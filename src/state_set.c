@@ -0,0 +1,88 @@
+//
+// Created by davidg on 07.09.25.
+//
+
+#include <state_set.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SLOT_EMPTY 0 // hash 0 is stored as 1, see slot_key
+
+struct StateSet {
+    _Atomic uint64_t* slots;
+    size_t mask;
+    _Alignas(64) atomic_size_t count;
+};
+
+static uint64_t slot_key(uint64_t hash) {
+    return hash == SLOT_EMPTY ? 1 : hash;
+}
+
+StateSet* state_set_create(size_t capacity) {
+    // At most half full, so probe runs stay short
+    size_t size = 16;
+    while (size < capacity * 2) size *= 2;
+
+    // The count has a cache line of its own, malloc does not promise that alignment
+    StateSet* set = aligned_alloc(_Alignof(StateSet), sizeof(StateSet));
+    _Atomic uint64_t* slots = set ? malloc(size * sizeof(*slots)) : NULL;
+    if (!slots) {
+        perror("Fehler beim Anlegen der Zustandsmenge");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < size; i++) atomic_init(&slots[i], SLOT_EMPTY);
+    set->slots = slots;
+    set->mask = size - 1;
+    atomic_init(&set->count, 0);
+    return set;
+}
+
+void state_set_destroy(StateSet* set) {
+    if (!set) return;
+    free(set->slots);
+    free(set);
+}
+
+// Longest probe run: the whole table while it is small, STATE_SET_MAX_PROBE slots otherwise
+static size_t max_probe(const StateSet* set) {
+    return set->mask < STATE_SET_MAX_PROBE ? set->mask + 1 : STATE_SET_MAX_PROBE;
+}
+
+state_set_status_t state_set_insert(StateSet* set, uint64_t hash) {
+    uint64_t key = slot_key(hash);
+    size_t probes = max_probe(set);
+
+    // Hashes are mixed already, the low bits pick the slot
+    for (size_t probe = 0, i = key & set->mask; probe < probes; probe++, i = (i + 1) & set->mask) {
+        uint64_t seen = atomic_load_explicit(&set->slots[i], memory_order_relaxed);
+        if (seen == SLOT_EMPTY) {
+            if (atomic_compare_exchange_strong_explicit(&set->slots[i], &seen, key,
+                                                        memory_order_relaxed, memory_order_relaxed)) {
+                atomic_fetch_add_explicit(&set->count, 1, memory_order_relaxed);
+                return STATE_SET_ADDED;
+            }
+            // Lost the slot to another thread, `seen` is what it stored
+        }
+        if (seen == key) return STATE_SET_SEEN;
+    }
+    return STATE_SET_FULL;
+}
+
+bool state_set_contains(const StateSet* set, uint64_t hash) {
+    uint64_t key = slot_key(hash);
+    size_t probes = max_probe(set);
+
+    // Inserts never store a key further from home
+    for (size_t probe = 0, i = key & set->mask; probe < probes; probe++, i = (i + 1) & set->mask) {
+        uint64_t seen = atomic_load_explicit(&set->slots[i], memory_order_relaxed);
+        if (seen == key) return true;
+        if (seen == SLOT_EMPTY) return false;
+    }
+    return false;
+}
+
+size_t state_set_count(const StateSet* set) {
+    return atomic_load_explicit(&set->count, memory_order_relaxed);
+}
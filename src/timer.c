@@ -0,0 +1,198 @@
+//
+// Created by davidg on 18.08.25.
+//
+
+#include <timer.h>
+#include <gb.h>
+#include <interrupt.h>
+#include <scheduler.h>
+
+#define TAC_ENABLE 0x04
+#define DIV_INITIAL 0xABCC // counter value the boot ROM leaves behind
+#define TICK_CYCLES 4
+
+// Counter bit whose falling edge clocks TIMA, by TAC & 3
+static const uint8_t tac_bits[4] = { 9, 3, 5, 7 };
+
+static bool timer_signal(uint8_t tac, uint32_t counter) {
+    return (tac & TAC_ENABLE) && (counter >> tac_bits[tac & 3] & 1);
+}
+
+static void tima_increment(GB* gb) {
+    Timer* timer = &gb->timer;
+    if (++timer->tima == 0) {
+        timer->tima = timer->tma;
+        interrupt_request(gb, INT_TIMER);
+    }
+}
+
+// Falling edges of the selected counter bit in (from, to]
+static uint64_t edges_between(const Timer* timer, uint64_t from, uint64_t to) {
+    if (!(timer->tac & TAC_ENABLE)) return 0;
+
+    unsigned shift = tac_bits[timer->tac & 3] + 1;
+    uint64_t c0 = from - timer->div_base;
+    uint64_t c1 = to - timer->div_base;
+    return (c1 >> shift) - (c0 >> shift);
+}
+
+static void lazy_sync(GB* gb) {
+    Timer* timer = &gb->timer;
+    uint64_t edges = edges_between(timer, timer->synced, gb->cpu.cycles);
+    timer->synced = gb->cpu.cycles;
+
+    if (edges < 0x100u - timer->tima) {
+        timer->tima += edges;
+        return;
+    }
+
+    // Overflowed at least once, every later lap starts at TMA
+    edges -= 0x100u - timer->tima;
+    timer->tima = timer->tma + edges % (0x100u - timer->tma);
+    interrupt_request(gb, INT_TIMER);
+}
+
+static void per_cycle_sync(GB* gb) {
+    Timer* timer = &gb->timer;
+    while (timer->synced != gb->cpu.cycles) {
+        bool before = timer_signal(timer->tac, timer->counter);
+        timer->counter++;
+        if (before && !timer_signal(timer->tac, timer->counter)) tima_increment(gb);
+        timer->synced++;
+    }
+}
+
+static void timer_sync(GB* gb) {
+    if (gb->timer.per_cycle) {
+        per_cycle_sync(gb);
+    } else {
+        lazy_sync(gb);
+    }
+}
+
+// Counter at timer->synced
+static uint16_t timer_counter(const GB* gb) {
+    const Timer* timer = &gb->timer;
+    return timer->per_cycle ? timer->counter : (uint16_t)(timer->synced - timer->div_base);
+}
+
+// Moves EVENT_TIMER after the registers changed, expects a synced timer
+static void timer_reschedule(GB* gb) {
+    Timer* timer = &gb->timer;
+
+    if (!(timer->tac & TAC_ENABLE)) {
+        sched_cancel(gb, EVENT_TIMER);
+    } else if (timer->per_cycle) {
+        if (!sched_is_scheduled(gb, EVENT_TIMER)) sched_schedule(gb, EVENT_TIMER, timer->synced + TICK_CYCLES);
+    } else {
+        // Counter value of the next falling edge, then as many edges as TIMA has left
+        unsigned shift = tac_bits[timer->tac & 3] + 1;
+        uint64_t first = (((timer->synced - timer->div_base) >> shift) + 1) << shift;
+        uint64_t overflow = first + ((uint64_t)(0xFFu - timer->tima) << shift);
+        sched_schedule(gb, EVENT_TIMER, timer->div_base + overflow);
+    }
+}
+
+static uint8_t div_read(GB* gb, uint16_t address) {
+    Timer* timer = &gb->timer;
+    if (timer->per_cycle) {
+        per_cycle_sync(gb);
+        return timer->counter >> 8;
+    }
+    return (uint16_t)(gb->cpu.cycles - timer->div_base) >> 8;
+}
+
+// DIV steps with every 256 counter cycles
+static uint64_t div_change(GB* gb, uint16_t address) {
+    uint64_t counter = gb->cpu.cycles - gb->timer.div_base;
+    return gb->timer.div_base + (((counter >> 8) + 1) << 8);
+}
+
+static void div_write(GB* gb, uint16_t address, uint8_t value) {
+    Timer* timer = &gb->timer;
+    timer_sync(gb);
+
+    // Clearing the counter is a falling edge if the selected bit was set
+    if (timer_signal(timer->tac, timer_counter(gb))) tima_increment(gb);
+    timer->counter = 0;
+    timer->div_base = timer->synced;
+    timer_reschedule(gb);
+}
+
+// TIMA steps at the next falling edge of the selected counter bit
+static uint64_t tima_change(GB* gb, uint16_t address) {
+    const Timer* timer = &gb->timer;
+    if (!(timer->tac & TAC_ENABLE)) return gb->cpu.cycles + MEM_CHANGE_NEVER;
+
+    unsigned shift = tac_bits[timer->tac & 3] + 1;
+    return timer->div_base + ((((gb->cpu.cycles - timer->div_base) >> shift) + 1) << shift);
+}
+
+static uint8_t tima_read(GB* gb, uint16_t address) {
+    timer_sync(gb);
+    return gb->timer.tima;
+}
+
+static void tima_write(GB* gb, uint16_t address, uint8_t value) {
+    timer_sync(gb);
+    gb->timer.tima = value;
+    timer_reschedule(gb);
+}
+
+static uint8_t tma_read(GB* gb, uint16_t address) {
+    return gb->timer.tma;
+}
+
+static void tma_write(GB* gb, uint16_t address, uint8_t value) {
+    timer_sync(gb); // overflows up to now still reload the old TMA
+    gb->timer.tma = value;
+}
+
+static uint8_t tac_read(GB* gb, uint16_t address) {
+    return gb->timer.tac | 0xF8;
+}
+
+static void tac_write(GB* gb, uint16_t address, uint8_t value) {
+    Timer* timer = &gb->timer;
+    timer_sync(gb);
+
+    // TIMA sees enable AND selected bit, switching that signal off is a falling edge too
+    uint16_t counter = timer_counter(gb);
+    bool before = timer_signal(timer->tac, counter);
+    timer->tac = value & 0x07;
+    if (before && !timer_signal(timer->tac, counter)) tima_increment(gb);
+    timer_reschedule(gb);
+}
+
+void timer_init(GB* gb) {
+    Timer* timer = &gb->timer;
+    timer->per_cycle = false;
+    timer->tima = timer->tma = timer->tac = 0;
+    timer->synced = gb->cpu.cycles;
+    timer->div_base = gb->cpu.cycles - DIV_INITIAL;
+    timer->counter = DIV_INITIAL;
+
+    mem_map_io(gb, DIV_ADDR, div_read, div_write);
+    mem_map_io(gb, TIMA_ADDR, tima_read, tima_write);
+    mem_map_io(gb, TMA_ADDR, tma_read, tma_write);
+    mem_map_io(gb, TAC_ADDR, tac_read, tac_write);
+
+    // Only the overflow is an event, DIV and TIMA count up in between
+    mem_mark_io_timed(gb, DIV_ADDR, div_change);
+    mem_mark_io_timed(gb, TIMA_ADDR, tima_change);
+}
+
+void timer_set_per_cycle(GB* gb, bool per_cycle) {
+    Timer* timer = &gb->timer;
+    timer_sync(gb);
+    timer->counter = timer_counter(gb);
+    timer->div_base = timer->synced - timer->counter;
+    timer->per_cycle = per_cycle;
+    sched_cancel(gb, EVENT_TIMER);
+    timer_reschedule(gb);
+}
+
+void timer_event(GB* gb) {
+    timer_sync(gb);
+    timer_reschedule(gb);
+}
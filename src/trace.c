@@ -0,0 +1,225 @@
+//
+// Created by davidg on 27.08.25.
+//
+
+#include <trace.h>
+#include <gb.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TRACE_MAGIC "LR35TRC"
+#define TRACE_VERSION 2
+#define MASK_BYTES 4 // one bit per record byte
+#define CHUNK_PAYLOAD_MAX (TRACE_CHUNK_RECORDS * (MASK_BYTES + sizeof(TraceRecord)))
+
+_Static_assert(offsetof(TraceRecord, flags_result) == offsetof(CPU, flags_result) &&
+               offsetof(CPU, halted) == TRACE_CPU_BYTES, "TraceRecord must start with a copy of CPU");
+_Static_assert(sizeof(TraceRecord) <= MASK_BYTES * 8, "change mask too small");
+
+typedef struct {
+    char magic[8];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t chunk_records;
+} TraceHeader;
+
+// Each chunk: record count, payload size, then per record a bit mask of the
+// bytes that differ from the record before and those bytes. The first record
+// of a chunk is compared against zeros, so every chunk decodes on its own.
+typedef struct {
+    uint32_t count;
+    uint32_t size;
+} ChunkHeader;
+
+static size_t encode_chunk(const TraceRecord* records, unsigned count, uint8_t* out) {
+    uint8_t prev[sizeof(TraceRecord)] = {0};
+    uint8_t* p = out;
+
+    for (unsigned n = 0; n < count; n++) {
+        const uint8_t* cur = (const uint8_t*)&records[n];
+        uint8_t* mask = p;
+        p += MASK_BYTES;
+        memset(mask, 0, MASK_BYTES);
+
+        for (unsigned i = 0; i < sizeof(TraceRecord); i++) {
+            if (cur[i] == prev[i]) continue;
+            mask[i >> 3] |= 1 << (i & 7);
+            *p++ = cur[i];
+        }
+        memcpy(prev, cur, sizeof(prev));
+    }
+
+    return p - out;
+}
+
+static void* writer_main(void* arg) {
+    Trace* trace = arg;
+    uint8_t* payload = malloc(CHUNK_PAYLOAD_MAX);
+    bool failed = payload == NULL;
+    if (failed) perror("Fehler beim Anlegen des Trace-Puffers");
+
+    for (;;) {
+        unsigned tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+        if (tail == atomic_load_explicit(&trace->head, memory_order_acquire)) {
+            if (atomic_load(&trace->stop)) break;
+            nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+            continue;
+        }
+
+        // Chunks are still consumed after a write error, the CPU must never block on a dead file
+        if (!failed) {
+            unsigned slot = tail % TRACE_CHUNKS;
+            ChunkHeader header = { .count = trace->counts[slot] };
+            header.size = encode_chunk(&trace->chunks[slot * TRACE_CHUNK_RECORDS], header.count, payload);
+
+            if (fwrite(&header, sizeof(header), 1, trace->file) != 1 ||
+                fwrite(payload, header.size, 1, trace->file) != 1) {
+                perror("Fehler beim Schreiben des Traces");
+                failed = true;
+            }
+        }
+        atomic_store_explicit(&trace->tail, tail + 1, memory_order_release);
+    }
+
+    free(payload);
+    return NULL;
+}
+
+bool trace_start(GB* gb, const char* filename) {
+    trace_stop(gb);
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+
+    TraceHeader header = {
+        .version = TRACE_VERSION,
+        .record_size = sizeof(TraceRecord),
+        .chunk_records = TRACE_CHUNK_RECORDS,
+    };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+
+    Trace* trace = calloc(1, sizeof(Trace));
+    TraceRecord* chunks = calloc(TRACE_CHUNKS * TRACE_CHUNK_RECORDS, sizeof(TraceRecord));
+    if (!trace || !chunks || fwrite(&header, sizeof(header), 1, file) != 1) {
+        free(chunks);
+        free(trace);
+        fclose(file);
+        return false;
+    }
+
+    trace->chunks = chunks;
+    trace->next = chunks;
+    trace->chunk_end = chunks + TRACE_CHUNK_RECORDS;
+    trace->file = file;
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->stop, false);
+
+    if (pthread_create(&trace->writer, NULL, writer_main, trace) != 0) {
+        free(chunks);
+        free(trace);
+        fclose(file);
+        return false;
+    }
+
+    gb->trace = trace;
+    return true;
+}
+
+void trace_publish(Trace* trace) {
+    unsigned head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    unsigned slot = head % TRACE_CHUNKS;
+
+    trace->counts[slot] = trace->next - &trace->chunks[slot * TRACE_CHUNK_RECORDS];
+    atomic_store_explicit(&trace->head, ++head, memory_order_release);
+
+    // All chunks in flight: the writer is behind, wait for it rather than drop records
+    while (head - atomic_load_explicit(&trace->tail, memory_order_acquire) == TRACE_CHUNKS) {
+        sched_yield();
+    }
+
+    trace->next = &trace->chunks[(head % TRACE_CHUNKS) * TRACE_CHUNK_RECORDS];
+    trace->chunk_end = trace->next + TRACE_CHUNK_RECORDS;
+}
+
+void trace_stop(GB* gb) {
+    Trace* trace = gb->trace;
+    if (!trace) return;
+
+    if (trace->next != trace->chunk_end - TRACE_CHUNK_RECORDS) trace_publish(trace);
+    atomic_store(&trace->stop, true);
+    pthread_join(trace->writer, NULL);
+
+    if (fclose(trace->file) != 0) perror("Fehler beim Schließen des Traces");
+    free(trace->chunks);
+    free(trace);
+    gb->trace = NULL;
+}
+
+bool trace_open(TraceReader* reader, const char* filename) {
+    TraceHeader header;
+
+    reader->file = fopen(filename, "rb");
+    reader->payload = NULL;
+    reader->count = reader->index = 0;
+    if (!reader->file) return false;
+
+    if (fread(&header, sizeof(header), 1, reader->file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord) ||
+        header.chunk_records != TRACE_CHUNK_RECORDS ||
+        !(reader->payload = malloc(CHUNK_PAYLOAD_MAX))) {
+        trace_close(reader);
+        return false;
+    }
+
+    return true;
+}
+
+static bool read_chunk(TraceReader* reader) {
+    ChunkHeader header;
+
+    if (fread(&header, sizeof(header), 1, reader->file) != 1) return false;
+    if (header.count > TRACE_CHUNK_RECORDS || header.size > CHUNK_PAYLOAD_MAX ||
+        fread(reader->payload, 1, header.size, reader->file) != header.size) return false;
+
+    uint8_t prev[sizeof(TraceRecord)] = {0};
+    const uint8_t* p = reader->payload;
+    const uint8_t* end = p + header.size;
+
+    for (unsigned n = 0; n < header.count; n++) {
+        if (end - p < MASK_BYTES) return false;
+        const uint8_t* mask = p;
+        p += MASK_BYTES;
+
+        for (unsigned i = 0; i < sizeof(TraceRecord); i++) {
+            if (!(mask[i >> 3] & 1 << (i & 7))) continue;
+            if (p == end) return false;
+            prev[i] = *p++;
+        }
+        memcpy(&reader->chunk[n], prev, sizeof(prev));
+    }
+
+    reader->count = header.count;
+    reader->index = 0;
+    return true;
+}
+
+bool trace_read(TraceReader* reader, TraceRecord* record) {
+    while (reader->index == reader->count) {
+        if (!read_chunk(reader)) return false;
+    }
+
+    *record = reader->chunk[reader->index++];
+    return true;
+}
+
+void trace_close(TraceReader* reader) {
+    if (reader->file) fclose(reader->file);
+    free(reader->payload);
+    reader->file = NULL;
+    reader->payload = NULL;
+}
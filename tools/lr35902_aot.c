@@ -0,0 +1,635 @@
+//
+// Created by davidg on 05.09.25.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gb.h>
+#include <aot.h>
+#include "opcodes.h"
+
+/*
+ * Static recompiler: walks the code reachable from the entry point and the
+ * interrupt vectors and writes it out as C, to be built into a shared
+ * object for aot_load:
+ *
+ *   lr35902_aot game.gb game_aot.c
+ *   cc -O2 -shared -fPIC -I include game_aot.c -o game_aot.so
+ *
+ * Code is cut into pieces the way block_cache.c cuts blocks: at most
+ * BLOCK_MAX_OPS instructions, ending after the first one that ends a block.
+ * Every instruction of a piece is an entry into its function, so wherever
+ * the block cache starts a block (after an interrupt, an event, a return)
+ * there is native code that covers a prefix of it.
+ */
+
+#define REGION_SIZE ROM_BANK_SIZE // 0x0000-0x3FFF is bank 0, 0x4000-0x7FFF the switchable bank
+#define MAX_WORK (1u << 20)
+
+typedef struct {
+    uint16_t bank;    // key bank: 0 below 0x4000
+    uint16_t address;
+} Location;
+
+typedef struct {
+    const uint8_t* rom;
+    size_t rom_size;
+    unsigned banks;    // switchable banks are 1..banks-1
+    bool banked;       // the game switches banks, code above 0x4000 may be in any
+    uint8_t** code;    // per key bank: instruction starts, one byte per address in the region
+    Location* work;
+    size_t pending;
+    FILE* out;
+    uint16_t piece[BLOCK_MAX_OPS]; // instructions of the piece being written
+    unsigned piece_count;
+    uint16_t bank;                 // its key bank
+} Translator;
+
+static uint8_t rom_byte(const Translator* aot, uint16_t bank, uint16_t address) {
+    size_t offset = address < REGION_SIZE ? address : (size_t)bank * REGION_SIZE + address - REGION_SIZE;
+    return offset < aot->rom_size ? aot->rom[offset] : 0xFF;
+}
+
+static void push_location(Translator* aot, uint16_t bank, uint16_t address) {
+    uint8_t* seen = &aot->code[bank][address % REGION_SIZE];
+    if (*seen) return;
+    if (aot->pending == MAX_WORK) {
+        fprintf(stderr, "Zu viele offene Sprungziele\n");
+        exit(1);
+    }
+    *seen = 1;
+    aot->work[aot->pending++] = (Location){ bank, address };
+}
+
+// Code at `target`, reached from code in key bank `from`. Nothing above ROM is translated
+static void reach(Translator* aot, uint16_t from, uint16_t target) {
+    if (target >= 0x8000) return;
+    if (target < REGION_SIZE) {
+        push_location(aot, 0, target);
+    } else if (from != 0) {
+        push_location(aot, from, target);
+    } else if (!aot->banked) {
+        push_location(aot, 1, target);
+    } else {
+        // Which bank is mapped is not known here, so it is followed into all of them
+        for (unsigned bank = 1; bank < aot->banks; bank++) push_location(aot, bank, target);
+    }
+}
+
+// Length of the instruction at `location`, 0 if there is none or it leaves its region
+static unsigned decode(const Translator* aot, Location location, uint8_t* bytes) {
+    for (unsigned i = 0; i < 3; i++) bytes[i] = rom_byte(aot, location.bank, location.address + i);
+
+    const OpcodeInfo* info = &opcode_table[bytes[0]];
+    unsigned end = location.address % REGION_SIZE + info->length;
+    return info->handler && end <= REGION_SIZE ? info->length : 0;
+}
+
+static void walk(Translator* aot) {
+    while (aot->pending) {
+        Location at = aot->work[--aot->pending];
+        uint8_t bytes[3];
+        unsigned length = decode(aot, at, bytes);
+
+        if (length == 0) {
+            aot->code[at.bank][at.address % REGION_SIZE] = 0; // nothing to translate here
+            continue;
+        }
+
+        uint8_t opcode = bytes[0];
+        uint16_t next = at.address + length;
+        uint16_t a16 = bytes[1] | bytes[2] << 8;
+
+        if (opcode == 0x18 || (opcode & 0xE7) == 0x20) reach(aot, at.bank, next + (int8_t)bytes[1]);
+        if (opcode == 0xC3 || (opcode & 0xE7) == 0xC2 || opcode == 0xCD || (opcode & 0xE7) == 0xC4) {
+            reach(aot, at.bank, a16);
+        }
+        if ((opcode & 0xC7) == 0xC7) reach(aot, at.bank, opcode & 0x38);
+
+        // Everything but unconditional jumps and returns can go on with the next instruction
+        switch (opcode) {
+            case 0x18: case 0xC3: case 0xC9: case 0xD9: case 0xE9:
+                break;
+            default:
+                if ((opcode & 0xC7) != 0xC7) reach(aot, at.bank, next);
+        }
+    }
+}
+
+// ---- C output ----
+
+static void emit(Translator* aot, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(aot->out, format, args);
+    va_end(args);
+}
+
+static const char* const r8_name[8] = { "b", "c", "d", "e", "h", "l", NULL, "a" };
+static const char* const pair_get[4] = { "(b << 8 | c)", "(d << 8 | e)", "(h << 8 | l)", "sp" };
+static const char* const push_high[4] = { "b", "d", "h", "a" };
+static const char* const push_low[4] = { "c", "e", "l", "f" };
+static const char* const pair_set[4] = { "SET_BC", "SET_DE", "SET_HL", "SET_SP" };
+static const char* const not_taken[4] = { "f & FLAG_Z", "!(f & FLAG_Z)", "f & FLAG_C", "!(f & FLAG_C)" }; // NZ, Z, NC, C
+static const char* const alu_macro[8] = { "ADD", "ADC", "SUB", "SBC", "AND", "XOR", "OR", "CP" };
+static const char* const shift_fn[8] = { "aot_rlc", "aot_rrc", "aot_rl", "aot_rr", "aot_sla", "aot_sra", "aot_swap", "aot_srl" };
+
+/*
+ * Helpers of the generated file. Registers live in locals and go back to
+ * the CPU on every exit. An instruction first makes sure every memory
+ * access it needs has a direct page (else it leaves the block untouched
+ * for the interpreter to redo it through the handlers), then spends its
+ * cycles, then takes effect.
+ */
+static const char* const prelude =
+    "#include <gb.h>\n"
+    "#include <aot.h>\n"
+    "\n"
+    "#pragma GCC diagnostic ignored \"-Wunused-variable\"\n"
+    "#pragma GCC diagnostic ignored \"-Wunused-but-set-variable\"\n"
+    "#pragma GCC diagnostic ignored \"-Wunused-label\"\n"
+    "\n"
+    "#define ENTER() \\\n"
+    "    CPU* cpu = &gb->cpu; \\\n"
+    "    uint8_t a = cpu->a, f = cpu->f, b = cpu->b, c = cpu->c, d = cpu->d, e = cpu->e, h = cpu->h, l = cpu->l; \\\n"
+    "    uint16_t sp = cpu->sp; \\\n"
+    "    uint32_t spent = 0; \\\n"
+    "    uint8_t lo, hi, value\n"
+    "#define EXIT(to) \\\n"
+    "    do { \\\n"
+    "        cpu->a = a; cpu->f = f; cpu->b = b; cpu->c = c; cpu->d = d; cpu->e = e; cpu->h = h; cpu->l = l; \\\n"
+    "        cpu->sp = sp; cpu->pc = (to); cpu->cycles += spent; \\\n"
+    "        return; \\\n"
+    "    } while (0)\n"
+    "\n"
+    "// Loops within a piece go round without returning to the block cache, as long as it would\n"
+    "// have run their block natively as well\n"
+    "#define CHAIN(block_cycles) \\\n"
+    "    (!gb->idle_skip && CYCLES_BEFORE(cpu->cycles + spent, gb->sched.deadline) && \\\n"
+    "     (int64_t)(gb->sched.next - (cpu->cycles + spent)) >= (block_cycles))\n"
+    "\n"
+    "#define SET16(hi_, lo_, v) do { unsigned v_ = (v); hi_ = v_ >> 8 & 0xFF; lo_ = v_ & 0xFF; } while (0)\n"
+    "#define SET_BC(v) SET16(b, c, v)\n"
+    "#define SET_DE(v) SET16(d, e, v)\n"
+    "#define SET_HL(v) SET16(h, l, v)\n"
+    "#define SET_SP(v) (sp = (uint16_t)(v))\n"
+    "\n"
+    "#define READ(dst, address, here) \\\n"
+    "    do { \\\n"
+    "        uint16_t r_ = (address); \\\n"
+    "        const uint8_t* p_ = gb->mem.read_pages[r_ >> 8]; \\\n"
+    "        if (!p_) EXIT(here); \\\n"
+    "        dst = p_[r_ & 0xFF]; \\\n"
+    "    } while (0)\n"
+    "#define WRITABLE(address, here) do { if (!gb->mem.write_pages[(uint16_t)(address) >> 8]) EXIT(here); } while (0)\n"
+    "#define WRITE(address, v) do { uint16_t w_ = (address); gb->mem.write_pages[w_ >> 8][w_ & 0xFF] = (v); } while (0)\n"
+    "\n"
+    "static inline uint8_t aot_flags(unsigned result, unsigned carries, uint8_t n) {\n"
+    "    return ((result & 0xFF) == 0 ? FLAG_Z : 0) | n | (carries & 0x10 ? FLAG_H : 0) | (carries & 0x100 ? FLAG_C : 0);\n"
+    "}\n"
+    "\n"
+    "#define ADD(v) do { unsigned v_ = (v), r_ = a + v_; f = aot_flags(r_, a ^ v_ ^ r_, 0); a = r_; } while (0)\n"
+    "#define ADC(v) do { unsigned v_ = (v), r_ = a + v_ + (f >> 4 & 1); f = aot_flags(r_, a ^ v_ ^ r_, 0); a = r_; } while (0)\n"
+    "#define SUB(v) do { unsigned v_ = (v), r_ = a - v_; f = aot_flags(r_, a ^ v_ ^ r_, FLAG_N); a = r_; } while (0)\n"
+    "#define SBC(v) do { unsigned v_ = (v), r_ = a - v_ - (f >> 4 & 1); f = aot_flags(r_, a ^ v_ ^ r_, FLAG_N); a = r_; } while (0)\n"
+    "#define AND(v) do { a &= (v); f = (a ? 0 : FLAG_Z) | FLAG_H; } while (0)\n"
+    "#define XOR(v) do { a ^= (v); f = a ? 0 : FLAG_Z; } while (0)\n"
+    "#define OR(v) do { a |= (v); f = a ? 0 : FLAG_Z; } while (0)\n"
+    "#define CP(v) do { unsigned v_ = (v), r_ = a - v_; f = aot_flags(r_, a ^ v_ ^ r_, FLAG_N); } while (0)\n"
+    "#define INC(r) do { r++; f = (f & FLAG_C) | (r ? 0 : FLAG_Z) | ((r & 0x0F) == 0 ? FLAG_H : 0); } while (0)\n"
+    "#define DEC(r) do { r--; f = (f & FLAG_C) | (r ? 0 : FLAG_Z) | FLAG_N | ((r & 0x0F) == 0x0F ? FLAG_H : 0); } while (0)\n"
+    "#define ADD_HL(v) \\\n"
+    "    do { \\\n"
+    "        unsigned hl_ = h << 8 | l, v_ = (v), r_ = hl_ + v_; \\\n"
+    "        f = (f & FLAG_Z) | ((hl_ & 0x0FFF) + (v_ & 0x0FFF) > 0x0FFF ? FLAG_H : 0) | (r_ > 0xFFFF ? FLAG_C : 0); \\\n"
+    "        SET_HL(r_); \\\n"
+    "    } while (0)\n"
+    "#define BIT(n, v) (f = (f & FLAG_C) | FLAG_H | ((v) & 1 << (n) ? 0 : FLAG_Z))\n"
+    "\n"
+    "static inline uint16_t aot_sp_offset(uint8_t* f, uint16_t sp, uint8_t offset) {\n"
+    "    *f = ((sp & 0x0F) + (offset & 0x0F) > 0x0F ? FLAG_H : 0) | ((sp & 0xFF) + offset > 0xFF ? FLAG_C : 0);\n"
+    "    return sp + (int8_t)offset;\n"
+    "}\n"
+    "\n"
+    "static inline void aot_daa(uint8_t* a, uint8_t* f) {\n"
+    "    uint8_t adjust = 0;\n"
+    "    int carry = *f & FLAG_C;\n"
+    "    if (*f & FLAG_N) {\n"
+    "        if (*f & FLAG_H) adjust |= 0x06;\n"
+    "        if (carry) adjust |= 0x60;\n"
+    "        *a -= adjust;\n"
+    "    } else {\n"
+    "        if ((*f & FLAG_H) || (*a & 0x0F) > 0x09) adjust |= 0x06;\n"
+    "        if (carry || *a > 0x99) {\n"
+    "            adjust |= 0x60;\n"
+    "            carry = 1;\n"
+    "        }\n"
+    "        *a += adjust;\n"
+    "    }\n"
+    "    *f = (*a == 0 ? FLAG_Z : 0) | (*f & FLAG_N) | (carry ? FLAG_C : 0);\n"
+    "}\n"
+    "\n"
+    "static inline uint8_t aot_shifted(uint8_t* f, uint8_t result, int carry) {\n"
+    "    *f = (result == 0 ? FLAG_Z : 0) | (carry ? FLAG_C : 0);\n"
+    "    return result;\n"
+    "}\n"
+    "static inline uint8_t aot_rlc(uint8_t* f, uint8_t v) { return aot_shifted(f, v << 1 | v >> 7, v & 0x80); }\n"
+    "static inline uint8_t aot_rrc(uint8_t* f, uint8_t v) { return aot_shifted(f, v >> 1 | v << 7, v & 0x01); }\n"
+    "static inline uint8_t aot_rl(uint8_t* f, uint8_t v) { return aot_shifted(f, v << 1 | (*f >> 4 & 1), v & 0x80); }\n"
+    "static inline uint8_t aot_rr(uint8_t* f, uint8_t v) { return aot_shifted(f, v >> 1 | (*f >> 4 & 1) << 7, v & 0x01); }\n"
+    "static inline uint8_t aot_sla(uint8_t* f, uint8_t v) { return aot_shifted(f, v << 1, v & 0x80); }\n"
+    "static inline uint8_t aot_sra(uint8_t* f, uint8_t v) { return aot_shifted(f, v >> 1 | (v & 0x80), v & 0x01); }\n"
+    "static inline uint8_t aot_swap(uint8_t* f, uint8_t v) { return aot_shifted(f, v << 4 | v >> 4, 0); }\n"
+    "static inline uint8_t aot_srl(uint8_t* f, uint8_t v) { return aot_shifted(f, v >> 1, v & 0x01); }\n"
+    "\n";
+
+// Stack writes go after the checks of both bytes, so a push exits before changing anything
+static void emit_push_checks(Translator* aot, unsigned here) {
+    emit(aot, "        WRITABLE(sp - 1, 0x%04X);\n        WRITABLE(sp - 2, 0x%04X);\n", here, here);
+}
+
+static void emit_push(Translator* aot, unsigned value) {
+    emit(aot, "        sp -= 2;\n        WRITE(sp, 0x%02X);\n        WRITE(sp + 1, 0x%02X);\n", value & 0xFF, value >> 8);
+}
+
+static void emit_pop(Translator* aot, unsigned here) {
+    emit(aot, "        READ(lo, sp, 0x%04X);\n        READ(hi, sp + 1, 0x%04X);\n", here, here);
+}
+
+// The branch not taken leaves the piece, what follows is the taken path
+static void emit_not_taken(Translator* aot, uint8_t opcode, unsigned cycles, uint16_t next) {
+    emit(aot, "        if (%s) {\n            spent += %u;\n            EXIT(0x%04X);\n        }\n",
+         not_taken[opcode >> 3 & 3], cycles, next);
+}
+
+// Cycles of the block block_cache.c decodes at `target`, 0 if it is not one the piece can chain to
+static unsigned chain_cycles(const Translator* aot, uint16_t target) {
+    bool in_piece = false;
+    for (unsigned i = 0; i < aot->piece_count; i++) in_piece |= aot->piece[i] == target;
+    if (!in_piece) return 0;
+
+    unsigned cycles = 0;
+    uint16_t address = target;
+    for (unsigned count = 0; count < BLOCK_MAX_OPS; count++) {
+        uint8_t bytes[3];
+        unsigned length = decode(aot, (Location){ aot->bank, address }, bytes);
+        if (length == 0) return 0; // ends other than the interpreter's block would, no chaining
+
+        const OpcodeInfo* info = &opcode_table[bytes[0]];
+        cycles += bytes[0] == OPCODE_PREFIX_CB ? cb_opcode_table[bytes[1]].cycles : info->cycles;
+        address += length;
+        if (info->flags & OPF_END_BLOCK) break;
+    }
+    return cycles;
+}
+
+// C for one instruction; falls through to the next one unless it branches
+static void emit_instruction(Translator* aot, uint16_t here, const uint8_t* bytes) {
+    const uint8_t opcode = bytes[0];
+    const OpcodeInfo* info = &opcode_table[opcode];
+    const uint16_t next = here + info->length;
+    const unsigned d8 = bytes[1], a16 = bytes[1] | bytes[2] << 8;
+    const unsigned y = opcode >> 3 & 7, z = opcode & 7, pair = opcode >> 4 & 3;
+    const unsigned cycles = info->cycles;
+    char text[64];
+
+    // (HL) as source or target of the register forms
+    const bool reads_hl = ((opcode >= 0x40 && opcode < 0x80) || (opcode >= 0x80 && opcode < 0xC0)) && z == 6;
+    const bool writes_hl = opcode >= 0x70 && opcode < 0x78;
+
+    if (opcode >= 0x40 && opcode < 0xC0 && opcode != 0x76) {
+        if (writes_hl) emit(aot, "        WRITABLE(h << 8 | l, 0x%04X);\n", here);
+        if (reads_hl) emit(aot, "        READ(value, h << 8 | l, 0x%04X);\n", here);
+        emit(aot, "        spent += %u;\n", cycles);
+        const char* source = reads_hl ? "value" : r8_name[z];
+        if (opcode >= 0x80) {
+            emit(aot, "        %s(%s);\n", alu_macro[y], source);
+        } else if (writes_hl) {
+            emit(aot, "        WRITE(h << 8 | l, %s);\n", source);
+        } else {
+            emit(aot, "        %s = %s;\n", r8_name[y], source);
+        }
+        return;
+    }
+
+    // INC r, DEC r, LD r,d8
+    if ((opcode & 0xC7) == 0x04 || (opcode & 0xC7) == 0x05 || (opcode & 0xC7) == 0x06) {
+        const char* operation = (opcode & 7) == 4 ? "INC" : (opcode & 7) == 5 ? "DEC" : NULL;
+        if (y == 6) {
+            emit(aot, "        WRITABLE(h << 8 | l, 0x%04X);\n", here);
+            if (operation) emit(aot, "        READ(value, h << 8 | l, 0x%04X);\n", here);
+            emit(aot, "        spent += %u;\n", cycles);
+            if (operation) {
+                emit(aot, "        %s(value);\n        WRITE(h << 8 | l, value);\n", operation);
+            } else {
+                emit(aot, "        WRITE(h << 8 | l, 0x%02X);\n", d8);
+            }
+        } else {
+            emit(aot, "        spent += %u;\n", cycles);
+            if (operation) {
+                emit(aot, "        %s(%s);\n", operation, r8_name[y]);
+            } else {
+                emit(aot, "        %s = 0x%02X;\n", r8_name[y], d8);
+            }
+        }
+        return;
+    }
+
+    // ALU A,d8
+    if ((opcode & 0xC7) == 0xC6) {
+        emit(aot, "        spent += %u;\n        %s(0x%02X);\n", cycles, alu_macro[y], d8);
+        return;
+    }
+
+    // Jumps, calls, returns and restarts. Taken conditional ones cost 4 (JR, JP) or 12 (CALL, RET) more
+    if (opcode == 0x18 || (opcode & 0xE7) == 0x20 || opcode == 0xC3 || (opcode & 0xE7) == 0xC2) {
+        bool relative = opcode < 0x40, conditional = opcode != 0x18 && opcode != 0xC3;
+        uint16_t target = relative ? next + (int8_t)d8 : a16;
+
+        unsigned chained = chain_cycles(aot, target);
+
+        if (conditional) emit_not_taken(aot, opcode, cycles, next);
+        emit(aot, "        spent += %u;\n", cycles + (conditional ? 4 : 0));
+        if (chained) emit(aot, "        if (CHAIN(%u)) goto at_%04X;\n", chained, target);
+        emit(aot, "        EXIT(0x%04X);\n", target);
+        return;
+    }
+    if (opcode == 0xCD || (opcode & 0xE7) == 0xC4 || (opcode & 0xC7) == 0xC7) {
+        bool conditional = (opcode & 0xE7) == 0xC4;
+        unsigned target = (opcode & 0xC7) == 0xC7 ? (opcode & 0x38) : a16;
+
+        if (conditional) emit_not_taken(aot, opcode, cycles, next);
+        emit_push_checks(aot, here);
+        emit(aot, "        spent += %u;\n", cycles + (conditional ? 12 : 0));
+        emit_push(aot, next);
+        emit(aot, "        EXIT(0x%04X);\n", target);
+        return;
+    }
+    if (opcode == 0xC9 || (opcode & 0xE7) == 0xC0) {
+        bool conditional = opcode != 0xC9;
+
+        if (conditional) emit_not_taken(aot, opcode, cycles, next);
+        emit_pop(aot, here);
+        emit(aot, "        spent += %u;\n        sp += 2;\n        EXIT(hi << 8 | lo);\n", cycles + (conditional ? 12 : 0));
+        return;
+    }
+
+    switch (opcode) {
+        case 0x00:
+            emit(aot, "        spent += %u;\n", cycles);
+            return;
+
+        case 0x01: case 0x11: case 0x21: case 0x31:
+            emit(aot, "        spent += %u;\n        %s(0x%04X);\n", cycles, pair_set[pair], a16);
+            return;
+        case 0x03: case 0x13: case 0x23: case 0x33:
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+            emit(aot, "        spent += %u;\n        %s(%s %c 1);\n", cycles, pair_set[pair], pair_get[pair],
+                 opcode & 0x08 ? '-' : '+');
+            return;
+        case 0x09: case 0x19: case 0x29: case 0x39:
+            emit(aot, "        spent += %u;\n        ADD_HL(%s);\n", cycles, pair_get[pair]);
+            return;
+
+        case 0x02: case 0x12:
+            emit(aot, "        WRITABLE(%s, 0x%04X);\n        spent += %u;\n        WRITE(%s, a);\n",
+                 pair_get[pair], here, cycles, pair_get[pair]);
+            return;
+        case 0x0A: case 0x1A:
+            emit(aot, "        READ(value, %s, 0x%04X);\n        spent += %u;\n        a = value;\n",
+                 pair_get[pair], here, cycles);
+            return;
+        case 0x22: case 0x32:
+            emit(aot, "        WRITABLE(h << 8 | l, 0x%04X);\n        spent += %u;\n        WRITE(h << 8 | l, a);\n"
+                      "        SET_HL((h << 8 | l) %c 1);\n", here, cycles, opcode == 0x22 ? '+' : '-');
+            return;
+        case 0x2A: case 0x3A:
+            emit(aot, "        READ(value, h << 8 | l, 0x%04X);\n        spent += %u;\n        a = value;\n"
+                      "        SET_HL((h << 8 | l) %c 1);\n", here, cycles, opcode == 0x2A ? '+' : '-');
+            return;
+
+        case 0x07: case 0x0F: case 0x17: case 0x1F:
+            emit(aot, "        spent += %u;\n        a = %s(&f, a);\n        f &= FLAG_C;\n", cycles, shift_fn[y]);
+            return;
+        case 0x27:
+            emit(aot, "        spent += %u;\n        aot_daa(&a, &f);\n", cycles);
+            return;
+        case 0x2F:
+            emit(aot, "        spent += %u;\n        a = ~a;\n        f |= FLAG_N | FLAG_H;\n", cycles);
+            return;
+        case 0x37:
+            emit(aot, "        spent += %u;\n        f = (f & FLAG_Z) | FLAG_C;\n", cycles);
+            return;
+        case 0x3F:
+            emit(aot, "        spent += %u;\n        f = (f & (FLAG_Z | FLAG_C)) ^ FLAG_C;\n", cycles);
+            return;
+
+        case 0x08:
+            emit(aot, "        WRITABLE(0x%04X, 0x%04X);\n        WRITABLE(0x%04X, 0x%04X);\n        spent += %u;\n"
+                      "        WRITE(0x%04X, sp & 0xFF);\n        WRITE(0x%04X, sp >> 8);\n",
+                 a16, here, (uint16_t)(a16 + 1), here, cycles, a16, (uint16_t)(a16 + 1));
+            return;
+        case 0xF9:
+            emit(aot, "        spent += %u;\n        sp = h << 8 | l;\n", cycles);
+            return;
+        case 0xE8:
+            emit(aot, "        spent += %u;\n        sp = aot_sp_offset(&f, sp, 0x%02X);\n", cycles, d8);
+            return;
+        case 0xF8:
+            emit(aot, "        spent += %u;\n        SET_HL(aot_sp_offset(&f, sp, 0x%02X));\n", cycles, d8);
+            return;
+
+        case 0xC5: case 0xD5: case 0xE5: case 0xF5:
+            emit_push_checks(aot, here);
+            emit(aot, "        spent += %u;\n        sp -= 2;\n", cycles);
+            emit(aot, "        WRITE(sp, %s);\n        WRITE(sp + 1, %s);\n", push_low[pair], push_high[pair]);
+            return;
+        case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+            emit_pop(aot, here);
+            emit(aot, "        spent += %u;\n        sp += 2;\n", cycles);
+            if (opcode == 0xF1) {
+                emit(aot, "        a = hi;\n        f = lo & 0xF0;\n");
+            } else {
+                emit(aot, "        %s(hi << 8 | lo);\n", pair_set[pair]);
+            }
+            return;
+
+        case 0xE0: case 0xE2: case 0xEA:
+            snprintf(text, sizeof(text), opcode == 0xE0 ? "0xFF%02X" : opcode == 0xE2 ? "0xFF00 | c" : "0x%04X",
+                     opcode == 0xE0 ? d8 : a16);
+            emit(aot, "        WRITABLE(%s, 0x%04X);\n        spent += %u;\n        WRITE(%s, a);\n", text, here, cycles, text);
+            return;
+        case 0xF0: case 0xF2: case 0xFA:
+            snprintf(text, sizeof(text), opcode == 0xF0 ? "0xFF%02X" : opcode == 0xF2 ? "0xFF00 | c" : "0x%04X",
+                     opcode == 0xF0 ? d8 : a16);
+            emit(aot, "        READ(value, %s, 0x%04X);\n        spent += %u;\n        a = value;\n", text, here, cycles);
+            return;
+
+        case 0xE9:
+            emit(aot, "        spent += %u;\n        EXIT(h << 8 | l);\n", cycles);
+            return;
+
+        case OPCODE_PREFIX_CB: {
+            const unsigned cb = bytes[1], n = cb >> 3 & 7, index = cb & 7;
+            const unsigned cb_cycles = cb_opcode_table[cb].cycles;
+            const char* target = index == 6 ? "value" : r8_name[index];
+
+            if (index == 6) {
+                if (cb >> 6 != 1) emit(aot, "        WRITABLE(h << 8 | l, 0x%04X);\n", here);
+                emit(aot, "        READ(value, h << 8 | l, 0x%04X);\n", here);
+            }
+            emit(aot, "        spent += %u;\n", cb_cycles);
+            switch (cb >> 6) {
+                case 0: emit(aot, "        %s = %s(&f, %s);\n", target, shift_fn[n], target); break;
+                case 1: emit(aot, "        BIT(%u, %s);\n", n, target); return;
+                case 2: emit(aot, "        %s &= (uint8_t)~0x%02X;\n", target, 1u << n); break;
+                default: emit(aot, "        %s |= 0x%02X;\n", target, 1u << n); break;
+            }
+            if (index == 6) emit(aot, "        WRITE(h << 8 | l, value);\n");
+            return;
+        }
+
+        default:
+            // HALT, STOP, DI, EI, RETI: scheduler and interrupt state, the interpreter does them
+            emit(aot, "        EXIT(0x%04X);\n", here);
+            return;
+    }
+}
+
+static bool is_code(const Translator* aot, uint16_t bank, uint32_t address) {
+    return aot->code[bank][address % REGION_SIZE];
+}
+
+// Pieces of one region in address order, returns how many instructions were written
+static size_t emit_region(Translator* aot, uint16_t bank) {
+    const uint16_t base = bank ? REGION_SIZE : 0;
+    size_t instructions = 0;
+
+    for (uint32_t offset = 0; offset < REGION_SIZE;) {
+        if (!is_code(aot, bank, offset)) {
+            offset++;
+            continue;
+        }
+
+        // Consecutive instructions up to a block end, as many as block_cache.c decodes at most
+        const uint32_t start = offset;
+        uint8_t bytes[BLOCK_MAX_OPS][3];
+        aot->bank = bank;
+        aot->piece_count = 0;
+        for (;;) {
+            unsigned length = decode(aot, (Location){ bank, base + offset }, bytes[aot->piece_count]);
+            uint8_t opcode = bytes[aot->piece_count][0];
+
+            aot->piece[aot->piece_count++] = base + offset;
+            offset += length;
+            if ((opcode_table[opcode].flags & OPF_END_BLOCK) || aot->piece_count == BLOCK_MAX_OPS ||
+                offset >= REGION_SIZE || !is_code(aot, bank, offset)) break;
+        }
+
+        emit(aot, "static void block_%02X_%04X(GB* gb) {\n    ENTER();\n\n    switch (cpu->pc) {\n", bank, base + start);
+        for (unsigned i = 0; i < aot->piece_count; i++) {
+            uint16_t address = aot->piece[i];
+            emit(aot, "    case 0x%04X: at_%04X: // %02X", address, address, bytes[i][0]);
+            for (unsigned j = 1; j < opcode_table[bytes[i][0]].length; j++) emit(aot, " %02X", bytes[i][j]);
+            emit(aot, "\n");
+            emit_instruction(aot, address, bytes[i]);
+        }
+        instructions += aot->piece_count;
+
+        emit(aot, "        EXIT(0x%04X);\n    default:\n        return; // not an entry of this piece\n    }\n}\n\n",
+             base + offset);
+    }
+    return instructions;
+}
+
+static void emit_table(Translator* aot, uint16_t bank, size_t* entries) {
+    const uint16_t base = bank ? REGION_SIZE : 0;
+    uint32_t piece = 0;
+    unsigned count = 0;
+
+    // The same cut as emit_region: every instruction maps to the function of its piece
+    for (uint32_t offset = 0; offset < REGION_SIZE;) {
+        if (!is_code(aot, bank, offset)) {
+            offset++;
+            count = 0;
+            continue;
+        }
+        if (count == 0) piece = offset;
+
+        uint8_t bytes[3];
+        unsigned length = decode(aot, (Location){ bank, base + offset }, bytes);
+        emit(aot, "    { 0x%04X, %u, block_%02X_%04X },\n", base + offset, bank, bank, base + piece);
+        (*entries)++;
+
+        count++;
+        offset += length;
+        if ((opcode_table[bytes[0]].flags & OPF_END_BLOCK) || count == BLOCK_MAX_OPS) count = 0;
+    }
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s rom.gb out.c\n", program);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    GB* gb = gb_create();
+    load_rom(gb, argv[1]);
+
+    Translator aot = {
+        .rom = gb->cart.rom->data,
+        .rom_size = gb->cart.rom->size,
+        .banks = gb->cart.rom_banks,
+        .banked = gb->cart.mbc != MBC_NONE,
+    };
+    aot.code = calloc(aot.banks, sizeof(uint8_t*));
+    aot.work = malloc(MAX_WORK * sizeof(Location));
+    for (unsigned bank = 0; aot.code && bank < aot.banks; bank++) {
+        aot.code[bank] = calloc(REGION_SIZE, 1);
+        if (!aot.code[bank]) aot.code = NULL;
+    }
+    if (!aot.code || !aot.work) {
+        perror("Fehler beim Anlegen der Codekarte");
+        return 1;
+    }
+
+    // Entry point, restarts and interrupt vectors
+    reach(&aot, 0, 0x0100);
+    for (uint16_t vector = 0x40; vector <= 0x60; vector += 8) reach(&aot, 0, vector);
+    walk(&aot);
+
+    aot.out = fopen(argv[2], "w");
+    if (!aot.out) {
+        perror("Fehler beim Schreiben des C-Codes");
+        return 1;
+    }
+
+    emit(&aot, "// Generated by lr35902_aot from %s, do not edit\n\n%s", argv[1], prelude);
+    size_t instructions = 0;
+    for (unsigned bank = 0; bank < aot.banks; bank++) instructions += emit_region(&aot, bank);
+
+    size_t entries = 0;
+    emit(&aot, "static const AotEntry entries[] = {\n");
+    for (unsigned bank = 0; bank < aot.banks; bank++) emit_table(&aot, bank, &entries);
+    emit(&aot, "};\n\n");
+    emit(&aot, "const AotImage " AOT_IMAGE_SYMBOL " = {\n    AOT_ABI_VERSION, sizeof(GB), 0x%08Xu, %zu, entries,\n};\n",
+         aot_rom_hash(aot.rom, aot.rom_size), entries);
+
+    if (fclose(aot.out) != 0) {
+        perror("Fehler beim Schreiben des C-Codes");
+        return 1;
+    }
+    printf("%zu instructions in %zu entries\n", instructions, entries);
+
+    for (unsigned bank = 0; bank < aot.banks; bank++) free(aot.code[bank]);
+    free(aot.code);
+    free(aot.work);
+    gb_destroy(gb);
+    return 0;
+}
@@ -0,0 +1,724 @@
+//
+// Created by davidg on 30.08.25.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <gb.h>
+#include <batch.h>
+#include <fleet.h>
+#include <state_set.h>
+
+#ifndef LR35902_DISPATCH_NAME
+#define LR35902_DISPATCH_NAME "unknown"
+#endif
+
+#define DEFAULT_CYCLES (16 * 4194304ull) // 16 seconds of emulated time per run
+#define DEFAULT_RUNS 5
+#define MAX_RUNS 100
+#define MAX_BATCH 256
+#define MAX_FLEET 65536
+#define SLICE_CYCLES (1u << 24)          // cpu_run takes a 32-bit budget
+#define LOOP_START 0x0150
+#define CHECK_WARMUP 10                  // frames a workload runs before it is saved or rewound
+#define CHECK_FRAMES 60                  // frames two machines are compared for after that
+#define CHECK_MARGIN 4096                // cycles short of a target cpu_run stops, cpu_step does the rest
+#define CHECK_MAX_STEPS 100000           // cpu_step calls two machines get to meet at the same cycle
+#define REWIND_INTERVAL (GB_FRAME_CYCLES / 4)
+#define REWIND_STEPS 3                   // crosses a keyframe with REWIND_KEYFRAMES 4
+#define REWIND_KEYFRAMES 4
+#define DELTA_CHAIN 4                    // deltas captured on top of one keyframe, a frame apart
+#define SET_THREADS 4
+#define SET_RUNS 8                       // runs of STATE_SET_MAX_PROBE hashes with the same home slot
+#define SET_CAPACITY 1024                // 2048 slots: the runs do not touch, the last one wraps around
+
+/**
+ * A workload is either a synthetic loop written straight into memory
+ * or a ROM file
+ */
+typedef struct {
+    const char* name;
+    void (*build)(GB* gb);
+    const char* rom;
+} Workload;
+
+// How the machines of a run are set up and driven
+typedef struct {
+    unsigned batch; // forks run together by batch_run, 0 runs one machine with cpu_run
+    unsigned fleet; // forks run side by side by fleet_run
+    unsigned workers;
+    bool jit;
+    bool idle;
+    bool step;      // drive the reference core with cpu_step instead of cpu_run
+    bool debugger;  // attach a debugger without breakpoints or watchpoints
+} Options;
+
+// Appends `count` copies of the opcodes in `ops` and jumps back to the start
+static void emit_loop(GB* gb, const uint8_t* ops, size_t length, unsigned count) {
+    uint16_t address = LOOP_START;
+
+    for (unsigned n = 0; n < count; n++) {
+        for (size_t i = 0; i < length; i++) gb->mem.data[address++] = ops[i];
+    }
+    gb->mem.data[address++] = 0xC3; // JP LOOP_START
+    gb->mem.data[address++] = LOOP_START & 0xFF;
+    gb->mem.data[address] = LOOP_START >> 8;
+    gb->mem.data[0x100] = 0xC3;
+    gb->mem.data[0x101] = LOOP_START & 0xFF;
+    gb->mem.data[0x102] = LOOP_START >> 8;
+}
+
+// LD r, r' over every register pair, 0x40-0x7F without (HL) and HALT
+static void build_loads(GB* gb) {
+    uint8_t ops[64];
+    size_t length = 0;
+
+    for (unsigned op = 0x40; op < 0x80; op++) {
+        if ((op & 0x07) == 6 || (op & 0xF8) == 0x70) continue;
+        ops[length++] = op;
+    }
+    emit_loop(gb, ops, length, 16);
+}
+
+// ADD/ADC/SUB/SBC A, r, 0x80-0x9F without (HL)
+static void build_alu(GB* gb) {
+    uint8_t ops[32];
+    size_t length = 0;
+
+    for (unsigned op = 0x80; op < 0xA0; op++) {
+        if ((op & 0x07) == 6) continue;
+        ops[length++] = op;
+    }
+    emit_loop(gb, ops, length, 32);
+}
+
+// Every load and ALU operation through (HL), HL reset to WRAM each pass
+static void build_memory(GB* gb) {
+    static const uint8_t ops[] = {
+        0x26, 0xC0, 0x2E, 0x80, // LD H, $C0; LD L, $80
+        0x46, 0x4E, 0x56, 0x5E, 0x7E,
+        0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x77,
+        0x86, 0x8E, 0x96, 0x9E,
+    };
+    emit_loop(gb, ops, sizeof(ops), 32);
+}
+
+// JR NZ taken 255 times out of 256, then a CALL/RET pair
+static void build_branches(GB* gb) {
+    static const uint8_t loop[] = {
+        0xC6, 0x01,       // ADD A, 1
+        0x20, 0xFC,       // JR NZ, -4
+        0xCD, 0x00, 0x02, // CALL $0200
+        0xC3, LOOP_START & 0xFF, LOOP_START >> 8,
+    };
+    memcpy(&gb->mem.data[LOOP_START], loop, sizeof(loop));
+    gb->mem.data[0x200] = 0xC9; // RET
+    gb->mem.data[0x100] = 0xC3;
+    gb->mem.data[0x101] = LOOP_START & 0xFF;
+    gb->mem.data[0x102] = LOOP_START >> 8;
+}
+
+// LD (HL+), A over all of WRAM with the LCD on and a timer interrupt every 4096 cycles,
+// so a savestate has memory, PPU, timer and interrupt state to get right
+static void build_stores(GB* gb) {
+    static const uint8_t setup[] = {
+        0x3E, 0x91, 0xE0, 0x40, // LD A, $91; LDH (LCDC), A
+        0x3E, 0x05, 0xE0, 0x07, // LD A, $05; LDH (TAC), A
+        0x3E, 0x04, 0xE0, 0xFF, // LD A, $04; LDH (IE), A
+        0xFB,                   // EI
+        0xC3, LOOP_START & 0xFF, LOOP_START >> 8,
+    };
+    static const uint8_t loop[] = {
+        0x21, 0x00, 0xC0, // LD HL, $C000
+        0x78,             // LD A, B
+        0x22,             // LD (HL+), A
+        0x04,             // INC B
+        0x7C,             // LD A, H
+        0xFE, 0xE0,       // CP $E0
+        0x20, 0xF8,       // JR NZ, -8
+        0x0C,             // INC C
+        0xC3, LOOP_START & 0xFF, LOOP_START >> 8,
+    };
+    memcpy(&gb->mem.data[0x100], setup, sizeof(setup));
+    memcpy(&gb->mem.data[LOOP_START], loop, sizeof(loop));
+    gb->mem.data[0x50] = 0xD9; // RETI
+}
+
+static GB* boot(const Workload* workload, const Options* options) {
+    GB* gb = gb_create();
+    if (workload->rom) {
+        load_rom(gb, workload->rom);
+    } else {
+        workload->build(gb);
+    }
+    if (options->jit) jit_set_enabled(gb, true);
+    block_cache_set_idle_skip(gb, options->idle);
+    if (options->debugger) debug_attach(gb);
+    return gb;
+}
+
+static double now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// Instructions per guest cycle, counted once with the reference core
+static double instructions_per_cycle(const Workload* workload, uint64_t cycles) {
+    static const Options reference = { 0 };
+    GB* gb = boot(workload, &reference);
+    uint64_t instructions = 0;
+    uint64_t done = 0;
+
+    while (done < cycles) {
+        uint64_t start = gb->cpu.cycles;
+        uint64_t end = start + (cycles - done < SLICE_CYCLES ? cycles - done : SLICE_CYCLES);
+        cpu_status_t status = CPU_OK;
+
+        while (status == CPU_OK && CYCLES_BEFORE(gb->cpu.cycles, end)) {
+            status = cpu_step(gb);
+            instructions++;
+        }
+        done += gb->cpu.cycles - start;
+        if (status != CPU_OK) break;
+    }
+
+    gb_destroy(gb);
+    return done ? (double)instructions / done : 0;
+}
+
+// `batch` forks of one fresh machine, told apart by A, run together by batch_run.
+// Returns the guest cycles of all of them, 0 if one stopped
+static uint64_t timed_batch(const Workload* workload, uint64_t cycles, const Options* options,
+                            double* ns, double* vectorized) {
+    unsigned batch = options->batch;
+    GB* seed = boot(workload, options);
+    GB* lanes[MAX_BATCH];
+    uint64_t lane_instructions = 0, scalar_instructions = 0;
+    uint64_t done = 0;
+    bool stopped = false;
+
+    for (unsigned i = 0; i < batch; i++) {
+        lanes[i] = gb_fork(seed);
+        lanes[i]->cpu.a = i;
+    }
+
+    double start = now_ns();
+    while (done < cycles && !stopped) {
+        uint32_t slice = cycles - done < SLICE_CYCLES ? cycles - done : SLICE_CYCLES;
+        uint64_t before = lanes[0]->cpu.cycles;
+        BatchStats stats;
+
+        batch_run(lanes, batch, slice, &stats);
+        lane_instructions += stats.lane_instructions;
+        scalar_instructions += stats.scalar_instructions;
+        for (unsigned i = 0; i < batch; i++) {
+            if (lanes[i]->cpu.cycles - before < slice) stopped = true;
+        }
+        done += lanes[0]->cpu.cycles - before;
+    }
+    *ns = now_ns() - start;
+    *vectorized = lane_instructions + scalar_instructions ?
+        (double)lane_instructions / (lane_instructions + scalar_instructions) : 0;
+
+    for (unsigned i = 0; i < batch; i++) gb_destroy(lanes[i]);
+    gb_destroy(seed);
+    return stopped ? 0 : done * batch;
+}
+
+// `fleet` forks of one fresh machine, told apart by A, run by fleet_run on options->workers threads.
+// Returns the guest cycles of all of them, 0 if one stopped
+static uint64_t timed_fleet(const Workload* workload, uint64_t cycles, const Options* options, double* ns) {
+    unsigned count = options->fleet;
+    GB* seed = boot(workload, options);
+    GB** machines = calloc(count, sizeof(GB*));
+    uint64_t first = seed->cpu.cycles;
+    uint64_t done = 0, total = 0;
+    bool stopped = false;
+
+    if (!machines) {
+        perror("Fehler beim Anlegen der Flotte");
+        exit(1);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        machines[i] = gb_fork(seed);
+        machines[i]->cpu.a = i;
+    }
+
+    // Every slice runs each machine at least that far, one that is behind has stopped
+    double start = now_ns();
+    while (done < cycles && !stopped) {
+        uint32_t slice = cycles - done < SLICE_CYCLES ? cycles - done : SLICE_CYCLES;
+        fleet_run(machines, count, options->workers, slice);
+        done += slice;
+        for (unsigned i = 0; i < count; i++) {
+            if (machines[i]->cpu.cycles - first < done) stopped = true;
+        }
+    }
+    *ns = now_ns() - start;
+
+    for (unsigned i = 0; i < count; i++) {
+        total += machines[i]->cpu.cycles - first;
+        gb_destroy(machines[i]);
+    }
+    free(machines);
+    gb_destroy(seed);
+    return stopped ? 0 : total;
+}
+
+// One timed run on a fresh machine; returns the guest cycles run, 0 if the guest stopped
+static uint64_t timed_run(const Workload* workload, uint64_t cycles, const Options* options, double* ns) {
+    GB* gb = boot(workload, options);
+    uint64_t done = 0;
+    cpu_status_t running = options->step ? CPU_OK : CPU_BUDGET_DONE;
+    cpu_status_t status = running;
+
+    double start = now_ns();
+    if (options->step) {
+        uint64_t first = gb->cpu.cycles;
+        while (status == CPU_OK && CYCLES_BEFORE(gb->cpu.cycles, first + cycles)) status = cpu_step(gb);
+        done = gb->cpu.cycles - first;
+    }
+    while (!options->step && done < cycles && status == CPU_BUDGET_DONE) {
+        uint64_t before = gb->cpu.cycles;
+        status = cpu_run(gb, cycles - done < SLICE_CYCLES ? cycles - done : SLICE_CYCLES);
+        done += gb->cpu.cycles - before;
+    }
+    *ns = now_ns() - start;
+
+    gb_destroy(gb);
+    return status == running ? done : 0;
+}
+
+static void stats(const double* samples, unsigned count, double* mean, double* stddev) {
+    double sum = 0, squares = 0;
+
+    for (unsigned i = 0; i < count; i++) sum += samples[i];
+    *mean = sum / count;
+    for (unsigned i = 0; i < count; i++) squares += (samples[i] - *mean) * (samples[i] - *mean);
+    *stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+}
+
+static void print_metric(const char* name, const double* samples, unsigned count) {
+    double mean, stddev, min = samples[0], max = samples[0];
+
+    stats(samples, count, &mean, &stddev);
+    for (unsigned i = 1; i < count; i++) {
+        if (samples[i] < min) min = samples[i];
+        if (samples[i] > max) max = samples[i];
+    }
+    printf("      \"%s\": {\"mean\": %.4f, \"stddev\": %.4f, \"min\": %.4f, \"max\": %.4f},\n",
+        name, mean, stddev, min, max);
+}
+
+// ROM paths may contain anything, JSON strings take no quotes, backslashes or control characters as is
+static void print_json_string(const char* text) {
+    putchar('"');
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+// Writes one JSON object, returns false if the guest stopped before the cycle count
+static bool bench(const Workload* workload, uint64_t cycles, unsigned runs, const Options* options, bool last) {
+    unsigned batch = options->batch;
+    double ns_per_instruction[MAX_RUNS];
+    double guest_mhz[MAX_RUNS];
+    double vectorized = 0;
+    double ipc = instructions_per_cycle(workload, cycles);
+    bool ok = ipc > 0;
+
+    for (unsigned run = 0; ok && run < runs; run++) {
+        double ns;
+        uint64_t done;
+        if (batch) {
+            done = timed_batch(workload, cycles, options, &ns, &vectorized);
+        } else if (options->fleet) {
+            done = timed_fleet(workload, cycles, options, &ns);
+        } else {
+            done = timed_run(workload, cycles, options, &ns);
+        }
+        if (done == 0) ok = false;
+
+        ns_per_instruction[run] = ns / (ipc * done);
+        guest_mhz[run] = done / ns * 1e3;
+    }
+
+    printf("    {\n      \"name\": ");
+    print_json_string(workload->name);
+    printf(",\n");
+    if (ok) {
+        double mean, stddev;
+        stats(guest_mhz, runs, &mean, &stddev);
+
+        unsigned machines = batch ? batch : options->fleet ? options->fleet : 1;
+        printf("      \"instructions_per_run\": %.0f,\n", ipc * cycles * machines);
+        if (batch) printf("      \"vectorized\": %.4f,\n", vectorized);
+        print_metric("ns_per_instruction", ns_per_instruction, runs);
+        print_metric("guest_mhz", guest_mhz, runs);
+        printf("      \"realtime_factor\": %.2f,\n", mean * 1e6 / GB_CLOCK_HZ);
+        printf("      \"coefficient_of_variation\": %.4f\n", mean > 0 ? stddev / mean : 0);
+    } else {
+        printf("      \"error\": \"guest halted or hit an unknown opcode\"\n");
+    }
+    printf("    }%s\n", last ? "" : ",");
+    return ok;
+}
+
+// Steps whichever machine is behind until both stand at the same cycle
+static bool catch_up(GB* a, GB* b) {
+    for (unsigned steps = 0; a->cpu.cycles != b->cpu.cycles; steps++) {
+        GB* behind = CYCLES_BEFORE(a->cpu.cycles, b->cpu.cycles) ? a : b;
+        if (steps == CHECK_MAX_STEPS || cpu_step(behind) != CPU_OK) return false;
+    }
+    return true;
+}
+
+// Runs close to `target` with cpu_run, catch_up takes it from there
+static void run_until(GB* gb, uint64_t target) {
+    while (CYCLES_BEFORE(gb->cpu.cycles + CHECK_MARGIN, target)) {
+        uint64_t left = target - CHECK_MARGIN - gb->cpu.cycles;
+        if (cpu_run(gb, left < SLICE_CYCLES ? left : SLICE_CYCLES) != CPU_BUDGET_DONE) return;
+    }
+}
+
+static bool same_machine(GB* a, GB* b) {
+    return a->cpu.cycles == b->cpu.cycles && state_hash(a) == state_hash(b);
+}
+
+// Runs both machines frame by frame and compares them after each frame; NULL if they never differ
+static const char* run_together(GB* a, GB* b, unsigned frames) {
+    if (!catch_up(a, b)) return "no common cycle";
+    if (!same_machine(a, b)) return "differs at once";
+
+    for (unsigned frame = 0; frame < frames; frame++) {
+        cpu_run(a, GB_FRAME_CYCLES);
+        cpu_run(b, GB_FRAME_CYCLES);
+        if (!catch_up(a, b)) return "no common cycle";
+        if (!same_machine(a, b)) return "differs later on";
+    }
+    return NULL;
+}
+
+static void run_frames(GB* gb, unsigned frames) {
+    for (unsigned frame = 0; frame < frames; frame++) cpu_run(gb, GB_FRAME_CYCLES);
+}
+
+// Capture, state_save, state_load and state_restore into a fresh machine, which then has to run like the original
+static const char* check_savestate(const Workload* workload, const Options* options) {
+    GB* original = boot(workload, options);
+    GB* copy = boot(workload, options);
+    const char* failure = NULL;
+    char path[] = "/tmp/lr35902_bench.XXXXXX";
+    int fd = mkstemp(path);
+
+    run_frames(original, CHECK_WARMUP);
+    SaveState* state = state_capture(original);
+    SaveState* loaded = NULL;
+    if (fd < 0 || close(fd) != 0 || !state_save(state, path)) {
+        failure = "state_save failed";
+    } else if (!(loaded = state_load(path))) {
+        failure = "state_load failed";
+    } else if (!state_restore(copy, loaded)) {
+        failure = "state_restore failed";
+    } else {
+        failure = run_together(original, copy, CHECK_FRAMES);
+    }
+
+    if (fd >= 0) unlink(path);
+    if (loaded) state_release(loaded);
+    state_release(state);
+    gb_destroy(copy);
+    gb_destroy(original);
+    return failure;
+}
+
+// A machine that stepped back has to run into the same state as one that recorded the same history and never did
+static const char* check_rewind(const Workload* workload, const Options* options) {
+    GB* rewound = boot(workload, options);
+    GB* reference = boot(workload, options);
+    const char* failure = NULL;
+
+    rewind_attach(rewound, CHECK_WARMUP * 4, REWIND_INTERVAL, REWIND_KEYFRAMES);
+    rewind_attach(reference, CHECK_WARMUP * 4, REWIND_INTERVAL, REWIND_KEYFRAMES);
+    run_frames(rewound, CHECK_WARMUP);
+    run_frames(reference, CHECK_WARMUP);
+    if (!catch_up(rewound, reference)) failure = "no common cycle";
+
+    for (unsigned step = 0; !failure && step < REWIND_STEPS; step++) {
+        if (!rewind_step_back(rewound)) failure = "rewind_step_back failed";
+    }
+    if (!failure && !CYCLES_BEFORE(rewound->cpu.cycles, reference->cpu.cycles)) failure = "did not go back";
+    if (!failure) {
+        run_until(rewound, reference->cpu.cycles);
+        failure = run_together(rewound, reference, CHECK_FRAMES);
+    }
+
+    gb_destroy(reference);
+    gb_destroy(rewound);
+    return failure;
+}
+
+// A delta from the middle of a chain, with the machine and the rest of the chain gone, has to
+// restore the same machine as a keyframe of a second one taken at the same cycle
+static const char* check_delta(const Workload* workload, const Options* options) {
+    GB* chained = boot(workload, options);
+    GB* reference = boot(workload, options);
+    GB* from_delta = boot(workload, options);
+    GB* from_keyframe = boot(workload, options);
+    SaveState* chain[DELTA_CHAIN + 1];
+    uint64_t cycle = 0;
+    const char* failure = NULL;
+
+    run_frames(chained, CHECK_WARMUP);
+    chain[0] = state_capture_keyframe(chained);
+    for (unsigned i = 1; i <= DELTA_CHAIN; i++) {
+        run_frames(chained, 1);
+        if (i == DELTA_CHAIN / 2) cycle = chained->cpu.cycles;
+        chain[i] = state_capture(chained);
+    }
+    SaveState* middle = chain[DELTA_CHAIN / 2];
+    for (unsigned i = 0; i <= DELTA_CHAIN; i++) {
+        if (chain[i] != middle) state_release(chain[i]);
+    }
+    gb_destroy(chained);
+
+    // The same cpu_run calls take a second machine to the same point, cpu_step could leave a due event behind
+    run_frames(reference, CHECK_WARMUP + DELTA_CHAIN / 2);
+    SaveState* keyframe = state_capture_keyframe(reference);
+
+    if (reference->cpu.cycles != cycle) {
+        failure = "second machine missed the capture";
+    } else if (!state_restore(from_delta, middle) || !state_restore(from_keyframe, keyframe)) {
+        failure = "state_restore failed";
+    } else {
+        failure = run_together(from_delta, from_keyframe, CHECK_FRAMES);
+    }
+
+    state_release(keyframe);
+    state_release(middle);
+    gb_destroy(from_keyframe);
+    gb_destroy(from_delta);
+    gb_destroy(reference);
+    return failure;
+}
+
+typedef struct {
+    StateSet* set;
+    const uint64_t* hashes;
+    atomic_uint* added; // STATE_SET_ADDED per hash over all threads
+    size_t count;
+    unsigned thread;
+    bool ok;
+} SetWorker;
+
+// Inserts every hash, each thread from its own starting point, and looks for it right after
+static void* state_set_worker(void* arg) {
+    SetWorker* worker = arg;
+
+    worker->ok = true;
+    for (size_t n = 0; n < worker->count; n++) {
+        size_t i = (n + worker->thread * worker->count / SET_THREADS) % worker->count;
+        state_set_status_t status = state_set_insert(worker->set, worker->hashes[i]);
+        if (status == STATE_SET_ADDED) atomic_fetch_add(&worker->added[i], 1);
+        if (status == STATE_SET_FULL || !state_set_contains(worker->set, worker->hashes[i])) worker->ok = false;
+    }
+    return NULL;
+}
+
+// Hash j of a run, all of them share the low 16 bits and with them the home slot in tables up to 65536 slots
+static uint64_t colliding_hash(unsigned run, unsigned j) {
+    return (uint64_t)j << 16 | (run * 256 + 200);
+}
+
+// Threads racing on the same colliding hashes: every hash is ADDED exactly once and found by all of
+// them, one hash more than a run has room for comes back STATE_SET_FULL
+static const char* check_state_set(void) {
+    enum { COUNT = SET_RUNS * STATE_SET_MAX_PROBE };
+    uint64_t hashes[COUNT];
+    atomic_uint added[COUNT];
+    SetWorker workers[SET_THREADS];
+    pthread_t threads[SET_THREADS];
+    bool started[SET_THREADS];
+    StateSet* set = state_set_create(SET_CAPACITY);
+    const char* failure = NULL;
+
+    for (unsigned run = 0; run < SET_RUNS; run++) {
+        for (unsigned j = 0; j < STATE_SET_MAX_PROBE; j++) {
+            hashes[run * STATE_SET_MAX_PROBE + j] = colliding_hash(run, j);
+            atomic_init(&added[run * STATE_SET_MAX_PROBE + j], 0);
+        }
+    }
+
+    for (unsigned i = 0; i < SET_THREADS; i++) {
+        workers[i] = (SetWorker){ set, hashes, added, COUNT, i, false };
+        started[i] = pthread_create(&threads[i], NULL, state_set_worker, &workers[i]) == 0;
+        if (!started[i]) state_set_worker(&workers[i]);
+    }
+    for (unsigned i = 0; i < SET_THREADS; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        if (!workers[i].ok) failure = "inserted hash not found";
+    }
+
+    for (size_t i = 0; !failure && i < COUNT; i++) {
+        if (atomic_load(&added[i]) != 1) failure = "hash not ADDED exactly once";
+    }
+    if (!failure && state_set_count(set) != COUNT) failure = "wrong count";
+    for (unsigned run = 0; !failure && run < SET_RUNS; run++) {
+        uint64_t extra = colliding_hash(run, STATE_SET_MAX_PROBE);
+        if (state_set_insert(set, extra) != STATE_SET_FULL || state_set_contains(set, extra)) {
+            failure = "full run took one more";
+        }
+    }
+    if (!failure && state_set_count(set) != COUNT) failure = "wrong count";
+
+    state_set_destroy(set);
+    return failure;
+}
+
+static bool report(const char* name, const char* subject, const char* failure) {
+    printf("%-4s %-10s %s%s%s\n", failure ? "FAIL" : "ok", name, subject, failure ? ": " : "", failure ? failure : "");
+    return !failure;
+}
+
+// Savestate self-checks on the chosen core, one line per check and workload
+static bool check(const Workload* workload, const Options* options) {
+    static const struct {
+        const char* name;
+        const char* (*run)(const Workload* workload, const Options* options);
+    } checks[] = {
+        { "savestate", check_savestate },
+        { "rewind", check_rewind },
+        { "delta", check_delta },
+    };
+    bool ok = true;
+
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        if (!report(checks[i].name, workload->name, checks[i].run(workload, options))) ok = false;
+    }
+    return ok;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [--cycles N] [--runs N] [--batch N] [--fleet N [--workers N]] [--jit] [--idle] [--step] [--debugger] [--check] [--no-synthetic] [rom ...]\n", program);
+}
+
+int main(int argc, char** argv) {
+    static const Workload synthetic[] = {
+        { "ld_r_r", build_loads, NULL },
+        { "alu_r", build_alu, NULL },
+        { "memory_hl", build_memory, NULL },
+        { "branches", build_branches, NULL },
+        { "stores_irq", build_stores, NULL },
+    };
+    const size_t synthetic_count = sizeof(synthetic) / sizeof(synthetic[0]);
+
+    Workload* workloads = calloc(synthetic_count + argc, sizeof(Workload));
+    size_t count = 0;
+    uint64_t cycles = DEFAULT_CYCLES;
+    unsigned runs = DEFAULT_RUNS;
+    Options options = { 0 };
+    bool with_synthetic = true;
+    bool checks = false;
+
+    if (!workloads) {
+        perror("Fehler beim Anlegen der Workloads");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            cycles = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            options.batch = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc) {
+            options.fleet = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            options.workers = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.jit = true;
+        } else if (strcmp(argv[i], "--idle") == 0) {
+            options.idle = true;
+        } else if (strcmp(argv[i], "--step") == 0) {
+            options.step = true;
+        } else if (strcmp(argv[i], "--debugger") == 0) {
+            options.debugger = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            checks = true;
+        } else if (strcmp(argv[i], "--no-synthetic") == 0) {
+            with_synthetic = false;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else {
+            workloads[count++] = (Workload){ argv[i], NULL, argv[i] };
+        }
+    }
+
+    if (cycles == 0 || runs == 0 || runs > MAX_RUNS || options.batch > MAX_BATCH ||
+        options.fleet > MAX_FLEET || (options.step && options.batch) ||
+        (options.fleet && (options.batch || options.step)) || (checks && (options.batch || options.fleet || options.step))) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Synthetic loops first, then the ROMs in command line order
+    if (with_synthetic) {
+        memmove(workloads + synthetic_count, workloads, count * sizeof(Workload));
+        memcpy(workloads, synthetic, sizeof(synthetic));
+        count += synthetic_count;
+    }
+
+    // fleet_run takes 0 for one thread per core, the report says how many that was
+    if (options.fleet && options.workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        options.workers = cores > 0 ? cores : 1;
+    }
+
+    if (options.jit) {
+        GB* probe = gb_create();
+        options.jit = jit_set_enabled(probe, true);
+        gb_destroy(probe);
+        if (!options.jit) fprintf(stderr, "JIT not available in this build\n");
+    }
+
+    if (checks) {
+        int result = report("state_set", "colliding hashes", check_state_set()) ? 0 : 1;
+        for (size_t i = 0; i < count; i++) {
+            if (!check(&workloads[i], &options)) result = 1;
+        }
+        free(workloads);
+        return result;
+    }
+
+    printf("{\n  \"dispatch\": \"%s\",\n  \"jit\": %s,\n", LR35902_DISPATCH_NAME, options.jit ? "true" : "false");
+    printf("  \"idle_skip\": %s,\n  \"batch\": %u,\n", options.idle ? "true" : "false", options.batch);
+    printf("  \"fleet\": %u,\n  \"workers\": %u,\n", options.fleet, options.fleet ? options.workers : 0);
+    printf("  \"step\": %s,\n  \"debugger\": %s,\n", options.step ? "true" : "false", options.debugger ? "true" : "false");
+    printf("  \"cycles_per_run\": %llu,\n  \"runs\": %u,\n", (unsigned long long)cycles, runs);
+    printf("  \"guest_clock_mhz\": %.6f,\n  \"workloads\": [\n", GB_CLOCK_HZ / 1e6);
+
+    int result = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!bench(&workloads[i], cycles, runs, &options, i + 1 == count)) result = 1;
+    }
+    printf("  ]\n}\n");
+
+    free(workloads);
+    return result;
+}
@@ -0,0 +1,329 @@
+//
+// Created by davidg on 07.09.25.
+//
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <gb.h>
+#include <interrupt.h>
+
+#define DEFAULT_SECONDS 120 // guest time a ROM gets to report a result
+#define SERIAL_MAX 4096
+#define REPORT_LINES 4 // serial output shown for a ROM that did not pass
+#define SB_ADDR 0xFF01
+#define SC_ADDR 0xFF02
+#define SIGNATURE_RUNNING 0x80 // status byte at 0xA000 while a test is still going
+
+typedef enum {
+    VERDICT_PASS,
+    VERDICT_FAIL,
+    VERDICT_TIMEOUT,
+    VERDICT_ERROR, // could not be loaded, halted for good or hit an unknown opcode
+} verdict_t;
+
+static const char* const verdict_names[] = { "pass", "fail", "timeout", "error" };
+
+typedef struct {
+    char* path;
+    verdict_t verdict;
+    const char* reason;   // how the verdict was reached
+    double seconds;
+    uint64_t cycles;
+    char serial[SERIAL_MAX + 1];
+    size_t serial_length;
+} Result;
+
+typedef struct {
+    Result* results;
+    size_t count;
+    atomic_size_t next;
+    uint64_t max_cycles;
+    bool jit;
+    bool idle;
+} Suite;
+
+// Result of the ROM the calling worker runs, for the serial hook
+static _Thread_local Result* current;
+
+/*
+ * Serial port without a link partner: a transfer on the internal clock
+ * finishes at once, the byte goes to the ROM's output and 0xFF comes back.
+ */
+static void serial_control_write(GB* gb, uint16_t address, uint8_t value) {
+    if ((value & 0x81) != 0x81) {
+        gb->mem.data[address] = value;
+        return;
+    }
+
+    if (current->serial_length < SERIAL_MAX) current->serial[current->serial_length++] = gb->mem.data[SB_ADDR];
+    gb->mem.data[SB_ADDR] = 0xFF;
+    gb->mem.data[address] = value & 0x7F;
+    interrupt_request(gb, INT_SERIAL);
+}
+
+// Blargg style text on the serial port
+static bool check_serial(Result* result) {
+    result->serial[result->serial_length] = '\0';
+    if (strstr(result->serial, "Passed")) {
+        result->verdict = VERDICT_PASS;
+    } else if (strstr(result->serial, "Failed")) {
+        result->verdict = VERDICT_FAIL;
+    } else {
+        return false;
+    }
+    result->reason = "serial";
+    return true;
+}
+
+// Blargg style status in cartridge RAM: 0xA000 is the result once 0xA001–0xA003 hold DE B0 61
+static bool check_signature(const GB* gb, Result* result) {
+    if (!gb->cart.rom || gb->cart.ram_size < 4) return false;
+    const uint8_t* ram = cart_ram_page(gb, 0);
+    if (ram[1] != 0xDE || ram[2] != 0xB0 || ram[3] != 0x61 || ram[0] == SIGNATURE_RUNNING) return false;
+
+    result->verdict = ram[0] == 0 ? VERDICT_PASS : VERDICT_FAIL;
+    result->reason = "signature";
+    return true;
+}
+
+// Mooneye style registers: Fibonacci numbers on success, all 0x42 on failure
+static bool check_registers(const CPU* cpu, Result* result) {
+    static const uint8_t passed[] = { 3, 5, 8, 13, 21, 34 };
+    const uint8_t registers[] = { cpu->b, cpu->c, cpu->d, cpu->e, cpu->h, cpu->l };
+
+    if (memcmp(registers, passed, sizeof(passed)) == 0) {
+        result->verdict = VERDICT_PASS;
+    } else if (memcmp(registers, "\x42\x42\x42\x42\x42\x42", sizeof(registers)) == 0) {
+        result->verdict = VERDICT_FAIL;
+    } else {
+        return false;
+    }
+    result->reason = "registers";
+    return true;
+}
+
+static bool finished(const GB* gb, Result* result) {
+    return check_serial(result) || check_signature(gb, result) || check_registers(&gb->cpu, result);
+}
+
+static double now_s(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void run_rom(const Suite* suite, Result* result) {
+    double start = now_s();
+    GB* gb = gb_create();
+
+    current = result;
+    if (!cart_load(gb, result->path)) {
+        result->verdict = VERDICT_ERROR;
+        result->reason = "cannot be loaded";
+        gb_destroy(gb);
+        return;
+    }
+    mem_map_io(gb, SC_ADDR, NULL, serial_control_write);
+    if (suite->jit) jit_set_enabled(gb, true);
+    block_cache_set_idle_skip(gb, suite->idle);
+
+    // Results are looked for once per frame, tests spin in a loop once they are done
+    uint64_t first = gb->cpu.cycles;
+    result->verdict = VERDICT_TIMEOUT;
+    result->reason = "no result";
+    while (gb->cpu.cycles - first < suite->max_cycles) {
+        cpu_status_t status = cpu_run(gb, GB_FRAME_CYCLES);
+        if (finished(gb, result)) break;
+        if (status == CPU_UNKNOWN_OPCODE || status == CPU_HALTED) {
+            result->verdict = VERDICT_ERROR;
+            result->reason = status == CPU_HALTED ? "halted" : "unknown opcode";
+            break;
+        }
+    }
+
+    result->cycles = gb->cpu.cycles - first;
+    gb_destroy(gb);
+    result->seconds = now_s() - start;
+}
+
+static void* worker(void* arg) {
+    Suite* suite = arg;
+
+    for (;;) {
+        size_t index = atomic_fetch_add(&suite->next, 1);
+        if (index >= suite->count) return NULL;
+        run_rom(suite, &suite->results[index]);
+    }
+}
+
+static bool is_rom(const char* name) {
+    const char* extension = strrchr(name, '.');
+    return extension && (strcmp(extension, ".gb") == 0 || strcmp(extension, ".gbc") == 0 ||
+                         strcmp(extension, ".bin") == 0);
+}
+
+// Collects the ROMs below `directory`, subdirectories included
+static bool collect(const char* directory, char*** paths, size_t* count, size_t* capacity) {
+    DIR* dir = opendir(directory);
+    if (!dir) return false;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+
+        size_t length = strlen(directory) + strlen(entry->d_name) + 2;
+        char* path = malloc(length);
+        struct stat st;
+        if (!path) {
+            perror("Fehler beim Anlegen der ROM-Liste");
+            exit(1);
+        }
+        snprintf(path, length, "%s/%s", directory, entry->d_name);
+
+        bool found = stat(path, &st) == 0;
+        if (found && S_ISDIR(st.st_mode)) {
+            collect(path, paths, count, capacity);
+            free(path);
+        } else if (found && S_ISREG(st.st_mode) && is_rom(entry->d_name)) {
+            if (*count == *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 64;
+                *paths = realloc(*paths, *capacity * sizeof(char*));
+                if (!*paths) {
+                    perror("Fehler beim Anlegen der ROM-Liste");
+                    exit(1);
+                }
+            }
+            (*paths)[(*count)++] = path;
+        } else {
+            free(path);
+        }
+    }
+
+    closedir(dir);
+    return true;
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Last lines the ROM printed, for the report of a ROM that did not pass
+static void print_output(const Result* result) {
+    const char* text = result->serial;
+    size_t end = result->serial_length;
+
+    while (end > 0 && (text[end - 1] == '\n' || text[end - 1] == ' ')) end--;
+    size_t begin = end;
+    for (unsigned lines = 0; begin > 0; begin--) {
+        if (text[begin - 1] == '\n' && ++lines == REPORT_LINES) break;
+    }
+
+    while (begin < end) {
+        const char* newline = memchr(text + begin, '\n', end - begin);
+        size_t length = newline ? (size_t)(newline - text) - begin : end - begin;
+        printf("        %.*s\n", (int)length, text + begin);
+        begin += length + 1;
+    }
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [--jobs N] [--seconds N] [--jit] [--idle] [--verbose] directory ...\n", program);
+}
+
+int main(int argc, char** argv) {
+    char** paths = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned jobs = 0;
+    double seconds = DEFAULT_SECONDS;
+    bool jit = false;
+    bool idle = false;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        } else if (strcmp(argv[i], "--idle") == 0) {
+            idle = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else if (!collect(argv[i], &paths, &count, &capacity)) {
+            fprintf(stderr, "Verzeichnis %s kann nicht gelesen werden: %s\n", argv[i], strerror(errno));
+            return 2;
+        }
+    }
+
+    if (count == 0 || seconds <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    qsort(paths, count, sizeof(char*), compare_paths);
+
+    if (jobs == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cores > 0 ? cores : 1;
+    }
+    if (jobs > count) jobs = count;
+
+    Suite suite = {
+        .results = calloc(count, sizeof(Result)),
+        .count = count,
+        .max_cycles = (uint64_t)(seconds * GB_CLOCK_HZ),
+        .jit = jit,
+        .idle = idle,
+    };
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    if (!suite.results || !threads) {
+        perror("Fehler beim Anlegen der Ergebnisse");
+        return 1;
+    }
+    atomic_init(&suite.next, 0);
+    for (size_t i = 0; i < count; i++) suite.results[i].path = paths[i];
+
+    // ROMs are handed out one at a time, a slow one does not hold up the rest
+    double start = now_s();
+    unsigned started = 0;
+    while (started < jobs && pthread_create(&threads[started], NULL, worker, &suite) == 0) started++;
+    if (started == 0) worker(&suite);
+    for (unsigned i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    double wall = now_s() - start;
+
+    size_t verdicts[4] = { 0 };
+    double busy = 0;
+    uint64_t cycles = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Result* result = &suite.results[i];
+        printf("%-7s %9.2f ms %12llu cycles  %s (%s)\n", verdict_names[result->verdict], result->seconds * 1e3,
+            (unsigned long long)result->cycles, result->path, result->reason);
+        if (result->verdict != VERDICT_PASS || verbose) print_output(result);
+
+        verdicts[result->verdict]++;
+        busy += result->seconds;
+        cycles += result->cycles;
+    }
+
+    printf("%zu ROMs: %zu passed, %zu failed, %zu timed out, %zu errors\n", count,
+        verdicts[VERDICT_PASS], verdicts[VERDICT_FAIL], verdicts[VERDICT_TIMEOUT], verdicts[VERDICT_ERROR]);
+    printf("%.3f s wall on %u threads (%.3f s of ROM time), %llu guest cycles, %.1f guest MHz\n",
+        wall, started ? started : 1, busy, (unsigned long long)cycles, wall > 0 ? cycles / wall / 1e6 : 0);
+
+    for (size_t i = 0; i < count; i++) free(paths[i]);
+    free(paths);
+    free(suite.results);
+    free(threads);
+    return verdicts[VERDICT_PASS] == count ? 0 : 1;
+}
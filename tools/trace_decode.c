@@ -0,0 +1,92 @@
+//
+// Created by davidg on 27.08.25.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <trace.h>
+
+// Z N H C of the recorded flag register, lazy flags resolved
+static uint8_t record_flags(const TraceRecord* record) {
+    if (record->flags_op == FLAGS_EAGER) return record->f;
+    return flags_from_result(record->flags_op, record->flags_xy, record->flags_result);
+}
+
+static void print_record(unsigned long index, const TraceRecord* record) {
+    printf("%10lu %12llu PC=%04X OP=%02X SP=%04X AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X\n",
+        index, (unsigned long long)record->cycles, record->pc, record->opcode, record->sp,
+        record->a, record_flags(record), record->b, record->c,
+        record->d, record->e, record->h, record->l);
+}
+
+static bool records_equal(const TraceRecord* x, const TraceRecord* y) {
+    return x->a == y->a && record_flags(x) == record_flags(y) && x->b == y->b && x->c == y->c &&
+           x->d == y->d && x->e == y->e && x->h == y->h && x->l == y->l &&
+           x->sp == y->sp && x->pc == y->pc && x->cycles == y->cycles && x->opcode == y->opcode;
+}
+
+static int dump(const char* filename) {
+    TraceReader reader;
+    TraceRecord record;
+    unsigned long index = 0;
+
+    if (!trace_open(&reader, filename)) {
+        perror("Fehler beim Öffnen des Traces");
+        return 2;
+    }
+
+    while (trace_read(&reader, &record)) print_record(index++, &record);
+
+    trace_close(&reader);
+    return 0;
+}
+
+// Stops at the first instruction where the two runs disagree
+static int diff(const char* left, const char* right) {
+    TraceReader x, y;
+    TraceRecord a, b;
+    unsigned long index = 0;
+
+    if (!trace_open(&x, left) || !trace_open(&y, right)) {
+        perror("Fehler beim Öffnen des Traces");
+        return 2;
+    }
+
+    int result = 0;
+    for (;;) {
+        bool more_a = trace_read(&x, &a);
+        bool more_b = trace_read(&y, &b);
+
+        if (!more_a && !more_b) {
+            printf("Traces agree for %lu instructions\n", index);
+            break;
+        }
+        if (more_a != more_b) {
+            printf("%s ends after %lu instructions\n", more_a ? right : left, index);
+            result = 1;
+            break;
+        }
+        if (!records_equal(&a, &b)) {
+            printf("Traces diverge at instruction %lu\n", index);
+            printf("%s:\n", left);
+            print_record(index, &a);
+            printf("%s:\n", right);
+            print_record(index, &b);
+            result = 1;
+            break;
+        }
+        index++;
+    }
+
+    trace_close(&y);
+    trace_close(&x);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2) return dump(argv[1]);
+    if (argc == 3) return diff(argv[1], argv[2]);
+
+    fprintf(stderr, "Usage: %s <trace> [<other trace>]\n", argv[0]);
+    return 2;
+}